@@ -0,0 +1,411 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "ApiSetSchema.h"
+
+//
+// The layouts of the schema. Every offset is from the start of the
+// schema and every length is in bytes of UTF-16 text, which is not
+// terminated.
+//
+
+struct ApiSetNamespaceV2
+{
+    DWORD version;
+    DWORD count;
+};
+
+struct ApiSetNamespaceEntryV2
+{
+    DWORD nameOffset;
+    DWORD nameLength;
+    DWORD dataOffset;
+};
+
+struct ApiSetValueEntryV2
+{
+    DWORD nameOffset;
+    DWORD nameLength;
+    DWORD valueOffset;
+    DWORD valueLength;
+};
+
+struct ApiSetNamespaceV6
+{
+    DWORD version;
+    DWORD size;
+    DWORD flags;
+    DWORD count;
+    DWORD entryOffset;
+    DWORD hashOffset;
+    DWORD hashFactor;
+};
+
+struct ApiSetNamespaceEntryV6
+{
+    DWORD flags;
+    DWORD nameOffset;
+    DWORD nameLength;
+    DWORD hashedLength;
+    DWORD valueOffset;
+    DWORD valueCount;
+};
+
+struct ApiSetValueEntryV6
+{
+    DWORD flags;
+    DWORD nameOffset;
+    DWORD nameLength;
+    DWORD valueOffset;
+    DWORD valueLength;
+};
+
+// --------------------------------------------------------------------------
+//  ApiSetSchema
+// --------------------------------------------------------------------------
+
+DWORD ApiSetSchema::Load(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+    _ASSERT(!IsLoaded());
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD error = NO_ERROR;
+
+    try
+    {
+        DWORD fileSizeHigh = 0;
+        const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+        if (fileSizeHigh || fileSize > MaxImageSize)
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        Array<BYTE> image;
+        image.SetCount(fileSize);
+
+        DWORD bytesRead = 0;
+
+        if (!ReadFile(file, image.GetData(), fileSize, &bytesRead, NULL))
+            throw SystemException(GetLastError());
+
+        if (bytesRead != fileSize)
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        Parse(image.GetData(), fileSize);
+    }
+    catch (SystemException& e)
+    {
+        error = e.GetCode();
+    }
+
+    CloseHandle(file);
+
+    return error;
+}
+
+void ApiSetSchema::Parse(const BYTE* image, DWORD imageSize)
+{
+    _ASSERT(image);
+
+    //
+    // The image is taken as it lies in the file, so the section is found
+    // through its raw offset rather than where it would be loaded.
+    //
+
+    IMAGE_DOS_HEADER dosHeader;
+    Read(image, imageSize, 0, &dosHeader, sizeof(dosHeader));
+
+    if (IMAGE_DOS_SIGNATURE != dosHeader.e_magic || dosHeader.e_lfanew < 0)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    const DWORD ntHeadersOffset = static_cast<DWORD>(dosHeader.e_lfanew);
+
+    DWORD signature;
+    Read(image, imageSize, ntHeadersOffset, &signature, sizeof(signature));
+
+    if (IMAGE_NT_SIGNATURE != signature)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    IMAGE_FILE_HEADER fileHeader;
+    Read(image, imageSize, ntHeadersOffset + sizeof(signature), &fileHeader, sizeof(fileHeader));
+
+    DWORD sectionOffset = ntHeadersOffset + sizeof(signature) + sizeof(fileHeader) +
+        fileHeader.SizeOfOptionalHeader;
+
+    for (int i = 0; i < fileHeader.NumberOfSections; i++, sectionOffset += sizeof(IMAGE_SECTION_HEADER))
+    {
+        IMAGE_SECTION_HEADER section;
+        Read(image, imageSize, sectionOffset, &section, sizeof(section));
+
+        if (0 != memcmp(section.Name, ".apiset", IMAGE_SIZEOF_SHORT_NAME))
+            continue;
+
+        const DWORD offset = section.PointerToRawData;
+        const DWORD size = section.SizeOfRawData;
+
+        if (offset > imageSize || size > imageSize - offset)
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        DWORD version;
+        Read(image + offset, size, 0, &version, sizeof(version));
+
+        if (2 == version)
+            ParseVersion2(image + offset, size);
+        else if (6 == version)
+            ParseVersion6(image + offset, size);
+        else
+            throw SystemException(ERROR_NOT_SUPPORTED);
+
+        m_version = version;
+
+        return;
+    }
+
+    throw SystemException(ERROR_BAD_FORMAT);
+}
+
+void ApiSetSchema::ParseVersion2(const BYTE* data, DWORD size)
+{
+    _ASSERT(data);
+
+    //
+    // Windows 7 only has api- contracts and leaves that prefix out of
+    // their names. A contract matches on its whole name, version and all.
+    //
+
+    ApiSetNamespaceV2 apiSet;
+    Read(data, size, 0, &apiSet, sizeof(apiSet));
+
+    if (apiSet.count > size / sizeof(ApiSetNamespaceEntryV2))
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    for (DWORD i = 0; i < apiSet.count; i++)
+    {
+        ApiSetNamespaceEntryV2 entry;
+        Read(data, size, sizeof(apiSet) + i * sizeof(entry), &entry, sizeof(entry));
+
+        TCHAR name[MAX_PATH];
+        ReadName(data, size, entry.nameOffset, entry.nameLength, name);
+
+        DWORD valueCount;
+        Read(data, size, entry.dataOffset, &valueCount, sizeof(valueCount));
+
+        if (valueCount > size / sizeof(ApiSetValueEntryV2))
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        //
+        // The default host is the one that is not just for a particular
+        // importing module.
+        //
+
+        TCHAR host[MAX_PATH] = { 0 };
+
+        for (DWORD j = 0; j < valueCount; j++)
+        {
+            ApiSetValueEntryV2 value;
+            Read(data, size, entry.dataOffset + sizeof(valueCount) + j * sizeof(value),
+                &value, sizeof(value));
+
+            if (0 == j || 0 == value.nameLength)
+                ReadName(data, size, value.valueOffset, value.valueLength, host);
+
+            if (0 == value.nameLength)
+                break;
+        }
+
+        AddContract(_T("API-"), name, host);
+    }
+}
+
+void ApiSetSchema::ParseVersion6(const BYTE* data, DWORD size)
+{
+    _ASSERT(data);
+
+    //
+    // As of Windows 10, a contract matches on its name up to the last
+    // hyphen, so any minor version of it is served by the same host.
+    //
+
+    ApiSetNamespaceV6 apiSet;
+    Read(data, size, 0, &apiSet, sizeof(apiSet));
+
+    if (apiSet.count > size / sizeof(ApiSetNamespaceEntryV6))
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    for (DWORD i = 0; i < apiSet.count; i++)
+    {
+        ApiSetNamespaceEntryV6 entry;
+        Read(data, size, apiSet.entryOffset + i * sizeof(entry), &entry, sizeof(entry));
+
+        TCHAR name[MAX_PATH];
+        ReadName(data, size, entry.nameOffset, entry.hashedLength, name);
+
+        if (entry.valueCount > size / sizeof(ApiSetValueEntryV6))
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        TCHAR host[MAX_PATH] = { 0 };
+
+        for (DWORD j = 0; j < entry.valueCount; j++)
+        {
+            ApiSetValueEntryV6 value;
+            Read(data, size, entry.valueOffset + j * sizeof(value), &value, sizeof(value));
+
+            if (0 == j || 0 == value.nameLength)
+                ReadName(data, size, value.valueOffset, value.valueLength, host);
+
+            if (0 == value.nameLength)
+                break;
+        }
+
+        AddContract(_T(""), name, host);
+    }
+}
+
+void ApiSetSchema::AddContract(LPCTSTR prefix, LPCTSTR name, LPCTSTR host)
+{
+    _ASSERT(prefix);
+    _ASSERT(name);
+    _ASSERT(host);
+
+    //
+    // Most contracts share a handful of hosts, so each host is stored
+    // once and contracts refer to it by number.
+    //
+
+    int hostIndex = -1;
+
+    if (*host)
+    {
+        TCHAR foldedHost[MAX_PATH];
+        lstrcpyn(foldedHost, host, DIM(foldedHost));
+        CharUpperBuff(foldedHost, lstrlen(foldedHost));
+
+        hostIndex = m_hostNames.Add(foldedHost, DirectoryIndex::Hash(foldedHost));
+
+        if (hostIndex == m_hostOffsets.GetCount())
+        {
+            m_hostOffsets.Add(m_hostText.GetCount());
+            m_hostText.Append(host, lstrlen(host) + 1);
+        }
+    }
+
+    if (lstrlen(prefix) + lstrlen(name) >= MAX_PATH)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    TCHAR contract[MAX_PATH];
+    lstrcpy(contract, prefix);
+    lstrcat(contract, name);
+    CharUpperBuff(contract, lstrlen(contract));
+
+    //
+    // Should a contract be listed twice, the first one listed stands.
+    //
+
+    if (m_contracts.Add(contract, DirectoryIndex::Hash(contract)) == m_contractHosts.GetCount())
+        m_contractHosts.Add(hostIndex);
+}
+
+LPCTSTR ApiSetSchema::Find(LPCTSTR fileName) const
+{
+    _ASSERT(fileName);
+
+    if (!IsLoaded() || !IsContractName(fileName))
+        return NULL;
+
+    int length = lstrlen(fileName);
+
+    if (length >= MAX_PATH)
+        return NULL;
+
+    TCHAR contract[MAX_PATH];
+    lstrcpy(contract, fileName);
+    CharUpperBuff(contract, length);
+
+    //
+    // The extension is not part of the contract name, and neither is
+    // the minor version as of Windows 10.
+    //
+
+    if (length > 4 && 0 == lstrcmp(contract + length - 4, _T(".DLL")))
+        contract[length -= 4] = 0;
+
+    if (6 == m_version)
+    {
+        LPTSTR hyphen = StrRChr(contract, NULL, _T('-'));
+
+        if (hyphen)
+            *hyphen = 0;
+    }
+
+    const int contractIndex = m_contracts.Find(contract, DirectoryIndex::Hash(contract));
+
+    if (contractIndex < 0)
+        return NULL;
+
+    const int hostIndex = m_contractHosts[contractIndex];
+
+    return hostIndex < 0 ? _T("") : m_hostText.GetData() + m_hostOffsets[hostIndex];
+}
+
+bool ApiSetSchema::IsContractName(LPCTSTR fileName)
+{
+    _ASSERT(fileName);
+
+    return 0 == StrCmpNI(fileName, _T("api-"), 4) || 0 == StrCmpNI(fileName, _T("ext-"), 4);
+}
+
+void ApiSetSchema::Read(const BYTE* data, DWORD size, DWORD offset, LPVOID value, DWORD valueSize)
+{
+    _ASSERT(data || !size);
+    _ASSERT(value);
+
+    if (offset > size || valueSize > size - offset)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    CopyMemory(value, data + offset, valueSize);
+}
+
+void ApiSetSchema::ReadName(const BYTE* data, DWORD size, DWORD offset, DWORD length, LPTSTR name)
+{
+    _ASSERT(name);
+
+    if (0 != length % sizeof(WCHAR) || length / sizeof(WCHAR) >= MAX_PATH)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    WCHAR wide[MAX_PATH];
+    Read(data, size, offset, wide, length);
+    wide[length / sizeof(WCHAR)] = 0;
+
+#ifdef UNICODE
+    lstrcpy(name, wide);
+#else
+    if (!WideCharToMultiByte(CP_ACP, 0, wide, -1, name, MAX_PATH, NULL, NULL))
+        throw SystemException(ERROR_BAD_FORMAT);
+#endif
+}
@@ -0,0 +1,78 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ApiSetSchema
+// --------------------------------------------------------------------------
+//
+//  The API set schema maps contract names such as api-ms-win-core-file-
+//  l1-1-0.dll and ext-ms-win-* onto the DLLs that implement them on a
+//  given build of Windows. The loader applies it before anything else,
+//  so such a name never goes through a path search at all.
+//
+//  The schema is read from the .apiset section of an apisetschema.dll
+//  image, taken as a plain file and so from any build of Windows or for
+//  any machine. The layouts of Windows 7 (version 2) and of Windows 10
+//  and later (version 6) are understood. Contracts are kept in a hash
+//  table of their folded names, each pointing to its default host, with
+//  every host name stored just once.
+//
+//  Find gives the host of a contract, an empty name for a contract that
+//  has no host on that build, or NULL for a name that is not a contract
+//  of the schema, which the loader then searches for like any other.
+//
+
+class ApiSetSchema
+{
+public:
+
+    enum { MaxImageSize = 64 * 1024 * 1024 };
+
+    ApiSetSchema() : m_version(0) {}
+
+    DWORD Load(LPCTSTR filePath);
+
+    bool IsLoaded() const { return 0 != m_version; }
+    DWORD GetVersion() const { return m_version; }
+    int GetContractCount() const { return m_contracts.GetCount(); }
+
+    LPCTSTR Find(LPCTSTR fileName) const;
+
+    static bool IsContractName(LPCTSTR fileName);
+
+private:
+
+    void Parse(const BYTE* image, DWORD imageSize);
+    void ParseVersion2(const BYTE* data, DWORD size);
+    void ParseVersion6(const BYTE* data, DWORD size);
+    void AddContract(LPCTSTR prefix, LPCTSTR name, LPCTSTR host);
+
+    static void Read(const BYTE* data, DWORD size, DWORD offset, LPVOID value, DWORD valueSize);
+    static void ReadName(const BYTE* data, DWORD size, DWORD offset, DWORD length, LPTSTR name);
+
+    NameTable m_contracts;
+    Array<int> m_contractHosts;
+    NameTable m_hostNames;
+    Array<int> m_hostOffsets;
+    Array<TCHAR> m_hostText;
+    DWORD m_version;
+
+    ApiSetSchema(const ApiSetSchema&);
+    ApiSetSchema& operator=(const ApiSetSchema&);
+};
@@ -0,0 +1,128 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  Array<T>
+// --------------------------------------------------------------------------
+//
+//  A minimal growable array in the same spirit as WinOutputStream: just
+//  enough to avoid pulling in the C++ library. Items are moved around
+//  with CopyMemory so T must be a plain data type without constructors
+//  or destructors of consequence.
+//
+
+template<class T>
+class Array
+{
+public:
+
+    Array() : m_items(NULL), m_count(0), m_capacity(0) {}
+
+    ~Array() { delete [] m_items; }
+
+    int GetCount() const { return m_count; }
+
+    T* GetData() { return m_items; }
+    const T* GetData() const { return m_items; }
+
+    T& operator[](int index)
+    {
+        _ASSERT(index >= 0 && index < m_count);
+        return m_items[index];
+    }
+
+    const T& operator[](int index) const
+    {
+        _ASSERT(index >= 0 && index < m_count);
+        return m_items[index];
+    }
+
+    void Add(const T& item)
+    {
+        if (m_count == m_capacity)
+            Reserve(m_count + 1);
+
+        m_items[m_count++] = item;
+    }
+
+    void Append(const T* items, int count)
+    {
+        _ASSERT(items || !count);
+
+        Reserve(m_count + count);
+        CopyMemory(m_items + m_count, items, count * sizeof(T));
+        m_count += count;
+    }
+
+    void SetCount(int count)
+    {
+        _ASSERT(count >= 0);
+
+        Reserve(count);
+        m_count = count;
+    }
+
+    void Clear() { m_count = 0; }
+
+    void Free()
+    {
+        delete [] m_items;
+
+        m_items = NULL;
+        m_count = 0;
+        m_capacity = 0;
+    }
+
+    void Reserve(int capacity)
+    {
+        if (capacity <= m_capacity)
+            return;
+
+        //
+        // Grow geometrically so that a long run of Add calls costs
+        // amortized constant time per item.
+        //
+
+        int newCapacity = m_capacity ? m_capacity * 2 : 16;
+
+        if (newCapacity < capacity)
+            newCapacity = capacity;
+
+        T* items = new T[newCapacity];
+
+        if (!items)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+        if (m_count)
+            CopyMemory(items, m_items, m_count * sizeof(T));
+
+        delete [] m_items;
+
+        m_items = items;
+        m_capacity = newCapacity;
+    }
+
+private:
+
+    T* m_items;
+    int m_count;
+    int m_capacity;
+
+    Array(const Array&);
+    Array& operator=(const Array&);
+};
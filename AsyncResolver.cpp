@@ -0,0 +1,464 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "LookupIndex.h"
+#include "NameTable.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+#include "Resolver.h"
+#include "AsyncResolver.h"
+
+// --------------------------------------------------------------------------
+//  AsyncResolver
+// --------------------------------------------------------------------------
+
+AsyncResolver::AsyncResolver() :
+    m_resolver(NULL),
+    m_work(NULL),
+    m_expiryThread(NULL),
+    m_deadlineAdded(NULL),
+    m_expiryStop(NULL),
+    m_queueHead(0),
+    m_nextRequestId(0),
+    m_isStopping(false)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+AsyncResolver::~AsyncResolver()
+{
+    Stop();
+
+    if (m_work)
+        CloseHandle(m_work);
+
+    if (m_deadlineAdded)
+        CloseHandle(m_deadlineAdded);
+
+    if (m_expiryStop)
+        CloseHandle(m_expiryStop);
+
+    DeleteCriticalSection(&m_lock);
+}
+
+DWORD AsyncResolver::Start(const Resolver& resolver, int threadCount)
+{
+    _ASSERT(!m_resolver);
+
+    m_resolver = &resolver;
+
+    //
+    // The threads are woken once for every request queued and once more
+    // each when stopping, so the count can run up to as many requests as
+    // can be outstanding.
+    //
+
+    m_work = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+
+    if (!m_work)
+        return GetLastError();
+
+    //
+    // Timeouts are enforced by a thread of their own that waits for the
+    // nearest deadline, and is woken early whenever a request with one
+    // is added since that may come sooner.
+    //
+
+    m_deadlineAdded = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if (!m_deadlineAdded)
+        return GetLastError();
+
+    m_expiryStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (!m_expiryStop)
+        return GetLastError();
+
+    m_expiryThread = reinterpret_cast<HANDLE>(
+        _beginthreadex(NULL, 0, ExpiryProc, this, 0, NULL));
+
+    if (!m_expiryThread)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    threadCount = max(1, min(threadCount, MAXIMUM_WAIT_OBJECTS));
+
+    try
+    {
+        m_threads.Reserve(threadCount);
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    while (m_threads.GetCount() < threadCount)
+    {
+        HANDLE thread = reinterpret_cast<HANDLE>(
+            _beginthreadex(NULL, 0, WorkerProc, this, 0, NULL));
+
+        if (!thread)
+            break;
+
+        m_threads.Add(thread);
+    }
+
+    return m_threads.GetCount() ? NO_ERROR : ERROR_NOT_ENOUGH_MEMORY;
+}
+
+void AsyncResolver::Stop()
+{
+    if (!m_threads.GetCount() && !m_expiryThread)
+        return;
+
+    //
+    // Whatever is still queued is cancelled, and the threads each stop
+    // once they find the queue empty, having completed all of it.
+    //
+
+    EnterCriticalSection(&m_lock);
+
+    m_isStopping = true;
+
+    for (int i = 0; i < m_outstanding.GetCount(); i++)
+        m_outstanding[i]->isCancelled = true;
+
+    LeaveCriticalSection(&m_lock);
+
+    if (m_threads.GetCount())
+    {
+        ReleaseSemaphore(m_work, m_threads.GetCount(), NULL);
+        WaitForMultipleObjects(m_threads.GetCount(), m_threads.GetData(), TRUE, INFINITE);
+
+        for (int i = 0; i < m_threads.GetCount(); i++)
+            CloseHandle(m_threads[i]);
+
+        m_threads.Clear();
+    }
+
+    //
+    // With the workers gone nothing is outstanding any more, so neither
+    // is anything left to expire.
+    //
+
+    if (m_expiryThread)
+    {
+        SetEvent(m_expiryStop);
+        WaitForSingleObject(m_expiryThread, INFINITE);
+        CloseHandle(m_expiryThread);
+        m_expiryThread = NULL;
+    }
+}
+
+DWORD AsyncResolver::BeginResolve(LPCTSTR fileName, DWORD timeout,
+    ResolveCompletionProc completion, LPVOID context, DWORD& requestId)
+{
+    _ASSERT(fileName);
+    _ASSERT(completion);
+
+    requestId = 0;
+
+    if (!m_threads.GetCount())
+        return ERROR_INVALID_HANDLE;
+
+    if (lstrlen(fileName) >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    Request* request = new Request;
+
+    if (!request)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    lstrcpy(request->fileName, fileName);
+    request->startTime = GetTickCount();
+    request->timeout = timeout;
+    request->completion = completion;
+    request->context = context;
+    request->isCancelled = false;
+    request->isCompleted = false;
+
+    DWORD error = NO_ERROR;
+
+    EnterCriticalSection(&m_lock);
+
+    if (m_isStopping)
+    {
+        error = ERROR_INVALID_HANDLE;
+    }
+    else
+    {
+        try
+        {
+            //
+            // Both lists are grown before either is added to so that
+            // the request is never left in one of them only.
+            //
+
+            m_outstanding.Reserve(m_outstanding.GetCount() + 1);
+            m_queue.Reserve(m_queue.GetCount() + 1);
+
+            request->id = ++m_nextRequestId;
+
+            m_outstanding.Add(request);
+            m_queue.Add(request);
+        }
+        catch (SystemException& e)
+        {
+            error = e.GetCode();
+        }
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    if (NO_ERROR != error)
+    {
+        delete request;
+        return error;
+    }
+
+    requestId = request->id;
+    ReleaseSemaphore(m_work, 1, NULL);
+
+    if (INFINITE != timeout)
+        SetEvent(m_deadlineAdded);
+
+    return NO_ERROR;
+}
+
+bool AsyncResolver::Cancel(DWORD requestId)
+{
+    bool isFound = false;
+
+    EnterCriticalSection(&m_lock);
+
+    for (int i = 0; i < m_outstanding.GetCount() && !isFound; i++)
+    {
+        if (requestId == m_outstanding[i]->id)
+        {
+            m_outstanding[i]->isCancelled = true;
+            isFound = true;
+        }
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return isFound;
+}
+
+unsigned __stdcall AsyncResolver::WorkerProc(LPVOID parameter)
+{
+    AsyncResolver* resolver = static_cast<AsyncResolver*>(parameter);
+    resolver->Work();
+
+    return 0;
+}
+
+void AsyncResolver::Work()
+{
+    for (;;)
+    {
+        WaitForSingleObject(m_work, INFINITE);
+
+        //
+        // Every wake-up is for a request in the queue, bar the last one
+        // when stopping, which finds the queue empty.
+        //
+
+        Request* request = NULL;
+
+        EnterCriticalSection(&m_lock);
+
+        if (m_queueHead < m_queue.GetCount())
+        {
+            request = m_queue[m_queueHead++];
+
+            if (m_queueHead == m_queue.GetCount())
+            {
+                m_queue.Clear();
+                m_queueHead = 0;
+            }
+        }
+
+        const bool isSettled = request && (request->isCancelled || request->isCompleted);
+
+        LeaveCriticalSection(&m_lock);
+
+        if (!request)
+            break;
+
+        if (isSettled)
+        {
+            Complete(request, ERROR_CANCELLED, NULL);
+            continue;
+        }
+
+        Resolution resolution;
+        DWORD error = ERROR_TIMEOUT;
+
+        if (GetTickCount() - request->startTime < request->timeout)
+            error = m_resolver->Resolve(request->fileName, resolution);
+
+        Complete(request, error, NO_ERROR == error ? &resolution : NULL);
+    }
+}
+
+unsigned __stdcall AsyncResolver::ExpiryProc(LPVOID parameter)
+{
+    AsyncResolver* resolver = static_cast<AsyncResolver*>(parameter);
+    resolver->Expire();
+
+    return 0;
+}
+
+void AsyncResolver::Expire()
+{
+    for (;;)
+    {
+        //
+        // Complete the requests whose time is up one at a time, since
+        // the lock cannot be held while calling out, and note how long
+        // it is until the next one's. The request itself stays with the
+        // worker that takes it up, which finds it completed and only
+        // has to free it, so everything the call needs is copied first.
+        //
+
+        DWORD wait = INFINITE;
+
+        for (;;)
+        {
+            ResolveCompletionProc completion = NULL;
+            LPVOID context = NULL;
+            DWORD requestId = 0;
+            DWORD error = ERROR_TIMEOUT;
+
+            EnterCriticalSection(&m_lock);
+
+            const DWORD now = GetTickCount();
+            wait = INFINITE;
+
+            for (int i = 0; i < m_outstanding.GetCount() && !completion; i++)
+            {
+                Request* request = m_outstanding[i];
+
+                if (INFINITE == request->timeout)
+                    continue;
+
+                const DWORD elapsed = now - request->startTime;
+
+                if (elapsed >= request->timeout)
+                {
+                    completion = request->completion;
+                    context = request->context;
+                    requestId = request->id;
+
+                    if (request->isCancelled)
+                        error = ERROR_CANCELLED;
+
+                    Withdraw(request);
+                }
+                else if (request->timeout - elapsed < wait)
+                {
+                    wait = request->timeout - elapsed;
+                }
+            }
+
+            LeaveCriticalSection(&m_lock);
+
+            if (!completion)
+                break;
+
+            completion(requestId, error, NULL, context);
+        }
+
+        HANDLE events[] = { m_expiryStop, m_deadlineAdded };
+
+        if (WAIT_OBJECT_0 == WaitForMultipleObjects(DIM(events), events, FALSE, wait))
+            break;
+    }
+}
+
+void AsyncResolver::Complete(Request* request, DWORD error, const Resolution* resolution)
+{
+    _ASSERT(request);
+
+    EnterCriticalSection(&m_lock);
+
+    //
+    // A request that ran out of time may already have been completed,
+    // in which case all that is left is to free it. One cancelled or
+    // timed out while it was being searched for is failed all the same
+    // since its caller has stopped waiting.
+    //
+
+    const bool isCompleted = request->isCompleted;
+
+    if (!isCompleted)
+    {
+        Withdraw(request);
+
+        if (request->isCancelled)
+            error = ERROR_CANCELLED;
+        else if (GetTickCount() - request->startTime >= request->timeout)
+            error = ERROR_TIMEOUT;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    if (!isCompleted)
+    {
+        request->completion(request->id, error, NO_ERROR == error ? resolution : NULL,
+            request->context);
+    }
+
+    delete request;
+}
+
+void AsyncResolver::Withdraw(Request* request)
+{
+    _ASSERT(request);
+    _ASSERT(!request->isCompleted);
+
+    //
+    // Called with the lock held. Once withdrawn, the request can no
+    // longer be cancelled or completed by anyone else.
+    //
+
+    for (int i = 0; i < m_outstanding.GetCount(); i++)
+    {
+        if (request == m_outstanding[i])
+        {
+            const int last = m_outstanding.GetCount() - 1;
+            m_outstanding[i] = m_outstanding[last];
+            m_outstanding.SetCount(last);
+            break;
+        }
+    }
+
+    request->isCompleted = true;
+}
@@ -0,0 +1,102 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  AsyncResolver
+// --------------------------------------------------------------------------
+//
+//  Resolves names in the background for callers that cannot afford to
+//  wait, such as services built around an event loop. Requests are queued
+//  and taken up in turn by a fixed number of threads however many are
+//  outstanding. Each request's completion procedure is called exactly
+//  once, from one of the threads of the resolver, with the error code
+//  and, when that is NO_ERROR, the resolution, which is only valid for
+//  the duration of the call.
+//
+//  A request given a timeout, in milliseconds, other than INFINITE that
+//  it has not completed within completes with ERROR_TIMEOUT as soon as
+//  the time is up, whether it is still waiting its turn or already being
+//  searched for. A search under way is not interrupted, but its outcome
+//  is thrown away. A request cancelled through the identifier
+//  BeginResolve hands back completes with ERROR_CANCELLED, which it does
+//  when its turn comes or, if it is being searched for, the moment the
+//  search is over.
+//
+//  The resolver has to be initialized before Start and outlive Stop,
+//  which cancels whatever is still outstanding and returns once every
+//  completion procedure has been called. Since Stop waits for the very
+//  threads that call them, a completion procedure must never call Stop.
+//  None of the methods throw.
+//
+
+typedef void (CALLBACK * ResolveCompletionProc)(DWORD requestId, DWORD error,
+    const Resolution* resolution, LPVOID context);
+
+class AsyncResolver
+{
+public:
+
+    AsyncResolver();
+    ~AsyncResolver();
+
+    DWORD Start(const Resolver& resolver, int threadCount);
+    void Stop();
+
+    DWORD BeginResolve(LPCTSTR fileName, DWORD timeout,
+        ResolveCompletionProc completion, LPVOID context, DWORD& requestId);
+
+    bool Cancel(DWORD requestId);
+
+private:
+
+    struct Request
+    {
+        DWORD id;
+        TCHAR fileName[MAX_PATH];
+        DWORD startTime;
+        DWORD timeout;
+        ResolveCompletionProc completion;
+        LPVOID context;
+        bool isCancelled;
+        bool isCompleted;
+    };
+
+    static unsigned __stdcall WorkerProc(LPVOID parameter);
+    static unsigned __stdcall ExpiryProc(LPVOID parameter);
+    void Work();
+    void Expire();
+    void Complete(Request* request, DWORD error, const Resolution* resolution);
+    void Withdraw(Request* request);
+
+    const Resolver* m_resolver;
+    CRITICAL_SECTION m_lock;
+    HANDLE m_work;
+    Array<HANDLE> m_threads;
+    HANDLE m_expiryThread;
+    HANDLE m_deadlineAdded;
+    HANDLE m_expiryStop;
+    Array<Request*> m_queue;
+    int m_queueHead;
+    Array<Request*> m_outstanding;
+    DWORD m_nextRequestId;
+    bool m_isStopping;
+
+    AsyncResolver(const AsyncResolver&);
+    AsyncResolver& operator=(const AsyncResolver&);
+};
@@ -0,0 +1,242 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Profiler.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "LookupIndex.h"
+#include "NameTable.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "ImageMachine.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+#include "Resolver.h"
+#include "Benchmark.h"
+
+// --------------------------------------------------------------------------
+//  Benchmark
+// --------------------------------------------------------------------------
+
+Benchmark::Benchmark() :
+    m_frequency(0)
+{
+    ZeroMemory(&m_result, sizeof(m_result));
+
+    LARGE_INTEGER frequency;
+
+    if (QueryPerformanceFrequency(&frequency))
+        m_frequency = frequency.QuadPart;
+}
+
+DWORD Benchmark::Run(const Resolver& resolver, BenchmarkReadProc read, LPVOID context,
+    int threadCount, DirectoryIndexTable* directoryIndexes)
+{
+    _ASSERT(read);
+
+    if (!m_frequency)
+        return ERROR_NOT_SUPPORTED;
+
+    m_latencies.Clear();
+    ZeroMemory(&m_result, sizeof(m_result));
+
+    if (!threadCount)
+        threadCount = GetProcessorCount();
+
+    if (directoryIndexes && directoryIndexes->IsBudgeted())
+        threadCount = 1;
+
+    Context benchmark = { this, &resolver, read, context, NULL };
+
+    ResolverStatistics before;
+    resolver.GetStatistics(before);
+
+    FileSystemStatistics callsBefore;
+    resolver.GetFileSystem().GetStatistics(callsBefore);
+
+    const LONGLONG start = GetTime();
+
+    if (threadCount > 1)
+    {
+        enum { SlotCount = 1024 };
+
+        Array<Query> slots;
+
+        try
+        {
+            slots.SetCount(SlotCount);
+        }
+        catch (SystemException& e)
+        {
+            return e.GetCode();
+        }
+
+        benchmark.slots = slots.GetData();
+
+        const DWORD error = ParallelPipeline(threadCount, SlotCount, ReadQuery,
+            ResolveQuery, RecordQuery, &benchmark);
+
+        if (NO_ERROR != error)
+            return error;
+    }
+    else
+    {
+        Query query;
+        benchmark.slots = &query;
+
+        try
+        {
+            while (ReadQuery(0, &benchmark))
+            {
+                Resolve(resolver, query);
+                Record(query);
+
+                if (directoryIndexes)
+                    directoryIndexes->Trim();
+            }
+        }
+        catch (SystemException& e)
+        {
+            return e.GetCode();
+        }
+    }
+
+    m_result.elapsedMicroseconds = GetMicroseconds(start, GetTime());
+
+    ResolverStatistics after;
+    resolver.GetStatistics(after);
+
+    FileSystemStatistics callsAfter;
+    resolver.GetFileSystem().GetStatistics(callsAfter);
+
+    //
+    // Everything is reported as what the replay added to the counts the
+    // resolver and the file system already had, which takes in listing
+    // directories for an index and reading images for the metadata
+    // cache.
+    //
+
+    m_result.queryCount = m_latencies.GetCount();
+    m_result.threadCount = threadCount;
+
+    m_result.throughput = m_result.elapsedMicroseconds ? static_cast<DWORD>(
+        static_cast<ULONGLONG>(m_result.queryCount) * 1000000 / m_result.elapsedMicroseconds) : 0;
+
+    m_result.resolverStatistics.probeCount = after.probeCount - before.probeCount;
+    m_result.resolverStatistics.imageReadCount = after.imageReadCount - before.imageReadCount;
+    m_result.resolverStatistics.listingCount = after.listingCount - before.listingCount;
+
+    m_result.fileSystemStatistics.attributeCount = callsAfter.attributeCount - callsBefore.attributeCount;
+    m_result.fileSystemStatistics.listingCount = callsAfter.listingCount - callsBefore.listingCount;
+    m_result.fileSystemStatistics.readCount = callsAfter.readCount - callsBefore.readCount;
+    m_result.fileSystemStatistics.mapCount = callsAfter.mapCount - callsBefore.mapCount;
+
+    qsort(m_latencies.GetData(), m_latencies.GetCount(), sizeof(DWORD), CompareLatencies);
+
+    return NO_ERROR;
+}
+
+DWORD Benchmark::GetPercentile(int perMille) const
+{
+    _ASSERT(perMille >= 0 && perMille <= 1000);
+
+    //
+    // The nearest rank, so that the 1000th is the slowest name of all.
+    //
+
+    const int count = m_latencies.GetCount();
+
+    if (!count)
+        return 0;
+
+    const int rank = static_cast<int>((static_cast<ULONGLONG>(count) * perMille + 999) / 1000);
+
+    return m_latencies[rank > 0 ? rank - 1 : 0];
+}
+
+bool CALLBACK Benchmark::ReadQuery(int slot, LPVOID context)
+{
+    Context& benchmark = *static_cast<Context*>(context);
+    Query& query = benchmark.slots[slot];
+
+    return benchmark.read(query.fileName, DIM(query.fileName), query.isTruncated,
+        benchmark.readContext);
+}
+
+void CALLBACK Benchmark::ResolveQuery(int slot, LPVOID context)
+{
+    Context& benchmark = *static_cast<Context*>(context);
+
+    benchmark.benchmark->Resolve(*benchmark.resolver, benchmark.slots[slot]);
+}
+
+void CALLBACK Benchmark::RecordQuery(int slot, LPVOID context)
+{
+    Context& benchmark = *static_cast<Context*>(context);
+
+    benchmark.benchmark->Record(benchmark.slots[slot]);
+}
+
+int __cdecl Benchmark::CompareLatencies(const void* a, const void* b)
+{
+    const DWORD x = *static_cast<const DWORD*>(a);
+    const DWORD y = *static_cast<const DWORD*>(b);
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+void Benchmark::Resolve(const Resolver& resolver, Query& query) const
+{
+    Resolution resolution;
+
+    const LONGLONG start = GetTime();
+
+    query.error = query.isTruncated ? ERROR_FILENAME_EXCED_RANGE :
+        resolver.Resolve(query.fileName, resolution);
+
+    query.microseconds = GetMicroseconds(start, GetTime());
+}
+
+void Benchmark::Record(const Query& query)
+{
+    m_latencies.Add(query.microseconds);
+
+    if (NO_ERROR != query.error)
+        m_result.missCount++;
+}
+
+LONGLONG Benchmark::GetTime() const
+{
+    LARGE_INTEGER time;
+    QueryPerformanceCounter(&time);
+
+    return time.QuadPart;
+}
+
+DWORD Benchmark::GetMicroseconds(LONGLONG start, LONGLONG end) const
+{
+    return static_cast<DWORD>((end - start) * 1000000 / m_frequency);
+}
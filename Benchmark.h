@@ -0,0 +1,111 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  BenchmarkResult
+// --------------------------------------------------------------------------
+//
+//  What a replay of names cost: how many there were and how many could
+//  not be found, how long they took all told and, as deltas over the
+//  replay, what the resolver and its file system did to answer them.
+//  Throughput is in queries per second.
+//
+
+struct BenchmarkResult
+{
+    int queryCount;
+    int missCount;
+    int threadCount;
+    DWORD elapsedMicroseconds;
+    DWORD throughput;
+    ResolverStatistics resolverStatistics;
+    FileSystemStatistics fileSystemStatistics;
+};
+
+typedef bool (CALLBACK * BenchmarkReadProc)(LPTSTR fileName, int capacity, bool& isTruncated, LPVOID context);
+
+// --------------------------------------------------------------------------
+//  Benchmark
+// --------------------------------------------------------------------------
+//
+//  Replays a stream of names against a resolver as it was set up, cold,
+//  from an index file, from shared listings, from a lookup index or
+//  within a cache, timing every name and keeping the latencies so that
+//  percentiles can be had afterwards.
+//
+//  Names come from the read procedure, which returns false at the end of
+//  the stream and flags a name that did not fit so that it counts as a
+//  failure without being resolved. Names are replayed on the given number
+//  of threads, or on every processor for none, through ParallelPipeline.
+//  Given a directory index table that is held within a budget, they are
+//  replayed one at a time instead and the table is trimmed after every
+//  name, just as it would be in use.
+//
+//  Run returns a Win32 error code. The read procedure may throw a
+//  SystemException, whose code is then returned.
+//
+
+class Benchmark
+{
+public:
+
+    Benchmark();
+
+    DWORD Run(const Resolver& resolver, BenchmarkReadProc read, LPVOID context,
+        int threadCount, DirectoryIndexTable* directoryIndexes = NULL);
+
+    const BenchmarkResult& GetResult() const { return m_result; }
+    DWORD GetPercentile(int perMille) const;
+
+private:
+
+    struct Query
+    {
+        TCHAR fileName[MAX_PATH];
+        bool isTruncated;
+        DWORD error;
+        DWORD microseconds;
+    };
+
+    struct Context
+    {
+        Benchmark* benchmark;
+        const Resolver* resolver;
+        BenchmarkReadProc read;
+        LPVOID readContext;
+        Query* slots;
+    };
+
+    static bool CALLBACK ReadQuery(int slot, LPVOID context);
+    static void CALLBACK ResolveQuery(int slot, LPVOID context);
+    static void CALLBACK RecordQuery(int slot, LPVOID context);
+    static int __cdecl CompareLatencies(const void* a, const void* b);
+
+    void Resolve(const Resolver& resolver, Query& query) const;
+    void Record(const Query& query);
+    LONGLONG GetTime() const;
+    DWORD GetMicroseconds(LONGLONG start, LONGLONG end) const;
+
+    LONGLONG m_frequency;
+    Array<DWORD> m_latencies;
+    BenchmarkResult m_result;
+
+    Benchmark(const Benchmark&);
+    Benchmark& operator=(const Benchmark&);
+};
@@ -0,0 +1,144 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  BufferedOutputStream
+// --------------------------------------------------------------------------
+//
+//  Same idea as WinOutputStream but collects output in a buffer and only
+//  hands it to the system in large blocks. When writing one record per
+//  query for a long list of names, this makes the difference between
+//  one system call per field and one per several hundred records.
+//
+//  If the other end goes away (say the reading end of a pipe is closed)
+//  then the error is remembered and any further output is discarded.
+//
+
+class BufferedOutputStream
+{
+public:
+
+    enum { BufferSize = 64 * 1024 };
+
+    BufferedOutputStream(HANDLE handle) :
+        m_handle(handle),
+        m_buffer(new BYTE[BufferSize]),
+        m_length(0),
+        m_error(NO_ERROR)
+    {
+        _ASSERT(handle);
+
+        if (!m_buffer)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+    }
+
+    ~BufferedOutputStream()
+    {
+        Flush();
+        delete [] m_buffer;
+    }
+
+    DWORD GetError() const { return m_error; }
+
+    void Write(LPCTSTR text)
+    {
+        _ASSERT(text);
+        WriteBytes(text, lstrlen(text) * sizeof(TCHAR));
+    }
+
+    void Write(const unsigned long n)
+    {
+        TCHAR text[20];
+        wsprintf(text, _T("%lu"), n);
+        Write(text);
+    }
+
+    void Write(const int n)
+    {
+        TCHAR text[20];
+        wsprintf(text, _T("%d"), n);
+        Write(text);
+    }
+
+    void Write(const TCHAR ch)
+    {
+        WriteBytes(&ch, sizeof(ch));
+    }
+
+    void WriteBytes(const void* data, DWORD size)
+    {
+        _ASSERT(data || !size);
+
+        if (size > BufferSize - m_length)
+        {
+            Flush();
+
+            //
+            // Anything that would not fit in an empty buffer either
+            // goes straight out instead of being copied in pieces.
+            //
+
+            if (size >= BufferSize)
+            {
+                WriteThrough(data, size);
+                return;
+            }
+        }
+
+        CopyMemory(m_buffer + m_length, data, size);
+        m_length += size;
+    }
+
+    void Flush()
+    {
+        if (m_length)
+        {
+            WriteThrough(m_buffer, m_length);
+            m_length = 0;
+        }
+    }
+
+private:
+
+    void WriteThrough(const void* data, DWORD size)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(data);
+
+        while (size && NO_ERROR == m_error)
+        {
+            DWORD bytesWritten;
+
+            if (!WriteFile(m_handle, bytes, size, &bytesWritten, NULL))
+            {
+                m_error = GetLastError();
+                break;
+            }
+
+            bytes += bytesWritten;
+            size -= bytesWritten;
+        }
+    }
+
+    HANDLE m_handle;
+    BYTE* m_buffer;
+    DWORD m_length;
+    DWORD m_error;
+
+    BufferedOutputStream(const BufferedOutputStream&);
+    BufferedOutputStream& operator=(const BufferedOutputStream&);
+};
@@ -0,0 +1,143 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "DirectoryIdentity.h"
+
+// --------------------------------------------------------------------------
+//  DirectoryIdentity
+// --------------------------------------------------------------------------
+
+bool DirectoryIdentity::Query(LPCTSTR directory, DirectoryIdentity& identity)
+{
+    _ASSERT(directory);
+
+    //
+    // A directory can only be opened as a handle with backup semantics.
+    // No access is asked for since only its file information is needed,
+    // and sharing everything keeps from getting in anyone else's way.
+    //
+
+    HANDLE handle = CreateFile(directory, 0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+
+    if (INVALID_HANDLE_VALUE == handle)
+        return false;
+
+    BY_HANDLE_FILE_INFORMATION information;
+    const bool isKnown = FALSE != GetFileInformationByHandle(handle, &information) &&
+        0 != (information.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+
+    CloseHandle(handle);
+
+    if (!isKnown)
+        return false;
+
+    identity.volumeSerialNumber = information.dwVolumeSerialNumber;
+    identity.fileIndexHigh = information.nFileIndexHigh;
+    identity.fileIndexLow = information.nFileIndexLow;
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+//  DirectoryIdentityCache
+// --------------------------------------------------------------------------
+
+DirectoryIdentityCache::DirectoryIdentityCache()
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+DirectoryIdentityCache::~DirectoryIdentityCache()
+{
+    DeleteCriticalSection(&m_lock);
+}
+
+bool DirectoryIdentityCache::GetIdentity(LPCTSTR directory, DirectoryIdentity& identity)
+{
+    _ASSERT(directory);
+
+    EnterCriticalSection(&m_lock);
+
+    const int index = Find(directory);
+    const bool isCached = index >= 0;
+    bool hasIdentity = isCached && m_hasIdentity[index];
+
+    if (hasIdentity)
+        identity = m_identities[index];
+
+    LeaveCriticalSection(&m_lock);
+
+    if (isCached)
+        return hasIdentity;
+
+    //
+    // Opening the directory can take a while, like when it is on a
+    // network share that has gone away, so do it outside of the lock.
+    // Should another thread get there first, its answer stands.
+    //
+
+    DirectoryIdentity queried = { 0 };
+    hasIdentity = DirectoryIdentity::Query(directory, queried);
+
+    EnterCriticalSection(&m_lock);
+
+    try
+    {
+        if (Find(directory) < 0)
+        {
+            m_directoryOffsets.Reserve(m_directoryOffsets.GetCount() + 1);
+            m_identities.Reserve(m_identities.GetCount() + 1);
+            m_hasIdentity.Reserve(m_hasIdentity.GetCount() + 1);
+
+            const int offset = m_directories.GetCount();
+            m_directories.Append(directory, lstrlen(directory) + 1);
+
+            m_directoryOffsets.Add(offset);
+            m_identities.Add(queried);
+            m_hasIdentity.Add(hasIdentity);
+        }
+    }
+    catch (...)
+    {
+        LeaveCriticalSection(&m_lock);
+        throw;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    if (hasIdentity)
+        identity = queried;
+
+    return hasIdentity;
+}
+
+int DirectoryIdentityCache::Find(LPCTSTR directory) const
+{
+    _ASSERT(directory);
+
+    for (int i = 0; i < m_directoryOffsets.GetCount(); i++)
+    {
+        if (0 == lstrcmpi(directory, m_directories.GetData() + m_directoryOffsets[i]))
+            return i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,76 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  DirectoryIdentity
+// --------------------------------------------------------------------------
+//
+//  What makes a directory physically the same as another no matter how
+//  its path is spelled: the serial number of the volume it lives on and
+//  its file index on that volume. Two paths with the same identity, like
+//  a directory and a junction to it, list the same files.
+//
+
+struct DirectoryIdentity
+{
+    DWORD volumeSerialNumber;
+    DWORD fileIndexHigh;
+    DWORD fileIndexLow;
+
+    bool IsSameAs(const DirectoryIdentity& other) const
+    {
+        return volumeSerialNumber == other.volumeSerialNumber &&
+               fileIndexHigh == other.fileIndexHigh &&
+               fileIndexLow == other.fileIndexLow;
+    }
+
+    static bool Query(LPCTSTR directory, DirectoryIdentity& identity);
+};
+
+// --------------------------------------------------------------------------
+//  DirectoryIdentityCache
+// --------------------------------------------------------------------------
+//
+//  Remembers the identity of each directory path it has been asked
+//  about, including when there turned out to be none, so that opening
+//  the directory is paid for once however many snapshots include it.
+//  It can be shared by any number of threads.
+//
+
+class DirectoryIdentityCache
+{
+public:
+
+    DirectoryIdentityCache();
+    ~DirectoryIdentityCache();
+
+    bool GetIdentity(LPCTSTR directory, DirectoryIdentity& identity);
+
+private:
+
+    int Find(LPCTSTR directory) const;
+
+    CRITICAL_SECTION m_lock;
+    Array<TCHAR> m_directories;
+    Array<int> m_directoryOffsets;
+    Array<DirectoryIdentity> m_identities;
+    Array<bool> m_hasIdentity;
+
+    DirectoryIdentityCache(const DirectoryIdentityCache&);
+    DirectoryIdentityCache& operator=(const DirectoryIdentityCache&);
+};
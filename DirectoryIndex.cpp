@@ -0,0 +1,1212 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Profiler.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+
+//
+// Rounds a size up to a multiple of eight so that whatever follows it in
+// an image or file is suitably aligned.
+//
+
+static DWORD Align(DWORD size)
+{
+    return (size + 7) & ~7UL;
+}
+
+// --------------------------------------------------------------------------
+//  DirectoryIndex
+// --------------------------------------------------------------------------
+
+DirectoryIndex::DirectoryIndex(LPCTSTR directory, const FileSystem* fileSystem) :
+    m_fileSystem(fileSystem ? fileSystem : &FileSystem::GetWin32()),
+    m_state(Unscanned),
+    m_isScanOnDemand(false),
+    m_hitCount(0),
+    m_missCount(0),
+    m_lastUseTime(0),
+    m_scanTime(0),
+    m_imageSize(0),
+    m_header(NULL),
+    m_hashes(NULL),
+    m_blockOffsets(NULL),
+    m_slots(NULL),
+    m_arena(NULL)
+{
+    _ASSERT(directory);
+
+    lstrcpyn(m_directory, directory, DIM(m_directory));
+}
+
+bool DirectoryIndex::Scan()
+{
+    if (Unscanned != InterlockedCompareExchange(&m_state, Scanning, Unscanned))
+        return IsScanned();
+
+    PROFILE_PHASE(ScanPhase);
+
+    try
+    {
+        Array<TCHAR> names;
+        Array<int> nameOffsets;
+        FILETIME lastWriteTime;
+
+        const DWORD startTime = GetTickCount();
+        const bool isListed = List(names, nameOffsets, lastWriteTime);
+
+        if (isListed)
+            Build(names, nameOffsets, lastWriteTime);
+
+        m_scanTime = GetTickCount() - startTime;
+        m_lastUseTime = GetTickCount();
+
+        InterlockedExchange(&m_state, isListed ? Scanned : Unlistable);
+    }
+    catch (...)
+    {
+        InterlockedExchange(&m_state, Unlistable);
+        throw;
+    }
+
+    return IsScanned();
+}
+
+bool DirectoryIndex::Attach(const void* image, DWORD imageSize)
+{
+    _ASSERT(image);
+
+    //
+    // An image is only any good if nothing has been added to, removed
+    // from or renamed in the directory since it was made, all of which
+    // update the last write time of the directory.
+    //
+
+    if (!IsValidImage(image, imageSize))
+        return false;
+
+    FILETIME lastWriteTime;
+
+    if (!QueryLastWriteTime(m_directory, lastWriteTime, m_fileSystem) ||
+        0 != CompareFileTime(&lastWriteTime,
+            &static_cast<const DirectoryIndexHeader*>(image)->lastWriteTime))
+    {
+        return false;
+    }
+
+    return Adopt(image, imageSize);
+}
+
+bool DirectoryIndex::Adopt(const void* image, DWORD imageSize)
+{
+    _ASSERT(image);
+
+    if (!IsValidImage(image, imageSize))
+        return false;
+
+    if (Unscanned != InterlockedCompareExchange(&m_state, Scanning, Unscanned))
+        return false;
+
+    SetImage(image, imageSize);
+    InterlockedExchange(&m_state, Scanned);
+
+    return true;
+}
+
+void DirectoryIndex::Rebase(const void* image)
+{
+    _ASSERT(image);
+    _ASSERT(IsScanned() && !m_storage.GetCount());
+    _ASSERT(0 == memcmp(image, m_header, m_imageSize));
+
+    SetImage(image, m_imageSize);
+}
+
+bool DirectoryIndex::Evict()
+{
+    //
+    // Only an index that owns its image has anything to give back.
+    //
+
+    if (!m_storage.GetCount() || Scanned != InterlockedCompareExchange(&m_state, Scanning, Scanned))
+        return false;
+
+    m_header = NULL;
+    m_hashes = NULL;
+    m_blockOffsets = NULL;
+    m_slots = NULL;
+    m_arena = NULL;
+    m_imageSize = 0;
+    m_storage.Free();
+
+    InterlockedExchange(&m_state, Unscanned);
+
+    return true;
+}
+
+struct DirectoryIndexListing
+{
+    Array<TCHAR>* names;
+    Array<int>* nameOffsets;
+    bool hasLongName;
+};
+
+bool DirectoryIndex::List(Array<TCHAR>& names, Array<int>& nameOffsets, FILETIME& lastWriteTime)
+{
+    //
+    // Take the time before listing so that a change made while listing
+    // makes the index look out of date rather than the other way round.
+    //
+
+    if (!QueryLastWriteTime(m_directory, lastWriteTime, m_fileSystem))
+        return false;
+
+    DirectoryIndexListing listing = { &names, &nameOffsets, false };
+
+    const DWORD error = m_fileSystem->List(m_directory, AddName, &listing);
+
+    //
+    // The arena keeps the length of every name in a single character,
+    // which on a double-byte code page is not always enough. Rather than
+    // leave such a name out, leave the whole directory to the file system.
+    //
+
+    if (NO_ERROR == error && listing.hasLongName)
+        return false;
+
+    //
+    // Nothing will ever be found in a directory that does not exist,
+    // which an empty index says just as well. Anything else, like being
+    // denied access, leaves the question to the file system.
+    //
+
+    if (ERROR_FILE_NOT_FOUND == error || ERROR_PATH_NOT_FOUND == error)
+    {
+        names.Clear();
+        nameOffsets.Clear();
+        return true;
+    }
+
+    return NO_ERROR == error;
+}
+
+void CALLBACK DirectoryIndex::AddName(const WIN32_FIND_DATA& findData, LPVOID context)
+{
+    DirectoryIndexListing& listing = *static_cast<DirectoryIndexListing*>(context);
+
+    LPCTSTR name = findData.cFileName;
+
+    for (int i = 0; i < 2; i++)
+    {
+        const int length = lstrlen(name);
+        const int offset = listing.names->GetCount();
+
+        if (length > MaxNameLength)
+            listing.hasLongName = true;
+
+        if (length > 0)
+        {
+            listing.nameOffsets->Add(offset);
+            listing.names->Append(name, length + 1);
+            CharUpperBuff(listing.names->GetData() + offset, length);
+        }
+
+        name = findData.cAlternateFileName;
+    }
+}
+
+void DirectoryIndex::Build(const Array<TCHAR>& names, const Array<int>& nameOffsets,
+    const FILETIME& lastWriteTime)
+{
+    //
+    // Sort the names so that neighbours share as long a prefix as
+    // possible, and drop any that turn up twice, as a short name that
+    // is the same as the long one does.
+    //
+
+    Array<LPCTSTR> sorted;
+    sorted.SetCount(nameOffsets.GetCount());
+
+    for (int i = 0; i < sorted.GetCount(); i++)
+        sorted[i] = names.GetData() + nameOffsets[i];
+
+    qsort(sorted.GetData(), sorted.GetCount(), sizeof(LPCTSTR), CompareNames);
+
+    Array<LPCTSTR> unique;
+
+    for (int i = 0; i < sorted.GetCount(); i++)
+    {
+        if (0 == i || 0 != _tcscmp(sorted[i], sorted[i - 1]))
+            unique.Add(sorted[i]);
+    }
+
+    const int nameCount = unique.GetCount();
+
+    //
+    // Front-code the names into the arena, a block at a time.
+    //
+
+    Array<TCHAR> arena;
+    Array<DWORD> blockOffsets;
+
+    for (int i = 0; i < nameCount; i++)
+    {
+        LPCTSTR name = unique[i];
+        const int length = lstrlen(name);
+        int prefixLength = 0;
+
+        if (0 == i % BlockSize)
+        {
+            blockOffsets.Add(arena.GetCount());
+        }
+        else
+        {
+            LPCTSTR previous = unique[i - 1];
+
+            while (prefixLength < length && previous[prefixLength] == name[prefixLength])
+                prefixLength++;
+        }
+
+        _ASSERT(length <= MaxNameLength);
+
+        arena.Add(static_cast<TCHAR>(prefixLength));
+        arena.Add(static_cast<TCHAR>(length - prefixLength));
+        arena.Append(name + prefixLength, length - prefixLength);
+    }
+
+    //
+    // The hash table uses open addressing with linear probing and is
+    // kept at most three quarters full.
+    //
+
+    DWORD slotCount = 16;
+
+    while (slotCount < static_cast<DWORD>(nameCount) * 4 / 3 + 1)
+        slotCount *= 2;
+
+    const DWORD blockCount = blockOffsets.GetCount();
+    const DWORD arenaLength = arena.GetCount();
+
+    const DWORD imageSize = Align(sizeof(DirectoryIndexHeader) +
+        (nameCount + blockCount + slotCount) * sizeof(DWORD) +
+        arenaLength * sizeof(TCHAR));
+
+    m_storage.SetCount(imageSize);
+    ZeroMemory(m_storage.GetData(), imageSize);
+
+    DirectoryIndexHeader* header = reinterpret_cast<DirectoryIndexHeader*>(m_storage.GetData());
+    header->signature = Signature;
+    header->version = Version;
+    header->characterSize = sizeof(TCHAR);
+    header->nameCount = nameCount;
+    header->blockCount = blockCount;
+    header->slotCount = slotCount;
+    header->arenaLength = arenaLength;
+    header->lastWriteTime = lastWriteTime;
+
+    DWORD* hashes = reinterpret_cast<DWORD*>(header + 1);
+    DWORD* blocks = hashes + nameCount;
+    DWORD* slots = blocks + blockCount;
+
+    if (blockCount)
+        CopyMemory(blocks, blockOffsets.GetData(), blockCount * sizeof(DWORD));
+
+    if (arenaLength)
+        CopyMemory(slots + slotCount, arena.GetData(), arenaLength * sizeof(TCHAR));
+
+    const DWORD mask = slotCount - 1;
+
+    for (int i = 0; i < nameCount; i++)
+    {
+        const DWORD hash = Hash(unique[i]);
+        hashes[i] = hash;
+
+        DWORD slot = hash & mask;
+
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+
+        slots[slot] = i + 1;
+    }
+
+    SetImage(header, imageSize);
+}
+
+void DirectoryIndex::SetImage(const void* image, DWORD imageSize)
+{
+    m_header = static_cast<const DirectoryIndexHeader*>(image);
+    m_imageSize = imageSize;
+    m_hashes = reinterpret_cast<const DWORD*>(m_header + 1);
+    m_blockOffsets = m_hashes + m_header->nameCount;
+    m_slots = m_blockOffsets + m_header->blockCount;
+    m_arena = reinterpret_cast<const TCHAR*>(m_slots + m_header->slotCount);
+}
+
+bool DirectoryIndex::IsValidImage(const void* image, DWORD imageSize)
+{
+    //
+    // Images come from files that may have been cut short or written by
+    // another build, so check everything that decoding relies on before
+    // trusting one.
+    //
+
+    if (imageSize < sizeof(DirectoryIndexHeader))
+        return false;
+
+    const DirectoryIndexHeader* header = static_cast<const DirectoryIndexHeader*>(image);
+
+    if (Signature != header->signature || Version != header->version ||
+        sizeof(TCHAR) != header->characterSize)
+    {
+        return false;
+    }
+
+    const DWORD nameCount = header->nameCount;
+    const DWORD slotCount = header->slotCount;
+
+    if (nameCount > imageSize || slotCount > imageSize || header->arenaLength > imageSize ||
+        header->blockCount != (nameCount + BlockSize - 1) / BlockSize ||
+        0 == slotCount || 0 != (slotCount & (slotCount - 1)) || slotCount <= nameCount)
+    {
+        return false;
+    }
+
+    const ULONGLONG requiredSize = sizeof(DirectoryIndexHeader) +
+        (static_cast<ULONGLONG>(nameCount) + header->blockCount + slotCount) * sizeof(DWORD) +
+        static_cast<ULONGLONG>(header->arenaLength) * sizeof(TCHAR);
+
+    if (requiredSize > imageSize)
+    {
+        return false;
+    }
+
+    const DWORD* blockOffsets = reinterpret_cast<const DWORD*>(header + 1) + nameCount;
+    const DWORD* slots = blockOffsets + header->blockCount;
+
+    for (DWORD i = 0; i < header->blockCount; i++)
+    {
+        if (blockOffsets[i] >= header->arenaLength)
+            return false;
+    }
+
+    for (DWORD i = 0; i < slotCount; i++)
+    {
+        if (slots[i] > nameCount)
+            return false;
+    }
+
+    return true;
+}
+
+LPCTSTR DirectoryIndex::GetName(int nameIndex, LPTSTR buffer) const
+{
+    _ASSERT(buffer);
+    _ASSERT(nameIndex >= 0 && nameIndex < GetNameCount());
+
+    //
+    // Decode from the start of the block, each name building on the
+    // one before it. Anything that would not fit, which only a damaged
+    // image could hold, ends the name.
+    //
+
+    const DWORD arenaLength = m_header->arenaLength;
+    DWORD position = m_blockOffsets[nameIndex / BlockSize];
+    int length = 0;
+
+    for (int i = nameIndex - nameIndex % BlockSize; i <= nameIndex; i++)
+    {
+        if (position + 2 > arenaLength)
+            break;
+
+        const int prefixLength = static_cast<_TUCHAR>(m_arena[position]);
+        const int suffixLength = static_cast<_TUCHAR>(m_arena[position + 1]);
+        position += 2;
+
+        if (prefixLength > length || prefixLength + suffixLength >= MAX_PATH ||
+            position + suffixLength > arenaLength)
+        {
+            length = 0;
+            break;
+        }
+
+        CopyMemory(buffer + prefixLength, m_arena + position, suffixLength * sizeof(TCHAR));
+        position += suffixLength;
+        length = prefixLength + suffixLength;
+    }
+
+    buffer[length] = 0;
+
+    return buffer;
+}
+
+int DirectoryIndex::Find(LPCTSTR foldedName, DWORD hash) const
+{
+    _ASSERT(foldedName);
+    _ASSERT(IsScanned());
+
+    //
+    // The hashes sit apart from the names so that probing only decodes
+    // a name when its hash has already matched.
+    //
+
+    const DWORD mask = m_header->slotCount - 1;
+
+    for (DWORD slot = hash & mask; m_slots[slot]; slot = (slot + 1) & mask)
+    {
+        const int nameIndex = m_slots[slot] - 1;
+        TCHAR name[MAX_PATH];
+
+        if (hash == m_hashes[nameIndex] && 0 == _tcscmp(foldedName, GetName(nameIndex, name)))
+            return nameIndex;
+    }
+
+    return -1;
+}
+
+DWORD DirectoryIndex::Hash(LPCTSTR foldedName)
+{
+    _ASSERT(foldedName);
+
+    //
+    // FNV-1a, one character at a time.
+    //
+
+    DWORD hash = 2166136261;
+
+    for (LPCTSTR ch = foldedName; *ch; ch++)
+    {
+        hash ^= static_cast<DWORD>(static_cast<_TUCHAR>(*ch));
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+bool DirectoryIndex::IsIndexable(LPCTSTR name)
+{
+    _ASSERT(name);
+
+    //
+    // Only a plain name can be answered from a single directory listing.
+    // Names that reach into a subdirectory, and names with trailing dots
+    // or spaces that Windows quietly strips before opening, have to be
+    // left to the file system.
+    //
+
+    const int length = lstrlen(name);
+
+    if (0 == length || StrPBrk(name, _T("\\/:*?")))
+        return false;
+
+    const TCHAR last = name[length - 1];
+
+    return _T('.') != last && _T(' ') != last;
+}
+
+bool DirectoryIndex::QueryLastWriteTime(LPCTSTR directory, FILETIME& lastWriteTime,
+    const FileSystem* fileSystem)
+{
+    _ASSERT(directory);
+
+    if (!fileSystem)
+        fileSystem = &FileSystem::GetWin32();
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    const DWORD error = fileSystem->GetAttributes(directory, data);
+
+    if (NO_ERROR == error)
+    {
+        lastWriteTime = data.ftLastWriteTime;
+        return true;
+    }
+
+    //
+    // A directory that does not exist has no time of its own, so it
+    // goes by zero for as long as it stays that way.
+    //
+
+    if (ERROR_FILE_NOT_FOUND != error && ERROR_PATH_NOT_FOUND != error)
+        return false;
+
+    lastWriteTime.dwLowDateTime = 0;
+    lastWriteTime.dwHighDateTime = 0;
+
+    return true;
+}
+
+int __cdecl DirectoryIndex::CompareNames(const void* a, const void* b)
+{
+    return _tcscmp(*static_cast<const LPCTSTR*>(a), *static_cast<const LPCTSTR*>(b));
+}
+
+// --------------------------------------------------------------------------
+//  DirectoryIndexTable
+// --------------------------------------------------------------------------
+
+DirectoryIndexTable::DirectoryIndexTable() :
+    m_fileSystem(NULL),
+    m_mapping(NULL),
+    m_view(NULL),
+    m_viewSize(0),
+    m_budget(0),
+    m_policy(LeastRecentlyUsedEviction),
+    m_evictionCount(0)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+DirectoryIndexTable::~DirectoryIndexTable()
+{
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+        delete m_indexes[i];
+
+    Unload();
+
+    DeleteCriticalSection(&m_lock);
+}
+
+DirectoryIndex* DirectoryIndexTable::Register(LPCTSTR directory)
+{
+    _ASSERT(directory);
+
+    //
+    // Directories are told apart by their case-folded path without any
+    // trailing backslash, so C:\Tools and c:\tools\ share one index.
+    //
+
+    TCHAR key[MAX_PATH];
+    lstrcpyn(key, directory, DIM(key));
+    PathRemoveBackslash(key);
+
+    DirectoryIndex* index = NULL;
+
+    EnterCriticalSection(&m_lock);
+
+    try
+    {
+        const int existing = Find(key);
+
+        if (existing >= 0)
+        {
+            index = m_indexes[existing];
+        }
+        else
+        {
+            m_indexes.Reserve(m_indexes.GetCount() + 1);
+            m_keyHashes.Reserve(m_keyHashes.GetCount() + 1);
+
+            index = new DirectoryIndex(key, m_fileSystem);
+
+            if (!index)
+                throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+            CharUpperBuff(key, lstrlen(key));
+
+            if (IsBudgeted())
+                index->SetScanOnDemand();
+
+            m_indexes.Add(index);
+            m_keyHashes.Add(DirectoryIndex::Hash(key));
+        }
+    }
+    catch (...)
+    {
+        LeaveCriticalSection(&m_lock);
+        throw;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return index;
+}
+
+int DirectoryIndexTable::Find(LPCTSTR directory) const
+{
+    _ASSERT(directory);
+
+    TCHAR key[MAX_PATH];
+    lstrcpyn(key, directory, DIM(key));
+    PathRemoveBackslash(key);
+    CharUpperBuff(key, lstrlen(key));
+
+    const DWORD keyHash = DirectoryIndex::Hash(key);
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        if (keyHash == m_keyHashes[i] && 0 == lstrcmpi(key, m_indexes[i]->GetDirectory()))
+            return i;
+    }
+
+    return -1;
+}
+
+DWORD DirectoryIndexTable::Scan(int threadCount)
+{
+    //
+    // Listing a directory is mostly waiting on the file system, so it is
+    // worth overlapping even on a single processor.
+    //
+
+    return ParallelFor(m_indexes.GetCount(), threadCount, ScanIndex, this);
+}
+
+void CALLBACK DirectoryIndexTable::ScanIndex(int index, LPVOID context)
+{
+    DirectoryIndexTable* table = static_cast<DirectoryIndexTable*>(context);
+    table->m_indexes[index]->Scan();
+}
+
+void DirectoryIndexTable::SetFileSystem(const FileSystem& fileSystem)
+{
+    _ASSERT(!m_indexes.GetCount());
+
+    m_fileSystem = &fileSystem;
+}
+
+void DirectoryIndexTable::SetBudget(ULONGLONG budget, EvictionPolicy policy)
+{
+    _ASSERT(!m_indexes.GetCount());
+
+    m_budget = budget;
+    m_policy = policy;
+}
+
+void DirectoryIndexTable::Trim()
+{
+    if (!IsBudgeted())
+        return;
+
+    ULONGLONG heldSize = 0;
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+        heldSize += m_indexes[i]->GetHeldSize();
+
+    while (heldSize > m_budget)
+    {
+        const int victim = FindVictim();
+
+        if (victim < 0)
+            break;
+
+        const DWORD size = m_indexes[victim]->GetHeldSize();
+
+        if (m_indexes[victim]->Evict())
+        {
+            heldSize -= size;
+            m_evictionCount++;
+        }
+    }
+}
+
+int DirectoryIndexTable::FindVictim() const
+{
+    //
+    // Go by how long ago each index was last used. Weighing in the cost
+    // of getting an index back, one is kept as though it had been used
+    // later by as long as it took to scan, so that a slow network share
+    // outlasts a local directory that was used at much the same time.
+    //
+
+    const DWORD now = GetTickCount();
+    int victim = -1;
+    LONGLONG victimScore = 0;
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        const DirectoryIndex* index = m_indexes[i];
+
+        if (!index->GetHeldSize())
+            continue;
+
+        LONGLONG score = static_cast<DWORD>(now - index->GetLastUseTime());
+
+        if (CostAwareEviction == m_policy)
+            score -= index->GetScanTime();
+
+        if (victim < 0 || score > victimScore)
+        {
+            victim = i;
+            victimScore = score;
+        }
+    }
+
+    return victim;
+}
+
+void DirectoryIndexTable::GetStatistics(DirectoryCacheStatistics& statistics) const
+{
+    ZeroMemory(&statistics, sizeof(statistics));
+
+    statistics.budget = m_budget;
+    statistics.evictionCount = m_evictionCount;
+    statistics.indexCount = m_indexes.GetCount();
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        const DirectoryIndex* index = m_indexes[i];
+        const DWORD heldSize = index->GetHeldSize();
+
+        statistics.hitCount += index->GetHitCount();
+        statistics.missCount += index->GetMissCount();
+        statistics.heldSize += heldSize;
+
+        if (heldSize)
+            statistics.heldCount++;
+    }
+}
+
+DWORD DirectoryIndexTable::Load(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+
+    if (m_view)
+        return NO_ERROR;
+
+    //
+    // Allow the file to be deleted while it is mapped. Replacing it takes
+    // more than that: Save has to let go of the view first.
+    //
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD fileSizeHigh = 0;
+    const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+    if (fileSizeHigh || fileSize < sizeof(FileHeader))
+    {
+        CloseHandle(file);
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD error = m_mapping ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    const BYTE* view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (!view)
+    {
+        error = GetLastError();
+        Unload();
+        return error;
+    }
+
+    error = AttachView(view, fileSize);
+
+    if (NO_ERROR != error)
+    {
+        UnmapViewOfFile(view);
+        Unload();
+    }
+
+    return error;
+}
+
+DWORD DirectoryIndexTable::AttachView(const BYTE* view, DWORD viewSize)
+{
+    _ASSERT(view);
+
+    const FileHeader* header = reinterpret_cast<const FileHeader*>(view);
+
+    if (viewSize < sizeof(FileHeader) ||
+        FileSignature != header->signature || FileVersion != header->version ||
+        sizeof(TCHAR) != header->characterSize ||
+        header->directoryCount > (viewSize - sizeof(FileHeader)) / sizeof(FileEntry))
+    {
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_view = view;
+    m_viewSize = viewSize;
+
+    //
+    // Attach every registered directory that is in the view and has not
+    // changed since. The rest are left for Scan.
+    //
+
+    const FileEntry* entries = reinterpret_cast<const FileEntry*>(header + 1);
+
+    for (DWORD i = 0; i < header->directoryCount; i++)
+    {
+        const FileEntry& entry = entries[i];
+        LPCTSTR directory = GetFileDirectory(entry);
+
+        if (!directory)
+            continue;
+
+        const int index = Find(directory);
+
+        if (index >= 0)
+            m_indexes[index]->Attach(m_view + entry.imageOffset, entry.imageSize);
+    }
+
+    return NO_ERROR;
+}
+
+LPCTSTR DirectoryIndexTable::GetFileDirectory(const FileEntry& entry) const
+{
+    _ASSERT(m_view);
+
+    //
+    // Check that the entry lies within the file and that its directory
+    // path is terminated, since the file may have been damaged.
+    //
+
+    if (entry.directoryOffset >= m_viewSize || entry.imageOffset > m_viewSize ||
+        entry.imageSize > m_viewSize - entry.imageOffset ||
+        0 != (entry.directoryOffset % sizeof(TCHAR)) || 0 != (entry.imageOffset & 7))
+    {
+        return NULL;
+    }
+
+    LPCTSTR directory = reinterpret_cast<LPCTSTR>(m_view + entry.directoryOffset);
+    const DWORD maxLength = (m_viewSize - entry.directoryOffset) / sizeof(TCHAR);
+
+    for (DWORD length = 0; length < maxLength && length < MAX_PATH; length++)
+    {
+        if (!directory[length])
+            return directory;
+    }
+
+    return NULL;
+}
+
+void DirectoryIndexTable::Rebase(const Array<BYTE>& file)
+{
+    _ASSERT(m_mapping);
+    _ASSERT(!m_file.GetCount());
+
+    m_file.Append(file.GetData(), file.GetCount());
+
+    const FileHeader* header = reinterpret_cast<const FileHeader*>(m_file.GetData());
+    const FileEntry* entries = reinterpret_cast<const FileEntry*>(header + 1);
+
+    for (DWORD i = 0; i < header->directoryCount; i++)
+    {
+        const FileEntry& entry = entries[i];
+        LPCTSTR directory = reinterpret_cast<LPCTSTR>(m_file.GetData() + entry.directoryOffset);
+        const int index = Find(directory);
+
+        if (index < 0)
+            continue;
+
+        DirectoryIndex& directoryIndex = *m_indexes[index];
+        const BYTE* image = static_cast<const BYTE*>(directoryIndex.GetImage());
+
+        if (directoryIndex.IsScanned() && image >= m_view && image < m_view + m_viewSize)
+            directoryIndex.Rebase(m_file.GetData() + entry.imageOffset);
+    }
+
+    //
+    // The copy then stands in for the view, directories carried over
+    // without being registered included.
+    //
+
+    Unload();
+
+    m_view = m_file.GetData();
+    m_viewSize = m_file.GetCount();
+}
+
+void DirectoryIndexTable::Unload()
+{
+    //
+    // A view into a shared segment belongs to the segment and goes with
+    // it, and one into a saved copy goes with the table.
+    //
+
+    if (m_mapping)
+    {
+        if (m_view)
+            UnmapViewOfFile(m_view);
+
+        CloseHandle(m_mapping);
+    }
+
+    m_view = NULL;
+    m_viewSize = 0;
+    m_mapping = NULL;
+}
+
+void DirectoryIndexTable::Serialize(Array<BYTE>& file) const
+{
+    //
+    // Lay out the whole file in memory: the header, a table of entries
+    // and then the directory path and image of every scanned index.
+    // Directories that came with a loaded view but that nobody
+    // registered this time are carried over as they were.
+    //
+
+    file.Clear();
+
+    Array<LPCTSTR> directories;
+    Array<const void*> images;
+    Array<DWORD> imageSizes;
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        const DirectoryIndex& index = *m_indexes[i];
+
+        if (index.IsScanned())
+        {
+            directories.Add(index.GetDirectory());
+            images.Add(index.GetImage());
+            imageSizes.Add(index.GetImageSize());
+        }
+    }
+
+    if (m_view)
+    {
+        const FileHeader* header = reinterpret_cast<const FileHeader*>(m_view);
+        const FileEntry* entries = reinterpret_cast<const FileEntry*>(header + 1);
+
+        for (DWORD i = 0; i < header->directoryCount; i++)
+        {
+            const FileEntry& entry = entries[i];
+            LPCTSTR directory = GetFileDirectory(entry);
+
+            if (!directory || Find(directory) >= 0)
+                continue;
+
+            directories.Add(directory);
+            images.Add(m_view + entry.imageOffset);
+            imageSizes.Add(entry.imageSize);
+        }
+    }
+
+    const DWORD count = directories.GetCount();
+    DWORD size = Align(sizeof(FileHeader) + count * sizeof(FileEntry));
+
+    file.SetCount(size);
+    ZeroMemory(file.GetData(), size);
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        const DWORD directorySize = Align((lstrlen(directories[i]) + 1) * sizeof(TCHAR));
+        const DWORD imageSize = Align(imageSizes[i]);
+
+        file.SetCount(size + directorySize + imageSize);
+        ZeroMemory(file.GetData() + size, directorySize + imageSize);
+
+        FileEntry& entry = reinterpret_cast<FileEntry*>(
+            file.GetData() + sizeof(FileHeader))[i];
+
+        entry.directoryOffset = size;
+        entry.imageOffset = size + directorySize;
+        entry.imageSize = imageSizes[i];
+
+        CopyMemory(file.GetData() + entry.directoryOffset, directories[i],
+            lstrlen(directories[i]) * sizeof(TCHAR));
+
+        CopyMemory(file.GetData() + entry.imageOffset, images[i], imageSizes[i]);
+
+        size += directorySize + imageSize;
+    }
+
+    FileHeader& header = *reinterpret_cast<FileHeader*>(file.GetData());
+    header.signature = FileSignature;
+    header.version = FileVersion;
+    header.characterSize = sizeof(TCHAR);
+    header.directoryCount = count;
+}
+
+DWORD DirectoryIndexTable::Save(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+
+    Array<BYTE> file;
+
+    try
+    {
+        Serialize(file);
+
+        //
+        // Windows will not replace a file while a view of it is mapped,
+        // so move every index off a loaded file and onto a copy of what
+        // is about to be written over it before letting go of the file.
+        //
+
+        if (m_mapping)
+            Rebase(file);
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    //
+    // Write to a temporary file and then move it over the old one so
+    // that no reader ever sees a file that is only partly written.
+    //
+
+    TCHAR temporaryPath[MAX_PATH];
+
+    if (lstrlen(filePath) + 4 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(temporaryPath, filePath);
+    lstrcat(temporaryPath, _T(".tmp"));
+
+    HANDLE output = CreateFile(temporaryPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == output)
+        return GetLastError();
+
+    DWORD written = 0;
+    DWORD error = WriteFile(output, file.GetData(), file.GetCount(), &written, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(output);
+
+    if (NO_ERROR == error && !MoveFileEx(temporaryPath, filePath, MOVEFILE_REPLACE_EXISTING))
+        error = GetLastError();
+
+    if (NO_ERROR != error)
+        DeleteFile(temporaryPath);
+
+    return error;
+}
+
+DWORD DirectoryIndexTable::Refresh(LPCTSTR filePath, int threadCount)
+{
+    _ASSERT(filePath);
+
+    //
+    // A file that cannot be loaded, for whatever reason, is no different
+    // from one with nothing in it: everything gets scanned afresh and
+    // the file written over.
+    //
+
+    Load(filePath);
+
+    const bool isChanged = IsPending();
+
+    DWORD error = Scan(threadCount);
+
+    if (NO_ERROR != error || !isChanged)
+        return error;
+
+    return Save(filePath);
+}
+
+DWORD DirectoryIndexTable::Share(LPCTSTR segmentName, int threadCount)
+{
+    _ASSERT(segmentName);
+
+    if (m_view)
+        return ERROR_ALREADY_INITIALIZED;
+
+    DWORD error = m_segment.Open(segmentName);
+
+    if (NO_ERROR != error)
+        return error;
+
+    //
+    // Attach to whatever was published last. Should every directory be
+    // in there and unchanged, that is all there is to it.
+    //
+
+    const BYTE* image;
+    DWORD imageSize;
+
+    if (m_segment.Read(image, imageSize))
+        AttachView(image, imageSize);
+
+    if (!IsPending())
+        return NO_ERROR;
+
+    //
+    // Otherwise become the writer, which may mean waiting for another
+    // process to finish publishing, in which case what it published may
+    // well have what this one was missing.
+    //
+
+    error = m_segment.Lock();
+
+    if (NO_ERROR != error)
+        return error;
+
+    try
+    {
+        if (m_segment.Read(image, imageSize) && image != m_view)
+            AttachView(image, imageSize);
+
+        //
+        // Only publish when something new was scanned. A directory that
+        // cannot be listed stays pending however often it is tried.
+        //
+
+        if (IsPending())
+        {
+            const int scannedCount = GetScannedCount();
+
+            error = Scan(threadCount);
+
+            if (NO_ERROR == error && GetScannedCount() > scannedCount)
+            {
+                Array<BYTE> file;
+                Serialize(file);
+
+                error = m_segment.Publish(file.GetData(), file.GetCount());
+            }
+        }
+    }
+    catch (SystemException& e)
+    {
+        error = e.GetCode();
+    }
+
+    m_segment.Unlock();
+
+    return error;
+}
+
+int DirectoryIndexTable::GetScannedCount() const
+{
+    int count = 0;
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        if (m_indexes[i]->IsScanned())
+            count++;
+    }
+
+    return count;
+}
+
+bool DirectoryIndexTable::IsPending() const
+{
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        if (m_indexes[i]->IsPending())
+            return true;
+    }
+
+    return false;
+}
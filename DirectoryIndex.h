@@ -0,0 +1,319 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  DirectoryIndexHeader
+// --------------------------------------------------------------------------
+//
+//  An index is kept as a single flat image, the same in memory as on
+//  disk, so that it can be used straight out of a mapped file. The header
+//  is followed by, in order:
+//
+//  - the hash of every name, in name order (nameCount DWORDs);
+//  - the offset into the arena of every block of names (blockCount DWORDs);
+//  - the hash table, holding name indexes plus one (slotCount DWORDs);
+//  - the arena of front-coded names (arenaLength characters).
+//
+//  Names are sorted and stored in blocks of BlockSize. The first name of
+//  a block is stored whole and every other one as the number of leading
+//  characters it shares with the name before it, followed by the number
+//  of characters that follow and then those characters.
+//
+
+struct DirectoryIndexHeader
+{
+    DWORD signature;
+    WORD version;
+    WORD characterSize;
+    DWORD nameCount;
+    DWORD blockCount;
+    DWORD slotCount;
+    DWORD arenaLength;
+    FILETIME lastWriteTime;
+};
+
+// --------------------------------------------------------------------------
+//  DirectoryIndex
+// --------------------------------------------------------------------------
+//
+//  The case-folded names in one directory, listed once and kept in a hash
+//  table so that asking whether a name exists there costs a lookup in
+//  memory rather than a trip to the file system. Short 8.3 names are
+//  indexed alongside long ones since either will open the file.
+//
+//  An index is scanned at most once. Until the scan has finished, or if
+//  the directory could not be listed, IsScanned returns false and callers
+//  are expected to go to the file system instead. A directory that does
+//  not exist scans as an empty index. The directory is listed through
+//  the file system it was created with, which is that of Windows unless
+//  another is given, and which has to outlive the index.
+//
+//  Instead of being scanned, an index can be attached to an image saved
+//  by an earlier scan, provided the directory has not been written to
+//  since then. The image has to stay put for as long as the index lives.
+//  An image captured elsewhere, such as on another host, is adopted as
+//  it is instead, without the directory being looked at at all. Rebase
+//  moves an index from its image to an identical copy elsewhere, so that
+//  whatever held the first can let go of it.
+//
+//  An index that is scanned on demand is left for its user to scan the
+//  first time it is needed, and can be evicted again to free its memory,
+//  after which it is pending once more. Such an index keeps track of how
+//  often it was used, when it was last used and how long it took to scan
+//  so that a table can tell which ones are worth keeping.
+//
+
+class DirectoryIndex
+{
+public:
+
+    enum
+    {
+        Signature = 0x49445046, // FPDI
+        Version = 1,
+        BlockSize = 16
+    };
+
+    DirectoryIndex(LPCTSTR directory, const FileSystem* fileSystem = NULL);
+
+    LPCTSTR GetDirectory() const { return m_directory; }
+
+    bool Scan();
+    bool Attach(const void* image, DWORD imageSize);
+    bool Adopt(const void* image, DWORD imageSize);
+    void Rebase(const void* image);
+    bool Evict();
+    bool IsScanned() const { return Scanned == m_state; }
+    bool IsPending() const { return Unscanned == m_state; }
+
+    void SetScanOnDemand() { m_isScanOnDemand = true; }
+    bool IsScanOnDemand() const { return m_isScanOnDemand; }
+
+    void RecordHit() const { m_lastUseTime = GetTickCount(); InterlockedIncrement(&m_hitCount); }
+    void RecordMiss() const { InterlockedIncrement(&m_missCount); }
+
+    LONG GetHitCount() const { return m_hitCount; }
+    LONG GetMissCount() const { return m_missCount; }
+    DWORD GetLastUseTime() const { return m_lastUseTime; }
+    DWORD GetScanTime() const { return m_scanTime; }
+
+    //
+    // The memory the index holds of its own, which is nothing for one
+    // attached to an image that belongs to someone else.
+    //
+
+    DWORD GetHeldSize() const { return IsScanned() ? m_storage.GetCount() : 0; }
+
+    const void* GetImage() const { return m_header; }
+    DWORD GetImageSize() const { return m_imageSize; }
+
+    const FILETIME& GetLastWriteTime() const { return m_header->lastWriteTime; }
+
+    int GetNameCount() const { return m_header ? m_header->nameCount : 0; }
+    LPCTSTR GetName(int nameIndex, LPTSTR buffer) const;
+    DWORD GetNameHash(int nameIndex) const { return m_hashes[nameIndex]; }
+
+    int Find(LPCTSTR foldedName, DWORD hash) const;
+    bool Contains(LPCTSTR foldedName, DWORD hash) const { return Find(foldedName, hash) >= 0; }
+
+    static DWORD Hash(LPCTSTR foldedName);
+    static bool IsIndexable(LPCTSTR name);
+    static bool QueryLastWriteTime(LPCTSTR directory, FILETIME& lastWriteTime,
+        const FileSystem* fileSystem = NULL);
+
+private:
+
+    enum State { Unscanned, Scanning, Scanned, Unlistable };
+
+    //
+    // The longest name whose length fits in the single character that
+    // the arena keeps it in.
+    //
+
+    enum { MaxNameLength = (1 << (8 * sizeof(TCHAR))) - 1 };
+
+    bool List(Array<TCHAR>& names, Array<int>& nameOffsets, FILETIME& lastWriteTime);
+    void Build(const Array<TCHAR>& names, const Array<int>& nameOffsets, const FILETIME& lastWriteTime);
+    void SetImage(const void* image, DWORD imageSize);
+
+    static bool IsValidImage(const void* image, DWORD imageSize);
+    static int __cdecl CompareNames(const void* a, const void* b);
+    static void CALLBACK AddName(const WIN32_FIND_DATA& findData, LPVOID context);
+
+    TCHAR m_directory[MAX_PATH];
+    const FileSystem* m_fileSystem;
+    LONG volatile m_state;
+    bool m_isScanOnDemand;
+    mutable LONG volatile m_hitCount;
+    mutable LONG volatile m_missCount;
+    mutable DWORD volatile m_lastUseTime;
+    DWORD m_scanTime;
+    Array<BYTE> m_storage;
+    DWORD m_imageSize;
+    const DirectoryIndexHeader* m_header;
+    const DWORD* m_hashes;
+    const DWORD* m_blockOffsets;
+    const DWORD* m_slots;
+    const TCHAR* m_arena;
+
+    DirectoryIndex(const DirectoryIndex&);
+    DirectoryIndex& operator=(const DirectoryIndex&);
+};
+
+// --------------------------------------------------------------------------
+//  DirectoryCacheStatistics
+// --------------------------------------------------------------------------
+//
+//  How a table kept within a memory budget has fared. A hit is a lookup
+//  in a directory that its index could answer and a miss is one where the
+//  index had to be scanned first or was still being scanned.
+//
+
+struct DirectoryCacheStatistics
+{
+    ULONGLONG hitCount;
+    ULONGLONG missCount;
+    ULONGLONG heldSize;
+    ULONGLONG budget;
+    DWORD evictionCount;
+    int heldCount;
+    int indexCount;
+};
+
+enum EvictionPolicy
+{
+    LeastRecentlyUsedEviction,
+    CostAwareEviction
+};
+
+// --------------------------------------------------------------------------
+//  DirectoryIndexTable
+// --------------------------------------------------------------------------
+//
+//  Hands out one index per distinct directory so that any number of
+//  resolvers whose search orders overlap end up sharing the indexes of
+//  the directories they have in common. Directories are registered as
+//  resolvers are initialized and then scanned together, in parallel.
+//
+//  The indexes can be saved to a file and loaded back from it on a later
+//  run, in which case only the directories that changed in between, or
+//  that are not in the file, need to be scanned again. Refresh does all
+//  of that in one go. A loaded file stays mapped until the table goes or
+//  saves over it, since Windows will not replace a file that is mapped.
+//  Saving moves the indexes off the file and onto the copy in memory
+//  that was written out in its place.
+//
+//  Instead of a file, the indexes can be shared through a segment of
+//  memory with every other process in the session that shares them under
+//  the same name. Share attaches to what was last published there without
+//  taking any lock, and only when some directory is missing or changed
+//  does it become the one process that scans and publishes again.
+//
+//  The table can be held to a memory budget, set before any directory is
+//  registered. Its indexes are then scanned on demand and Trim evicts
+//  whole indexes until those held fit the budget again: either those
+//  used least recently or, weighing that against what it would cost to
+//  get them back, those that were quickest to scan. Images from a file
+//  or shared segment belong to the system rather than the table and do
+//  not count. Trim must not be called while any resolver is resolving.
+//
+//  The indexes list their directories through the file system of the
+//  table, which is that of Windows unless another one is set before any
+//  directory is registered, and which has to outlive the table.
+//
+//  The table owns the indexes and so has to outlive every resolver that
+//  was initialized with it.
+//
+
+class DirectoryIndexTable
+{
+public:
+
+    enum
+    {
+        FileSignature = 0x58495046, // FPIX
+        FileVersion = 1
+    };
+
+    DirectoryIndexTable();
+    ~DirectoryIndexTable();
+
+    DirectoryIndex* Register(LPCTSTR directory);
+    DWORD Scan(int threadCount);
+
+    void SetFileSystem(const FileSystem& fileSystem);
+    void SetBudget(ULONGLONG budget, EvictionPolicy policy);
+    bool IsBudgeted() const { return 0 != m_budget; }
+    void Trim();
+    void GetStatistics(DirectoryCacheStatistics& statistics) const;
+
+    DWORD Load(LPCTSTR filePath);
+    DWORD Save(LPCTSTR filePath);
+    DWORD Refresh(LPCTSTR filePath, int threadCount);
+    DWORD Share(LPCTSTR segmentName, int threadCount);
+
+    int GetCount() const { return m_indexes.GetCount(); }
+    const DirectoryIndex& GetIndex(int index) const { return *m_indexes[index]; }
+
+private:
+
+    struct FileHeader
+    {
+        DWORD signature;
+        WORD version;
+        WORD characterSize;
+        DWORD directoryCount;
+        DWORD reserved;
+    };
+
+    struct FileEntry
+    {
+        DWORD directoryOffset;
+        DWORD imageOffset;
+        DWORD imageSize;
+        DWORD reserved;
+    };
+
+    int Find(LPCTSTR directory) const;
+    int FindVictim() const;
+    bool IsPending() const;
+    int GetScannedCount() const;
+    DWORD AttachView(const BYTE* view, DWORD viewSize);
+    void Serialize(Array<BYTE>& file) const;
+    void Rebase(const Array<BYTE>& file);
+    LPCTSTR GetFileDirectory(const FileEntry& entry) const;
+    void Unload();
+
+    static void CALLBACK ScanIndex(int index, LPVOID context);
+
+    CRITICAL_SECTION m_lock;
+    const FileSystem* m_fileSystem;
+    Array<DirectoryIndex*> m_indexes;
+    Array<DWORD> m_keyHashes;
+    HANDLE m_mapping;
+    const BYTE* m_view;
+    DWORD m_viewSize;
+    Array<BYTE> m_file;
+    SharedIndexSegment m_segment;
+    ULONGLONG m_budget;
+    EvictionPolicy m_policy;
+    DWORD m_evictionCount;
+
+    DirectoryIndexTable(const DirectoryIndexTable&);
+    DirectoryIndexTable& operator=(const DirectoryIndexTable&);
+};
@@ -0,0 +1,834 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "ImageFile.h"
+#include "ExportIndex.h"
+
+//
+// Rounds a size up to a multiple of eight so that whatever follows it in
+// the image is suitably aligned.
+//
+
+static DWORD Align(DWORD size)
+{
+    return (size + 7) & ~7UL;
+}
+
+// --------------------------------------------------------------------------
+//  ExportIndex::Builder
+// --------------------------------------------------------------------------
+//
+//  Puts an index together one image at a time, in order of precedence,
+//  and then lays it out as an image.
+//
+
+class ExportIndex::Builder
+{
+public:
+
+    Builder() {}
+
+    void AddImage(LPCTSTR path, const Candidate& candidate, bool isRead)
+    {
+        _ASSERT(path);
+
+        FileImage image = { AddText(path), candidate.sizeLow, candidate.sizeHigh };
+
+        //
+        // An image that could not be read is given no time at all so
+        // that it never looks unchanged and is tried again next time.
+        //
+
+        if (isRead)
+            image.lastWriteTime = candidate.lastWriteTime;
+
+        image.firstExport = m_exports.GetCount();
+        m_images.Add(image);
+    }
+
+    void AddExport(LPCTSTR name, DWORD ordinal, LPCTSTR forwarder)
+    {
+        _ASSERT(name);
+        _ASSERT(m_images.GetCount());
+
+        const DWORD hash = DirectoryIndex::Hash(name);
+        int symbolIndex = m_symbolNames.Find(name, hash);
+
+        if (symbolIndex < 0)
+        {
+            symbolIndex = m_symbolNames.Add(name, hash);
+
+            FileSymbol symbol = { AddText(name), hash };
+            m_symbols.Add(symbol);
+        }
+
+        m_symbols[symbolIndex].entryCount++;
+
+        FileExport entry =
+        {
+            m_images.GetCount() - 1,
+            m_symbols[symbolIndex].nameOffset,
+            ordinal,
+            forwarder ? AddText(forwarder) : NoForwarder
+        };
+
+        m_exports.Add(entry);
+        m_exportSymbols.Add(symbolIndex);
+        m_images[m_images.GetCount() - 1].exportCount++;
+    }
+
+    void Finish(Array<BYTE>& storage)
+    {
+        const DWORD imageCount = m_images.GetCount();
+        const DWORD exportCount = m_exports.GetCount();
+        const DWORD symbolCount = m_symbols.GetCount();
+
+        //
+        // Group the exports by symbol. Going through them in order keeps
+        // the exports of every symbol in order of precedence.
+        //
+
+        Array<DWORD> nextEntries;
+        nextEntries.SetCount(symbolCount);
+
+        DWORD entryCount = 0;
+
+        for (DWORD i = 0; i < symbolCount; i++)
+        {
+            m_symbols[i].firstEntry = entryCount;
+            nextEntries[i] = entryCount;
+            entryCount += m_symbols[i].entryCount;
+        }
+
+        Array<DWORD> entries;
+        entries.SetCount(exportCount);
+
+        for (DWORD i = 0; i < exportCount; i++)
+            entries[nextEntries[m_exportSymbols[i]]++] = i;
+
+        //
+        // The hash table is kept at most half full so that a lookup
+        // rarely goes past its first slot.
+        //
+
+        DWORD slotCount = 2;
+
+        while (slotCount < symbolCount * 2)
+            slotCount *= 2;
+
+        Array<DWORD> slots;
+        slots.SetCount(slotCount);
+        ZeroMemory(slots.GetData(), slotCount * sizeof(DWORD));
+
+        for (DWORD i = 0; i < symbolCount; i++)
+        {
+            DWORD slot = m_symbols[i].hash & (slotCount - 1);
+
+            while (slots[slot])
+                slot = (slot + 1) & (slotCount - 1);
+
+            slots[slot] = i + 1;
+        }
+
+        FileHeader header = { FileSignature, FileVersion, sizeof(TCHAR),
+            imageCount, exportCount, symbolCount, slotCount };
+
+        header.imagesOffset = Align(sizeof(FileHeader));
+        header.exportsOffset = header.imagesOffset + Align(imageCount * sizeof(FileImage));
+        header.symbolsOffset = header.exportsOffset + Align(exportCount * sizeof(FileExport));
+        header.slotsOffset = header.symbolsOffset + Align(symbolCount * sizeof(FileSymbol));
+        header.entriesOffset = header.slotsOffset + Align(slotCount * sizeof(DWORD));
+        header.textOffset = header.entriesOffset + Align(exportCount * sizeof(DWORD));
+        header.textLength = m_text.GetCount();
+        header.size = header.textOffset + Align(header.textLength * sizeof(TCHAR));
+
+        storage.SetCount(header.size);
+
+        BYTE* image = storage.GetData();
+        ZeroMemory(image, header.size);
+
+        CopyMemory(image, &header, sizeof(header));
+        CopyMemory(image + header.imagesOffset, m_images.GetData(), imageCount * sizeof(FileImage));
+        CopyMemory(image + header.exportsOffset, m_exports.GetData(), exportCount * sizeof(FileExport));
+        CopyMemory(image + header.symbolsOffset, m_symbols.GetData(), symbolCount * sizeof(FileSymbol));
+        CopyMemory(image + header.slotsOffset, slots.GetData(), slotCount * sizeof(DWORD));
+        CopyMemory(image + header.entriesOffset, entries.GetData(), exportCount * sizeof(DWORD));
+        CopyMemory(image + header.textOffset, m_text.GetData(), header.textLength * sizeof(TCHAR));
+    }
+
+private:
+
+    DWORD AddText(LPCTSTR text)
+    {
+        const DWORD offset = m_text.GetCount();
+        m_text.Append(text, lstrlen(text) + 1);
+
+        return offset;
+    }
+
+    Array<TCHAR> m_text;
+    Array<FileImage> m_images;
+    Array<FileExport> m_exports;
+    Array<DWORD> m_exportSymbols;
+    Array<FileSymbol> m_symbols;
+    NameTable m_symbolNames;
+
+    Builder(const Builder&);
+    Builder& operator=(const Builder&);
+};
+
+// --------------------------------------------------------------------------
+//  ExportIndex
+// --------------------------------------------------------------------------
+
+ExportIndex::ExportIndex() :
+    m_mapping(NULL),
+    m_view(NULL),
+    m_header(NULL),
+    m_images(NULL),
+    m_exports(NULL),
+    m_symbols(NULL),
+    m_slots(NULL),
+    m_entries(NULL),
+    m_text(NULL),
+    m_parsedCount(0)
+{
+}
+
+ExportIndex::~ExportIndex()
+{
+    Unload();
+}
+
+DWORD ExportIndex::Refresh(LPCTSTR filePath, const SearchOrder& searchOrder, int threadCount)
+{
+    bool isChanged = true;
+
+    {
+        //
+        // A file that cannot be loaded, for whatever reason, is no
+        // different from one with nothing in it: every image is parsed
+        // afresh and the file written over.
+        //
+
+        ExportIndex previous;
+
+        if (filePath)
+            previous.Load(filePath);
+
+        Unload();
+
+        try
+        {
+            isChanged = Build(searchOrder, previous, threadCount);
+        }
+        catch (SystemException& e)
+        {
+            Unload();
+            return e.GetCode();
+        }
+    }
+
+    if (!filePath || !isChanged)
+        return NO_ERROR;
+
+    return Save(filePath);
+}
+
+bool ExportIndex::Build(const SearchOrder& searchOrder, const ExportIndex& previous, int threadCount)
+{
+    Array<TCHAR> paths;
+    Array<Candidate> candidates;
+
+    List(searchOrder, paths, candidates);
+
+    //
+    // Match every image to the same one in the previous index, by path,
+    // and keep its exports if its size and last write time are the same.
+    //
+
+    NameTable previousPaths;
+    Array<int> previousImages;
+
+    for (int i = 0; i < previous.GetImageCount(); i++)
+    {
+        TCHAR path[MAX_PATH];
+        lstrcpyn(path, previous.GetText(previous.m_images[i].pathOffset), DIM(path));
+        CharUpperBuff(path, lstrlen(path));
+
+        if (previousPaths.Add(path, DirectoryIndex::Hash(path)) == previousImages.GetCount())
+            previousImages.Add(i);
+    }
+
+    Array<int> parseList;
+
+    for (int i = 0; i < candidates.GetCount(); i++)
+    {
+        Candidate& candidate = candidates[i];
+
+        TCHAR path[MAX_PATH];
+        lstrcpyn(path, paths.GetData() + candidate.pathOffset, DIM(path));
+        CharUpperBuff(path, lstrlen(path));
+
+        const int pathIndex = previousPaths.Find(path, DirectoryIndex::Hash(path));
+
+        if (pathIndex >= 0)
+        {
+            const FileImage& image = previous.m_images[previousImages[pathIndex]];
+
+            if (image.sizeLow == candidate.sizeLow && image.sizeHigh == candidate.sizeHigh &&
+                (image.lastWriteTime.dwLowDateTime || image.lastWriteTime.dwHighDateTime) &&
+                0 == CompareFileTime(&image.lastWriteTime, &candidate.lastWriteTime))
+            {
+                candidate.previousImage = previousImages[pathIndex];
+                continue;
+            }
+        }
+
+        parseList.Add(i);
+    }
+
+    //
+    // Parse the export tables of all the rest in parallel, each into a
+    // result of its own.
+    //
+
+    Array<ParsedImage*> results;
+    results.SetCount(parseList.GetCount());
+    ZeroMemory(results.GetData(), results.GetCount() * sizeof(ParsedImage*));
+
+    try
+    {
+        for (int i = 0; i < results.GetCount(); i++)
+        {
+            results[i] = new ParsedImage;
+
+            if (!results[i])
+                throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+        }
+
+        ParseContext context = { paths.GetData(), candidates.GetData(),
+            parseList.GetData(), results.GetData() };
+
+        const DWORD error = ParallelFor(parseList.GetCount(), threadCount, ParseCandidate, &context);
+
+        if (NO_ERROR != error)
+            throw SystemException(error);
+
+        //
+        // Put the new index together in order of precedence, taking each
+        // image either from the previous index or from what was parsed.
+        //
+
+        Builder builder;
+        int parsedIndex = 0;
+
+        for (int i = 0; i < candidates.GetCount(); i++)
+        {
+            const Candidate& candidate = candidates[i];
+            LPCTSTR path = paths.GetData() + candidate.pathOffset;
+
+            if (candidate.previousImage >= 0)
+            {
+                const FileImage& image = previous.m_images[candidate.previousImage];
+
+                builder.AddImage(path, candidate, true);
+
+                for (DWORD j = 0; j < image.exportCount; j++)
+                {
+                    const FileExport& entry = previous.m_exports[image.firstExport + j];
+
+                    builder.AddExport(previous.GetText(entry.nameOffset), entry.ordinal,
+                        NoForwarder == entry.forwarderOffset ? NULL : previous.GetText(entry.forwarderOffset));
+                }
+            }
+            else
+            {
+                const ParsedImage& parsed = *results[parsedIndex++];
+                const TCHAR* text = parsed.text.GetData();
+
+                builder.AddImage(path, candidate, parsed.isRead);
+
+                for (int j = 0; j < parsed.exports.GetCount(); j++)
+                {
+                    const ParsedExport& entry = parsed.exports[j];
+
+                    builder.AddExport(text + entry.nameOffset, entry.ordinal,
+                        NoForwarder == entry.forwarderOffset ? NULL : text + entry.forwarderOffset);
+                }
+            }
+        }
+
+        builder.Finish(m_storage);
+    }
+    catch (...)
+    {
+        for (int i = 0; i < results.GetCount(); i++)
+            delete results[i];
+
+        throw;
+    }
+
+    for (int i = 0; i < results.GetCount(); i++)
+        delete results[i];
+
+    SetImage(m_storage.GetData());
+    m_parsedCount = parseList.GetCount();
+
+    return parseList.GetCount() || candidates.GetCount() != previous.GetImageCount();
+}
+
+void ExportIndex::List(const SearchOrder& searchOrder, Array<TCHAR>& paths, Array<Candidate>& candidates)
+{
+    for (int i = 0; i < searchOrder.GetCount(); i++)
+    {
+        LPCTSTR directory = searchOrder.GetDirectory(i);
+
+        TCHAR pattern[MAX_PATH];
+
+        if (!PathCombine(pattern, directory, _T("*")))
+            continue;
+
+        //
+        // Directories that cannot be listed have nothing to offer the
+        // loader either.
+        //
+
+        WIN32_FIND_DATA findData;
+        HANDLE find = FindFirstFile(pattern, &findData);
+
+        if (INVALID_HANDLE_VALUE == find)
+            continue;
+
+        try
+        {
+            do
+            {
+                TCHAR path[MAX_PATH];
+
+                if (0 != (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+                    !IsImageName(findData.cFileName) ||
+                    !PathCombine(path, directory, findData.cFileName))
+                {
+                    continue;
+                }
+
+                Candidate candidate =
+                {
+                    paths.GetCount(),
+                    findData.nFileSizeLow,
+                    findData.nFileSizeHigh,
+                    findData.ftLastWriteTime,
+                    -1
+                };
+
+                paths.Append(path, lstrlen(path) + 1);
+                candidates.Add(candidate);
+            }
+            while (FindNextFile(find, &findData));
+        }
+        catch (...)
+        {
+            FindClose(find);
+            throw;
+        }
+
+        FindClose(find);
+    }
+}
+
+bool ExportIndex::IsImageName(LPCTSTR name)
+{
+    _ASSERT(name);
+
+    static const LPCTSTR extensions[] =
+    {
+        _T(".DLL"), _T(".EXE"), _T(".OCX"), _T(".CPL"), _T(".DRV")
+    };
+
+    LPCTSTR extension = PathFindExtension(name);
+
+    for (int i = 0; i < DIM(extensions); i++)
+    {
+        if (0 == lstrcmpi(extension, extensions[i]))
+            return true;
+    }
+
+    return false;
+}
+
+void CALLBACK ExportIndex::ParseCandidate(int index, LPVOID context)
+{
+    const ParseContext& parse = *static_cast<const ParseContext*>(context);
+    const Candidate& candidate = parse.candidates[parse.parseList[index]];
+
+    ParsedImage& image = *parse.results[index];
+    image.isRead = Parse(parse.paths + candidate.pathOffset, image);
+}
+
+bool ExportIndex::Parse(LPCTSTR path, ParsedImage& image)
+{
+    _ASSERT(path);
+
+    ImageFile file;
+    const DWORD error = file.Open(path);
+
+    //
+    // A file that is not an image simply has no exports.
+    //
+
+    if (ERROR_BAD_FORMAT == error)
+        return true;
+
+    if (NO_ERROR != error)
+        return false;
+
+    try
+    {
+        ParseExports(file, image);
+    }
+    catch (SystemException& e)
+    {
+        //
+        // Neither has a damaged image. Only running out of memory is
+        // worth giving up over.
+        //
+
+        image.text.Clear();
+        image.exports.Clear();
+
+        if (ERROR_NOT_ENOUGH_MEMORY == e.GetCode())
+            throw;
+    }
+
+    return true;
+}
+
+void ExportIndex::ParseExports(const ImageFile& file, ParsedImage& image)
+{
+    IMAGE_DATA_DIRECTORY exportData;
+
+    if (!file.GetDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT, exportData))
+        return;
+
+    IMAGE_EXPORT_DIRECTORY directory;
+    file.Read(file.MapAddress(exportData.VirtualAddress), &directory, sizeof(directory));
+
+    if (!directory.NumberOfNames)
+        return;
+
+    if (directory.NumberOfNames > file.GetSize() / sizeof(DWORD) ||
+        directory.NumberOfFunctions > file.GetSize() / sizeof(DWORD))
+    {
+        throw SystemException(ERROR_BAD_FORMAT);
+    }
+
+    const DWORD namesOffset = file.MapAddress(directory.AddressOfNames);
+    const DWORD ordinalsOffset = file.MapAddress(directory.AddressOfNameOrdinals);
+    const DWORD functionsOffset = file.MapAddress(directory.AddressOfFunctions);
+
+    image.exports.Reserve(directory.NumberOfNames);
+
+    for (DWORD i = 0; i < directory.NumberOfNames; i++)
+    {
+        DWORD nameAddress;
+        file.Read(namesOffset + i * sizeof(DWORD), &nameAddress, sizeof(nameAddress));
+
+        WORD functionIndex;
+        file.Read(ordinalsOffset + i * sizeof(WORD), &functionIndex, sizeof(functionIndex));
+
+        if (functionIndex >= directory.NumberOfFunctions)
+            continue;
+
+        DWORD functionAddress;
+        file.Read(functionsOffset + functionIndex * sizeof(DWORD), &functionAddress, sizeof(functionAddress));
+
+        ParsedExport entry = { image.text.GetCount(), directory.Base + functionIndex, NoForwarder };
+
+        if (!file.ReadString(file.MapAddress(nameAddress), MaxSymbolLength, image.text))
+            continue;
+
+        //
+        // An export whose address lies within the export directory is
+        // not code but the name of the export it forwards to.
+        //
+
+        if (functionAddress >= exportData.VirtualAddress &&
+            functionAddress - exportData.VirtualAddress < exportData.Size)
+        {
+            const DWORD forwarderOffset = image.text.GetCount();
+
+            if (file.ReadString(file.MapAddress(functionAddress), MaxSymbolLength, image.text))
+                entry.forwarderOffset = forwarderOffset;
+        }
+
+        image.exports.Add(entry);
+    }
+}
+
+int ExportIndex::Find(LPCTSTR symbol, const DWORD*& exportIndexes) const
+{
+    _ASSERT(symbol);
+
+    exportIndexes = NULL;
+
+    if (!m_header)
+        return 0;
+
+    const DWORD hash = DirectoryIndex::Hash(symbol);
+    const DWORD mask = m_header->slotCount - 1;
+
+    for (DWORD slot = hash & mask; m_slots[slot]; slot = (slot + 1) & mask)
+    {
+        const FileSymbol& entry = m_symbols[m_slots[slot] - 1];
+
+        if (hash == entry.hash && 0 == _tcscmp(symbol, GetText(entry.nameOffset)))
+        {
+            exportIndexes = m_entries + entry.firstEntry;
+            return entry.entryCount;
+        }
+    }
+
+    return 0;
+}
+
+LPCTSTR ExportIndex::GetImagePath(DWORD exportIndex) const
+{
+    _ASSERT(m_header && exportIndex < m_header->exportCount);
+
+    return GetText(m_images[m_exports[exportIndex].imageIndex].pathOffset);
+}
+
+LPCTSTR ExportIndex::GetForwarder(DWORD exportIndex) const
+{
+    _ASSERT(m_header && exportIndex < m_header->exportCount);
+
+    const DWORD offset = m_exports[exportIndex].forwarderOffset;
+
+    return NoForwarder == offset ? NULL : GetText(offset);
+}
+
+DWORD ExportIndex::Load(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+
+    Unload();
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD fileSizeHigh = 0;
+    const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+    if (fileSizeHigh || fileSize < sizeof(FileHeader))
+    {
+        CloseHandle(file);
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD error = m_mapping ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    m_view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (!m_view)
+    {
+        error = GetLastError();
+        Unload();
+        return error;
+    }
+
+    SetImage(m_view);
+
+    if (!IsValid(fileSize))
+    {
+        Unload();
+        return ERROR_BAD_FORMAT;
+    }
+
+    return NO_ERROR;
+}
+
+bool ExportIndex::IsValid(DWORD fileSize) const
+{
+    _ASSERT(m_header);
+
+    //
+    // Check every offset once, up front, since the file may have been
+    // damaged, so that lookups need not check anything themselves.
+    //
+
+    const FileHeader& header = *m_header;
+
+    const ULONGLONG imagesEnd = header.imagesOffset +
+        static_cast<ULONGLONG>(header.imageCount) * sizeof(FileImage);
+    const ULONGLONG exportsEnd = header.exportsOffset +
+        static_cast<ULONGLONG>(header.exportCount) * sizeof(FileExport);
+    const ULONGLONG symbolsEnd = header.symbolsOffset +
+        static_cast<ULONGLONG>(header.symbolCount) * sizeof(FileSymbol);
+    const ULONGLONG slotsEnd = header.slotsOffset +
+        static_cast<ULONGLONG>(header.slotCount) * sizeof(DWORD);
+    const ULONGLONG entriesEnd = header.entriesOffset +
+        static_cast<ULONGLONG>(header.exportCount) * sizeof(DWORD);
+    const ULONGLONG textEnd = header.textOffset +
+        static_cast<ULONGLONG>(header.textLength) * sizeof(TCHAR);
+
+    if (FileSignature != header.signature || FileVersion != header.version ||
+        sizeof(TCHAR) != header.characterSize || header.size > fileSize ||
+        0 != ((header.imagesOffset | header.exportsOffset | header.symbolsOffset |
+            header.slotsOffset | header.entriesOffset | header.textOffset) & 7) ||
+        imagesEnd > header.size || exportsEnd > header.size || symbolsEnd > header.size ||
+        slotsEnd > header.size || entriesEnd > header.size || textEnd > header.size ||
+        header.slotCount < 2 || 0 != (header.slotCount & (header.slotCount - 1)) ||
+        header.symbolCount >= header.slotCount ||
+        (header.textLength && m_text[header.textLength - 1]))
+    {
+        return false;
+    }
+
+    for (DWORD i = 0; i < header.imageCount; i++)
+    {
+        const FileImage& image = m_images[i];
+
+        if (image.pathOffset >= header.textLength || image.firstExport > header.exportCount ||
+            image.exportCount > header.exportCount - image.firstExport)
+        {
+            return false;
+        }
+    }
+
+    for (DWORD i = 0; i < header.exportCount; i++)
+    {
+        const FileExport& entry = m_exports[i];
+
+        if (entry.imageIndex >= header.imageCount || entry.nameOffset >= header.textLength ||
+            (NoForwarder != entry.forwarderOffset && entry.forwarderOffset >= header.textLength) ||
+            m_entries[i] >= header.exportCount)
+        {
+            return false;
+        }
+    }
+
+    for (DWORD i = 0; i < header.symbolCount; i++)
+    {
+        const FileSymbol& symbol = m_symbols[i];
+
+        if (symbol.nameOffset >= header.textLength || symbol.firstEntry > header.exportCount ||
+            symbol.entryCount > header.exportCount - symbol.firstEntry)
+        {
+            return false;
+        }
+    }
+
+    for (DWORD i = 0; i < header.slotCount; i++)
+    {
+        if (m_slots[i] > header.symbolCount)
+            return false;
+    }
+
+    return true;
+}
+
+void ExportIndex::SetImage(const BYTE* image)
+{
+    _ASSERT(image);
+
+    m_header = reinterpret_cast<const FileHeader*>(image);
+    m_images = reinterpret_cast<const FileImage*>(image + m_header->imagesOffset);
+    m_exports = reinterpret_cast<const FileExport*>(image + m_header->exportsOffset);
+    m_symbols = reinterpret_cast<const FileSymbol*>(image + m_header->symbolsOffset);
+    m_slots = reinterpret_cast<const DWORD*>(image + m_header->slotsOffset);
+    m_entries = reinterpret_cast<const DWORD*>(image + m_header->entriesOffset);
+    m_text = reinterpret_cast<const TCHAR*>(image + m_header->textOffset);
+}
+
+void ExportIndex::Unload()
+{
+    if (m_view)
+        UnmapViewOfFile(m_view);
+
+    if (m_mapping)
+        CloseHandle(m_mapping);
+
+    m_storage.Free();
+
+    m_mapping = NULL;
+    m_view = NULL;
+    m_header = NULL;
+    m_images = NULL;
+    m_exports = NULL;
+    m_symbols = NULL;
+    m_slots = NULL;
+    m_entries = NULL;
+    m_text = NULL;
+}
+
+DWORD ExportIndex::Save(LPCTSTR filePath) const
+{
+    _ASSERT(filePath);
+    _ASSERT(IsReady());
+
+    //
+    // Write to a temporary file and then move it over the old one so
+    // that no reader ever maps a file that is only partly written.
+    //
+
+    TCHAR temporaryPath[MAX_PATH];
+
+    if (lstrlen(filePath) + 4 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(temporaryPath, filePath);
+    lstrcat(temporaryPath, _T(".tmp"));
+
+    HANDLE output = CreateFile(temporaryPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == output)
+        return GetLastError();
+
+    DWORD written = 0;
+    DWORD error = WriteFile(output, m_header, m_header->size, &written, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(output);
+
+    if (NO_ERROR == error && !MoveFileEx(temporaryPath, filePath, MOVEFILE_REPLACE_EXISTING))
+        error = GetLastError();
+
+    if (NO_ERROR != error)
+        DeleteFile(temporaryPath);
+
+    return error;
+}
@@ -0,0 +1,204 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ExportIndex
+// --------------------------------------------------------------------------
+//
+//  Every function exported by name from the images in a search order,
+//  mapped to the images that export it, in order of precedence. It is
+//  what tells which DLLs on the path could have satisfied an import
+//  that the loader reported as an entry point not found.
+//
+//  Each export records the image, the ordinal and, for an export that the
+//  image forwards to another DLL, the forwarder string, such as
+//  "NTDLL.RtlAllocateHeap". Names are matched exactly, as GetProcAddress
+//  matches them.
+//
+//  The index is kept as a single flat image, the same in memory as in
+//  the file it is saved to. Refresh loads the file, if any, lists the
+//  images in the search order and parses the export tables of only those
+//  that are new or whose size or last write time has changed since, in
+//  parallel, carrying the exports of all the others over as they were.
+//  The file is then written anew if anything changed.
+//
+//  Images are the files in the search order directories whose extension
+//  is that of a DLL, control or driver, or of a program, which can also
+//  export functions. A file that turns out not to be an image, or has no
+//  export table, is kept as an image with no exports so that it is not
+//  read again until it changes.
+//
+
+class ExportIndex
+{
+public:
+
+    enum
+    {
+        FileSignature = 0x58455046, // FPEX
+        FileVersion = 1,
+        MaxSymbolLength = 1024,
+        NoForwarder = 0xFFFFFFFF
+    };
+
+    ExportIndex();
+    ~ExportIndex();
+
+    DWORD Refresh(LPCTSTR filePath, const SearchOrder& searchOrder, int threadCount);
+    DWORD Load(LPCTSTR filePath);
+    DWORD Save(LPCTSTR filePath) const;
+
+    bool IsReady() const { return NULL != m_header; }
+    int GetImageCount() const { return m_header ? m_header->imageCount : 0; }
+    int GetSymbolCount() const { return m_header ? m_header->symbolCount : 0; }
+
+    //
+    // How many images the last Refresh had to parse rather than carry
+    // over from the file.
+    //
+
+    int GetParsedCount() const { return m_parsedCount; }
+
+    int Find(LPCTSTR symbol, const DWORD*& exportIndexes) const;
+
+    LPCTSTR GetImagePath(DWORD exportIndex) const;
+    DWORD GetOrdinal(DWORD exportIndex) const { return m_exports[exportIndex].ordinal; }
+    LPCTSTR GetForwarder(DWORD exportIndex) const;
+
+private:
+
+    //
+    // The header is followed, each part at the offset the header gives
+    // for it, by a record per image, in order of precedence, a record
+    // per export, grouped by image, a record per distinct symbol, the
+    // hash table of symbols, holding symbol indexes plus one, the export
+    // indexes of every symbol, in order of precedence, and the text that
+    // all paths, names and forwarders are offsets into.
+    //
+
+    struct FileHeader
+    {
+        DWORD signature;
+        WORD version;
+        WORD characterSize;
+        DWORD imageCount;
+        DWORD exportCount;
+        DWORD symbolCount;
+        DWORD slotCount;
+        DWORD imagesOffset;
+        DWORD exportsOffset;
+        DWORD symbolsOffset;
+        DWORD slotsOffset;
+        DWORD entriesOffset;
+        DWORD textOffset;
+        DWORD textLength;
+        DWORD size;
+    };
+
+    struct FileImage
+    {
+        DWORD pathOffset;
+        DWORD sizeLow;
+        DWORD sizeHigh;
+        FILETIME lastWriteTime;
+        DWORD firstExport;
+        DWORD exportCount;
+    };
+
+    struct FileExport
+    {
+        DWORD imageIndex;
+        DWORD nameOffset;
+        DWORD ordinal;
+        DWORD forwarderOffset;
+    };
+
+    struct FileSymbol
+    {
+        DWORD nameOffset;
+        DWORD hash;
+        DWORD firstEntry;
+        DWORD entryCount;
+    };
+
+    //
+    // An image found in the search order, with the index of the same
+    // image in the previous index if it has not changed since.
+    //
+
+    struct Candidate
+    {
+        DWORD pathOffset;
+        DWORD sizeLow;
+        DWORD sizeHigh;
+        FILETIME lastWriteTime;
+        int previousImage;
+    };
+
+    struct ParsedExport
+    {
+        DWORD nameOffset;
+        DWORD ordinal;
+        DWORD forwarderOffset;
+    };
+
+    struct ParsedImage
+    {
+        Array<TCHAR> text;
+        Array<ParsedExport> exports;
+        bool isRead;
+    };
+
+    struct ParseContext
+    {
+        const TCHAR* paths;
+        const Candidate* candidates;
+        const int* parseList;
+        ParsedImage* const* results;
+    };
+
+    class Builder;
+
+    bool Build(const SearchOrder& searchOrder, const ExportIndex& previous, int threadCount);
+    LPCTSTR GetText(DWORD offset) const { return m_text + offset; }
+    bool IsValid(DWORD fileSize) const;
+    void SetImage(const BYTE* image);
+    void Unload();
+
+    static void List(const SearchOrder& searchOrder, Array<TCHAR>& paths, Array<Candidate>& candidates);
+    static bool IsImageName(LPCTSTR name);
+    static void CALLBACK ParseCandidate(int index, LPVOID context);
+    static bool Parse(LPCTSTR path, ParsedImage& image);
+    static void ParseExports(const ImageFile& file, ParsedImage& image);
+
+    Array<BYTE> m_storage;
+    HANDLE m_mapping;
+    const BYTE* m_view;
+    const FileHeader* m_header;
+    const FileImage* m_images;
+    const FileExport* m_exports;
+    const FileSymbol* m_symbols;
+    const DWORD* m_slots;
+    const DWORD* m_entries;
+    const TCHAR* m_text;
+    int m_parsedCount;
+
+    ExportIndex(const ExportIndex&);
+    ExportIndex& operator=(const ExportIndex&);
+};
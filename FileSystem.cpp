@@ -0,0 +1,814 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+
+// --------------------------------------------------------------------------
+//  FileSystem
+// --------------------------------------------------------------------------
+
+static Win32FileSystem win32FileSystem;
+
+FileSystem::FileSystem() :
+    m_attributeCount(0),
+    m_listingCount(0),
+    m_readCount(0),
+    m_mapCount(0)
+{
+}
+
+void FileSystem::GetStatistics(FileSystemStatistics& statistics) const
+{
+    statistics.attributeCount = m_attributeCount;
+    statistics.listingCount = m_listingCount;
+    statistics.readCount = m_readCount;
+    statistics.mapCount = m_mapCount;
+}
+
+const FileSystem& FileSystem::GetWin32()
+{
+    return win32FileSystem;
+}
+
+// --------------------------------------------------------------------------
+//  Win32FileSystem
+// --------------------------------------------------------------------------
+
+DWORD Win32FileSystem::GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const
+{
+    _ASSERT(path);
+
+    CountAttributes();
+
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data))
+        return GetLastError();
+
+    return NO_ERROR;
+}
+
+DWORD Win32FileSystem::List(LPCTSTR directory, FileListProc proc, LPVOID context) const
+{
+    _ASSERT(directory);
+    _ASSERT(proc);
+
+    CountListing();
+
+    TCHAR pattern[MAX_PATH];
+
+    if (lstrlen(directory) + 2 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(pattern, directory);
+    PathAppend(pattern, _T("*"));
+
+    WIN32_FIND_DATA findData;
+    HANDLE find = FindFirstFile(pattern, &findData);
+
+    if (INVALID_HANDLE_VALUE == find)
+        return GetLastError();
+
+    DWORD error = NO_ERROR;
+
+    try
+    {
+        do
+        {
+            LPCTSTR name = findData.cFileName;
+
+            if (0 != lstrcmp(name, _T(".")) && 0 != lstrcmp(name, _T("..")))
+                proc(findData, context);
+        }
+        while (FindNextFile(find, &findData));
+
+        error = GetLastError();
+    }
+    catch (...)
+    {
+        FindClose(find);
+        throw;
+    }
+
+    FindClose(find);
+
+    return ERROR_NO_MORE_FILES == error ? NO_ERROR : error;
+}
+
+DWORD Win32FileSystem::Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const
+{
+    _ASSERT(path);
+    _ASSERT(buffer || !size);
+
+    CountRead();
+
+    bytesRead = 0;
+
+    HANDLE file = CreateFile(path, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    const DWORD error = ReadFile(file, buffer, size, &bytesRead, NULL) ? NO_ERROR : GetLastError();
+
+    CloseHandle(file);
+
+    return error;
+}
+
+DWORD Win32FileSystem::Map(LPCTSTR path, const BYTE*& view, DWORD& size) const
+{
+    _ASSERT(path);
+
+    CountMap();
+
+    view = NULL;
+    size = 0;
+
+    HANDLE file = CreateFile(path, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD fileSizeHigh = 0;
+    const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+    //
+    // An empty file cannot be mapped at all, and there is nothing in it
+    // to map anyway.
+    //
+
+    if (fileSizeHigh || 0 == fileSize)
+    {
+        CloseHandle(file);
+        return fileSizeHigh ? ERROR_FILE_TOO_LARGE : NO_ERROR;
+    }
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD error = mapping ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    //
+    // The view keeps the mapping alive on its own, so the mapping need
+    // not be held on to.
+    //
+
+    view = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    error = view ? NO_ERROR : GetLastError();
+    CloseHandle(mapping);
+
+    if (NO_ERROR != error)
+        return error;
+
+    size = fileSize;
+
+    return NO_ERROR;
+}
+
+void Win32FileSystem::Unmap(const BYTE* view) const
+{
+    if (view)
+        UnmapViewOfFile(view);
+}
+
+// --------------------------------------------------------------------------
+//  MemoryFileSystem
+// --------------------------------------------------------------------------
+
+struct MemoryFileSystemCopy
+{
+    MemoryFileSystem* fileSystem;
+    const FileSystem* source;
+    LPCTSTR directory;
+    DWORD maxContentSize;
+    Array<BYTE>* content;
+};
+
+MemoryFileSystem::MemoryFileSystem() :
+    m_keyCount(0),
+    m_latency(0),
+    m_clockInterval(15625),
+    m_frequency(0),
+    m_waitCount(0)
+{
+    LARGE_INTEGER frequency;
+
+    if (QueryPerformanceFrequency(&frequency))
+        m_frequency = frequency.QuadPart;
+
+    //
+    // The interval between clock interrupts, which is what Sleep is good
+    // to, comes in units of 100 nanoseconds.
+    //
+
+    DWORD adjustment = 0;
+    DWORD increment = 0;
+    BOOL isDisabled = FALSE;
+
+    if (GetSystemTimeAdjustment(&adjustment, &increment, &isDisabled) && increment)
+        m_clockInterval = increment / 10;
+}
+
+MemoryFileSystem::~MemoryFileSystem()
+{
+    for (int i = 0; i < m_entries.GetCount(); i++)
+        delete m_entries[i];
+}
+
+void MemoryFileSystem::AddDirectory(LPCTSTR path, const WIN32_FILE_ATTRIBUTE_DATA& data)
+{
+    _ASSERT(path);
+
+    Entry& entry = *m_entries[Add(path, NULL, true)];
+
+    entry.data = data;
+    entry.data.dwFileAttributes |= FILE_ATTRIBUTE_DIRECTORY;
+}
+
+void MemoryFileSystem::AddFile(LPCTSTR path, const WIN32_FILE_ATTRIBUTE_DATA& data,
+    LPCTSTR alternateName, const void* content, DWORD contentSize)
+{
+    _ASSERT(path);
+    _ASSERT(content || !contentSize);
+
+    Entry& entry = *m_entries[Add(path, alternateName, false)];
+
+    entry.data = data;
+    entry.data.dwFileAttributes &= ~FILE_ATTRIBUTE_DIRECTORY;
+
+    entry.content.Clear();
+    entry.content.Append(static_cast<const BYTE*>(content), contentSize);
+}
+
+DWORD MemoryFileSystem::Copy(const FileSystem& source, LPCTSTR directory, DWORD maxContentSize)
+{
+    _ASSERT(directory);
+
+    //
+    // A directory that the source does not have is left out here too,
+    // so that it is just as missing.
+    //
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    DWORD error = source.GetAttributes(directory, data);
+
+    if (ERROR_FILE_NOT_FOUND == error || ERROR_PATH_NOT_FOUND == error)
+        return NO_ERROR;
+
+    if (NO_ERROR != error)
+        return error;
+
+    if (0 == (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return ERROR_DIRECTORY;
+
+    try
+    {
+        AddDirectory(directory, data);
+
+        Array<BYTE> content;
+        MemoryFileSystemCopy copy = { this, &source, directory, maxContentSize, &content };
+
+        error = source.List(directory, CopyEntry, &copy);
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return error;
+}
+
+void CALLBACK MemoryFileSystem::CopyEntry(const WIN32_FIND_DATA& findData, LPVOID context)
+{
+    MemoryFileSystemCopy& copy = *static_cast<MemoryFileSystemCopy*>(context);
+
+    TCHAR path[MAX_PATH];
+
+    if (!PathCombine(path, copy.directory, findData.cFileName))
+        return;
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    data.dwFileAttributes = findData.dwFileAttributes;
+    data.ftCreationTime = findData.ftCreationTime;
+    data.ftLastAccessTime = findData.ftLastAccessTime;
+    data.ftLastWriteTime = findData.ftLastWriteTime;
+    data.nFileSizeHigh = findData.nFileSizeHigh;
+    data.nFileSizeLow = findData.nFileSizeLow;
+
+    //
+    // Subdirectories are copied as entries but not what is in them.
+    //
+
+    if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        copy.fileSystem->AddDirectory(path, data);
+        return;
+    }
+
+    //
+    // A file that cannot be read is still there, only without content.
+    //
+
+    DWORD contentSize = copy.maxContentSize;
+
+    if (!findData.nFileSizeHigh && findData.nFileSizeLow < contentSize)
+        contentSize = findData.nFileSizeLow;
+
+    copy.content->SetCount(contentSize);
+
+    if (contentSize && NO_ERROR != copy.source->Read(path,
+            copy.content->GetData(), contentSize, contentSize))
+    {
+        contentSize = 0;
+    }
+
+    copy.fileSystem->AddFile(path, data, findData.cAlternateFileName,
+        copy.content->GetData(), contentSize);
+}
+
+DWORD MemoryFileSystem::GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const
+{
+    _ASSERT(path);
+
+    CountAttributes();
+
+    Wait();
+
+    DWORD error;
+    const int index = Find(path, error);
+
+    if (index < 0)
+        return error;
+
+    data = m_entries[index]->data;
+
+    return NO_ERROR;
+}
+
+DWORD MemoryFileSystem::List(LPCTSTR directory, FileListProc proc, LPVOID context) const
+{
+    _ASSERT(directory);
+    _ASSERT(proc);
+
+    CountListing();
+
+    Wait();
+
+    DWORD error;
+    const int index = Find(directory, error);
+
+    if (index < 0)
+        return error;
+
+    const Entry& entry = *m_entries[index];
+
+    if (0 == (entry.data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return ERROR_PATH_NOT_FOUND;
+
+    for (int i = 0; i < entry.children.GetCount(); i++)
+    {
+        const Entry& child = *m_entries[entry.children[i]];
+
+        WIN32_FIND_DATA findData;
+        ZeroMemory(&findData, sizeof(findData));
+
+        findData.dwFileAttributes = child.data.dwFileAttributes;
+        findData.ftCreationTime = child.data.ftCreationTime;
+        findData.ftLastAccessTime = child.data.ftLastAccessTime;
+        findData.ftLastWriteTime = child.data.ftLastWriteTime;
+        findData.nFileSizeHigh = child.data.nFileSizeHigh;
+        findData.nFileSizeLow = child.data.nFileSizeLow;
+        lstrcpy(findData.cFileName, child.name);
+        lstrcpy(findData.cAlternateFileName, child.alternateName);
+
+        proc(findData, context);
+    }
+
+    return NO_ERROR;
+}
+
+DWORD MemoryFileSystem::Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const
+{
+    _ASSERT(path);
+    _ASSERT(buffer || !size);
+
+    CountRead();
+
+    bytesRead = 0;
+
+    Wait();
+
+    DWORD error;
+    const int index = Find(path, error);
+
+    if (index < 0)
+        return error;
+
+    const Entry& entry = *m_entries[index];
+
+    if (entry.data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        return ERROR_ACCESS_DENIED;
+
+    bytesRead = min(size, static_cast<DWORD>(entry.content.GetCount()));
+    CopyMemory(buffer, entry.content.GetData(), bytesRead);
+
+    return NO_ERROR;
+}
+
+DWORD MemoryFileSystem::Map(LPCTSTR path, const BYTE*& view, DWORD& size) const
+{
+    _ASSERT(path);
+
+    CountMap();
+
+    view = NULL;
+    size = 0;
+
+    Wait();
+
+    DWORD error;
+    const int index = Find(path, error);
+
+    if (index < 0)
+        return error;
+
+    const Entry& entry = *m_entries[index];
+
+    if (entry.data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        return ERROR_ACCESS_DENIED;
+
+    if (entry.content.GetCount())
+    {
+        view = entry.content.GetData();
+        size = entry.content.GetCount();
+    }
+
+    return NO_ERROR;
+}
+
+void MemoryFileSystem::Unmap(const BYTE*) const
+{
+}
+
+int MemoryFileSystem::Add(LPCTSTR path, LPCTSTR alternateName, bool isDirectory)
+{
+    _ASSERT(path);
+
+    TCHAR buffer[MAX_PATH];
+    LPTSTR components[MAX_PATH];
+
+    const int count = Split(path, buffer, components);
+
+    if (count <= 0)
+        throw SystemException(ERROR_BAD_PATHNAME);
+
+    int index = -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        const bool isLast = i == count - 1;
+        const bool isDirectoryWanted = !isLast || isDirectory;
+
+        TCHAR foldedName[MAX_PATH];
+        lstrcpy(foldedName, components[i]);
+        CharUpperBuff(foldedName, lstrlen(foldedName));
+
+        int childIndex = FindChild(index, foldedName);
+
+        if (childIndex < 0)
+        {
+            childIndex = AddChild(index, components[i],
+                isLast ? alternateName : NULL, isDirectoryWanted);
+        }
+
+        const bool isChildDirectory =
+            0 != (m_entries[childIndex]->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+
+        if (isChildDirectory != isDirectoryWanted)
+            throw SystemException(isLast ? ERROR_ALREADY_EXISTS : ERROR_DIRECTORY);
+
+        index = childIndex;
+    }
+
+    return index;
+}
+
+int MemoryFileSystem::AddChild(int parentIndex, LPCTSTR name, LPCTSTR alternateName, bool isDirectory)
+{
+    _ASSERT(name);
+
+    Reserve(2);
+
+    Entry* entry = new Entry;
+
+    if (!entry)
+        throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+    entry->parentIndex = parentIndex;
+
+    lstrcpyn(entry->name, name, DIM(entry->name));
+    lstrcpy(entry->foldedName, entry->name);
+    CharUpperBuff(entry->foldedName, lstrlen(entry->foldedName));
+
+    entry->alternateName[0] = 0;
+
+    if (alternateName && lstrlen(alternateName) < MaxAlternateName)
+        lstrcpy(entry->alternateName, alternateName);
+
+    lstrcpy(entry->foldedAlternateName, entry->alternateName);
+    CharUpperBuff(entry->foldedAlternateName, lstrlen(entry->foldedAlternateName));
+
+    ZeroMemory(&entry->data, sizeof(entry->data));
+    entry->data.dwFileAttributes = isDirectory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+
+    const int index = m_entries.GetCount();
+
+    try
+    {
+        m_entries.Add(entry);
+    }
+    catch (...)
+    {
+        delete entry;
+        throw;
+    }
+
+    if (parentIndex >= 0)
+        m_entries[parentIndex]->children.Add(index);
+
+    //
+    // The short name is a second key for the same entry, unless it is
+    // no different from the long one.
+    //
+
+    Place(index, entry->foldedName);
+
+    if (*entry->foldedAlternateName && 0 != lstrcmp(entry->foldedAlternateName, entry->foldedName))
+        Place(index, entry->foldedAlternateName);
+
+    return index;
+}
+
+int MemoryFileSystem::Find(LPCTSTR path, DWORD& error) const
+{
+    _ASSERT(path);
+
+    TCHAR buffer[MAX_PATH];
+    LPTSTR components[MAX_PATH];
+
+    const int count = Split(path, buffer, components);
+
+    error = ERROR_PATH_NOT_FOUND;
+
+    if (count <= 0)
+        return -1;
+
+    int index = -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        //
+        // Only a directory has anything in it. Otherwise it is the path
+        // leading up to the name that is wrong, as it is when anything
+        // but the last part of it is missing.
+        //
+
+        if (index >= 0 && 0 == (m_entries[index]->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            return -1;
+
+        CharUpperBuff(components[i], lstrlen(components[i]));
+
+        index = FindChild(index, components[i]);
+
+        if (index < 0)
+        {
+            if (i == count - 1)
+                error = ERROR_FILE_NOT_FOUND;
+
+            return -1;
+        }
+    }
+
+    error = NO_ERROR;
+
+    return index;
+}
+
+int MemoryFileSystem::FindChild(int parentIndex, LPCTSTR foldedName) const
+{
+    _ASSERT(foldedName);
+
+    if (!m_slots.GetCount())
+        return -1;
+
+    const DWORD mask = m_slots.GetCount() - 1;
+
+    for (DWORD slot = Hash(parentIndex, foldedName) & mask; m_slots[slot]; slot = (slot + 1) & mask)
+    {
+        const int index = m_slots[slot] - 1;
+        const Entry& entry = *m_entries[index];
+
+        if (parentIndex == entry.parentIndex &&
+            (0 == lstrcmp(foldedName, entry.foldedName) ||
+             0 == lstrcmp(foldedName, entry.foldedAlternateName)))
+        {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+void MemoryFileSystem::Reserve(int keyCount)
+{
+    //
+    // Keep the table at most half full, growing it by powers of two and
+    // placing every key again whenever it would be any fuller.
+    //
+
+    if ((m_keyCount + keyCount) * 2 <= m_slots.GetCount())
+        return;
+
+    int slotCount = m_slots.GetCount() ? m_slots.GetCount() : 64;
+
+    while ((m_keyCount + keyCount) * 2 > slotCount)
+        slotCount *= 2;
+
+    m_slots.SetCount(slotCount);
+    ZeroMemory(m_slots.GetData(), slotCount * sizeof(DWORD));
+    m_keyCount = 0;
+
+    for (int i = 0; i < m_entries.GetCount(); i++)
+    {
+        const Entry& entry = *m_entries[i];
+
+        Place(i, entry.foldedName);
+
+        if (*entry.foldedAlternateName && 0 != lstrcmp(entry.foldedAlternateName, entry.foldedName))
+            Place(i, entry.foldedAlternateName);
+    }
+}
+
+void MemoryFileSystem::Place(int entryIndex, LPCTSTR foldedName)
+{
+    _ASSERT(foldedName);
+    _ASSERT((m_keyCount + 1) * 2 <= m_slots.GetCount());
+
+    const DWORD mask = m_slots.GetCount() - 1;
+    DWORD slot = Hash(m_entries[entryIndex]->parentIndex, foldedName) & mask;
+
+    while (m_slots[slot])
+        slot = (slot + 1) & mask;
+
+    m_slots[slot] = entryIndex + 1;
+    m_keyCount++;
+}
+
+void MemoryFileSystem::Wait() const
+{
+    if (!m_latency || !m_frequency)
+        return;
+
+    InterlockedIncrement(&m_waitCount);
+
+    //
+    // Sleep is only good to the tick of the system clock and may run
+    // over by up to one. So sleep through all but the last tick of the
+    // wait and go by the performance counter for what is left, letting
+    // any other thread that is ready run in the meantime. Latencies of
+    // less than a tick are thus the only ones spent yielding throughout.
+    //
+
+    const LONGLONG ticks = m_frequency * m_latency / 1000000;
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    if (m_latency > m_clockInterval + 1000)
+        Sleep((m_latency - m_clockInterval) / 1000);
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    while (now.QuadPart - start.QuadPart < ticks)
+    {
+        SwitchToThread();
+        QueryPerformanceCounter(&now);
+    }
+}
+
+int MemoryFileSystem::Split(LPCTSTR path, LPTSTR buffer, LPTSTR* components)
+{
+    _ASSERT(path);
+    _ASSERT(buffer);
+    _ASSERT(components);
+
+    if (lstrlen(path) >= MAX_PATH)
+        return -1;
+
+    lstrcpy(buffer, path);
+
+    for (LPTSTR ch = buffer; *ch; ch = CharNext(ch))
+    {
+        if (_T('/') == *ch)
+            *ch = _T('\\');
+    }
+
+    //
+    // The root, be it a drive or a share, is the first component. Only
+    // a full path has one.
+    //
+
+    LPTSTR component = PathSkipRoot(buffer);
+
+    if (!component || component == buffer)
+        return -1;
+
+    if (_T('\\') == component[-1])
+        component[-1] = 0;
+
+    components[0] = buffer;
+    int count = 1;
+
+    //
+    // Then come the names along the way, where . stays put, .. goes up
+    // but never past the root, and dots and spaces at the end of a name
+    // do not count, just as Windows has it.
+    //
+
+    while (*component)
+    {
+        LPTSTR end = component;
+
+        while (*end && _T('\\') != *end)
+            end = CharNext(end);
+
+        const bool isLast = !*end;
+        *end = 0;
+
+        if (0 == lstrcmp(component, _T("..")))
+        {
+            if (count > 1)
+                count--;
+        }
+        else if (0 != lstrcmp(component, _T(".")))
+        {
+            int length = lstrlen(component);
+
+            while (length > 0 && (_T('.') == component[length - 1] || _T(' ') == component[length - 1]))
+                length--;
+
+            component[length] = 0;
+
+            if (length > 0)
+                components[count++] = component;
+        }
+
+        if (isLast)
+            break;
+
+        component = end + 1;
+    }
+
+    return count;
+}
+
+DWORD MemoryFileSystem::Hash(int parentIndex, LPCTSTR foldedName)
+{
+    _ASSERT(foldedName);
+
+    //
+    // FNV-1a over the name, starting from the parent so that the same
+    // name in different directories lands in different slots.
+    //
+
+    DWORD hash = 2166136261 ^ static_cast<DWORD>(parentIndex);
+
+    for (LPCTSTR ch = foldedName; *ch; ch++)
+    {
+        hash ^= static_cast<DWORD>(static_cast<_TUCHAR>(*ch));
+        hash *= 16777619;
+    }
+
+    return hash;
+}
@@ -0,0 +1,208 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+typedef void (CALLBACK * FileListProc)(const WIN32_FIND_DATA& findData, LPVOID context);
+
+// --------------------------------------------------------------------------
+//  FileSystemStatistics
+// --------------------------------------------------------------------------
+//
+//  How many calls of each kind a file system has been asked to make,
+//  whoever asked and whether or not they succeeded.
+//
+
+struct FileSystemStatistics
+{
+    LONG attributeCount;
+    LONG listingCount;
+    LONG readCount;
+    LONG mapCount;
+};
+
+// --------------------------------------------------------------------------
+//  FileSystem
+// --------------------------------------------------------------------------
+//
+//  Everything that resolving asks of the file system: the attributes of
+//  a path, the entries of a directory and the content of a file, either
+//  read from the start or mapped whole. Failures are reported as Win32
+//  error codes, with ERROR_FILE_NOT_FOUND and ERROR_PATH_NOT_FOUND
+//  meaning that there is nothing by that name.
+//
+//  List calls back for every entry of a directory but . and .., and
+//  whatever the callback throws is passed on once the listing has been
+//  closed. A mapped view stays valid until it is unmapped.
+//
+//  Every method can be called from any number of threads at the same
+//  time. GetWin32 returns the one that goes to Windows itself, which is
+//  what is used wherever no other is given, and so counts the calls made
+//  through it by the whole process.
+//
+
+class FileSystem
+{
+public:
+
+    FileSystem();
+    virtual ~FileSystem() {}
+
+    virtual DWORD GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const = 0;
+    virtual DWORD List(LPCTSTR directory, FileListProc proc, LPVOID context) const = 0;
+    virtual DWORD Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const = 0;
+    virtual DWORD Map(LPCTSTR path, const BYTE*& view, DWORD& size) const = 0;
+    virtual void Unmap(const BYTE* view) const = 0;
+
+    void GetStatistics(FileSystemStatistics& statistics) const;
+
+    static const FileSystem& GetWin32();
+
+protected:
+
+    //
+    // Every implementation counts each call it is asked to make, up
+    // front, with one of these.
+    //
+
+    void CountAttributes() const { InterlockedIncrement(&m_attributeCount); }
+    void CountListing() const { InterlockedIncrement(&m_listingCount); }
+    void CountRead() const { InterlockedIncrement(&m_readCount); }
+    void CountMap() const { InterlockedIncrement(&m_mapCount); }
+
+private:
+
+    mutable LONG volatile m_attributeCount;
+    mutable LONG volatile m_listingCount;
+    mutable LONG volatile m_readCount;
+    mutable LONG volatile m_mapCount;
+
+    FileSystem(const FileSystem&);
+    FileSystem& operator=(const FileSystem&);
+};
+
+// --------------------------------------------------------------------------
+//  Win32FileSystem
+// --------------------------------------------------------------------------
+
+class Win32FileSystem : public FileSystem
+{
+public:
+
+    Win32FileSystem() {}
+
+    virtual DWORD GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const;
+    virtual DWORD List(LPCTSTR directory, FileListProc proc, LPVOID context) const;
+    virtual DWORD Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const;
+    virtual DWORD Map(LPCTSTR path, const BYTE*& view, DWORD& size) const;
+    virtual void Unmap(const BYTE* view) const;
+
+private:
+
+    Win32FileSystem(const Win32FileSystem&);
+    Win32FileSystem& operator=(const Win32FileSystem&);
+};
+
+// --------------------------------------------------------------------------
+//  MemoryFileSystem
+// --------------------------------------------------------------------------
+//
+//  A file system held entirely in memory that names its files the way
+//  Windows does: without regard to case, with / taken for \, with dots
+//  and spaces at the end of a name dropped and with a file reachable
+//  through its short name as well as its long one. Resolving against it
+//  costs nothing but the work of resolving, whatever the disk and cache
+//  of the machine happen to be doing.
+//
+//  It is filled in before it is used, either an entry at a time or by
+//  copying directories from another file system, after which any number
+//  of threads can read it. Adding an entry throws a SystemException for
+//  a path that is not a full one, and creates any directories leading up
+//  to it that are not there yet. A copy can be made to take only the start of
+//  every file, such as the page that holds the headers of an image, in
+//  which case mapping a file gives just that much of it.
+//
+//  Every call can be made to take a given time, as it would on a slow
+//  network share, so that such a share can be reproduced at will. The
+//  caller is held for that long mostly asleep, as it would be were it
+//  waiting on the network, so that the time shows up as waiting rather
+//  than as work. How many calls were held is counted so that the time
+//  spent waiting can be told apart from the rest.
+//
+
+class MemoryFileSystem : public FileSystem
+{
+public:
+
+    MemoryFileSystem();
+    virtual ~MemoryFileSystem();
+
+    void AddDirectory(LPCTSTR path, const WIN32_FILE_ATTRIBUTE_DATA& data);
+    void AddFile(LPCTSTR path, const WIN32_FILE_ATTRIBUTE_DATA& data,
+        LPCTSTR alternateName, const void* content, DWORD contentSize);
+    DWORD Copy(const FileSystem& source, LPCTSTR directory, DWORD maxContentSize);
+
+    void SetLatency(DWORD microseconds) { m_latency = microseconds; }
+    DWORD GetLatency() const { return m_latency; }
+    LONG GetWaitCount() const { return m_waitCount; }
+
+    int GetEntryCount() const { return m_entries.GetCount(); }
+
+    virtual DWORD GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const;
+    virtual DWORD List(LPCTSTR directory, FileListProc proc, LPVOID context) const;
+    virtual DWORD Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const;
+    virtual DWORD Map(LPCTSTR path, const BYTE*& view, DWORD& size) const;
+    virtual void Unmap(const BYTE* view) const;
+
+private:
+
+    enum { MaxAlternateName = 14 };
+
+    struct Entry
+    {
+        int parentIndex;
+        TCHAR name[MAX_PATH];
+        TCHAR alternateName[MaxAlternateName];
+        TCHAR foldedName[MAX_PATH];
+        TCHAR foldedAlternateName[MaxAlternateName];
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        Array<int> children;
+        Array<BYTE> content;
+    };
+
+    int Add(LPCTSTR path, LPCTSTR alternateName, bool isDirectory);
+    int AddChild(int parentIndex, LPCTSTR name, LPCTSTR alternateName, bool isDirectory);
+    int Find(LPCTSTR path, DWORD& error) const;
+    int FindChild(int parentIndex, LPCTSTR foldedName) const;
+    void Reserve(int keyCount);
+    void Place(int entryIndex, LPCTSTR foldedName);
+    void Wait() const;
+
+    static int Split(LPCTSTR path, LPTSTR buffer, LPTSTR* components);
+    static DWORD Hash(int parentIndex, LPCTSTR foldedName);
+    static void CALLBACK CopyEntry(const WIN32_FIND_DATA& findData, LPVOID context);
+
+    Array<Entry*> m_entries;
+    Array<DWORD> m_slots;
+    int m_keyCount;
+    DWORD m_latency;
+    DWORD m_clockInterval;
+    LONGLONG m_frequency;
+    mutable LONG volatile m_waitCount;
+
+    MemoryFileSystem(const MemoryFileSystem&);
+    MemoryFileSystem& operator=(const MemoryFileSystem&);
+};
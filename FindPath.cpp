@@ -18,6 +18,12 @@
 #include "Exceptions.h"
 #include "OutputStream.h"
 #include "WinOutputStream.h"
+#include "BufferedOutputStream.h"
+#include "LineReader.h"
+#include "libfindpath.h"
+#include "QueryReader.h"
+#include "QueryLog.h"
+#include "RecordWriter.h"
 
 //
 // Libraries
@@ -35,51 +41,35 @@ static void ShowLogo();
 static void CopyToClipboard(LPCTSTR text);
 static void OpenContainingFolder(LPCTSTR path);
 static int SplitString(LPTSTR text, TCHAR delimiter);
-static void ExtractManifest(LPCTSTR path);
-static BOOL CALLBACK EnumResourceNamesCallback(HMODULE moduleHandle, LPCTSTR type, LPTSTR name, LONG_PTR userParam);
-
-//
-// Macros
-//
-
-#ifndef DIM
-#define DIM(a) (sizeof(a) / sizeof((a)[0]))
+static void ExtractManifest(LPCTSTR path, const ImageMetadataCache* imageMetadata);
+static void ExtractCachedManifest(LPCTSTR path, const ImageMetadataCache& imageMetadata);
+static void ShowSuggestions(const Resolver& resolver, LPCTSTR fileName, int maxSuggestionCount);
+static void AnalyzeSearchOrder(QueryReader& queries);
+static void ExportSnapshot(LPCTSTR indexFilePath, bool isBinary, BufferedOutputStream& output);
+static void ReportShadows(LPCTSTR indexFilePath, bool isComparing, BufferedOutputStream& output);
+static bool FindExports(LPCTSTR exportsFilePath, QueryReader& queries, bool isBatch,
+    BufferedOutputStream& output);
+static void ShowCacheStatistics(const DirectoryIndexTable& directoryIndexes);
+#ifdef FINDPATH_PROFILER
+static void ShowProfile();
 #endif
+static bool CALLBACK ReportTreeMatch(int nameIndex, int extensionIndex, LPCTSTR path, LPVOID context);
+static void LoadProfiles(LPCTSTR filePath, Array<TCHAR>& text, Array<EnvironmentProfile>& profiles);
+static void LoadRedirections(LPCTSTR apiSetFilePath, LPCTSTR knownDllsFilePath,
+    ApiSetSchema& apiSetSchema, KnownDllList& knownDlls, ResolverOptions& options);
+static void CALLBACK TraceSearch(LPCTSTR fileName, LPCTSTR extension, LPVOID context);
+static void ShowError(DWORD code, LPCTSTR fileName = NULL, LPCTSTR profileName = NULL);
+static BOOL CALLBACK EnumResourceNamesCallback(HMODULE moduleHandle, LPCTSTR type, LPTSTR name, LONG_PTR userParam);
 
 //
 // Global variables
 //
 
+static const TCHAR sharedIndexName[] = _T("Local\\FindPath.DirectoryIndexes");
+
 WinOutputStream cout(GetStdHandle(STD_OUTPUT_HANDLE));
 WinOutputStream cerr(GetStdHandle(STD_ERROR_HANDLE));
 
-//
-// Activation context API
-//
-// These function pointers are for late-binding support of the activation 
-// context API to prevent the application from implicitly importing them
-// and therefore becoming bound to only those versions of the operating
-// system that implement them.
-//
-
-namespace ActivationContext
-{
-    HANDLE (WINAPI * Create)(PACTCTX);
-    BOOL   (WINAPI * Activate)(HANDLE, ULONG_PTR*);
-    BOOL   (WINAPI * Deactivate)(DWORD, ULONG_PTR);
-    void   (WINAPI * Release)(HANDLE);
-};
-
-//
-// Redirectiong of activaton context API via macros.
-//
-
-#undef CreateActCtx
-#define CreateActCtx     ActivationContext::Create
-#define ActivateActCtx   ActivationContext::Activate
-#define DeactivateActCtx ActivationContext::Deactivate
-#define ReleaseActCtx    ActivationContext::Release
-
 // --------------------------------------------------------------------------
 //  CommandLineArguments<Handler>
 // --------------------------------------------------------------------------
@@ -129,34 +119,114 @@ private:
 //  CommandLineHandler
 // --------------------------------------------------------------------------
 
+enum OutputFormat
+{
+    TextFormat,
+    JsonLinesFormat,
+    NulFormat
+};
+
+enum SnapshotFormat
+{
+    NoSnapshot,
+    TextSnapshot,
+    BinarySnapshot
+};
+
 class CommandLineHandler 
 {
 public:
 
-    LPCTSTR m_fileName;
+    Array<LPCTSTR> m_fileNames;
+    Array<LPCTSTR> m_roots;
+    LPCTSTR m_batchFilePath;
+    LPCTSTR m_profilesFilePath;
+    LPCTSTR m_indexFilePath;
+    LPCTSTR m_lookupFilePath;
+    LPCTSTR m_apiSetFilePath;
+    LPCTSTR m_knownDllsFilePath;
+    LPCTSTR m_exportsFilePath;
+    OutputFormat m_format;
+    SnapshotFormat m_snapshotFormat;
+    bool m_showMetadata;
+    bool m_share;
+    bool m_isFirstMatchOnly;
+    bool m_showStatistics;
+    bool m_profile;
+    int m_cacheSize;
+    EvictionPolicy m_evictionPolicy;
+    bool m_analyze;
     bool m_copyToClipboard;
     bool m_showHelp;
     bool m_openContainingFolder;
     bool m_verbose;
     bool m_suppressLogo;
     LPCTSTR m_manifestFilePath;
+    WORD m_machine;
     bool m_extractManifest;
+    int m_suggestionCount;
+    bool m_validate;
+    bool m_shadows;
+    bool m_compare;
+    LPCTSTR m_fromPath;
+    DWORD m_searchPolicy;
+    bool m_hasSearchPolicy;
+    LPCTSTR m_captureFilePath;
+    LPCTSTR m_replayFilePath;
+    LPCTSTR m_logFilePath;
+    LPCTSTR m_benchFilePath;
+    int m_threadCount;
+    LPCTSTR m_imageCacheFilePath;
+    bool m_simulate;
+    DWORD m_latency;
 
     CommandLineHandler() : 
-        m_fileName(NULL),
+        m_batchFilePath(NULL),
+        m_profilesFilePath(NULL),
+        m_indexFilePath(NULL),
+        m_lookupFilePath(NULL),
+        m_apiSetFilePath(NULL),
+        m_knownDllsFilePath(NULL),
+        m_exportsFilePath(NULL),
+        m_format(TextFormat),
+        m_snapshotFormat(NoSnapshot),
+        m_showMetadata(false),
+        m_share(false),
+        m_isFirstMatchOnly(false),
+        m_showStatistics(false),
+        m_profile(false),
+        m_cacheSize(0),
+        m_evictionPolicy(LeastRecentlyUsedEviction),
+        m_analyze(false),
         m_copyToClipboard(false),
         m_showHelp(false),
         m_openContainingFolder(false),
         m_verbose(false),
         m_suppressLogo(false),
         m_manifestFilePath(NULL),
-        m_extractManifest(false)
+        m_machine(ImageMachine::Any),
+        m_extractManifest(false),
+        m_suggestionCount(5),
+        m_validate(false),
+        m_shadows(false),
+        m_compare(false),
+        m_fromPath(NULL),
+        m_searchPolicy(SearchPathPolicy),
+        m_hasSearchPolicy(false),
+        m_captureFilePath(NULL),
+        m_replayFilePath(NULL),
+        m_logFilePath(NULL),
+        m_benchFilePath(NULL),
+        m_threadCount(0),
+        m_imageCacheFilePath(NULL),
+        m_simulate(false),
+        m_latency(0)
         {}
 
     bool HandleUnnamed(LPCTSTR unnamed)
     {
         _ASSERT(unnamed);
-        m_fileName = unnamed;
+        m_fileNames.Add(unnamed);
 
         return true;
     }
@@ -173,6 +243,349 @@ public:
         {
             m_extractManifest = true;
         }
+        else if (IsOption(option, _T("meta")))
+        {
+            m_showMetadata = true;
+        }
+        else if (IsOption(option, _T("share")))
+        {
+            m_share = true;
+        }
+        else if (IsOption(option, _T("stats")))
+        {
+            m_showStatistics = true;
+        }
+#ifdef FINDPATH_PROFILER
+        else if (IsOption(option, _T("profile")))
+        {
+            m_profile = true;
+        }
+#endif
+        else if (IsOption(option, _T("cache")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing cache size.\n");
+                return false;
+            }
+
+            m_cacheSize = StrToInt(argument);
+
+            if (m_cacheSize <= 0)
+            {
+                cerr << _T("Invalid cache size: ") << argument << _T("\n");
+                return false;
+            }
+
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("log")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing log file name.\n");
+                return false;
+            }
+
+            m_logFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("bench")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing log file name.\n");
+                return false;
+            }
+
+            m_benchFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("threads")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing thread count.\n");
+                return false;
+            }
+
+            m_threadCount = StrToInt(argument);
+
+            if (m_threadCount <= 0)
+            {
+                cerr << _T("Invalid thread count: ") << argument << _T("\n");
+                return false;
+            }
+
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("simulate")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing latency.\n");
+                return false;
+            }
+
+            const int latency = StrToInt(argument);
+
+            if (latency < 0)
+            {
+                cerr << _T("Invalid latency: ") << argument << _T("\n");
+                return false;
+            }
+
+            m_simulate = true;
+            m_latency = latency;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("evict")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing eviction policy.\n");
+                return false;
+            }
+
+            if (IsOption(argument, _T("lru")))
+                m_evictionPolicy = LeastRecentlyUsedEviction;
+            else if (IsOption(argument, _T("cost")))
+                m_evictionPolicy = CostAwareEviction;
+            else
+            {
+                cerr << _T("Invalid eviction policy: ") << argument << _T("\n");
+                return false;
+            }
+
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("first")))
+        {
+            m_isFirstMatchOnly = true;
+        }
+        else if (IsOption(option, _T("r")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing root directory.\n");
+                return false;
+            }
+
+            m_roots.Add(argument);
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("analyze")))
+        {
+            m_analyze = true;
+        }
+        else if (IsOption(option, _T("batch")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing batch file name.\n");
+                return false;
+            }
+
+            m_batchFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("profiles")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing profiles file name.\n");
+                return false;
+            }
+
+            m_profilesFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("index")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing index file name.\n");
+                return false;
+            }
+
+            m_indexFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("imagecache")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing image cache file name.\n");
+                return false;
+            }
+
+            m_imageCacheFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("lookup")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing lookup file name.\n");
+                return false;
+            }
+
+            m_lookupFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("apiset")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing API set schema file name.\n");
+                return false;
+            }
+
+            m_apiSetFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("knowndlls")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing known DLLs file name.\n");
+                return false;
+            }
+
+            m_knownDllsFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("exports")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing export index file name.\n");
+                return false;
+            }
+
+            m_exportsFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("validate")))
+        {
+            m_validate = true;
+        }
+        else if (IsOption(option, _T("shadows")))
+        {
+            m_shadows = true;
+        }
+        else if (IsOption(option, _T("compare")))
+        {
+            m_compare = true;
+        }
+        else if (IsOption(option, _T("capture")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing capture file name.\n");
+                return false;
+            }
+
+            m_captureFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("replay")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing capture file name.\n");
+                return false;
+            }
+
+            m_replayFilePath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("snapshot")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing snapshot format.\n");
+                return false;
+            }
+
+            if (IsOption(argument, _T("text")))
+                m_snapshotFormat = TextSnapshot;
+            else if (IsOption(argument, _T("binary")))
+                m_snapshotFormat = BinarySnapshot;
+            else
+            {
+                cerr << _T("Invalid snapshot format: ") << argument << _T("\n");
+                return false;
+            }
+
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("from")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing application file name.\n");
+                return false;
+            }
+
+            m_fromPath = argument;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("policy")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing search policy.\n");
+                return false;
+            }
+
+            if (!SearchOrder::ParsePolicy(argument, m_searchPolicy))
+            {
+                cerr << _T("Invalid search policy: ") << argument << _T("\n");
+                return false;
+            }
+
+            m_hasSearchPolicy = true;
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("arch")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing architecture.\n");
+                return false;
+            }
+
+            if (!ImageMachine::Parse(argument, m_machine))
+            {
+                cerr << _T("Invalid architecture: ") << argument << _T("\n");
+                return false;
+            }
+
+            argument = NULL;
+        }
+        else if (IsOption(option, _T("format")))
+        {
+            if (argument == NULL)
+            {
+                cerr << _T("Missing output format.\n");
+                return false;
+            }
+
+            if (IsOption(argument, _T("text")))
+                m_format = TextFormat;
+            else if (IsOption(argument, _T("jsonl")))
+                m_format = JsonLinesFormat;
+            else if (IsOption(argument, _T("nul")))
+                m_format = NulFormat;
+            else
+            {
+                cerr << _T("Invalid output format: ") << argument << _T("\n");
+                return false;
+            }
+
+            argument = NULL;
+        }
         else
         {
             switch (tolower(option[0]))
@@ -195,346 +608,1963 @@ public:
                     break;
                 }
 
-                default  : 
-                {
-                    cerr << _T("Invalid option: ") << option << _T("\n");
-                    return false;
-                }
-            }
-        }
+                case 's' :
+                {
+                    if (argument == NULL)
+                    {
+                        cerr << _T("Missing suggestion count.\n");
+                        return false;
+                    }
+
+                    m_suggestionCount = StrToInt(argument);
+                    argument = NULL;
+                    break;
+                }
+
+                default  : 
+                {
+                    cerr << _T("Invalid option: ") << option << _T("\n");
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool EndOfParse()
+    {
+        if (!m_showHelp && !m_analyze && NoSnapshot == m_snapshotFormat &&
+            !m_fileNames.GetCount() && !m_batchFilePath)
+        {
+            cerr << _T("Missing file name.\n");
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+
+    static bool IsOption(LPCTSTR test, LPCTSTR option)
+    {
+        return CSTR_EQUAL == CompareString(LOCALE_INVARIANT, 0, test, -1, option, -1);
+    }
+
+    CommandLineHandler(const CommandLineHandler&);
+    CommandLineHandler& operator=(const CommandLineHandler&);
+};
+
+// --------------------------------------------------------------------------
+//  main
+// --------------------------------------------------------------------------
+
+static bool ProcessQuery(const CommandLineHandler& arguments, const Resolver& resolver,
+    LPCTSTR fileName, bool isTruncated, bool isBatch, QueryLog& log, RecordWriter& writer,
+    BufferedOutputStream& output);
+
+static bool ProcessPipelined(const CommandLineHandler& arguments, const Resolver& resolver,
+    QueryReader& queries, int threadCount, QueryLog& log, RecordWriter& writer,
+    BufferedOutputStream& output);
+
+static void RunBenchmark(const CommandLineHandler& arguments, const Resolver& resolver,
+    DirectoryIndexTable& directoryIndexes, const MemoryFileSystem& memoryFileSystem,
+    DWORD setupMicroseconds, BufferedOutputStream& output);
+
+static bool ProcessProfiles(const CommandLineHandler& arguments, QueryReader& queries,
+    RecordWriter& writer, BufferedOutputStream& output);
+
+static bool SearchTrees(const CommandLineHandler& arguments, QueryReader& queries,
+    RecordWriter& writer, BufferedOutputStream& output);
+
+static bool ValidateImports(const CommandLineHandler& arguments, QueryReader& queries,
+    BufferedOutputStream& output);
+
+static bool GetApplicationProfile(const CommandLineHandler& arguments, EnvironmentProfile& profile,
+    LPTSTR fromPath, WORD& machine);
+
+static void CaptureHost(const CommandLineHandler& arguments);
+
+static bool ReplayCapture(const CommandLineHandler& arguments, QueryReader& queries,
+    RecordWriter& writer, BufferedOutputStream& output);
+
+static bool QueryMetadata(const CommandLineHandler& arguments, DWORD error,
+    const Resolution& resolution, WIN32_FILE_ATTRIBUTE_DATA& metadata);
+
+static bool QueryImageMetadata(const CommandLineHandler& arguments, const Resolver& resolver,
+    DWORD error, const Resolution& resolution, ImageMetadata& image);
+
+static bool ReportQuery(const CommandLineHandler& arguments, const Resolver& resolver,
+    LPCTSTR profileName, LPCTSTR fileName, DWORD error, const Resolution& resolution,
+    const WIN32_FILE_ATTRIBUTE_DATA* metadata, const ImageMetadata* image, bool isBatch,
+    RecordWriter& writer, BufferedOutputStream& output);
+
+int _tmain(int argsLength, LPCTSTR args[])
+{
+#ifdef _DEBUG
+    
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | 
+        _CRTDBG_CHECK_ALWAYS_DF | _CRTDBG_LEAK_CHECK_DF);
+
+#endif
+
+    int exitCode = 0;
+    MemoryFileSystem memoryFileSystem;
+    DirectoryIndexTable directoryIndexes;
+    ApiSetSchema apiSetSchema;
+    KnownDllList knownDlls;
+    ImageMetadataCache imageMetadata;
+    Resolver resolver;
+
+    try
+    {
+        //
+        // Parse command-line arguments.
+        //
+
+        CommandLineArguments<CommandLineHandler> arguments;
+
+        if (!arguments.Parse(argsLength, args))
+        {
+            TCHAR moduleFileName[MAX_PATH];
+            GetModuleFileName(NULL, moduleFileName, DIM(moduleFileName));
+            PathStripPath(moduleFileName);
+            PathRemoveExtension(moduleFileName);
+
+            cerr << _T("\nTry '") << moduleFileName << _T(" -?' for more help.\n");
+
+            return -1;
+        }
+
+        //
+        // The logo would only get in the way of the machine-readable
+        // output formats.
+        //
+
+        if (!arguments.m_suppressLogo && TextFormat == arguments.m_format &&
+            NoSnapshot == arguments.m_snapshotFormat)
+            ShowLogo();
+
+#ifdef FINDPATH_PROFILER
+        if (arguments.m_profile)
+            Profiler::Enable();
+#endif
+
+        //
+        // If showing usage, then also exit program.
+        //
+
+        if (arguments.m_showHelp)
+        {
+            ShowHelp();
+            return 0;
+        }
+
+        //
+        // Set up the encoder for the requested output format. All of
+        // them stream one record per query through the same buffer.
+        //
+
+        BufferedOutputStream output(GetStdHandle(STD_OUTPUT_HANDLE));
+
+        TextRecordWriter textWriter(output);
+        JsonLinesRecordWriter jsonLinesWriter(output);
+        NulRecordWriter nulWriter(output, arguments.m_showMetadata,
+            NULL != arguments.m_profilesFilePath);
+
+        RecordWriter* writer = &textWriter;
+
+        if (JsonLinesFormat == arguments.m_format)
+            writer = &jsonLinesWriter;
+        else if (NulFormat == arguments.m_format)
+            writer = &nulWriter;
+
+        //
+        // Resolve the names given on the command line followed by those
+        // listed in the batch file, if any, either against every profile
+        // or against the environment of this process.
+        //
+
+        QueryReader queries(arguments.m_fileNames, arguments.m_batchFilePath);
+
+        if (arguments.m_analyze)
+        {
+            AnalyzeSearchOrder(queries);
+        }
+        else if (NoSnapshot != arguments.m_snapshotFormat)
+        {
+            ExportSnapshot(arguments.m_indexFilePath,
+                BinarySnapshot == arguments.m_snapshotFormat, output);
+        }
+        else if (arguments.m_shadows)
+        {
+            ReportShadows(arguments.m_indexFilePath, arguments.m_compare, output);
+        }
+        else if (arguments.m_captureFilePath)
+        {
+            CaptureHost(arguments);
+        }
+        else if (arguments.m_replayFilePath)
+        {
+            if (!ReplayCapture(arguments, queries, *writer, output))
+                exitCode = -1;
+        }
+        else if (arguments.m_exportsFilePath)
+        {
+            if (!FindExports(arguments.m_exportsFilePath, queries,
+                    arguments.m_batchFilePath || arguments.m_fileNames.GetCount() > 1, output))
+            {
+                exitCode = -1;
+            }
+        }
+        else if (arguments.m_validate)
+        {
+            if (!ValidateImports(arguments, queries, output))
+                exitCode = -1;
+        }
+        else if (arguments.m_roots.GetCount())
+        {
+            if (!SearchTrees(arguments, queries, *writer, output))
+                exitCode = -1;
+        }
+        else if (arguments.m_profilesFilePath)
+        {
+            if (!ProcessProfiles(arguments, queries, *writer, output))
+                exitCode = -1;
+        }
+        else
+        {
+            //
+            // Take a snapshot of the search environment, including the
+            // activation context of the manifest if one was given.
+            //
+
+            LONGLONG setupStart = QueryLog::GetTime();
+
+            ResolverOptions options = { 0 };
+            options.manifestFilePath = arguments.m_manifestFilePath;
+            options.machine = arguments.m_machine;
+
+            EnvironmentProfile profile = { 0 };
+            TCHAR fromPath[MAX_PATH];
+
+            if (GetApplicationProfile(arguments, profile, fromPath, options.machine))
+                options.profile = &profile;
+
+            if (arguments.m_indexFilePath || arguments.m_lookupFilePath || arguments.m_share ||
+                arguments.m_cacheSize)
+            {
+                options.directoryIndexes = &directoryIndexes;
+            }
+
+            //
+            // With a cache size, directories are only listed as they are
+            // needed and the listings held are trimmed back to the size
+            // after every name.
+            //
+
+            if (arguments.m_cacheSize)
+            {
+                directoryIndexes.SetBudget(static_cast<ULONGLONG>(arguments.m_cacheSize) * 1024 * 1024,
+                    arguments.m_evictionPolicy);
+            }
+
+            //
+            // A simulation looks for files in memory rather than on disk,
+            // directory listings included.
+            //
+
+            if (arguments.m_simulate)
+            {
+                directoryIndexes.SetFileSystem(memoryFileSystem);
+                options.fileSystem = &memoryFileSystem;
+            }
+
+            LoadRedirections(arguments.m_apiSetFilePath, arguments.m_knownDllsFilePath,
+                apiSetSchema, knownDlls, options);
+
+            //
+            // With an image cache, what is needed from images is read
+            // from it, and it takes in any image that it does not have
+            // yet. A cache that cannot be loaded starts out empty.
+            //
+
+            if (arguments.m_imageCacheFilePath)
+            {
+                imageMetadata.Load(arguments.m_imageCacheFilePath);
+                options.imageMetadata = &imageMetadata;
+            }
+
+            DWORD error = resolver.Initialize(options);
+
+            if (NO_ERROR != error)
+                throw SystemException(error);
+
+            //
+            // Only now that the search order is known can its directories
+            // be copied into memory, along with the headers of the files
+            // in them should there be a machine to check images against.
+            // A directory that cannot be copied is left out, as if it were
+            // not there. Copying is no part of setting the resolver up,
+            // so it is not counted as such, and calls only start taking
+            // their time once it is done.
+            //
+
+            if (arguments.m_simulate)
+            {
+                const LONGLONG copyStart = QueryLog::GetTime();
+                const SearchOrder& searchOrder = resolver.GetEnvironment().GetSearchOrder();
+
+                const DWORD contentSize = ImageMachine::Any != options.machine ?
+                    static_cast<DWORD>(ImageMachine::PageSize) : 0;
+
+                for (int i = 0; i < searchOrder.GetCount(); i++)
+                {
+                    memoryFileSystem.Copy(FileSystem::GetWin32(),
+                        searchOrder.GetDirectory(i), contentSize);
+                }
+
+                memoryFileSystem.SetLatency(arguments.m_latency);
+                setupStart += QueryLog::GetTime() - copyStart;
+            }
+
+            //
+            // With an index file, the directories are answered for from
+            // their saved listings, bringing those up to date first.
+            // Shared listings are used the same way, except that should
+            // they be unavailable for any reason, the directories are
+            // simply listed afresh. Sharing lists every directory at once,
+            // so within a cache it is left out in favour of listing them
+            // as they are needed.
+            //
+
+            if (arguments.m_share && !arguments.m_cacheSize)
+            {
+                if (NO_ERROR != directoryIndexes.Share(sharedIndexName, GetProcessorCount()))
+                    error = directoryIndexes.Scan(GetProcessorCount());
+
+                if (NO_ERROR != error)
+                    throw SystemException(error);
+            }
+            else if (arguments.m_indexFilePath)
+            {
+                error = directoryIndexes.Refresh(arguments.m_indexFilePath, GetProcessorCount());
+
+                if (NO_ERROR != error)
+                    throw SystemException(error);
+            }
+
+            //
+            // With a lookup file, every name is looked up in one go in
+            // an index of the whole search order instead.
+            //
+
+            if (arguments.m_lookupFilePath)
+            {
+                error = resolver.AttachLookupIndex(arguments.m_lookupFilePath, GetProcessorCount());
+
+                if (NO_ERROR != error)
+                    throw SystemException(error);
+            }
+
+            const bool isBatch = arguments.m_batchFilePath || arguments.m_fileNames.GetCount() > 1;
+            const int threadCount = GetProcessorCount();
+
+            QueryLog log;
+
+            if (arguments.m_logFilePath)
+                log.Open(arguments.m_logFilePath);
+
+            //
+            // A batch is resolved on every processor while it is still
+            // being read and written out, unless something has to be
+            // done between one name and the next: tracing the search,
+            // acting on the desktop or trimming the cache. A benchmark
+            // replays a log instead and only reports how that went.
+            //
+
+            if (arguments.m_benchFilePath)
+            {
+                RunBenchmark(arguments, resolver, directoryIndexes, memoryFileSystem,
+                    QueryLog::GetMicroseconds(setupStart, QueryLog::GetTime()), output);
+            }
+            else if (isBatch && threadCount > 1 && !arguments.m_verbose &&
+                !arguments.m_copyToClipboard && !arguments.m_openContainingFolder &&
+                !arguments.m_cacheSize)
+            {
+                if (!ProcessPipelined(arguments, resolver, queries, threadCount, log, *writer, output))
+                    exitCode = -1;
+            }
+            else
+            {
+                TCHAR fileName[MAX_PATH];
+                bool isTruncated;
+
+                while (queries.Next(fileName, DIM(fileName), isTruncated))
+                {
+                    if (!ProcessQuery(arguments, resolver, fileName, isTruncated, isBatch, log, *writer, output))
+                        exitCode = -1;
+
+                    directoryIndexes.Trim();
+                }
+            }
+
+            if (arguments.m_imageCacheFilePath && imageMetadata.IsChanged())
+            {
+                error = imageMetadata.Save(arguments.m_imageCacheFilePath);
+
+                if (NO_ERROR != error)
+                    throw SystemException(error);
+            }
+
+            if (arguments.m_showStatistics)
+            {
+                output.Flush();
+                ShowCacheStatistics(directoryIndexes);
+            }
+        }
+
+        {
+            PROFILE_PHASE(OutputPhase);
+            output.Flush();
+        }
+
+#ifdef FINDPATH_PROFILER
+        if (arguments.m_profile)
+            ShowProfile();
+#endif
+    }
+    catch (SystemException& e)
+    {
+        ShowError(e.GetCode());
+        exitCode = -1;
+    }
+    catch (ApplicationException& e)
+    {
+        cerr << e.GetMessage() << _T('\n');
+
+        exitCode = -1;
+    }
+
+    return exitCode;
+}
+
+// --------------------------------------------------------------------------
+//  ProcessQuery
+// --------------------------------------------------------------------------
+
+bool ProcessQuery(const CommandLineHandler& arguments, const Resolver& resolver,
+    LPCTSTR fileName, bool isTruncated, bool isBatch, QueryLog& log, RecordWriter& writer,
+    BufferedOutputStream& output)
+{
+    _ASSERT(fileName);
+
+    //
+    // Search for the file, trying each extension from PATHEXT in turn if
+    // the name alone is not found. The trace goes to the error stream
+    // for the machine-readable formats so as not to corrupt them. A name
+    // that was cut short is not searched for at all since it would be
+    // the wrong name.
+    //
+
+    if (arguments.m_verbose)
+        output.Flush();
+
+    Resolution resolution;
+    DWORD error = ERROR_FILENAME_EXCED_RANGE;
+
+    const LONGLONG start = QueryLog::GetTime();
+
+    if (!isTruncated)
+    {
+        error = resolver.Resolve(fileName, resolution,
+            arguments.m_verbose ? TraceSearch : NULL,
+            TextFormat == arguments.m_format ? &cout : &cerr);
+    }
+
+    log.Write(fileName, QueryLog::GetMicroseconds(start, QueryLog::GetTime()), error);
+
+    WIN32_FILE_ATTRIBUTE_DATA metadata;
+    const bool hasMetadata = QueryMetadata(arguments, error, resolution, metadata);
+
+    ImageMetadata image;
+    const bool hasImage = QueryImageMetadata(arguments, resolver, error, resolution, image);
+
+    if (!ReportQuery(arguments, resolver, NULL, fileName, error, resolution,
+            hasMetadata ? &metadata : NULL, hasImage ? &image : NULL, isBatch, writer, output))
+    {
+        return false;
+    }
+
+    LPCTSTR path = resolution.path;
+
+    if (arguments.m_copyToClipboard || arguments.m_openContainingFolder || arguments.m_extractManifest)
+        output.Flush();
+
+    //
+    // Copy to the clipboard if requested.
+    //
+
+    if (arguments.m_copyToClipboard)
+    {
+        TCHAR quotedPath[MAX_PATH + 2];
+        LPCTSTR formattedPath = path;
+
+        if (StrChr(path, _T(' ')))
+        {
+            wsprintf(quotedPath, _T("\"%s\""), path);
+            formattedPath = quotedPath;
+        }
+
+        CopyToClipboard(formattedPath);
+    }
+
+    //
+    // Open the containing folder in Windows Explorer if requested.
+    //
+
+    if (arguments.m_openContainingFolder)
+        OpenContainingFolder(path);
+
+    if (arguments.m_extractManifest)
+        ExtractManifest(path, resolver.GetImageMetadata());
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+//  ProcessPipelined
+// --------------------------------------------------------------------------
+
+struct PipelinedQuery
+{
+    TCHAR fileName[MAX_PATH];
+    bool isTruncated;
+    DWORD error;
+    DWORD microseconds;
+    Resolution resolution;
+    WIN32_FILE_ATTRIBUTE_DATA metadata;
+    bool hasMetadata;
+    ImageMetadata image;
+    bool hasImage;
+};
+
+struct PipelineContext
+{
+    const CommandLineHandler* arguments;
+    const Resolver* resolver;
+    QueryReader* queries;
+    PipelinedQuery* slots;
+    QueryLog* log;
+    RecordWriter* writer;
+    BufferedOutputStream* output;
+    bool isSuccessful;
+};
+
+static bool CALLBACK ReadPipelinedQuery(int slot, LPVOID context)
+{
+    PipelineContext& pipeline = *static_cast<PipelineContext*>(context);
+    PipelinedQuery& query = pipeline.slots[slot];
+
+    return pipeline.queries->Next(query.fileName, DIM(query.fileName), query.isTruncated);
+}
+
+static void CALLBACK ResolvePipelinedQuery(int slot, LPVOID context)
+{
+    PipelineContext& pipeline = *static_cast<PipelineContext*>(context);
+    PipelinedQuery& query = pipeline.slots[slot];
+
+    const LONGLONG start = QueryLog::GetTime();
+
+    query.error = query.isTruncated ? ERROR_FILENAME_EXCED_RANGE :
+        pipeline.resolver->Resolve(query.fileName, query.resolution);
+
+    query.microseconds = QueryLog::GetMicroseconds(start, QueryLog::GetTime());
+
+    query.hasMetadata = QueryMetadata(*pipeline.arguments, query.error,
+        query.resolution, query.metadata);
+
+    query.hasImage = QueryImageMetadata(*pipeline.arguments, *pipeline.resolver, query.error,
+        query.resolution, query.image);
+}
+
+static void CALLBACK WritePipelinedQuery(int slot, LPVOID context)
+{
+    PipelineContext& pipeline = *static_cast<PipelineContext*>(context);
+    const PipelinedQuery& query = pipeline.slots[slot];
+    const CommandLineHandler& arguments = *pipeline.arguments;
+
+    pipeline.log->Write(query.fileName, query.microseconds, query.error);
+
+    if (!ReportQuery(arguments, *pipeline.resolver, NULL, query.fileName, query.error,
+            query.resolution, query.hasMetadata ? &query.metadata : NULL,
+            query.hasImage ? &query.image : NULL, true, *pipeline.writer, *pipeline.output))
+    {
+        pipeline.isSuccessful = false;
+        return;
+    }
+
+    if (arguments.m_extractManifest)
+    {
+        pipeline.output->Flush();
+        ExtractManifest(query.resolution.path, pipeline.resolver->GetImageMetadata());
+    }
+}
+
+bool ProcessPipelined(const CommandLineHandler& arguments, const Resolver& resolver,
+    QueryReader& queries, int threadCount, QueryLog& log, RecordWriter& writer,
+    BufferedOutputStream& output)
+{
+    //
+    // Names are read, resolved and reported in stages that overlap, with
+    // up to a fixed number of names in flight at any one time. Looking
+    // up metadata goes with resolving since it too waits on the file
+    // system. Everything that writes to the console, including manifest
+    // extraction, stays with reporting so that it comes out in the order
+    // the names went in.
+    //
+
+    enum { SlotCount = 1024 };
+
+    Array<PipelinedQuery> slots;
+    slots.SetCount(SlotCount);
+
+    PipelineContext context = { &arguments, &resolver, &queries, slots.GetData(),
+        &log, &writer, &output, true };
+
+    const DWORD error = ParallelPipeline(threadCount, SlotCount, ReadPipelinedQuery,
+        ResolvePipelinedQuery, WritePipelinedQuery, &context);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    return context.isSuccessful;
+}
+
+// --------------------------------------------------------------------------
+//  RunBenchmark
+// --------------------------------------------------------------------------
+
+static bool CALLBACK ReadBenchmarkQuery(LPTSTR fileName, int capacity, bool& isTruncated, LPVOID context)
+{
+    QueryReader& queries = *static_cast<QueryReader*>(context);
+
+    if (!queries.Next(fileName, capacity, isTruncated))
+        return false;
+
+    QueryLog::ParseName(fileName);
+
+    return true;
+}
+
+void RunBenchmark(const CommandLineHandler& arguments, const Resolver& resolver,
+    DirectoryIndexTable& directoryIndexes, const MemoryFileSystem& memoryFileSystem,
+    DWORD setupMicroseconds, BufferedOutputStream& output)
+{
+    _ASSERT(arguments.m_benchFilePath);
+
+    //
+    // Replay the names in the log, or any list of names for that matter,
+    // against the resolver as it was set up by the other options: cold,
+    // from an index file, from shared listings, from a lookup index or
+    // within a cache. Names are replayed on every processor unless told
+    // otherwise.
+    //
+
+    Array<LPCTSTR> noFileNames;
+    QueryReader queries(noFileNames, arguments.m_benchFilePath);
+
+    const LONG waitCountBefore = memoryFileSystem.GetWaitCount();
+
+    Benchmark benchmark;
+
+    DWORD error = benchmark.Run(resolver, ReadBenchmarkQuery, &queries,
+        arguments.m_threadCount, &directoryIndexes);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    //
+    // Report throughput over the whole replay and latency per name,
+    // along with what the names cost in file system calls, both as the
+    // resolver saw them and as the file system was asked to make them.
+    // Fractions are worked out in hundredths.
+    //
+
+    const BenchmarkResult& result = benchmark.GetResult();
+    const ResolverStatistics& resolverStatistics = result.resolverStatistics;
+    const FileSystemStatistics& calls = result.fileSystemStatistics;
+
+    const DWORD callsPerQuery = result.queryCount ? static_cast<DWORD>(
+        (static_cast<ULONGLONG>(calls.attributeCount) + calls.listingCount + calls.readCount + calls.mapCount) *
+        100 / result.queryCount) : 0;
+
+    TCHAR line[160];
+
+    wsprintf(line, _T("Queries:      %d, %d not found\n"), result.queryCount, result.missCount);
+    output << line;
+
+    wsprintf(line, _T("Setup:        %lu.%03lu ms\n"),
+        setupMicroseconds / 1000, setupMicroseconds % 1000);
+    output << line;
+
+    wsprintf(line, _T("Replay:       %lu.%03lu ms on %d thread%s\n"),
+        result.elapsedMicroseconds / 1000, result.elapsedMicroseconds % 1000,
+        result.threadCount, result.threadCount > 1 ? _T("s") : _T(""));
+    output << line;
+
+    wsprintf(line, _T("Throughput:   %lu queries/s\n"), result.throughput);
+    output << line;
+
+    wsprintf(line, _T("Latency (us): p50 %lu, p90 %lu, p99 %lu, p99.9 %lu, max %lu\n"),
+        benchmark.GetPercentile(500), benchmark.GetPercentile(900),
+        benchmark.GetPercentile(990), benchmark.GetPercentile(999),
+        benchmark.GetPercentile(1000));
+    output << line;
+
+    wsprintf(line, _T("Resolver:     %lu probes, %lu image reads, %lu listings\n"),
+        resolverStatistics.probeCount, resolverStatistics.imageReadCount,
+        resolverStatistics.listingCount);
+    output << line;
+
+    wsprintf(line, _T("File system:  %lu attributes, %lu listings, %lu reads, %lu maps, %lu.%02lu per query\n"),
+        calls.attributeCount, calls.listingCount, calls.readCount, calls.mapCount,
+        callsPerQuery / 100, callsPerQuery % 100);
+    output << line;
+
+    //
+    // The simulated latency is spent asleep, so it is reported as time
+    // waited, summed over every thread, rather than as work done.
+    //
+
+    if (arguments.m_simulate)
+    {
+        const DWORD waitCount = memoryFileSystem.GetWaitCount() - waitCountBefore;
+        const ULONGLONG waitMicroseconds = static_cast<ULONGLONG>(waitCount) * arguments.m_latency;
+
+        wsprintf(line, _T("Simulated:    in memory, %lu us per call, %lu calls, %lu.%03lu ms waited\n"),
+            arguments.m_latency, waitCount,
+            static_cast<DWORD>(waitMicroseconds / 1000), static_cast<DWORD>(waitMicroseconds % 1000));
+        output << line;
+    }
+}
+
+// --------------------------------------------------------------------------
+//  QueryMetadata
+// --------------------------------------------------------------------------
+
+bool QueryMetadata(const CommandLineHandler& arguments, DWORD error,
+    const Resolution& resolution, WIN32_FILE_ATTRIBUTE_DATA& metadata)
+{
+    if (NO_ERROR != error || !arguments.m_showMetadata)
+        return false;
+
+    PROFILE_PHASE(MetadataPhase);
+
+    return FALSE != GetFileAttributesEx(resolution.path, GetFileExInfoStandard, &metadata);
+}
+
+// --------------------------------------------------------------------------
+//  QueryImageMetadata
+// --------------------------------------------------------------------------
+
+bool QueryImageMetadata(const CommandLineHandler& arguments, const Resolver& resolver,
+    DWORD error, const Resolution& resolution, ImageMetadata& image)
+{
+    const ImageMetadataCache* imageMetadata = resolver.GetImageMetadata();
+
+    if (NO_ERROR != error || !arguments.m_showMetadata || !imageMetadata)
+        return false;
+
+    PROFILE_PHASE(MetadataPhase);
+
+    return NO_ERROR == imageMetadata->Query(resolution.path, image) && NO_ERROR == image.error;
+}
+
+// --------------------------------------------------------------------------
+//  ReportQuery
+// --------------------------------------------------------------------------
+
+bool ReportQuery(const CommandLineHandler& arguments, const Resolver& resolver,
+    LPCTSTR profileName, LPCTSTR fileName, DWORD error, const Resolution& resolution,
+    const WIN32_FILE_ATTRIBUTE_DATA* metadata, const ImageMetadata* image, bool isBatch,
+    RecordWriter& writer, BufferedOutputStream& output)
+{
+    _ASSERT(fileName);
+
+    QueryRecord record = { fileName, error };
+    record.profile = profileName;
+
+    if (NO_ERROR == error)
+    {
+        record.resolution = &resolution;
+        record.metadata = metadata;
+        record.image = image;
+
+        if (resolution.extensionIndex >= 0)
+            record.extension = resolver.GetEnvironment().GetExtension(resolution.extensionIndex);
+    }
+
+    {
+        PROFILE_PHASE(OutputPhase);
+        writer.Write(record);
+    }
+
+    if (NO_ERROR == error)
+        return true;
+
+    if (TextFormat == arguments.m_format)
+    {
+        output.Flush();
+        ShowError(error, isBatch ? fileName : NULL, profileName);
+
+        //
+        // If the file simply could not be found anywhere then it may
+        // have been misspelled so offer the closest names instead. This
+        // is left out for profiles where it would mean listing every
+        // directory of every profile over again.
+        //
+
+        if (ERROR_FILE_NOT_FOUND == error && !profileName)
+            ShowSuggestions(resolver, fileName, arguments.m_suggestionCount);
+    }
+
+    return false;
+}
+
+// --------------------------------------------------------------------------
+//  ProcessProfiles
+// --------------------------------------------------------------------------
+
+bool ProcessProfiles(const CommandLineHandler& arguments, QueryReader& queries,
+    RecordWriter& writer, BufferedOutputStream& output)
+{
+    _ASSERT(arguments.m_profilesFilePath);
+
+    Array<TCHAR> profileText;
+    Array<EnvironmentProfile> profiles;
+
+    LoadProfiles(arguments.m_profilesFilePath, profileText, profiles);
+
+    if (!profiles.GetCount())
+        throw ApplicationException(_T("The profiles file does not define any profiles."));
+
+    const int profileCount = profiles.GetCount();
+
+    //
+    // Set up one resolver per profile. Between them they list each
+    // distinct directory only once.
+    //
+
+    ResolverOptions options = { 0 };
+    options.manifestFilePath = arguments.m_manifestFilePath;
+    options.machine = arguments.m_machine;
+
+    ApiSetSchema apiSetSchema;
+    KnownDllList knownDlls;
+
+    LoadRedirections(arguments.m_apiSetFilePath, arguments.m_knownDllsFilePath,
+        apiSetSchema, knownDlls, options);
+
+    ResolverSet resolvers;
+
+    DWORD error = resolvers.Initialize(profiles.GetData(), profileCount,
+        options, GetProcessorCount(), arguments.m_indexFilePath);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    //
+    // Take the names a chunk at a time, resolve each chunk against all
+    // profiles in parallel and then report the results in order, name
+    // by name and profile by profile.
+    //
+
+    enum { ChunkSize = 1024 };
+
+    Array<TCHAR> names;
+    Array<int> nameOffsets;
+    Array<bool> truncations;
+    Array<LPCTSTR> fileNames;
+    Array<Resolution> resolutions;
+    Array<DWORD> errors;
+
+    bool isSuccessful = true;
+    bool isAtEnd = false;
+
+    while (!isAtEnd)
+    {
+        names.Clear();
+        nameOffsets.Clear();
+        truncations.Clear();
+
+        TCHAR fileName[MAX_PATH];
+        bool isTruncated;
+
+        while (nameOffsets.GetCount() < ChunkSize)
+        {
+            if (!queries.Next(fileName, DIM(fileName), isTruncated))
+            {
+                isAtEnd = true;
+                break;
+            }
+
+            nameOffsets.Add(names.GetCount());
+            names.Append(fileName, lstrlen(fileName) + 1);
+            truncations.Add(isTruncated);
+        }
+
+        const int nameCount = nameOffsets.GetCount();
+
+        fileNames.SetCount(nameCount);
+
+        for (int i = 0; i < nameCount; i++)
+            fileNames[i] = names.GetData() + nameOffsets[i];
+
+        resolutions.SetCount(nameCount * profileCount);
+        errors.SetCount(nameCount * profileCount);
+
+        error = resolvers.ResolveAll(fileNames.GetData(), nameCount,
+            resolutions.GetData(), errors.GetData());
+
+        if (NO_ERROR != error)
+            throw SystemException(error);
+
+        for (int i = 0; i < nameCount; i++)
+        {
+            for (int j = 0; j < profileCount; j++)
+            {
+                const int result = i * profileCount + j;
+                const DWORD resultError = truncations[i] ? ERROR_FILENAME_EXCED_RANGE : errors[result];
+
+                WIN32_FILE_ATTRIBUTE_DATA metadata;
+                const bool hasMetadata = QueryMetadata(arguments, resultError,
+                    resolutions[result], metadata);
+
+                if (!ReportQuery(arguments, resolvers.GetResolver(j), profiles[j].name, fileNames[i],
+                        resultError, resolutions[result], hasMetadata ? &metadata : NULL, NULL,
+                        true, writer, output))
+                {
+                    isSuccessful = false;
+                }
+            }
+        }
+    }
+
+    return isSuccessful;
+}
+
+// --------------------------------------------------------------------------
+//  SearchTrees
+// --------------------------------------------------------------------------
+
+struct TreeSearchContext
+{
+    const CommandLineHandler* arguments;
+    const SearchEnvironment* environment;
+    const Array<TCHAR>* text;
+    const Array<int>* offsets;
+    RecordWriter* writer;
+};
+
+bool SearchTrees(const CommandLineHandler& arguments, QueryReader& queries,
+    RecordWriter& writer, BufferedOutputStream& output)
+{
+    SearchEnvironment environment;
+    environment.Capture();
+
+    //
+    // Every name has to be known before the trees are walked since each
+    // is walked just once, looking for all of them at the same time.
+    //
+
+    TreeSearch search(environment);
+    Array<TCHAR> text;
+    Array<int> offsets;
+    bool isSuccessful = true;
+
+    TCHAR fileName[MAX_PATH];
+    bool isTruncated;
+
+    while (queries.Next(fileName, DIM(fileName), isTruncated))
+    {
+        if (isTruncated)
+        {
+            QueryRecord record = { fileName, ERROR_FILENAME_EXCED_RANGE };
+            writer.Write(record);
+
+            if (TextFormat == arguments.m_format)
+            {
+                output.Flush();
+                ShowError(ERROR_FILENAME_EXCED_RANGE, fileName);
+            }
+
+            isSuccessful = false;
+            continue;
+        }
+
+        offsets.Add(text.GetCount());
+        text.Append(fileName, lstrlen(fileName) + 1);
+        search.AddName(fileName);
+    }
+
+    //
+    // Matches are written out as they are found, in no particular order,
+    // followed by the names that were not found anywhere.
+    //
+
+    TreeSearchContext context = { &arguments, &environment, &text, &offsets, &writer };
+
+    DWORD error = search.Search(arguments.m_roots.GetData(), arguments.m_roots.GetCount(),
+        arguments.m_isFirstMatchOnly, GetProcessorCount(), ReportTreeMatch, &context);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    const bool isBatch = search.GetNameCount() > 1;
+
+    for (int i = 0; i < search.GetNameCount(); i++)
+    {
+        if (search.IsFound(i))
+            continue;
+
+        LPCTSTR name = text.GetData() + offsets[i];
+        QueryRecord record = { name, ERROR_FILE_NOT_FOUND };
+        writer.Write(record);
+
+        if (TextFormat == arguments.m_format)
+        {
+            output.Flush();
+            ShowError(ERROR_FILE_NOT_FOUND, isBatch ? name : NULL);
+        }
+
+        isSuccessful = false;
+    }
+
+    return isSuccessful;
+}
+
+bool CALLBACK ReportTreeMatch(int nameIndex, int extensionIndex, LPCTSTR path, LPVOID context)
+{
+    _ASSERT(path);
+    _ASSERT(context);
+
+    const TreeSearchContext& search = *static_cast<const TreeSearchContext*>(context);
+
+    //
+    // A match in a tree is not in any directory of the search order.
+    //
+
+    Resolution resolution;
+    lstrcpyn(resolution.path, path, DIM(resolution.path));
+    resolution.directoryIndex = -1;
+    resolution.extensionIndex = extensionIndex;
+
+    QueryRecord record = { search.text->GetData() + (*search.offsets)[nameIndex], NO_ERROR };
+    record.resolution = &resolution;
+
+    if (extensionIndex >= 0)
+        record.extension = search.environment->GetExtension(extensionIndex);
+
+    WIN32_FILE_ATTRIBUTE_DATA metadata;
+
+    if (search.arguments->m_showMetadata &&
+        GetFileAttributesEx(path, GetFileExInfoStandard, &metadata))
+    {
+        record.metadata = &metadata;
+    }
+
+    search.writer->Write(record);
+
+    return true;
+}
+
+#ifdef FINDPATH_PROFILER
+
+// --------------------------------------------------------------------------
+//  ShowProfile
+// --------------------------------------------------------------------------
+
+void ShowProfile()
+{
+    cerr << _T("\nPhase            Calls   Wall (ms)    CPU (ms)  Cycles (M)\n\n");
+
+    for (int i = 0; i < ProfilePhaseCount; i++)
+    {
+        const ProfilePhase phase = static_cast<ProfilePhase>(i);
+
+        ProfileCounters counters;
+        Profiler::GetCounters(phase, counters);
+
+        const DWORD cycleTenths = static_cast<DWORD>(counters.cycleCount / 100000);
+
+        TCHAR line[96];
+
+        wsprintf(line, _T("%-12s %9lu %7lu.%03lu %7lu.%03lu %9lu.%lu\n"),
+            Profiler::GetPhaseName(phase),
+            static_cast<DWORD>(counters.callCount),
+            static_cast<DWORD>(counters.elapsedMicroseconds / 1000),
+            static_cast<DWORD>(counters.elapsedMicroseconds % 1000),
+            static_cast<DWORD>(counters.cpuMicroseconds / 1000),
+            static_cast<DWORD>(counters.cpuMicroseconds % 1000),
+            cycleTenths / 10, cycleTenths % 10);
+
+        cerr << line;
+    }
+}
+
+#endif
+
+// --------------------------------------------------------------------------
+//  ShowCacheStatistics
+// --------------------------------------------------------------------------
+
+void ShowCacheStatistics(const DirectoryIndexTable& directoryIndexes)
+{
+    DirectoryCacheStatistics statistics;
+    directoryIndexes.GetStatistics(statistics);
+
+    //
+    // The hit ratio is worked out in tenths of a percent.
+    //
+
+    const ULONGLONG lookupCount = statistics.hitCount + statistics.missCount;
+    const DWORD hitRatio = lookupCount ?
+        static_cast<DWORD>(statistics.hitCount * 1000 / lookupCount) : 0;
+
+    TCHAR heldSize[32];
+    StrFormatByteSize64(statistics.heldSize, heldSize, DIM(heldSize));
+
+    TCHAR budget[32];
+    StrFormatByteSize64(statistics.budget, budget, DIM(budget));
+
+    TCHAR line[160];
+
+    wsprintf(line, _T("Directory cache: %lu hits, %lu misses, %lu.%lu%% hit ratio\n"),
+        static_cast<DWORD>(statistics.hitCount), static_cast<DWORD>(statistics.missCount),
+        hitRatio / 10, hitRatio % 10);
+
+    cerr << line;
+
+    wsprintf(line, _T("                 %s held of %s in %d of %d directories, %lu evictions\n"),
+        heldSize, budget, statistics.heldCount, statistics.indexCount, statistics.evictionCount);
+
+    cerr << line;
+}
+
+// --------------------------------------------------------------------------
+//  ExportSnapshot
+// --------------------------------------------------------------------------
+
+void ExportSnapshot(LPCTSTR indexFilePath, bool isBinary, BufferedOutputStream& output)
+{
+    //
+    // Every directory in the search order is listed, all at once, or
+    // brought up to date from the index file if there is one, and the
+    // snapshot is worked out from the listings alone.
+    //
+
+    DirectoryIndexTable directoryIndexes;
+    Resolver resolver;
+
+    ResolverOptions options = { 0 };
+    options.directoryIndexes = &directoryIndexes;
+
+    DWORD error = resolver.Initialize(options);
+
+    if (NO_ERROR == error && indexFilePath)
+        error = directoryIndexes.Refresh(indexFilePath, GetProcessorCount());
+
+    if (NO_ERROR == error)
+        error = resolver.ScanDirectories(GetProcessorCount());
+
+    ResolutionSnapshot snapshot;
+
+    if (NO_ERROR == error)
+        error = snapshot.Build(resolver.GetEnvironment(), resolver.GetDirectoryIndexes());
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    //
+    // The binary form is the image as it is. The text form has a line
+    // per command with a tab between it and its path.
+    //
+
+    if (isBinary)
+    {
+        output.WriteBytes(snapshot.GetImage(), snapshot.GetImageSize());
+        return;
+    }
+
+    for (int i = 0; i < snapshot.GetCount(); i++)
+    {
+        TCHAR command[MAX_PATH];
+        TCHAR path[MAX_PATH];
+
+        output << snapshot.GetCommand(i, command) << _T('\t')
+               << snapshot.GetPath(i, path) << _T('\n');
+    }
+}
+
+// --------------------------------------------------------------------------
+//  ReportShadows
+// --------------------------------------------------------------------------
+
+struct ShadowContext
+{
+    const ShadowReport* report;
+    BufferedOutputStream* output;
+};
+
+static void WriteShadow(const ShadowReport& report, int index,
+    const ShadowComparison* comparison, BufferedOutputStream& output)
+{
+    output << report.GetCommand(index) << _T('\n');
+
+    for (int i = 0; i < report.GetCopyCount(index); i++)
+    {
+        TCHAR path[MAX_PATH];
+        output << (i ? _T("    ") : _T("  * ")) << report.GetPath(index, i, path);
+
+        if (comparison && i && i < ShadowComparison::MaxCopyCount)
+        {
+            const DWORD differences = comparison->differences[i];
+
+            if (NO_ERROR != comparison->errors[i])
+            {
+                output << _T(" (error ") << comparison->errors[i] << _T(")");
+            }
+            else if (!differences)
+            {
+                output << _T(" (same)");
+            }
+            else
+            {
+                output << _T(" (")
+                       << (differences & FileSizeDiffers ? _T("size ") : _T(""))
+                       << (differences & FileVersionDiffers ? _T("version ") : _T(""))
+                       << (differences & FileContentDiffers ? _T("content ") : _T(""))
+                       << _T("differ)");
+            }
+        }
+
+        output << _T('\n');
+    }
+}
+
+static void CALLBACK WriteShadowComparison(const ShadowComparison& comparison, LPVOID context)
+{
+    ShadowContext& shadows = *static_cast<ShadowContext*>(context);
+
+    WriteShadow(*shadows.report, comparison.index, &comparison, *shadows.output);
+}
+
+void ReportShadows(LPCTSTR indexFilePath, bool isComparing, BufferedOutputStream& output)
+{
+    //
+    // Every directory in the search order is listed, all at once, or
+    // brought up to date from the index file if there is one, and the
+    // names in all of them are then joined in one go.
+    //
+
+    DirectoryIndexTable directoryIndexes;
+    Resolver resolver;
+
+    ResolverOptions options = { 0 };
+    options.directoryIndexes = &directoryIndexes;
+
+    DWORD error = resolver.Initialize(options);
+
+    if (NO_ERROR == error && indexFilePath)
+        error = directoryIndexes.Refresh(indexFilePath, GetProcessorCount());
+
+    if (NO_ERROR == error)
+        error = resolver.ScanDirectories(GetProcessorCount());
+
+    ShadowReport report;
+
+    if (NO_ERROR == error)
+        error = report.Build(resolver.GetEnvironment(), resolver.GetDirectoryIndexes());
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    if (!isComparing)
+    {
+        for (int i = 0; i < report.GetCount(); i++)
+            WriteShadow(report, i, NULL, output);
+
+        return;
+    }
+
+    ShadowContext context = { &report, &output };
+
+    error = report.CompareCopies(GetProcessorCount(), WriteShadowComparison, &context);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+}
+
+// --------------------------------------------------------------------------
+//  FindExports
+// --------------------------------------------------------------------------
+
+bool FindExports(LPCTSTR exportsFilePath, QueryReader& queries, bool isBatch,
+    BufferedOutputStream& output)
+{
+    _ASSERT(exportsFilePath);
+
+    //
+    // Bring the index of every export in the search order up to date,
+    // parsing only the images that changed since it was saved, and then
+    // answer for each name from it.
+    //
+
+    SearchEnvironment environment;
+    environment.Capture();
+
+    ExportIndex exports;
+
+    DWORD error = exports.Refresh(exportsFilePath, environment.GetSearchOrder(), GetProcessorCount());
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    bool isSuccessful = true;
+
+    TCHAR symbol[ExportIndex::MaxSymbolLength];
+    bool isTruncated;
+
+    while (queries.Next(symbol, DIM(symbol), isTruncated))
+    {
+        const DWORD* exportIndexes = NULL;
+        const int count = isTruncated ? 0 : exports.Find(symbol, exportIndexes);
+
+        if (!count)
+        {
+            output.Flush();
+            ShowError(ERROR_PROC_NOT_FOUND, isBatch ? symbol : NULL);
+            isSuccessful = false;
+            continue;
+        }
+
+        //
+        // One line per image exporting the name, in order of precedence,
+        // with the ordinal and whatever the export is forwarded to.
+        //
+
+        for (int i = 0; i < count; i++)
+        {
+            const DWORD exportIndex = exportIndexes[i];
+
+            if (isBatch)
+                output << symbol << _T(": ");
+
+            LPCTSTR path = exports.GetImagePath(exportIndex);
+            const bool isQuoted = NULL != StrChr(path, _T(' '));
+
+            if (isQuoted)
+                output << _T('"');
+
+            output << path;
+
+            if (isQuoted)
+                output << _T('"');
+
+            output << _T(" @") << exports.GetOrdinal(exportIndex);
+
+            LPCTSTR forwarder = exports.GetForwarder(exportIndex);
+
+            if (forwarder)
+                output << _T(" -> ") << forwarder;
+
+            output << _T('\n');
+        }
+    }
+
+    return isSuccessful;
+}
+
+// --------------------------------------------------------------------------
+//  ValidateImports
+// --------------------------------------------------------------------------
+
+bool ValidateImports(const CommandLineHandler& arguments, QueryReader& queries,
+    BufferedOutputStream& output)
+{
+    ApiSetSchema apiSetSchema;
+    KnownDllList knownDlls;
+
+    ResolverOptions options = { 0 };
+    options.machine = arguments.m_machine;
+
+    LoadRedirections(arguments.m_apiSetFilePath, arguments.m_knownDllsFilePath,
+        apiSetSchema, knownDlls, options);
+
+    //
+    // The executables themselves are found through the search order of
+    // this process, the way they would be run from here.
+    //
+
+    Resolver processResolver;
+
+    DWORD error = processResolver.Initialize(options);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    bool isSuccessful = true;
+
+    TCHAR fileName[MAX_PATH];
+    bool isTruncated;
+
+    while (queries.Next(fileName, DIM(fileName), isTruncated))
+    {
+        Resolution resolution;
+        error = isTruncated ? ERROR_FILENAME_EXCED_RANGE : processResolver.Resolve(fileName, resolution);
+
+        if (NO_ERROR != error)
+        {
+            output.Flush();
+            ShowError(error, fileName);
+            isSuccessful = false;
+            continue;
+        }
+
+        //
+        // Its DLLs are found the way the loader would find them for it,
+        // and unless told otherwise, only those built for the same
+        // machine will do.
+        //
+
+        TCHAR applicationDirectory[MAX_PATH];
+        lstrcpy(applicationDirectory, resolution.path);
+        PathRemoveFileSpec(applicationDirectory);
+
+        EnvironmentProfile profile = { 0 };
+        profile.applicationDirectory = applicationDirectory;
+        profile.applicationPath = resolution.path;
+        profile.searchPolicy = arguments.m_hasSearchPolicy ?
+            arguments.m_searchPolicy : SafeDllSearchPolicy;
+
+        ResolverOptions executableOptions = options;
+        executableOptions.profile = &profile;
+
+        if (ImageMachine::Any == executableOptions.machine)
+            ImageMachine::Query(resolution.path, executableOptions.machine);
+
+        Resolver resolver;
+        ImportValidator validator;
+
+        error = resolver.Initialize(executableOptions);
+
+        if (NO_ERROR == error)
+            error = validator.Validate(resolution.path, resolver, GetProcessorCount());
+
+        if (NO_ERROR != error)
+        {
+            output.Flush();
+            ShowError(error, resolution.path);
+            isSuccessful = false;
+            continue;
+        }
+
+        //
+        // One line per problem, naming the module that imports what is
+        // missing, and then how far the check reached.
+        //
+
+        for (int i = 0; i < validator.GetProblemCount(); i++)
+        {
+            ImportProblem problem;
+            validator.GetProblem(i, problem);
+
+            output << validator.GetModulePath(problem.moduleIndex) << _T(": ") << problem.dllName;
+
+            if (problem.symbol)
+                output << _T('!') << problem.symbol;
+            else if (problem.ordinal)
+                output << _T("!#") << problem.ordinal;
+
+            if (ERROR_MOD_NOT_FOUND == problem.error)
+                output << _T(": DLL not found\n");
+            else if (ERROR_PROC_NOT_FOUND == problem.error)
+                output << _T(": entry point not found\n");
+            else
+                output << _T(": cannot be loaded (") << problem.error << _T(")\n");
+        }
+
+        output << resolution.path << _T(": ") << validator.GetModuleCount() << _T(" modules, ")
+               << validator.GetProblemCount() << _T(" problems\n");
+
+        if (validator.GetProblemCount())
+            isSuccessful = false;
+    }
+
+    return isSuccessful;
+}
+
+// --------------------------------------------------------------------------
+//  GetApplicationProfile
+// --------------------------------------------------------------------------
+
+bool GetApplicationProfile(const CommandLineHandler& arguments, EnvironmentProfile& profile,
+    LPTSTR fromPath, WORD& machine)
+{
+    _ASSERT(fromPath);
+
+    //
+    // On behalf of another application, search as the loader would for
+    // it, for its machine unless told otherwise. The full path goes into
+    // the buffer given, which must hold MAX_PATH characters.
+    //
+
+    if (arguments.m_fromPath)
+    {
+        if (!GetFullPathName(arguments.m_fromPath, MAX_PATH, fromPath, NULL))
+            SystemException::ThrowLast();
+
+        if (INVALID_FILE_ATTRIBUTES == GetFileAttributes(fromPath))
+            SystemException::ThrowLast();
+
+        profile.applicationPath = fromPath;
+        profile.searchPolicy = SafeDllSearchPolicy;
+
+        if (ImageMachine::Any == machine)
+            ImageMachine::Query(fromPath, machine);
+    }
+
+    if (arguments.m_hasSearchPolicy)
+        profile.searchPolicy = arguments.m_searchPolicy;
+
+    return arguments.m_fromPath || arguments.m_hasSearchPolicy;
+}
+
+// --------------------------------------------------------------------------
+//  CaptureHost
+// --------------------------------------------------------------------------
+
+void CaptureHost(const CommandLineHandler& arguments)
+{
+    _ASSERT(arguments.m_captureFilePath);
+
+    EnvironmentProfile profile = { 0 };
+    TCHAR fromPath[MAX_PATH];
+    WORD machine = arguments.m_machine;
+
+    const bool hasProfile = GetApplicationProfile(arguments, profile, fromPath, machine);
+
+    DWORD error = HostCapture::Capture(arguments.m_captureFilePath,
+        hasProfile ? &profile : NULL, arguments.m_showMetadata, GetProcessorCount());
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+}
+
+// --------------------------------------------------------------------------
+//  ReplayCapture
+// --------------------------------------------------------------------------
+
+bool ReplayCapture(const CommandLineHandler& arguments, QueryReader& queries,
+    RecordWriter& writer, BufferedOutputStream& output)
+{
+    _ASSERT(arguments.m_replayFilePath);
+
+    //
+    // Resolve every name against the host the capture was taken on
+    // rather than this one. Nothing here is looked at, so there is no
+    // metadata to report and no trace of the search to give.
+    //
+
+    HostCapture capture;
+
+    DWORD error = capture.Load(arguments.m_replayFilePath);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    ResolverOptions options = { 0 };
+    options.machine = arguments.m_machine;
+
+    ApiSetSchema apiSetSchema;
+    KnownDllList knownDlls;
+
+    LoadRedirections(arguments.m_apiSetFilePath, arguments.m_knownDllsFilePath,
+        apiSetSchema, knownDlls, options);
+
+    Resolver resolver;
+    error = capture.InitializeResolver(resolver, options);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    const bool isBatch = arguments.m_batchFilePath || arguments.m_fileNames.GetCount() > 1;
+    bool isSuccessful = true;
 
-        return true;
-    }
+    TCHAR fileName[MAX_PATH];
+    bool isTruncated;
 
-    bool EndOfParse()
+    while (queries.Next(fileName, DIM(fileName), isTruncated))
     {
-        if (!m_showHelp && !m_fileName)
+        Resolution resolution;
+
+        error = isTruncated ? ERROR_FILENAME_EXCED_RANGE :
+            resolver.Resolve(fileName, resolution);
+
+        QueryRecord record = { fileName, error };
+
+        if (NO_ERROR == error)
         {
-            cerr << _T("Missing file name.\n");
-            return false;
+            record.resolution = &resolution;
+
+            if (resolution.extensionIndex >= 0)
+                record.extension = resolver.GetEnvironment().GetExtension(resolution.extensionIndex);
         }
 
-        return true;
-    }
+        writer.Write(record);
 
-private:
+        if (NO_ERROR != error)
+        {
+            if (TextFormat == arguments.m_format)
+            {
+                output.Flush();
+                ShowError(error, isBatch ? fileName : NULL);
+            }
 
-    static bool IsOption(LPCTSTR test, LPCTSTR option)
-    {
-        return CSTR_EQUAL == CompareString(LOCALE_INVARIANT, 0, test, -1, option, -1);
+            isSuccessful = false;
+        }
     }
 
-    CommandLineHandler(const CommandLineHandler&);
-    CommandLineHandler& operator=(const CommandLineHandler&);
-};
+    return isSuccessful;
+}
 
 // --------------------------------------------------------------------------
-//  main
+//  AnalyzeSearchOrder
 // --------------------------------------------------------------------------
 
-template<class P>
-void GetProcAddress(HMODULE module, LPCTSTR procedureName, P& procedure)
+void AnalyzeSearchOrder(QueryReader& queries)
 {
-    procedure = (P) GetProcAddress(module, procedureName);
-}
+    PathAnalysis analysis;
 
-int _tmain(int argsLength, LPCTSTR args[])
-{
-#ifdef _DEBUG
-    
-    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | 
-        _CRTDBG_CHECK_ALWAYS_DF | _CRTDBG_LEAK_CHECK_DF);
+    DWORD error = analysis.Analyze(NULL, GetProcessorCount());
 
-#endif
+    if (NO_ERROR != error)
+        throw SystemException(error);
 
-    int exitCode = 0;
-    LPTSTR path = NULL;
-    LPTSTR formattedPath = NULL;
-    HANDLE activationContext = NULL;
-    ULONG_PTR activationContextActivationCookie = 0;
-    HMODULE kernelLibrary = NULL;
+    //
+    // The names given, if any, are taken to be a log of the queries that
+    // the search order typically has to answer.
+    //
 
-    try
+    TCHAR fileName[MAX_PATH];
+    bool isTruncated;
+
+    while (queries.Next(fileName, DIM(fileName), isTruncated))
     {
-        //
-        // Parse command-line arguments.
-        //
+        if (!isTruncated)
+            analysis.AddQuery(fileName);
+    }
 
-        CommandLineArguments<CommandLineHandler> arguments;
+    const SearchOrder& searchOrder = analysis.GetSearchOrder();
+    const int count = searchOrder.GetCount();
 
-        if (!arguments.Parse(argsLength, args))
+    cout << _T("  #  Status     Miss (ms)    Probes      Hits  Directory\n\n");
+
+    for (int i = 0; i < count; i++)
+    {
+        const PathEntry& entry = analysis.GetEntry(i);
+
+        static const LPCTSTR statusNames[] =
         {
-            TCHAR moduleFileName[MAX_PATH];
-            GetModuleFileName(NULL, moduleFileName, DIM(moduleFileName));
-            PathStripPath(moduleFileName);
-            PathRemoveExtension(moduleFileName);
+            _T("ok"),
+            _T("duplicate"),
+            _T("missing"),
+            _T("not dir"),
+            _T("unreachable")
+        };
 
-            cerr << _T("\nTry '") << moduleFileName << _T(" -?' for more help.\n");
+        TCHAR line[64];
 
-            return -1;
-        }
+        wsprintf(line, _T("%3d  %-11s %4lu.%03lu %9lu %9lu  "),
+            i + 1, statusNames[entry.status],
+            entry.missMicroseconds / 1000, entry.missMicroseconds % 1000,
+            entry.probeCount, entry.hitCount);
 
-        if (!arguments.m_suppressLogo)
-            ShowLogo();
+        cout << line << searchOrder.GetDirectory(i);
 
-        //
-        // If showing usage, then also exit program.
-        //
+        if (i < searchOrder.GetFirstPathIndex())
+            cout << _T(" (fixed)");
 
-        if (arguments.m_showHelp)
-        {
-            ShowHelp();
-            return 0;
-        }
+        cout << _T('\n');
+    }
 
-        if (arguments.m_manifestFilePath)
-        {
-            kernelLibrary = LoadLibrary(_T("kernel32.dll"));
-            
-            bool isAvailable = false;
+    //
+    // Call out the entries that only cost time without ever answering
+    // anything, and those that are slow to answer a miss.
+    //
 
-            if (NULL != kernelLibrary)
-            {
-                #ifdef UNICODE
-                    GetProcAddress(kernelLibrary, _T("CreateActCtxW"), ActivationContext::Create);
-                #else
-                    GetProcAddress(kernelLibrary, _T("CreateActCtxA"), ActivationContext::Create);
-                #endif
+    cout << _T('\n');
 
-                GetProcAddress(kernelLibrary, _T("ActivateActCtx"), ActivationContext::Activate);
-                GetProcAddress(kernelLibrary, _T("DeactivateActCtx"), ActivationContext::Deactivate);
-                GetProcAddress(kernelLibrary, _T("ReleaseActCtx"), ActivationContext::Release);
+    for (int i = 0; i < count; i++)
+    {
+        const PathEntry& entry = analysis.GetEntry(i);
+
+        if (PathEntryDuplicate == entry.status)
+            cout << _T("Entry ") << i + 1 << _T(" is a duplicate of entry ") << entry.duplicateOf + 1 << _T(".\n");
+        else if (PathEntryMissing == entry.status)
+            cout << _T("Entry ") << i + 1 << _T(" does not exist.\n");
+        else if (PathEntryNotDirectory == entry.status)
+            cout << _T("Entry ") << i + 1 << _T(" is not a directory.\n");
+        else if (PathEntryUnreachable == entry.status)
+            cout << _T("Entry ") << i + 1 << _T(" cannot be reached (error ") << entry.error << _T(").\n");
+
+        if (entry.missMicroseconds >= PathAnalysis::SlowMissMicroseconds)
+            cout << _T("Entry ") << i + 1 << _T(" is slow to search.\n");
+    }
 
-                isAvailable = true;
-            }
+    Array<int> order;
+    error = analysis.ProposeOrder(order);
 
-            if (isAvailable)
-            {
-                ACTCTX activationContextSetup = { sizeof(activationContextSetup) };
-                
-                activationContextSetup.lpSource = arguments.m_manifestFilePath;
-                activationContext = CreateActCtx(&activationContextSetup);
+    if (NO_ERROR != error)
+        throw SystemException(error);
 
-                if (INVALID_HANDLE_VALUE == activationContext)
-                    SystemException::ThrowLast();
+    cout << _T("\nProposed PATH, resolving every name as before:\n\n");
 
-                if (!ActivateActCtx(activationContext, &activationContextActivationCookie))
-                    SystemException::ThrowLast();
-            }
-        }
+    for (int i = searchOrder.GetFirstPathIndex(); i < order.GetCount(); i++)
+        cout << _T("    ") << searchOrder.GetDirectory(order[i]) << _T('\n');
 
-        //
-        // Get the PATHEXT enivornment variable and create an array of
-        // extensions out of it. This is used during search to test
-        // against different extensions in case an extension was not
-        // supplied with the filename.
-        //
+    if (analysis.GetQueryCount())
+    {
+        Array<int> currentOrder;
 
-        LPCTSTR pathExtensions[31] = { 0 };
-        const int maxPathExtensionCount = DIM(pathExtensions) - 1;
+        for (int i = 0; i < count; i++)
+            currentOrder.Add(i);
 
-        DWORD pathExtLength = GetEnvironmentVariable(_T("PATHEXT"), NULL, 0);
-        LPTSTR pathExt = static_cast<LPTSTR>(_alloca(pathExtLength * sizeof(pathExt[0])));
-        GetEnvironmentVariable(_T("PATHEXT"), pathExt, pathExtLength);
+        cout << _T("\nProbes for ") << analysis.GetQueryCount() << _T(" queries: ")
+             << analysis.CountProbes(currentOrder) << _T(" now, ")
+             << analysis.CountProbes(order) << _T(" as proposed.\n");
+    }
+}
 
-        int pathExtensionCount = SplitString(pathExt, _T(';'));
+// --------------------------------------------------------------------------
+//  LoadRedirections
+// --------------------------------------------------------------------------
 
-        if (pathExtensionCount > maxPathExtensionCount)
-            pathExtensionCount = maxPathExtensionCount;
+void LoadRedirections(LPCTSTR apiSetFilePath, LPCTSTR knownDllsFilePath,
+    ApiSetSchema& apiSetSchema, KnownDllList& knownDlls, ResolverOptions& options)
+{
+    if (apiSetFilePath)
+    {
+        DWORD error = apiSetSchema.Load(apiSetFilePath);
 
-        LPCTSTR pathExtension = pathExt;
+        if (NO_ERROR != error)
+            throw SystemException(error);
 
-        for (int i = 0; i < pathExtensionCount; i++)
-        {
-            pathExtensions[i] = pathExtension;
-            pathExtension += lstrlen(pathExtension) + 1;
-        }
+        options.apiSetSchema = &apiSetSchema;
+    }
 
-        //
-        // Repeat search until all extensions have been tried.
-        //
+    if (knownDllsFilePath)
+    {
+        DWORD error = knownDlls.Load(knownDllsFilePath);
 
-        LPCTSTR extension = NULL;
-        int extensionIndex = -1;
+        if (NO_ERROR != error)
+            throw SystemException(error);
 
-        DWORD pathLength;
+        options.knownDlls = &knownDlls;
+    }
+}
 
-        do
-        {
-            if (arguments.m_verbose)
-            {
-                cout << _T("Searching for ") << arguments.m_fileName;
+// --------------------------------------------------------------------------
+//  LoadProfiles
+// --------------------------------------------------------------------------
 
-                if (extension)
-                    cout << extension;
-                
-                cout << _T('\n');
-            }
+void LoadProfiles(LPCTSTR filePath, Array<TCHAR>& text, Array<EnvironmentProfile>& profiles)
+{
+    _ASSERT(filePath);
 
-            //
-            // Get the search path, re-allocating receiving string
-            // as needed.
-            //
+    //
+    // Each section of the file is a profile named after the section:
+    //
+    //   [Spooler]
+    //   ApplicationDirectory=C:\WINDOWS\system32
+    //   CurrentDirectory=C:\WINDOWS\system32
+    //   Path=C:\WINDOWS\system32;C:\WINDOWS
+    //   PathExt=.COM;.EXE
+    //
+    // Any key that is missing or empty is taken from this process. The
+    // path has to be qualified or else the profile API goes looking for
+    // the file in the Windows directory.
+    //
 
-            pathLength = 0;
-            DWORD pathCapacity;
+    TCHAR fullPath[MAX_PATH];
+    DWORD length = GetFullPathName(filePath, DIM(fullPath), fullPath, NULL);
 
-            do
-            {
-                delete [] path;
-                
-                path = new TCHAR[pathLength];
-                
-                if (pathLength)
-                    path[0] = 0;
-                
-                if (!path)
-                    throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+    if (0 == length)
+        SystemException::ThrowLast();
 
-                pathCapacity = pathLength;
+    if (length >= MAX_PATH)
+        throw SystemException(ERROR_FILENAME_EXCED_RANGE);
 
-                LPTSTR filePart;
+    if (INVALID_FILE_ATTRIBUTES == GetFileAttributes(fullPath))
+        SystemException::ThrowLast();
 
-                pathLength = SearchPath(NULL, 
-                    arguments.m_fileName, extension, 
-                    pathCapacity, path, &filePart);
-            }
-            while (pathLength > pathCapacity);
+    Array<TCHAR> sectionNames;
+    DWORD size = 4096;
 
-            //
-            // Did SearchPath fail? Find out why.
-            //
+    for (;;)
+    {
+        sectionNames.SetCount(size);
+        sectionNames[0] = 0;
 
-            if (0 == pathLength)
-            {
-                delete [] path;
-                path = NULL;
+        if (GetPrivateProfileSectionNames(sectionNames.GetData(), size, fullPath) < size - 2)
+            break;
 
-                //
-                // If it is because the file was not found, then try the 
-                // next extension. Otherwise throw an exception holding 
-                // the last system error generated by SearchPath.
-                //
+        size *= 2;
+    }
 
-                DWORD lastError = GetLastError();
+    static const LPCTSTR keys[] =
+    {
+        _T("ApplicationDirectory"),
+        _T("CurrentDirectory"),
+        _T("Path"),
+        _T("PathExt"),
+        _T("Application"),
+        _T("SearchPolicy")
+    };
 
-                if (ERROR_FILE_NOT_FOUND == lastError)
-                {
-                    extension = pathExtensions[++extensionIndex];
+    enum { FieldCount = 1 + DIM(keys), MaxValueLength = 32767 };
 
-                    //
-                    // If at the end of the extensions array then just
-                    // raise an exception stating the file was not found.
-                    //
+    //
+    // Gather the text of all profiles first and only point the profiles
+    // into it once it has stopped moving about as it grows.
+    //
 
-                    if (!extension)
-                        throw SystemException(lastError);
-                }
-                else
-                {
-                    throw SystemException(lastError);
-                }
-            }
-        }
-        while (0 == pathLength);
+    Array<TCHAR> value;
+    value.SetCount(MaxValueLength + 1);
 
-        //
-        // Quote the path if there is space in it, for long file paths.
-        //
+    Array<int> offsets;
 
-        if (StrChr(path, _T(' ')))
-        {
-            formattedPath = new TCHAR[pathLength + 3];
+    text.Clear();
 
-            if (!formattedPath)
-                throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+    for (LPCTSTR section = sectionNames.GetData(); *section; section += lstrlen(section) + 1)
+    {
+        offsets.Add(text.GetCount());
+        text.Append(section, lstrlen(section) + 1);
 
-            formattedPath[0] = _T('"');
-            ::lstrcpy(formattedPath + 1, path);
-            formattedPath[pathLength + 1] = _T('"');
-            formattedPath[pathLength + 2] = 0;
-        }
-        else
+        for (int i = 0; i < FieldCount - 1; i++)
         {
-            formattedPath = path;
-        }
+            GetPrivateProfileString(section, keys[i], _T(""),
+                value.GetData(), value.GetCount(), fullPath);
 
-        //
-        // Display the path.
-        //
+            if (value[0])
+            {
+                offsets.Add(text.GetCount());
+                text.Append(value.GetData(), lstrlen(value.GetData()) + 1);
+            }
+            else
+            {
+                offsets.Add(-1);
+            }
+        }
+    }
 
-        cout << formattedPath << _T('\n');
+    profiles.SetCount(offsets.GetCount() / FieldCount);
 
-        //
-        // Copy to the clipboard if requested.
-        //
+    for (int i = 0; i < profiles.GetCount(); i++)
+    {
+        LPCTSTR fields[FieldCount];
 
-        if (arguments.m_copyToClipboard)
-            CopyToClipboard(formattedPath);
+        for (int j = 0; j < FieldCount; j++)
+        {
+            const int offset = offsets[i * FieldCount + j];
+            fields[j] = offset < 0 ? NULL : text.GetData() + offset;
+        }
 
-        //
-        // Open the containing folder in Windows Explorer if requested.
-        //
+        EnvironmentProfile& profile = profiles[i];
 
-        if (arguments.m_openContainingFolder)
-            OpenContainingFolder(path);
+        profile.name = fields[0];
+        profile.applicationDirectory = fields[1];
+        profile.currentDirectory = fields[2];
+        profile.path = fields[3];
+        profile.pathExtensions = fields[4];
+        profile.applicationPath = fields[5];
+        profile.searchPolicy = SearchPathPolicy;
 
-        if (arguments.m_extractManifest)
-            ExtractManifest(path);
-    }
-    catch (SystemException& e)
-    {
         //
-        // Get and display the error message corresponding to exception
-        // code.
+        // Looking on behalf of an application follows the loader, which
+        // by default is in safe search mode, unless told otherwise.
         //
 
-        LPTSTR message = NULL;
-
-        FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER |
-            FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-            NULL, e.GetCode(), 0, 
-            reinterpret_cast<LPTSTR>(&message), 0, NULL);
-
-        cerr << _T('\n') << e.GetCode() << _T(": ");
-
-        if (message)
+        if (fields[6])
         {
-            cerr << message << _T('\n');
-            LocalFree(message);
+            if (!SearchOrder::ParsePolicy(fields[6], profile.searchPolicy))
+                throw ApplicationException(_T("A profile has an invalid search policy."));
         }
-        else
+        else if (profile.applicationPath)
         {
-            cerr << _T("(No description available for this error code)\n");
+            profile.searchPolicy = SafeDllSearchPolicy;
         }
-
-        exitCode = -1;
     }
-    catch (ApplicationException& e)
-    {
-        cerr << e.GetMessage() << _T('\n');
+}
 
-        exitCode = -1;
-    }
+// --------------------------------------------------------------------------
+//  ShowError
+// --------------------------------------------------------------------------
+
+void ShowError(DWORD code, LPCTSTR fileName, LPCTSTR profileName)
+{
+    //
+    // Get and display the error message corresponding to the code,
+    // naming the file it is about when there is more than one and the
+    // profile it was searched for under, if any.
+    //
 
-    if (formattedPath != path)
-        delete [] formattedPath;
+    LPTSTR message = NULL;
 
-    delete [] path;
+    FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER |
+        FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+        NULL, code, 0, 
+        reinterpret_cast<LPTSTR>(&message), 0, NULL);
 
-    if (activationContext)
-    {
-        if (activationContextActivationCookie)
-            DeactivateActCtx(0, activationContextActivationCookie);
+    cerr << _T('\n');
 
-        ReleaseActCtx(activationContext);
+    if (profileName)
+        cerr << profileName << _T(": ");
+
+    if (fileName)
+        cerr << fileName << _T(": ");
+
+    cerr << code << _T(": ");
+
+    if (message)
+    {
+        cerr << message << _T('\n');
+        LocalFree(message);
     }
+    else
+    {
+        cerr << _T("(No description available for this error code)\n");
+    }
+}
 
-    if (NULL != kernelLibrary)
-        FreeLibrary(kernelLibrary);
+// --------------------------------------------------------------------------
+//  TraceSearch
+// --------------------------------------------------------------------------
 
+void CALLBACK TraceSearch(LPCTSTR fileName, LPCTSTR extension, LPVOID context)
+{
+    _ASSERT(fileName);
+    _ASSERT(context);
 
-    return exitCode;
+    WinOutputStream& stream = *static_cast<WinOutputStream*>(context);
+
+    stream << _T("Searching for ") << fileName;
+
+    if (extension)
+        stream << extension;
+    
+    stream << _T('\n');
 }
 
 // --------------------------------------------------------------------------
@@ -563,8 +2593,28 @@ void ShowHelp()
     GetWindowsDirectory(windowsPath, DIM(windowsPath));
 
     cout << _T("Usage: ") << applicationBinaryName 
-         << _T(" [-c] [-m <manifest>] [-nologo] [-o] [-v] [-xm] [-?]\n")
-         << _T("       <filename>\n\n")
+         << _T(" [-apiset <file>] [-arch <machine>] [-batch <file>] [-c]\n")
+         << _T("       [-cache <megabytes>] [-evict <policy>] [-format <format>]\n")
+         << _T("       [-m <manifest>] [-imagecache <file>] [-index <file>]\n")
+         << _T("       [-knowndlls <file>] [-log <file>] [-lookup <file>] [-meta]\n")
+         << _T("       [-nologo] [-o] [-profiles <file>] [-policy <policy>] [-s <count>]\n")
+         << _T("       [-share] [-stats] [-v] [-xm] [-from <application>] [-?]\n")
+         << _T("       <filename> ...\n")
+         << _T("       ") << applicationBinaryName << _T(" -analyze [-batch <file>] [<filename> ...]\n")
+         << _T("       ") << applicationBinaryName << _T(" -snapshot <format> [-index <file>]\n")
+         << _T("       ") << applicationBinaryName << _T(" -shadows [-compare] [-index <file>]\n")
+         << _T("       ") << applicationBinaryName << _T(" -exports <file> [-batch <file>] <symbol> ...\n")
+         << _T("       ") << applicationBinaryName << _T(" -capture <file> [-from <application>] [-meta]\n")
+         << _T("       [-policy <policy>]\n")
+         << _T("       ") << applicationBinaryName << _T(" -bench <log> [-index <file>] [-lookup <file>]\n")
+         << _T("       [-share] [-cache <megabytes>] [-threads <count>]\n")
+         << _T("       [-simulate <microseconds>]\n")
+         << _T("       ") << applicationBinaryName << _T(" -replay <file> [-arch <machine>] [-batch <file>]\n")
+         << _T("       [-format <format>] <filename> ...\n")
+         << _T("       ") << applicationBinaryName << _T(" -validate [-apiset <file>] [-arch <machine>]\n")
+         << _T("       [-knowndlls <file>] <filename> ...\n")
+         << _T("       ") << applicationBinaryName << _T(" -r <root> ... [-batch <file>] [-first] [-format <format>]\n")
+         << _T("       [-meta] <filename> ...\n\n")
          << _T("Searches for the specified file in the following directories,\n")
          << _T("in the following sequence:\n\n")
          << _T("1. The directory from which the application loaded.\n")
@@ -573,7 +2623,9 @@ void ShowHelp()
          << _T("4. Windows NT/2000/XP: The 16-bit Windows system directory.\n")
          << _T("   The directory is ") << windowsPath << _T("\\SYSTEM.\n")
          << _T("5. The Windows directory (") << windowsPath << _T(").\n")
-         << _T("6. The directories that are listed in the PATH environment variable.\n\n");
+         << _T("6. The directories that are listed in the PATH environment variable.\n\n")
+         << _T("With -from, the application is the one given rather than this one\n")
+         << _T("and the sequence is the one -policy chooses.\n\n");
 
     //
     // Break up the directories in the PATH and display them individually.
@@ -650,11 +2702,133 @@ void ShowHelp()
     //
 
     cout << _T("Options:\n\n")
+            _T("analyze - Time each search order directory, flag dead and\n")
+            _T("         duplicate entries and propose a faster PATH. Names\n")
+            _T("         given are taken as a log of typical queries.\n")
+            _T("apiset - Resolve API set contracts, such as api-ms-win-*.dll,\n")
+            _T("         to their hosts using the schema in <file>, a copy\n")
+            _T("         of apisetschema.dll.\n")
+            _T("arch   - Pass over images built for a machine other than\n")
+            _T("         <machine>, one of x86, x64 or arm64, as the loader\n")
+            _T("         of such a process would.\n")
+            _T("batch  - Also search for each name listed in <file>, one per\n")
+            _T("         line. Use - to read the names from standard input.\n")
+            _T("         Names are resolved on all processors at once but\n")
+            _T("         still reported in the order given.\n")
+            _T("bench  - Replay the names in <log>, as written by -log, and\n")
+            _T("         report throughput, latency percentiles and file\n")
+            _T("         system calls instead of the paths. The other\n")
+            _T("         options set the resolver up as they would for a\n")
+            _T("         search.\n")
             _T("c      - Copy path to the clipboard.\n")
+            _T("capture - Save everything that decides where names resolve on\n")
+            _T("         this host to <file>: the search order, PATH, PATHEXT\n")
+            _T("         and the listing of every directory in it, to be\n")
+            _T("         replayed elsewhere with -replay. With -meta, the\n")
+            _T("         machine of every image is saved as well.\n")
+            _T("compare - With -shadows, tell whether each shadowed copy\n")
+            _T("         differs from the one that wins in size, version\n")
+            _T("         or content.\n")
+            _T("cache  - List directories only as they are needed and hold\n")
+            _T("         at most <megabytes> of listings, evicting whole\n")
+            _T("         directories to stay within it. Not used with\n")
+            _T("         -profiles, and -share is ignored with it.\n")
+            _T("evict  - Choose which directories -cache evicts first:\n")
+            _T("         lru  - Those used least recently (default).\n")
+            _T("         cost - Those quickest to list again, weighed\n")
+            _T("                against how recently they were used.\n")
+            _T("exports - Look the names up as exported functions instead and\n")
+            _T("         list every image in the search order exporting each,\n")
+            _T("         in order of precedence, with its ordinal and what it\n")
+            _T("         is forwarded to, if anything. The exports are kept\n")
+            _T("         in <file> and only images that changed are read.\n")
+            _T("first  - With -r, stop at the first match for each name.\n")
+            _T("format - Write one record per name in the given <format>:\n")
+            _T("         text  - The path alone (default).\n")
+            _T("         jsonl - A JSON object per line, encoded in UTF-8.\n")
+            _T("         nul   - UTF-8 fields, each terminated by a NUL: name,\n")
+            _T("                 path, directory index, extension, error code\n")
+            _T("                 and, with -meta, size and modification time.\n")
+            _T("from   - Search as the loader would for <application>, from\n")
+            _T("         its directory, in safe search mode and for its\n")
+            _T("         machine unless -policy or -arch say otherwise.\n")
+            _T("imagecache - Keep what is read from images, such as their\n")
+            _T("         machine, version, imports, exports and where their\n")
+            _T("         manifest lies, in <file> by file identity, so that\n")
+            _T("         an image is only read again once it changes. With\n")
+            _T("         -meta, records include the machine and version.\n")
+            _T("index  - Keep directory listings in <file> between runs and\n")
+            _T("         answer from them. Only directories that changed\n")
+            _T("         since are listed again.\n")
+            _T("knowndlls - Resolve the DLLs listed in <file>, one per line,\n")
+            _T("         to the system directory as known DLLs. A line\n")
+            _T("         DllDirectory=<directory> names another directory.\n")
+            _T("log    - Append every name searched for to <file>, with the\n")
+            _T("         time it took in microseconds and the error code,\n")
+            _T("         to be replayed with -bench.\n")
+            _T("lookup - Keep an index of every name in the search order in\n")
+            _T("         <file> and find each name with a single lookup in it.\n")
+            _T("         It is rebuilt whenever a directory changes. Not used\n")
+            _T("         with -profiles.\n")
             _T("m      - Search using dependencies in <manfiest>.\n")
+            _T("meta   - Include size and modification time in records.\n")
             _T("nologo - Suppress logo.\n")
             _T("o      - Open containing folder in Windows Explorer.\n")
+            _T("policy - Follow the given search order, a list of these\n")
+            _T("         separated by commas:\n")
+            _T("         searchpath - That of SearchPath (default).\n")
+            _T("         safe       - The loader's, in safe search mode.\n")
+            _T("         unsafe     - The loader's, current directory second.\n")
+            _T("         local      - Look in <application>.local first.\n")
+            _T("         appdir, userdirs, system32, defaultdirs - Only the\n")
+            _T("                      locations LOAD_LIBRARY_SEARCH_* names,\n")
+            _T("                      the user directories taken from PATH.\n")
+#ifdef FINDPATH_PROFILER
+            _T("profile - Count the time, processor time and cycles spent in\n")
+            _T("         each phase of the run and break them down on the\n")
+            _T("         error stream.\n")
+#endif
+            _T("profiles - Search under each environment profile in <file>, an\n")
+            _T("         INI file with one section per profile and the keys\n")
+            _T("         ApplicationDirectory, CurrentDirectory, Path,\n")
+            _T("         PathExt, Application and SearchPolicy, as for -from\n")
+            _T("         and -policy. Missing keys are taken from this\n")
+            _T("         process. All profiles share directory listings.\n")
+            _T("r      - Search every directory under <root> for the names and\n")
+            _T("         their PATHEXT variants, instead of the search order.\n")
+            _T("         Give -r once for each root to search.\n")
+            _T("replay - Resolve the names as the host captured in <file> with\n")
+            _T("         -capture would have, without looking at this one.\n")
+            _T("         Names with a path resolve against the capture.\n")
+            _T("s      - Suggest up to <count> similar names if not found\n")
+            _T("         (default is 5, 0 to disable).\n")
+            _T("share  - Share directory listings with every other process in\n")
+            _T("         the session that shares them, in place of -index.\n")
+            _T("         Only the first to need a directory lists it.\n")
+            _T("shadows - List every command that more than one file in the\n")
+            _T("         search order answers to, with the file that wins\n")
+            _T("         first and those it shadows after it.\n")
+            _T("simulate - With -bench, look for files in a copy of the\n")
+            _T("         search order directories held in memory, with names\n")
+            _T("         matched as Windows would, and make every call to it\n")
+            _T("         take <microseconds>, 0 to measure the resolver\n")
+            _T("         alone. The time is spent waiting and reported as\n")
+            _T("         such. Not used with -m or -imagecache.\n")
+            _T("snapshot - Write every command that can be run through the\n")
+            _T("         search order, with the path it resolves to, in the\n")
+            _T("         given <format>:\n")
+            _T("         text   - The command and path per line, tab separated.\n")
+            _T("         binary - A sorted table to be read in one go.\n")
+            _T("stats  - Report how the directory cache fared on the error\n")
+            _T("         stream.\n")
+            _T("threads - With -bench, replay on <count> threads (default is\n")
+            _T("         one per processor, 1 to replay one name at a time).\n")
             _T("v      - Verbose mode.\n")
+            _T("validate - Check that each executable would load: find every\n")
+            _T("         DLL it depends on, directly or not, as the loader\n")
+            _T("         would for it, and check every function imported\n")
+            _T("         from each, following forwarders. Reports the DLLs\n")
+            _T("         and entry points that are missing.\n")
             _T("xm     - Extract manifest from PE image.\n")
             _T("?      - Show this help.\n");
 }
@@ -843,10 +3017,16 @@ void OpenContainingFolder(LPCTSTR path)
 //  ExtractManifest
 // --------------------------------------------------------------------------
 
-void ExtractManifest(LPCTSTR path)
+void ExtractManifest(LPCTSTR path, const ImageMetadataCache* imageMetadata)
 {
     _ASSERT(path);
 
+    if (imageMetadata)
+    {
+        ExtractCachedManifest(path, *imageMetadata);
+        return;
+    }
+
     //
     // Assume the worst. This method won't succeed. If we manage to reach
     // the end, then we'll indicate success.
@@ -969,6 +3149,118 @@ void ExtractManifest(LPCTSTR path)
     }
 }
 
+// --------------------------------------------------------------------------
+//  ExtractCachedManifest
+// --------------------------------------------------------------------------
+
+void ExtractCachedManifest(LPCTSTR path, const ImageMetadataCache& imageMetadata)
+{
+    _ASSERT(path);
+
+    //
+    // The cache knows where the manifest lies in the file, so it is read
+    // straight from there without loading the image at all.
+    //
+
+    ImageMetadata image;
+    DWORD error = imageMetadata.Query(path, image);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    if (NO_ERROR != image.error)
+        throw SystemException(image.error);
+
+    if (!image.manifestSize)
+        throw SystemException(ERROR_RESOURCE_TYPE_NOT_FOUND);
+
+    Array<BYTE> manifest;
+    manifest.SetCount(image.manifestSize);
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        SystemException::ThrowLast();
+
+    DWORD bytesRead = 0;
+
+    error = INVALID_SET_FILE_POINTER != SetFilePointer(file, image.manifestOffset, NULL, FILE_BEGIN) &&
+        ReadFile(file, manifest.GetData(), image.manifestSize, &bytesRead, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(file);
+
+    if (NO_ERROR == error && bytesRead != image.manifestSize)
+        error = ERROR_HANDLE_EOF;
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    TCHAR manifestFileName[MAX_PATH];
+    lstrcpyn(manifestFileName, path, DIM(manifestFileName));
+    PathStripPath(manifestFileName);
+
+    if (lstrlen(manifestFileName) + 9 >= MAX_PATH)
+        throw SystemException(ERROR_FILENAME_EXCED_RANGE);
+
+    lstrcat(manifestFileName, _T(".manifest"));
+
+    file = CreateFile(manifestFileName, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        SystemException::ThrowLast();
+
+    DWORD bytesWritten = 0;
+    error = WriteFile(file, manifest.GetData(), image.manifestSize, &bytesWritten, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        throw SystemException(error);
+
+    cout << _T("Manifest extracted to: ") << manifestFileName << _T('\n');
+}
+
+// --------------------------------------------------------------------------
+//  ShowSuggestions
+// --------------------------------------------------------------------------
+
+void ShowSuggestions(const Resolver& resolver, LPCTSTR fileName, int maxSuggestionCount)
+{
+    _ASSERT(fileName);
+
+    if (maxSuggestionCount <= 0)
+        return;
+
+    //
+    // Suggestions are only a courtesy on top of the error that has
+    // already been displayed. If anything goes wrong here then nothing
+    // more is displayed, just like with the version number in ShowLogo.
+    //
+
+    Resolution* suggestions = new Resolution[maxSuggestionCount];
+
+    if (!suggestions)
+        return;
+
+    int suggestionCount = 0;
+
+    resolver.Suggest(fileName, suggestions, maxSuggestionCount, suggestionCount);
+
+    if (suggestionCount)
+    {
+        cerr << _T("\nDid you mean:\n\n");
+
+        for (int i = 0; i < suggestionCount; i++)
+            cerr << _T("    ") << suggestions[i].path << _T('\n');
+    }
+
+    delete [] suggestions;
+}
+
 // --------------------------------------------------------------------------
 //  EnumResourceNamesCallback
 // --------------------------------------------------------------------------
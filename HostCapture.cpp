@@ -0,0 +1,717 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "LookupIndex.h"
+#include "NameTable.h"
+#include "ImageMachine.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+#include "Resolver.h"
+#include "HostCapture.h"
+
+//
+// Rounds a size up to a multiple of eight so that whatever follows it in
+// the image is suitably aligned.
+//
+
+static DWORD Align(DWORD size)
+{
+    return (size + 7) & ~7UL;
+}
+
+// --------------------------------------------------------------------------
+//  HostCapture
+// --------------------------------------------------------------------------
+
+HostCapture::HostCapture() :
+    m_mapping(NULL),
+    m_view(NULL),
+    m_header(NULL),
+    m_directoryIndexes(NULL)
+{
+}
+
+HostCapture::~HostCapture()
+{
+    Unload();
+}
+
+DWORD HostCapture::Capture(LPCTSTR filePath, const EnvironmentProfile* profile,
+    bool includeMachines, int threadCount)
+{
+    _ASSERT(filePath);
+
+    Array<BYTE> file;
+
+    try
+    {
+        SearchEnvironment environment;
+        environment.Capture(profile);
+
+        const SearchOrder& searchOrder = environment.GetSearchOrder();
+        const int directoryCount = searchOrder.GetCount();
+
+        //
+        // List every directory in the search order, all at once.
+        //
+
+        DirectoryIndexTable table;
+        Array<DirectoryIndex*> indexes;
+
+        for (int i = 0; i < directoryCount; i++)
+            indexes.Add(table.Register(searchOrder.GetDirectory(i)));
+
+        DWORD error = table.Scan(threadCount);
+
+        if (NO_ERROR != error)
+            throw SystemException(error);
+
+        //
+        // Then read the headers of every image in them, spread over the
+        // threads image by image rather than directory by directory since
+        // the system directory alone holds most of them.
+        //
+
+        Array<DWORD> machineStarts;
+        Array<WORD> machines;
+
+        machineStarts.SetCount(directoryCount + 1);
+        machineStarts[0] = 0;
+
+        for (int i = 0; i < directoryCount; i++)
+            machineStarts[i + 1] = machineStarts[i] + indexes[i]->GetNameCount();
+
+        if (includeMachines)
+        {
+            Array<MachineQuery> queries;
+
+            for (int i = 0; i < directoryCount; i++)
+            {
+                const DirectoryIndex& index = *indexes[i];
+
+                for (int j = 0; j < index.GetNameCount(); j++)
+                {
+                    TCHAR name[MAX_PATH];
+
+                    if (IsImageName(index.GetName(j, name)))
+                    {
+                        MachineQuery query = { i, j };
+                        queries.Add(query);
+                    }
+                }
+            }
+
+            machines.SetCount(machineStarts[directoryCount]);
+            ZeroMemory(machines.GetData(), machines.GetCount() * sizeof(WORD));
+
+            MachineContext context = { &searchOrder, indexes.GetData(),
+                queries.GetData(), machineStarts.GetData(), machines.GetData() };
+
+            error = ParallelFor(queries.GetCount(), threadCount, QueryMachine, &context);
+
+            if (NO_ERROR != error)
+                throw SystemException(error);
+        }
+
+        //
+        // Gather the text: the fields first and then the directories.
+        //
+
+        Array<TCHAR> text;
+        DWORD fieldOffsets[CapturedFieldCount];
+
+        TCHAR computerName[MAX_COMPUTERNAME_LENGTH + 1];
+        DWORD computerNameLength = DIM(computerName);
+
+        if (!GetComputerName(computerName, &computerNameLength))
+            computerName[0] = 0;
+
+        fieldOffsets[CapturedComputerName] = text.GetCount();
+        text.Append(computerName, lstrlen(computerName) + 1);
+
+        fieldOffsets[CapturedPath] = text.GetCount();
+
+        if (profile && profile->path)
+        {
+            text.Append(profile->path, lstrlen(profile->path) + 1);
+        }
+        else
+        {
+            const DWORD pathLength = GetEnvironmentVariable(_T("PATH"), NULL, 0);
+            const int pathOffset = text.GetCount();
+
+            text.SetCount(pathOffset + pathLength + 1);
+            text[pathOffset] = 0;
+
+            GetEnvironmentVariable(_T("PATH"), text.GetData() + pathOffset, pathLength);
+            text.SetCount(pathOffset + lstrlen(text.GetData() + pathOffset) + 1);
+        }
+
+        fieldOffsets[CapturedPathExtensions] = text.GetCount();
+        text.Append(environment.GetPathExtensions(), lstrlen(environment.GetPathExtensions()) + 1);
+
+        TCHAR directory[MAX_PATH];
+
+        if (!GetSystemDirectory(directory, DIM(directory)))
+            directory[0] = 0;
+
+        fieldOffsets[CapturedSystemDirectory] = text.GetCount();
+        text.Append(directory, lstrlen(directory) + 1);
+
+        if (!GetWindowsDirectory(directory, DIM(directory)))
+            directory[0] = 0;
+
+        fieldOffsets[CapturedWindowsDirectory] = text.GetCount();
+        text.Append(directory, lstrlen(directory) + 1);
+
+        Array<DWORD> pathOffsets;
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            LPCTSTR path = searchOrder.GetDirectory(i);
+
+            pathOffsets.Add(text.GetCount());
+            text.Append(path, lstrlen(path) + 1);
+        }
+
+        //
+        // Lay the file out and fill it in.
+        //
+
+        const DWORD directoriesOffset = Align(sizeof(FileHeader));
+        const DWORD textOffset = Align(directoriesOffset + directoryCount * sizeof(FileDirectory));
+
+        DWORD size = Align(textOffset + text.GetCount() * sizeof(TCHAR));
+
+        Array<FileDirectory> directories;
+        directories.SetCount(directoryCount);
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            const DirectoryIndex& index = *indexes[i];
+            FileDirectory& entry = directories[i];
+
+            entry.pathOffset = pathOffsets[i];
+            entry.imageOffset = 0;
+            entry.imageSize = 0;
+            entry.machinesOffset = 0;
+
+            if (!index.IsScanned())
+                continue;
+
+            entry.imageOffset = size;
+            entry.imageSize = index.GetImageSize();
+            size = Align(size + entry.imageSize);
+
+            if (includeMachines)
+            {
+                entry.machinesOffset = size;
+                size = Align(size + index.GetNameCount() * sizeof(WORD));
+            }
+        }
+
+        file.SetCount(size);
+        ZeroMemory(file.GetData(), size);
+
+        BYTE* image = file.GetData();
+
+        FileHeader& header = *reinterpret_cast<FileHeader*>(image);
+        header.signature = FileSignature;
+        header.version = FileVersion;
+        header.characterSize = sizeof(TCHAR);
+        header.flags = includeMachines ? HasMachines : 0;
+        header.directoryCount = directoryCount;
+        header.firstPathIndex = searchOrder.GetFirstPathIndex();
+        CopyMemory(header.fieldOffsets, fieldOffsets, sizeof(fieldOffsets));
+        header.directoriesOffset = directoriesOffset;
+        header.textOffset = textOffset;
+        header.textLength = text.GetCount();
+        header.size = size;
+
+        CopyMemory(image + directoriesOffset, directories.GetData(), directoryCount * sizeof(FileDirectory));
+        CopyMemory(image + textOffset, text.GetData(), text.GetCount() * sizeof(TCHAR));
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            const FileDirectory& entry = directories[i];
+
+            if (!entry.imageSize)
+                continue;
+
+            CopyMemory(image + entry.imageOffset, indexes[i]->GetImage(), entry.imageSize);
+
+            if (entry.machinesOffset)
+            {
+                CopyMemory(image + entry.machinesOffset, machines.GetData() + machineStarts[i],
+                    indexes[i]->GetNameCount() * sizeof(WORD));
+            }
+        }
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return Write(filePath, file);
+}
+
+void CALLBACK HostCapture::QueryMachine(int index, LPVOID context)
+{
+    const MachineContext& capture = *static_cast<const MachineContext*>(context);
+    const MachineQuery& query = capture.queries[index];
+    const DirectoryIndex& directoryIndex = *capture.indexes[query.directoryIndex];
+
+    TCHAR name[MAX_PATH];
+    TCHAR path[MAX_PATH];
+
+    if (!PathCombine(path, capture.searchOrder->GetDirectory(query.directoryIndex),
+            directoryIndex.GetName(query.nameIndex, name)))
+    {
+        return;
+    }
+
+    WORD machine;
+
+    if (ImageMachine::Query(path, machine))
+        capture.machines[capture.machineStarts[query.directoryIndex] + query.nameIndex] = machine;
+}
+
+bool HostCapture::IsImageName(LPCTSTR name)
+{
+    _ASSERT(name);
+
+    static const LPCTSTR extensions[] =
+    {
+        _T(".DLL"), _T(".EXE"), _T(".OCX"), _T(".CPL"), _T(".DRV"), _T(".SYS")
+    };
+
+    LPCTSTR extension = PathFindExtension(name);
+
+    for (int i = 0; i < DIM(extensions); i++)
+    {
+        if (0 == lstrcmpi(extension, extensions[i]))
+            return true;
+    }
+
+    return false;
+}
+
+DWORD HostCapture::Write(LPCTSTR filePath, const Array<BYTE>& file)
+{
+    _ASSERT(filePath);
+
+    //
+    // Write to a temporary file and then move it over the old one so
+    // that no reader ever sees a file that is only partly written.
+    //
+
+    TCHAR temporaryPath[MAX_PATH];
+
+    if (lstrlen(filePath) + 4 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(temporaryPath, filePath);
+    lstrcat(temporaryPath, _T(".tmp"));
+
+    HANDLE output = CreateFile(temporaryPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == output)
+        return GetLastError();
+
+    DWORD written = 0;
+    DWORD error = WriteFile(output, file.GetData(), file.GetCount(), &written, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(output);
+
+    if (NO_ERROR == error && !MoveFileEx(temporaryPath, filePath, MOVEFILE_REPLACE_EXISTING))
+        error = GetLastError();
+
+    if (NO_ERROR != error)
+        DeleteFile(temporaryPath);
+
+    return error;
+}
+
+DWORD HostCapture::Load(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+
+    Unload();
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD fileSizeHigh = 0;
+    const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+    if (fileSizeHigh || fileSize < sizeof(FileHeader))
+    {
+        CloseHandle(file);
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD error = m_mapping ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    m_view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (!m_view)
+    {
+        error = GetLastError();
+        Unload();
+        return error;
+    }
+
+    //
+    // Check that every part lies within the file and that the text ends
+    // in a terminator. The directory index images check themselves as
+    // they are adopted.
+    //
+
+    const FileHeader& header = *reinterpret_cast<const FileHeader*>(m_view);
+
+    const ULONGLONG directoriesEnd = header.directoriesOffset +
+        static_cast<ULONGLONG>(header.directoryCount) * sizeof(FileDirectory);
+    const ULONGLONG textEnd = header.textOffset +
+        static_cast<ULONGLONG>(header.textLength) * sizeof(TCHAR);
+
+    bool isValid = FileSignature == header.signature && FileVersion == header.version &&
+        sizeof(TCHAR) == header.characterSize && header.size <= fileSize &&
+        0 == ((header.directoriesOffset | header.textOffset) & 7) &&
+        directoriesEnd <= header.size && textEnd <= header.size && header.textLength &&
+        header.firstPathIndex <= header.directoryCount &&
+        0 == reinterpret_cast<const TCHAR*>(m_view + header.textOffset)[header.textLength - 1];
+
+    for (int i = 0; isValid && i < CapturedFieldCount; i++)
+        isValid = header.fieldOffsets[i] < header.textLength;
+
+    if (!isValid)
+    {
+        Unload();
+        return ERROR_BAD_FORMAT;
+    }
+
+    const FileDirectory* directories = reinterpret_cast<const FileDirectory*>(m_view + header.directoriesOffset);
+    LPCTSTR text = reinterpret_cast<LPCTSTR>(m_view + header.textOffset);
+
+    try
+    {
+        //
+        // The listings go into a table of their own that looks for files
+        // in the capture, so that a resolver given the table never looks
+        // at the host it runs on. A directory that appears more than once
+        // in the search order shares one index, adopted the first time.
+        //
+
+        m_directoryIndexes = new DirectoryIndexTable;
+
+        if (!m_directoryIndexes)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+        m_directoryIndexes->SetFileSystem(*this);
+
+        Array<LPCTSTR> paths;
+
+        for (DWORD i = 0; i < header.directoryCount; i++)
+        {
+            const FileDirectory& entry = directories[i];
+
+            if (entry.pathOffset >= header.textLength)
+                throw SystemException(ERROR_BAD_FORMAT);
+
+            DirectoryIndex* index = m_directoryIndexes->Register(text + entry.pathOffset);
+            m_indexes.Add(index);
+            paths.Add(text + entry.pathOffset);
+
+            const WORD* machines = NULL;
+
+            if (entry.imageSize)
+            {
+                if ((entry.imageOffset & 7) ||
+                    entry.imageOffset + static_cast<ULONGLONG>(entry.imageSize) > header.size ||
+                    (!index->IsScanned() && !index->Adopt(m_view + entry.imageOffset, entry.imageSize)))
+                {
+                    throw SystemException(ERROR_BAD_FORMAT);
+                }
+
+                if ((header.flags & HasMachines) && entry.machinesOffset)
+                {
+                    if ((entry.machinesOffset & 1) || entry.machinesOffset +
+                        static_cast<ULONGLONG>(index->GetNameCount()) * sizeof(WORD) > header.size)
+                    {
+                        throw SystemException(ERROR_BAD_FORMAT);
+                    }
+
+                    machines = reinterpret_cast<const WORD*>(m_view + entry.machinesOffset);
+                }
+            }
+
+            m_machines.Add(machines);
+        }
+
+        m_environment.Restore(paths.GetData(), paths.GetCount(), header.firstPathIndex,
+            text + header.fieldOffsets[CapturedPathExtensions]);
+    }
+    catch (SystemException& e)
+    {
+        Unload();
+        return e.GetCode();
+    }
+
+    m_header = &header;
+
+    return NO_ERROR;
+}
+
+LPCTSTR HostCapture::GetField(HostCaptureField field) const
+{
+    _ASSERT(field >= 0 && field < CapturedFieldCount);
+
+    if (!m_header)
+        return NULL;
+
+    return reinterpret_cast<LPCTSTR>(m_view + m_header->textOffset) + m_header->fieldOffsets[field];
+}
+
+DWORD HostCapture::InitializeResolver(Resolver& resolver, const ResolverOptions& options) const
+{
+    if (!m_header)
+        return ERROR_INVALID_HANDLE;
+
+    //
+    // Everything that would otherwise come from this host comes from the
+    // capture instead. The rest of the options are used as they are.
+    //
+
+    ResolverOptions captured = options;
+    captured.environment = &m_environment;
+    captured.directoryIndexes = m_directoryIndexes;
+    captured.fileSystem = this;
+    captured.isIndexOnly = true;
+    captured.profile = NULL;
+
+    return resolver.Initialize(captured);
+}
+
+DWORD HostCapture::GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const
+{
+    _ASSERT(path);
+
+    CountAttributes();
+    ZeroMemory(&data, sizeof(data));
+
+    //
+    // A listing only has names, so anything named in one is taken to be
+    // a file unless it is itself a captured directory.
+    //
+
+    if (FindDirectory(path) >= 0)
+    {
+        data.dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+        return NO_ERROR;
+    }
+
+    int directoryIndex;
+    int nameIndex;
+
+    DWORD error = Locate(path, directoryIndex, nameIndex);
+
+    if (NO_ERROR == error)
+        data.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+
+    return error;
+}
+
+DWORD HostCapture::List(LPCTSTR directory, FileListProc proc, LPVOID context) const
+{
+    _ASSERT(directory);
+    _ASSERT(proc);
+
+    CountListing();
+
+    const int directoryIndex = FindDirectory(directory);
+
+    if (directoryIndex < 0)
+        return ERROR_PATH_NOT_FOUND;
+
+    const DirectoryIndex& index = *m_indexes[directoryIndex];
+
+    if (!index.IsScanned())
+        return ERROR_NOT_READY;
+
+    for (int i = 0; i < index.GetNameCount(); i++)
+    {
+        WIN32_FIND_DATA findData;
+        ZeroMemory(&findData, sizeof(findData));
+        findData.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+        index.GetName(i, findData.cFileName);
+
+        proc(findData, context);
+    }
+
+    return NO_ERROR;
+}
+
+DWORD HostCapture::Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const
+{
+    _ASSERT(path);
+    _ASSERT(buffer);
+
+    CountRead();
+    bytesRead = 0;
+
+    int directoryIndex;
+    int nameIndex;
+
+    DWORD error = Locate(path, directoryIndex, nameIndex);
+
+    if (NO_ERROR != error)
+        return error;
+
+    //
+    // Only the machine of an image is captured, so that is all there is
+    // to read: just enough of the headers to say what it was built for.
+    //
+
+    const WORD* machines = m_machines[directoryIndex];
+
+    if (!machines || !machines[nameIndex])
+        return ERROR_NOT_SUPPORTED;
+
+    struct
+    {
+        IMAGE_DOS_HEADER dosHeader;
+        DWORD signature;
+        IMAGE_FILE_HEADER fileHeader;
+    }
+    headers;
+
+    ZeroMemory(&headers, sizeof(headers));
+    headers.dosHeader.e_magic = IMAGE_DOS_SIGNATURE;
+    headers.dosHeader.e_lfanew = sizeof(headers.dosHeader);
+    headers.signature = IMAGE_NT_SIGNATURE;
+    headers.fileHeader.Machine = machines[nameIndex];
+
+    bytesRead = min(size, static_cast<DWORD>(sizeof(headers)));
+    CopyMemory(buffer, &headers, bytesRead);
+
+    return NO_ERROR;
+}
+
+DWORD HostCapture::Map(LPCTSTR path, const BYTE*& view, DWORD& size) const
+{
+    _ASSERT(path);
+
+    CountMap();
+
+    view = NULL;
+    size = 0;
+
+    return ERROR_NOT_SUPPORTED;
+}
+
+void HostCapture::Unmap(const BYTE*) const
+{
+}
+
+int HostCapture::FindDirectory(LPCTSTR directory) const
+{
+    _ASSERT(directory);
+
+    TCHAR key[MAX_PATH];
+    lstrcpyn(key, directory, DIM(key));
+    PathRemoveBackslash(key);
+
+    for (int i = 0; i < m_indexes.GetCount(); i++)
+    {
+        if (0 == lstrcmpi(key, m_indexes[i]->GetDirectory()))
+            return i;
+    }
+
+    return -1;
+}
+
+DWORD HostCapture::Locate(LPCTSTR path, int& directoryIndex, int& nameIndex) const
+{
+    _ASSERT(path);
+
+    if (lstrlen(path) >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    TCHAR directory[MAX_PATH];
+    lstrcpy(directory, path);
+    PathRemoveFileSpec(directory);
+
+    directoryIndex = FindDirectory(directory);
+
+    if (directoryIndex < 0)
+        return ERROR_PATH_NOT_FOUND;
+
+    const DirectoryIndex& index = *m_indexes[directoryIndex];
+
+    if (!index.IsScanned())
+        return ERROR_NOT_READY;
+
+    TCHAR foldedName[MAX_PATH];
+    lstrcpy(foldedName, PathFindFileName(path));
+    CharUpperBuff(foldedName, lstrlen(foldedName));
+
+    nameIndex = index.Find(foldedName, DirectoryIndex::Hash(foldedName));
+
+    return nameIndex < 0 ? ERROR_FILE_NOT_FOUND : NO_ERROR;
+}
+
+void HostCapture::Unload()
+{
+    delete m_directoryIndexes;
+    m_directoryIndexes = NULL;
+
+    m_indexes.Clear();
+    m_machines.Clear();
+
+    if (m_view)
+        UnmapViewOfFile(m_view);
+
+    if (m_mapping)
+        CloseHandle(m_mapping);
+
+    m_mapping = NULL;
+    m_view = NULL;
+    m_header = NULL;
+}
@@ -0,0 +1,153 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  HostCapture
+// --------------------------------------------------------------------------
+//
+//  Everything that decides where names resolve on a host, captured into
+//  one file so that the resolution can be replayed somewhere else: the
+//  search order, PATH and PATHEXT, the system and Windows directories
+//  and the listing of every directory in the search order. Optionally,
+//  the machine of every image in those directories is captured too, so
+//  that images built for the wrong machine can be passed over.
+//
+//  A capture is replayed straight out of the mapped file by a resolver
+//  that InitializeResolver sets up with the options given, such as the
+//  machine, API sets and known DLLs, and everything else taken from the
+//  capture. The listings in it are directory index images that are
+//  adopted as they are, so a lookup costs what it does against a warm
+//  index, and nothing on the replaying host is ever looked at. The
+//  capture stands in for the file system too, so names with a path of
+//  their own resolve against what was captured.
+//
+//  A directory that could not be listed when captured has no listing,
+//  and a query that needs to look in it fails with ERROR_NOT_READY
+//  rather than taking the directory to hold nothing.
+//
+//  None of the methods throw. Failures are reported as Win32 error codes.
+//
+
+enum HostCaptureField
+{
+    CapturedComputerName,
+    CapturedPath,
+    CapturedPathExtensions,
+    CapturedSystemDirectory,
+    CapturedWindowsDirectory,
+    CapturedFieldCount
+};
+
+class HostCapture : public FileSystem
+{
+public:
+
+    enum
+    {
+        FileSignature = 0x43485046, // FPHC
+        FileVersion = 1,
+        HasMachines = 0x0001
+    };
+
+    HostCapture();
+    ~HostCapture();
+
+    static DWORD Capture(LPCTSTR filePath, const EnvironmentProfile* profile,
+        bool includeMachines, int threadCount);
+
+    DWORD Load(LPCTSTR filePath);
+    DWORD InitializeResolver(Resolver& resolver, const ResolverOptions& options) const;
+
+    const SearchEnvironment& GetEnvironment() const { return m_environment; }
+    LPCTSTR GetField(HostCaptureField field) const;
+    bool HasMachineTypes() const { return m_header && (m_header->flags & HasMachines); }
+
+    virtual DWORD GetAttributes(LPCTSTR path, WIN32_FILE_ATTRIBUTE_DATA& data) const;
+    virtual DWORD List(LPCTSTR directory, FileListProc proc, LPVOID context) const;
+    virtual DWORD Read(LPCTSTR path, LPVOID buffer, DWORD size, DWORD& bytesRead) const;
+    virtual DWORD Map(LPCTSTR path, const BYTE*& view, DWORD& size) const;
+    virtual void Unmap(const BYTE* view) const;
+
+private:
+
+    //
+    // The header is followed by a record per directory in the search
+    // order and then the text, which holds the fields and the directory
+    // paths. After that come the directory index images and, when there
+    // are machines, an array per directory of the machine of each of its
+    // names, in name order, each part aligned on eight bytes.
+    //
+
+    struct FileHeader
+    {
+        DWORD signature;
+        WORD version;
+        WORD characterSize;
+        DWORD flags;
+        DWORD directoryCount;
+        DWORD firstPathIndex;
+        DWORD fieldOffsets[CapturedFieldCount];
+        DWORD directoriesOffset;
+        DWORD textOffset;
+        DWORD textLength;
+        DWORD size;
+    };
+
+    struct FileDirectory
+    {
+        DWORD pathOffset;
+        DWORD imageOffset;
+        DWORD imageSize;
+        DWORD machinesOffset;
+    };
+
+    struct MachineQuery
+    {
+        int directoryIndex;
+        int nameIndex;
+    };
+
+    struct MachineContext
+    {
+        const SearchOrder* searchOrder;
+        DirectoryIndex* const* indexes;
+        const MachineQuery* queries;
+        const DWORD* machineStarts;
+        WORD* machines;
+    };
+
+    static void CALLBACK QueryMachine(int index, LPVOID context);
+    static bool IsImageName(LPCTSTR name);
+    static DWORD Write(LPCTSTR filePath, const Array<BYTE>& file);
+
+    void Unload();
+    int FindDirectory(LPCTSTR directory) const;
+    DWORD Locate(LPCTSTR path, int& directoryIndex, int& nameIndex) const;
+
+    HANDLE m_mapping;
+    const BYTE* m_view;
+    const FileHeader* m_header;
+    DirectoryIndexTable* m_directoryIndexes;
+    Array<DirectoryIndex*> m_indexes;
+    Array<const WORD*> m_machines;
+    SearchEnvironment m_environment;
+
+    HostCapture(const HostCapture&);
+    HostCapture& operator=(const HostCapture&);
+};
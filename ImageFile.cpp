@@ -0,0 +1,257 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "ImageFile.h"
+
+// --------------------------------------------------------------------------
+//  ImageFile
+// --------------------------------------------------------------------------
+
+ImageFile::ImageFile() :
+    m_fileSystem(NULL),
+    m_view(NULL),
+    m_size(0),
+    m_machine(0),
+    m_characteristics(0),
+    m_subsystem(0),
+    m_timeDateStamp(0),
+    m_magic(0),
+    m_directoriesOffset(0),
+    m_directoryCount(0),
+    m_sectionOffset(0),
+    m_sectionCount(0)
+{
+}
+
+DWORD ImageFile::Open(LPCTSTR path, const FileSystem* fileSystem)
+{
+    _ASSERT(path);
+
+    Close();
+
+    m_fileSystem = fileSystem ? fileSystem : &FileSystem::GetWin32();
+
+    DWORD error = m_fileSystem->Map(path, m_view, m_size);
+
+    //
+    // A file too large to map is certainly no image, and neither is one
+    // too small to hold even the DOS header.
+    //
+
+    if (ERROR_FILE_TOO_LARGE == error ||
+        (NO_ERROR == error && m_size < sizeof(IMAGE_DOS_HEADER)))
+    {
+        Close();
+        return ERROR_BAD_FORMAT;
+    }
+
+    if (NO_ERROR != error)
+    {
+        Close();
+        return error;
+    }
+
+    try
+    {
+        ReadHeaders();
+    }
+    catch (SystemException& e)
+    {
+        error = e.GetCode();
+        Close();
+    }
+
+    return error;
+}
+
+void ImageFile::ReadHeaders()
+{
+    IMAGE_DOS_HEADER dosHeader;
+    Read(0, &dosHeader, sizeof(dosHeader));
+
+    if (IMAGE_DOS_SIGNATURE != dosHeader.e_magic || dosHeader.e_lfanew < 0)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    const DWORD ntHeadersOffset = static_cast<DWORD>(dosHeader.e_lfanew);
+
+    DWORD signature;
+    Read(ntHeadersOffset, &signature, sizeof(signature));
+
+    if (IMAGE_NT_SIGNATURE != signature)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    IMAGE_FILE_HEADER fileHeader;
+    Read(ntHeadersOffset + sizeof(signature), &fileHeader, sizeof(fileHeader));
+
+    m_machine = fileHeader.Machine;
+    m_characteristics = fileHeader.Characteristics;
+    m_timeDateStamp = fileHeader.TimeDateStamp;
+
+    //
+    // The optional header comes in two sizes, for 32-bit and for 64-bit
+    // images, with the data directories at different offsets. Either
+    // may be cut short after the last directory that is present.
+    //
+
+    const DWORD optionalHeaderOffset = ntHeadersOffset + sizeof(signature) + sizeof(fileHeader);
+
+    Read(optionalHeaderOffset, &m_magic, sizeof(m_magic));
+
+    DWORD directoriesOffset;
+    DWORD directoryCountOffset;
+
+    if (IMAGE_NT_OPTIONAL_HDR32_MAGIC == m_magic)
+    {
+        directoriesOffset = FIELD_OFFSET(IMAGE_OPTIONAL_HEADER32, DataDirectory);
+        directoryCountOffset = FIELD_OFFSET(IMAGE_OPTIONAL_HEADER32, NumberOfRvaAndSizes);
+    }
+    else if (IMAGE_NT_OPTIONAL_HDR64_MAGIC == m_magic)
+    {
+        directoriesOffset = FIELD_OFFSET(IMAGE_OPTIONAL_HEADER64, DataDirectory);
+        directoryCountOffset = FIELD_OFFSET(IMAGE_OPTIONAL_HEADER64, NumberOfRvaAndSizes);
+    }
+    else
+    {
+        throw SystemException(ERROR_BAD_FORMAT);
+    }
+
+    //
+    // The subsystem sits at the same offset in both.
+    //
+
+    m_subsystem = 0;
+
+    if (fileHeader.SizeOfOptionalHeader >= FIELD_OFFSET(IMAGE_OPTIONAL_HEADER32, Subsystem) + sizeof(WORD))
+        Read(optionalHeaderOffset + FIELD_OFFSET(IMAGE_OPTIONAL_HEADER32, Subsystem), &m_subsystem, sizeof(m_subsystem));
+
+    m_directoryCount = 0;
+
+    if (fileHeader.SizeOfOptionalHeader >= directoriesOffset)
+    {
+        Read(optionalHeaderOffset + directoryCountOffset, &m_directoryCount, sizeof(m_directoryCount));
+
+        m_directoryCount = min(m_directoryCount,
+            (fileHeader.SizeOfOptionalHeader - directoriesOffset) / sizeof(IMAGE_DATA_DIRECTORY));
+    }
+
+    m_directoriesOffset = optionalHeaderOffset + directoriesOffset;
+    m_sectionOffset = optionalHeaderOffset + fileHeader.SizeOfOptionalHeader;
+    m_sectionCount = fileHeader.NumberOfSections;
+}
+
+void ImageFile::Close()
+{
+    if (m_view)
+        m_fileSystem->Unmap(m_view);
+
+    m_fileSystem = NULL;
+    m_view = NULL;
+    m_size = 0;
+}
+
+bool ImageFile::GetDirectory(int index, IMAGE_DATA_DIRECTORY& directory) const
+{
+    _ASSERT(m_view);
+    _ASSERT(index >= 0);
+
+    if (static_cast<DWORD>(index) >= m_directoryCount)
+        return false;
+
+    Read(m_directoriesOffset + index * sizeof(IMAGE_DATA_DIRECTORY), &directory, sizeof(directory));
+
+    return directory.VirtualAddress && directory.Size;
+}
+
+DWORD ImageFile::MapAddress(DWORD address) const
+{
+    _ASSERT(m_view);
+
+    //
+    // The image is taken as it lies in the file, so an address is turned
+    // into the offset of the same byte in the raw data of its section.
+    //
+
+    for (int i = 0; i < m_sectionCount; i++)
+    {
+        IMAGE_SECTION_HEADER section;
+        Read(m_sectionOffset + i * sizeof(section), &section, sizeof(section));
+
+        const DWORD extent = max(section.Misc.VirtualSize, section.SizeOfRawData);
+
+        if (address >= section.VirtualAddress && address - section.VirtualAddress < extent)
+        {
+            const DWORD offset = address - section.VirtualAddress;
+
+            if (offset >= section.SizeOfRawData)
+                break;
+
+            return section.PointerToRawData + offset;
+        }
+    }
+
+    throw SystemException(ERROR_BAD_FORMAT);
+}
+
+void ImageFile::Read(DWORD offset, LPVOID value, DWORD valueSize) const
+{
+    _ASSERT(m_view);
+    _ASSERT(value);
+
+    if (offset > m_size || valueSize > m_size - offset)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    CopyMemory(value, m_view + offset, valueSize);
+}
+
+bool ImageFile::ReadString(DWORD offset, DWORD maxLength, Array<TCHAR>& text) const
+{
+    _ASSERT(m_view);
+
+    //
+    // Names in an image are plain ASCII. One that runs off the end of
+    // the file, or on for longer than the given length, is no name.
+    //
+
+    if (offset >= m_size)
+        return false;
+
+    const char* chars = reinterpret_cast<const char*>(m_view + offset);
+    maxLength = min(m_size - offset, maxLength);
+
+    DWORD length = 0;
+
+    while (length < maxLength && chars[length])
+        length++;
+
+    if (length == maxLength || 0 == length)
+        return false;
+
+#ifdef UNICODE
+    for (DWORD i = 0; i < length; i++)
+        text.Add(static_cast<TCHAR>(static_cast<BYTE>(chars[i])));
+#else
+    text.Append(chars, length);
+#endif
+
+    text.Add(0);
+
+    return true;
+}
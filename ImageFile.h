@@ -0,0 +1,78 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ImageFile
+// --------------------------------------------------------------------------
+//
+//  A portable executable image mapped read-only, as it lies in the file,
+//  for reading its tables. It is mapped through the file system given,
+//  or that of Windows, which has to outlive the mapping. Addresses in the image are relative virtual
+//  addresses that MapAddress turns into offsets into the file through
+//  the section table.
+//
+//  Open fails with ERROR_BAD_FORMAT for a file that is not an image. Once
+//  it is open, the methods that read from the image check that what they
+//  read lies within the file and throw a SystemException with
+//  ERROR_BAD_FORMAT when it does not, so that a damaged image can be
+//  given up on wholesale.
+//
+
+class ImageFile
+{
+public:
+
+    ImageFile();
+    ~ImageFile() { Close(); }
+
+    DWORD Open(LPCTSTR path, const FileSystem* fileSystem = NULL);
+    void Close();
+
+    DWORD GetSize() const { return m_size; }
+    WORD GetMachine() const { return m_machine; }
+    WORD GetCharacteristics() const { return m_characteristics; }
+    WORD GetSubsystem() const { return m_subsystem; }
+    DWORD GetTimeDateStamp() const { return m_timeDateStamp; }
+    bool Is64Bit() const { return IMAGE_NT_OPTIONAL_HDR64_MAGIC == m_magic; }
+
+    bool GetDirectory(int index, IMAGE_DATA_DIRECTORY& directory) const;
+    DWORD MapAddress(DWORD address) const;
+    void Read(DWORD offset, LPVOID value, DWORD valueSize) const;
+    bool ReadString(DWORD offset, DWORD maxLength, Array<TCHAR>& text) const;
+
+private:
+
+    void ReadHeaders();
+
+    const FileSystem* m_fileSystem;
+    const BYTE* m_view;
+    DWORD m_size;
+    WORD m_machine;
+    WORD m_characteristics;
+    WORD m_subsystem;
+    DWORD m_timeDateStamp;
+    WORD m_magic;
+    DWORD m_directoriesOffset;
+    DWORD m_directoryCount;
+    DWORD m_sectionOffset;
+    int m_sectionCount;
+
+    ImageFile(const ImageFile&);
+    ImageFile& operator=(const ImageFile&);
+};
@@ -0,0 +1,119 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Profiler.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "ImageMachine.h"
+
+// --------------------------------------------------------------------------
+//  ImageMachine
+// --------------------------------------------------------------------------
+
+bool ImageMachine::Query(LPCTSTR path, WORD& machine, const FileSystem* fileSystem)
+{
+    _ASSERT(path);
+
+    PROFILE_PHASE(MetadataPhase);
+
+    if (!fileSystem)
+        fileSystem = &FileSystem::GetWin32();
+
+    BYTE page[PageSize];
+    DWORD size = 0;
+
+    return NO_ERROR == fileSystem->Read(path, page, sizeof(page), size) &&
+        ReadHeaders(page, size, machine);
+}
+
+bool ImageMachine::ReadHeaders(const BYTE* data, DWORD size, WORD& machine)
+{
+    _ASSERT(data);
+
+    //
+    // The DOS header gives where the NT headers start, which is a
+    // signature followed by the file header with the machine type.
+    //
+
+    if (size < sizeof(IMAGE_DOS_HEADER))
+        return false;
+
+    IMAGE_DOS_HEADER dosHeader;
+    CopyMemory(&dosHeader, data, sizeof(dosHeader));
+
+    if (IMAGE_DOS_SIGNATURE != dosHeader.e_magic || dosHeader.e_lfanew < 0)
+        return false;
+
+    const DWORD ntHeadersOffset = static_cast<DWORD>(dosHeader.e_lfanew);
+
+    if (ntHeadersOffset > size - sizeof(DWORD) - sizeof(IMAGE_FILE_HEADER))
+        return false;
+
+    DWORD signature;
+    CopyMemory(&signature, data + ntHeadersOffset, sizeof(signature));
+
+    if (IMAGE_NT_SIGNATURE != signature)
+        return false;
+
+    IMAGE_FILE_HEADER fileHeader;
+    CopyMemory(&fileHeader, data + ntHeadersOffset + sizeof(signature), sizeof(fileHeader));
+
+    machine = fileHeader.Machine;
+
+    return true;
+}
+
+static const struct
+{
+    LPCTSTR name;
+    WORD machine;
+}
+machines[] =
+{
+    { _T("x86"),   ImageMachine::I386  },
+    { _T("x64"),   ImageMachine::Amd64 },
+    { _T("arm64"), ImageMachine::Arm64 }
+};
+
+bool ImageMachine::Parse(LPCTSTR name, WORD& machine)
+{
+    _ASSERT(name);
+
+    for (int i = 0; i < DIM(machines); i++)
+    {
+        if (0 == lstrcmpi(name, machines[i].name))
+        {
+            machine = machines[i].machine;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+LPCTSTR ImageMachine::GetName(WORD machine)
+{
+    for (int i = 0; i < DIM(machines); i++)
+    {
+        if (machine == machines[i].machine)
+            return machines[i].name;
+    }
+
+    return NULL;
+}
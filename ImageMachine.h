@@ -0,0 +1,58 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ImageMachine
+// --------------------------------------------------------------------------
+//
+//  The machine type that a portable executable image was built for, as
+//  the loader sees it. The loader passes over a DLL built for a machine
+//  other than that of the process and carries on down the search order,
+//  so a resolver that is told what the process will be can do the same.
+//
+//  Only the first page of a file is ever read, through the file system
+//  given or that of Windows, which is where the headers of any image
+//  produced by the usual tools are. A file that is not an
+//  image at all, such as a script, has no machine type and is never
+//  passed over.
+//
+
+class ImageMachine
+{
+public:
+
+    enum
+    {
+        PageSize = 4096,
+        Any      = 0,
+        I386     = 0x014C,
+        Amd64    = 0x8664,
+        Arm64    = 0xAA64
+    };
+
+    static bool Query(LPCTSTR path, WORD& machine, const FileSystem* fileSystem = NULL);
+    static bool Parse(LPCTSTR name, WORD& machine);
+    static LPCTSTR GetName(WORD machine);
+
+private:
+
+    static bool ReadHeaders(const BYTE* data, DWORD size, WORD& machine);
+
+    ImageMachine();
+};
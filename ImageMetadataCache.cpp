@@ -0,0 +1,874 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+
+// --------------------------------------------------------------------------
+//  ImageIdentity
+// --------------------------------------------------------------------------
+
+DWORD ImageIdentity::Query(LPCTSTR path, ImageIdentity& identity)
+{
+    _ASSERT(path);
+
+    //
+    // No access is asked for since only the file information is needed,
+    // and sharing everything keeps from getting in anyone else's way.
+    //
+
+    HANDLE handle = CreateFile(path, 0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == handle)
+        return GetLastError();
+
+    BY_HANDLE_FILE_INFORMATION information;
+    const DWORD error = GetFileInformationByHandle(handle, &information) ? NO_ERROR : GetLastError();
+
+    CloseHandle(handle);
+
+    if (NO_ERROR != error)
+        return error;
+
+    identity.volumeSerialNumber = information.dwVolumeSerialNumber;
+    identity.fileIndexHigh = information.nFileIndexHigh;
+    identity.fileIndexLow = information.nFileIndexLow;
+    identity.sizeHigh = information.nFileSizeHigh;
+    identity.sizeLow = information.nFileSizeLow;
+    identity.lastWriteTime = information.ftLastWriteTime;
+
+    return NO_ERROR;
+}
+
+// --------------------------------------------------------------------------
+//  ImageMetadataCache
+// --------------------------------------------------------------------------
+
+ImageMetadataCache::ImageMetadataCache() :
+    m_mapping(NULL),
+    m_view(NULL),
+    m_header(NULL),
+    m_entries(NULL),
+    m_slots(NULL),
+    m_text(NULL),
+    m_addedCount(0)
+{
+    InitializeCriticalSection(&m_lock);
+
+    for (int i = 0; i < AddedBucketCount; i++)
+        m_addedBuckets[i] = -1;
+}
+
+ImageMetadataCache::~ImageMetadataCache()
+{
+    Unload();
+
+    for (int i = 0; i < m_added.GetCount(); i++)
+        delete m_added[i];
+
+    DeleteCriticalSection(&m_lock);
+}
+
+DWORD ImageMetadataCache::Query(LPCTSTR path, ImageMetadata& metadata, Array<TCHAR>* imports) const
+{
+    _ASSERT(path);
+
+    ImageIdentity identity;
+    DWORD error = ImageIdentity::Query(path, identity);
+
+    if (NO_ERROR != error)
+        return error;
+
+    try
+    {
+        //
+        // What was loaded never changes and can be looked up without a
+        // lock. What was added since is only ever added to.
+        //
+
+        const FileEntry* entry = Find(identity);
+
+        if (entry)
+        {
+            metadata = entry->metadata;
+
+            if (imports)
+            {
+                imports->Clear();
+                imports->Append(m_text + entry->importsOffset, entry->importsLength);
+            }
+
+            return NO_ERROR;
+        }
+
+        EnterCriticalSection(&m_lock);
+
+        const int addedIndex = FindAdded(identity);
+
+        if (addedIndex >= 0)
+        {
+            const AddedEntry& added = *m_added[addedIndex];
+            metadata = added.metadata;
+
+            try
+            {
+                if (imports)
+                {
+                    imports->Clear();
+                    imports->Append(added.imports.GetData(), added.imports.GetCount());
+                }
+            }
+            catch (...)
+            {
+                LeaveCriticalSection(&m_lock);
+                throw;
+            }
+
+            LeaveCriticalSection(&m_lock);
+
+            return NO_ERROR;
+        }
+
+        LeaveCriticalSection(&m_lock);
+
+        //
+        // Read the image without holding the lock so that other threads
+        // can read theirs at the same time. Should two threads race to
+        // read the same one, the first to add it wins.
+        //
+
+        AddedEntry* added = new AddedEntry;
+
+        if (!added)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+        added->identity = identity;
+
+        error = Read(path, added->metadata, added->imports);
+
+        if (NO_ERROR != error)
+        {
+            delete added;
+            return error;
+        }
+
+        metadata = added->metadata;
+
+        try
+        {
+            if (imports)
+            {
+                imports->Clear();
+                imports->Append(added->imports.GetData(), added->imports.GetCount());
+            }
+        }
+        catch (...)
+        {
+            delete added;
+            throw;
+        }
+
+        EnterCriticalSection(&m_lock);
+
+        if (FindAdded(identity) < 0)
+        {
+            try
+            {
+                m_added.Add(added);
+            }
+            catch (...)
+            {
+                LeaveCriticalSection(&m_lock);
+                delete added;
+                throw;
+            }
+
+            const DWORD bucket = Hash(identity) % AddedBucketCount;
+
+            added->next = m_addedBuckets[bucket];
+            m_addedBuckets[bucket] = m_added.GetCount() - 1;
+            InterlockedIncrement(&m_addedCount);
+
+            added = NULL;
+        }
+
+        LeaveCriticalSection(&m_lock);
+
+        delete added;
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+const ImageMetadataCache::FileEntry* ImageMetadataCache::Find(const ImageIdentity& identity) const
+{
+    if (!m_header || !m_header->entryCount)
+        return NULL;
+
+    const DWORD mask = m_header->slotCount - 1;
+
+    for (DWORD slot = Hash(identity) & mask; m_slots[slot]; slot = (slot + 1) & mask)
+    {
+        const FileEntry& entry = m_entries[m_slots[slot] - 1];
+
+        if (entry.identity.IsSameAs(identity))
+            return &entry;
+    }
+
+    return NULL;
+}
+
+int ImageMetadataCache::FindAdded(const ImageIdentity& identity) const
+{
+    for (int i = m_addedBuckets[Hash(identity) % AddedBucketCount]; i >= 0; i = m_added[i]->next)
+    {
+        if (m_added[i]->identity.IsSameAs(identity))
+            return i;
+    }
+
+    return -1;
+}
+
+DWORD ImageMetadataCache::Hash(const ImageIdentity& identity)
+{
+    return HashFields(HashFile(identity), identity.sizeLow,
+        identity.lastWriteTime.dwLowDateTime, identity.lastWriteTime.dwHighDateTime);
+}
+
+DWORD ImageMetadataCache::HashFile(const ImageIdentity& identity)
+{
+    return HashFields(2166136261UL, identity.fileIndexLow,
+        identity.fileIndexHigh, identity.volumeSerialNumber);
+}
+
+DWORD ImageMetadataCache::HashFields(DWORD hash, DWORD a, DWORD b, DWORD c)
+{
+    //
+    // FNV-1a, a byte at a time.
+    //
+
+    const DWORD fields[] = { a, b, c };
+
+    for (int i = 0; i < DIM(fields); i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            hash ^= (fields[i] >> (j * 8)) & 0xFF;
+            hash *= 16777619UL;
+        }
+    }
+
+    return hash;
+}
+
+// --------------------------------------------------------------------------
+//  Reading images
+// --------------------------------------------------------------------------
+
+DWORD ImageMetadataCache::Read(LPCTSTR path, ImageMetadata& metadata, Array<TCHAR>& imports)
+{
+    _ASSERT(path);
+
+    ZeroMemory(&metadata, sizeof(metadata));
+    imports.Clear();
+
+    ImageFile file;
+    DWORD error = file.Open(path);
+
+    //
+    // A file that is not an image is remembered as such so that it is
+    // not read again until it changes.
+    //
+
+    if (ERROR_BAD_FORMAT == error)
+    {
+        metadata.error = ERROR_BAD_FORMAT;
+        return NO_ERROR;
+    }
+
+    if (NO_ERROR != error)
+        return error;
+
+    metadata.machine = file.GetMachine();
+    metadata.characteristics = file.GetCharacteristics();
+    metadata.subsystem = file.GetSubsystem();
+    metadata.timeDateStamp = file.GetTimeDateStamp();
+
+    //
+    // A damaged table is taken as missing rather than spoiling what
+    // could be read from the rest of the image.
+    //
+
+    try
+    {
+        try
+        {
+            ReadImports(file, metadata, imports);
+        }
+        catch (SystemException& e)
+        {
+            if (ERROR_BAD_FORMAT != e.GetCode())
+                throw;
+
+            metadata.importCount = 0;
+            imports.Clear();
+        }
+
+        try
+        {
+            ReadExports(file, metadata);
+        }
+        catch (SystemException& e)
+        {
+            if (ERROR_BAD_FORMAT != e.GetCode())
+                throw;
+
+            metadata.exportCount = 0;
+            metadata.namedExportCount = 0;
+            metadata.forwarderCount = 0;
+        }
+
+        try
+        {
+            ReadResources(file, metadata);
+        }
+        catch (SystemException& e)
+        {
+            if (ERROR_BAD_FORMAT != e.GetCode())
+                throw;
+
+            metadata.fileVersionMS = metadata.fileVersionLS = 0;
+            metadata.productVersionMS = metadata.productVersionLS = 0;
+            metadata.manifestOffset = metadata.manifestSize = 0;
+        }
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+void ImageMetadataCache::ReadImports(const ImageFile& file, ImageMetadata& metadata, Array<TCHAR>& imports)
+{
+    IMAGE_DATA_DIRECTORY importData;
+
+    if (!file.GetDirectory(IMAGE_DIRECTORY_ENTRY_IMPORT, importData))
+        return;
+
+    DWORD descriptorOffset = file.MapAddress(importData.VirtualAddress);
+
+    for (;;)
+    {
+        ImportDescriptor descriptor;
+        file.Read(descriptorOffset, &descriptor, sizeof(descriptor));
+        descriptorOffset += sizeof(descriptor);
+
+        if (!descriptor.name || !descriptor.firstThunk)
+            break;
+
+        if (!file.ReadString(file.MapAddress(descriptor.name), MAX_PATH, imports))
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        metadata.importCount++;
+    }
+}
+
+void ImageMetadataCache::ReadExports(const ImageFile& file, ImageMetadata& metadata)
+{
+    IMAGE_DATA_DIRECTORY exportData;
+
+    if (!file.GetDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT, exportData))
+        return;
+
+    IMAGE_EXPORT_DIRECTORY directory;
+    file.Read(file.MapAddress(exportData.VirtualAddress), &directory, sizeof(directory));
+
+    if (directory.NumberOfFunctions > file.GetSize() / sizeof(DWORD))
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    metadata.namedExportCount = directory.NumberOfNames;
+
+    if (!directory.NumberOfFunctions)
+        return;
+
+    //
+    // The address table has a slot for every ordinal from the base up,
+    // some of which may be unused. An address within the export
+    // directory is that of the name of the export it forwards to.
+    //
+
+    const DWORD functionsOffset = file.MapAddress(directory.AddressOfFunctions);
+
+    for (DWORD i = 0; i < directory.NumberOfFunctions; i++)
+    {
+        DWORD functionAddress;
+        file.Read(functionsOffset + i * sizeof(DWORD), &functionAddress, sizeof(functionAddress));
+
+        if (!functionAddress)
+            continue;
+
+        metadata.exportCount++;
+
+        if (functionAddress >= exportData.VirtualAddress &&
+            functionAddress - exportData.VirtualAddress < exportData.Size)
+        {
+            metadata.forwarderCount++;
+        }
+    }
+}
+
+void ImageMetadataCache::ReadResources(const ImageFile& file, ImageMetadata& metadata)
+{
+    ResourceData data;
+
+    //
+    // The version resource starts with its length, the length of its
+    // value and its type, followed by the key "VS_VERSION_INFO" in
+    // UTF-16 and padding up to the fixed file information.
+    //
+
+    if (FindResource(file, VersionResource, data))
+    {
+        const DWORD valueOffset = 6 + sizeof(L"VS_VERSION_INFO") + 2;
+
+        if (data.size >= valueOffset + sizeof(VS_FIXEDFILEINFO))
+        {
+            VS_FIXEDFILEINFO fixedInfo;
+            file.Read(file.MapAddress(data.address) + valueOffset, &fixedInfo, sizeof(fixedInfo));
+
+            if (VS_FFI_SIGNATURE == fixedInfo.dwSignature)
+            {
+                metadata.fileVersionMS = fixedInfo.dwFileVersionMS;
+                metadata.fileVersionLS = fixedInfo.dwFileVersionLS;
+                metadata.productVersionMS = fixedInfo.dwProductVersionMS;
+                metadata.productVersionLS = fixedInfo.dwProductVersionLS;
+            }
+        }
+    }
+
+    if (FindResource(file, ManifestResource, data) && data.size)
+    {
+        const DWORD offset = file.MapAddress(data.address);
+
+        if (offset < file.GetSize() && data.size <= file.GetSize() - offset)
+        {
+            metadata.manifestOffset = offset;
+            metadata.manifestSize = data.size;
+        }
+    }
+}
+
+bool ImageMetadataCache::FindResource(const ImageFile& file, DWORD type, ResourceData& data)
+{
+    IMAGE_DATA_DIRECTORY resourceData;
+
+    if (!file.GetDirectory(IMAGE_DIRECTORY_ENTRY_RESOURCE, resourceData))
+        return false;
+
+    //
+    // Resources are a tree three levels deep: type, name and language.
+    // The type is looked up by its identifier among the entries that
+    // have one, which follow those that have a name, and then the first
+    // name and language are taken, as the loader would for a manifest.
+    // Offsets in the tree are from its start, with the top bit of an
+    // entry's offset set when it leads to another directory.
+    //
+
+    const DWORD rootOffset = file.MapAddress(resourceData.VirtualAddress);
+    DWORD directoryOffset = 0;
+
+    for (int level = 0; level < 3; level++)
+    {
+        ResourceDirectory directory;
+        file.Read(rootOffset + directoryOffset, &directory, sizeof(directory));
+
+        const DWORD entriesOffset = rootOffset + directoryOffset + sizeof(directory);
+        const DWORD entryCount = directory.namedEntryCount + directory.idEntryCount;
+
+        ResourceEntry entry;
+        bool isFound = false;
+
+        if (0 == level)
+        {
+            for (DWORD i = directory.namedEntryCount; i < entryCount && !isFound; i++)
+            {
+                file.Read(entriesOffset + i * sizeof(entry), &entry, sizeof(entry));
+                isFound = type == entry.name;
+            }
+        }
+        else if (entryCount)
+        {
+            file.Read(entriesOffset, &entry, sizeof(entry));
+            isFound = true;
+        }
+
+        if (!isFound)
+            return false;
+
+        const bool isDirectory = 0 != (entry.offset & 0x80000000);
+
+        if (isDirectory != (level < 2))
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        directoryOffset = entry.offset & 0x7FFFFFFF;
+
+        if (directoryOffset >= resourceData.Size)
+            throw SystemException(ERROR_BAD_FORMAT);
+    }
+
+    file.Read(rootOffset + directoryOffset, &data, sizeof(data));
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+//  Loading and saving
+// --------------------------------------------------------------------------
+
+DWORD ImageMetadataCache::Load(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+    _ASSERT(!m_addedCount);
+
+    Unload();
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD fileSizeHigh = 0;
+    const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+    if (fileSizeHigh || fileSize < sizeof(FileHeader))
+    {
+        CloseHandle(file);
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD error = m_mapping ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    m_view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (!m_view)
+    {
+        error = GetLastError();
+        Unload();
+        return error;
+    }
+
+    Attach(m_view);
+
+    if (!IsValid(fileSize))
+    {
+        Unload();
+        return ERROR_BAD_FORMAT;
+    }
+
+    return NO_ERROR;
+}
+
+bool ImageMetadataCache::IsValid(DWORD fileSize) const
+{
+    _ASSERT(m_header);
+
+    //
+    // Check every offset once, up front, since the file may have been
+    // damaged, so that lookups need not check anything themselves.
+    //
+
+    const FileHeader& header = *m_header;
+
+    const ULONGLONG entriesEnd = header.entriesOffset +
+        static_cast<ULONGLONG>(header.entryCount) * sizeof(FileEntry);
+    const ULONGLONG slotsEnd = header.slotsOffset +
+        static_cast<ULONGLONG>(header.slotCount) * sizeof(DWORD);
+    const ULONGLONG textEnd = header.textOffset +
+        static_cast<ULONGLONG>(header.textLength) * sizeof(TCHAR);
+
+    if (FileSignature != header.signature || FileVersion != header.version ||
+        sizeof(TCHAR) != header.characterSize || header.size > fileSize ||
+        0 != ((header.entriesOffset | header.slotsOffset | header.textOffset) & 7) ||
+        entriesEnd > header.size || slotsEnd > header.size || textEnd > header.size ||
+        header.slotCount < 2 || 0 != (header.slotCount & (header.slotCount - 1)) ||
+        header.entryCount >= header.slotCount)
+    {
+        return false;
+    }
+
+    for (DWORD i = 0; i < header.entryCount; i++)
+    {
+        const FileEntry& entry = m_entries[i];
+
+        if (entry.importsOffset > header.textLength ||
+            entry.importsLength > header.textLength - entry.importsOffset)
+        {
+            return false;
+        }
+    }
+
+    for (DWORD i = 0; i < header.slotCount; i++)
+    {
+        if (m_slots[i] > header.entryCount)
+            return false;
+    }
+
+    return true;
+}
+
+void ImageMetadataCache::Attach(const BYTE* view)
+{
+    _ASSERT(view);
+
+    m_header = reinterpret_cast<const FileHeader*>(view);
+    m_entries = reinterpret_cast<const FileEntry*>(view + m_header->entriesOffset);
+    m_slots = reinterpret_cast<const DWORD*>(view + m_header->slotsOffset);
+    m_text = reinterpret_cast<const TCHAR*>(view + m_header->textOffset);
+}
+
+void ImageMetadataCache::Unload()
+{
+    if (m_view)
+        UnmapViewOfFile(m_view);
+
+    if (m_mapping)
+        CloseHandle(m_mapping);
+
+    m_image.Clear();
+
+    m_mapping = NULL;
+    m_view = NULL;
+    m_header = NULL;
+    m_entries = NULL;
+    m_slots = NULL;
+    m_text = NULL;
+}
+
+DWORD ImageMetadataCache::Save(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+
+    Array<BYTE> image;
+
+    EnterCriticalSection(&m_lock);
+
+    try
+    {
+        //
+        // Everything read since loading goes in, along with whatever was
+        // loaded except for earlier versions of files read since.
+        //
+
+        const int addedCount = m_added.GetCount();
+
+        Array<FileEntry> entries;
+        Array<TCHAR> text;
+
+        //
+        // The files read since are hashed by file alone, leaving out the
+        // size and time, to tell the loaded entries they supersede.
+        //
+
+        DWORD addedSlotCount = 2;
+
+        while (addedSlotCount < static_cast<DWORD>(addedCount) * 2)
+            addedSlotCount *= 2;
+
+        Array<int> addedSlots;
+        addedSlots.SetCount(addedSlotCount);
+
+        for (DWORD i = 0; i < addedSlotCount; i++)
+            addedSlots[i] = -1;
+
+        const DWORD addedMask = addedSlotCount - 1;
+
+        for (int i = 0; i < addedCount; i++)
+        {
+            DWORD slot = HashFile(m_added[i]->identity) & addedMask;
+
+            while (addedSlots[slot] >= 0)
+                slot = (slot + 1) & addedMask;
+
+            addedSlots[slot] = i;
+        }
+
+        const DWORD loadedCount = m_header ? m_header->entryCount : 0;
+
+        for (DWORD i = 0; i < loadedCount; i++)
+        {
+            const FileEntry& loaded = m_entries[i];
+            bool isSuperseded = false;
+
+            for (DWORD slot = HashFile(loaded.identity) & addedMask;
+                addedSlots[slot] >= 0 && !isSuperseded; slot = (slot + 1) & addedMask)
+            {
+                isSuperseded = m_added[addedSlots[slot]]->identity.IsSameFileAs(loaded.identity);
+            }
+
+            if (isSuperseded)
+                continue;
+
+            FileEntry entry = loaded;
+            entry.importsOffset = text.GetCount();
+            text.Append(m_text + loaded.importsOffset, loaded.importsLength);
+            entries.Add(entry);
+        }
+
+        for (int i = 0; i < addedCount; i++)
+        {
+            const AddedEntry& added = *m_added[i];
+
+            FileEntry entry;
+            entry.identity = added.identity;
+            entry.metadata = added.metadata;
+            entry.importsOffset = text.GetCount();
+            entry.importsLength = added.imports.GetCount();
+            text.Append(added.imports.GetData(), added.imports.GetCount());
+            entries.Add(entry);
+        }
+
+        //
+        // The hash table is kept at most half full.
+        //
+
+        const DWORD entryCount = entries.GetCount();
+        DWORD slotCount = 2;
+
+        while (slotCount < entryCount * 2)
+            slotCount *= 2;
+
+        const DWORD entriesOffset = (sizeof(FileHeader) + 7) & ~7UL;
+        const DWORD slotsOffset = (entriesOffset + entryCount * sizeof(FileEntry) + 7) & ~7UL;
+        const DWORD textOffset = (slotsOffset + slotCount * sizeof(DWORD) + 7) & ~7UL;
+        const DWORD size = textOffset + text.GetCount() * sizeof(TCHAR);
+
+        image.SetCount(size);
+        ZeroMemory(image.GetData(), size);
+
+        FileHeader& header = *reinterpret_cast<FileHeader*>(image.GetData());
+        header.signature = FileSignature;
+        header.version = FileVersion;
+        header.characterSize = sizeof(TCHAR);
+        header.entryCount = entryCount;
+        header.slotCount = slotCount;
+        header.entriesOffset = entriesOffset;
+        header.slotsOffset = slotsOffset;
+        header.textOffset = textOffset;
+        header.textLength = text.GetCount();
+        header.size = size;
+
+        CopyMemory(image.GetData() + entriesOffset, entries.GetData(), entryCount * sizeof(FileEntry));
+        CopyMemory(image.GetData() + textOffset, text.GetData(), text.GetCount() * sizeof(TCHAR));
+
+        DWORD* slots = reinterpret_cast<DWORD*>(image.GetData() + slotsOffset);
+        const DWORD mask = slotCount - 1;
+
+        for (DWORD i = 0; i < entryCount; i++)
+        {
+            DWORD slot = Hash(entries[i].identity) & mask;
+
+            while (slots[slot])
+                slot = (slot + 1) & mask;
+
+            slots[slot] = i + 1;
+        }
+
+        //
+        // Windows will not replace a file while a view of it is mapped, so
+        // let go of the loaded file and carry on from a copy of the image
+        // just built, which holds everything the cache knows. The room for
+        // the copy is made first so that nothing can fail once the file
+        // is gone. The images added since loading are in it now and can
+        // go too.
+        //
+
+        m_image.Reserve(image.GetCount());
+
+        Unload();
+
+        m_image.Append(image.GetData(), image.GetCount());
+        Attach(m_image.GetData());
+
+        for (int i = 0; i < m_added.GetCount(); i++)
+            delete m_added[i];
+
+        m_added.Clear();
+
+        for (int i = 0; i < AddedBucketCount; i++)
+            m_addedBuckets[i] = -1;
+
+        InterlockedExchange(&m_addedCount, 0);
+    }
+    catch (SystemException& e)
+    {
+        LeaveCriticalSection(&m_lock);
+        return e.GetCode();
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    //
+    // Write to a temporary file and then move it over the old one so
+    // that no reader ever maps a file that is only partly written.
+    //
+
+    TCHAR temporaryPath[MAX_PATH];
+
+    if (lstrlen(filePath) + 4 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(temporaryPath, filePath);
+    lstrcat(temporaryPath, _T(".tmp"));
+
+    HANDLE output = CreateFile(temporaryPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == output)
+        return GetLastError();
+
+    DWORD written = 0;
+    DWORD error = WriteFile(output, image.GetData(), image.GetCount(), &written, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(output);
+
+    if (NO_ERROR == error && !MoveFileEx(temporaryPath, filePath, MOVEFILE_REPLACE_EXISTING))
+        error = GetLastError();
+
+    if (NO_ERROR != error)
+        DeleteFile(temporaryPath);
+
+    return error;
+}
@@ -0,0 +1,254 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ImageIdentity
+// --------------------------------------------------------------------------
+//
+//  What tells one version of an image file from any other: the volume it
+//  lives on, its file index there, its size and its last write time. It
+//  is read from the file system without opening the file for reading.
+//
+
+struct ImageIdentity
+{
+    DWORD volumeSerialNumber;
+    DWORD fileIndexHigh;
+    DWORD fileIndexLow;
+    DWORD sizeHigh;
+    DWORD sizeLow;
+    FILETIME lastWriteTime;
+
+    bool IsSameAs(const ImageIdentity& other) const
+    {
+        return IsSameFileAs(other) &&
+               sizeHigh == other.sizeHigh &&
+               sizeLow == other.sizeLow &&
+               0 == CompareFileTime(&lastWriteTime, &other.lastWriteTime);
+    }
+
+    bool IsSameFileAs(const ImageIdentity& other) const
+    {
+        return volumeSerialNumber == other.volumeSerialNumber &&
+               fileIndexHigh == other.fileIndexHigh &&
+               fileIndexLow == other.fileIndexLow;
+    }
+
+    static DWORD Query(LPCTSTR path, ImageIdentity& identity);
+};
+
+// --------------------------------------------------------------------------
+//  ImageMetadata
+// --------------------------------------------------------------------------
+//
+//  What is worth knowing about an image without having to read it again:
+//  its headers, its file version from the version resource, how many
+//  DLLs it imports from, a summary of its exports and where its manifest
+//  lies in the file, if it has one, so that it can be read straight off.
+//  The versions are zero when the image has no version resource.
+//
+//  A file that turned out not to be an image has ERROR_BAD_FORMAT as its
+//  error and nothing else.
+//
+
+struct ImageMetadata
+{
+    DWORD error;
+    WORD machine;
+    WORD characteristics;
+    WORD subsystem;
+    WORD reserved;
+    DWORD timeDateStamp;
+    DWORD fileVersionMS;
+    DWORD fileVersionLS;
+    DWORD productVersionMS;
+    DWORD productVersionLS;
+    DWORD importCount;
+    DWORD exportCount;
+    DWORD namedExportCount;
+    DWORD forwarderCount;
+    DWORD manifestOffset;
+    DWORD manifestSize;
+};
+
+// --------------------------------------------------------------------------
+//  ImageMetadataCache
+// --------------------------------------------------------------------------
+//
+//  The metadata of images, kept by their identity so that an image that
+//  has not changed is only ever read once, however many times and under
+//  however many paths it is asked about. Looking an image up costs one
+//  query of its identity and, when it is already known, nothing more.
+//
+//  The cache is kept as a single flat image, the same in memory as in the
+//  file it is saved to, with a hash table of identities. Images that are
+//  not in it are read as they are asked about and held aside until the
+//  cache is saved, when they are merged in. Entries for earlier versions
+//  of the same files are dropped at that point.
+//
+//  Any number of threads can look images up at the same time, as from
+//  the workers of ParallelFor. Those that find nothing read the image
+//  themselves, outside of any lock, so that the cache fills in parallel.
+//
+//  A loaded file stays mapped until the cache is saved. Windows will not
+//  replace a file that is mapped, so saving moves the cache off the file
+//  and onto the merged image in memory before writing it out, which
+//  means that Save must not be called while images are being looked up.
+//
+//  None of the methods throw. Failures are reported as Win32 error codes.
+//
+
+class ImageMetadataCache
+{
+public:
+
+    enum
+    {
+        FileSignature = 0x4D495046, // FPIM
+        FileVersion = 1
+    };
+
+    ImageMetadataCache();
+    ~ImageMetadataCache();
+
+    DWORD Load(LPCTSTR filePath);
+    DWORD Save(LPCTSTR filePath);
+
+    DWORD Query(LPCTSTR path, ImageMetadata& metadata, Array<TCHAR>* imports = NULL) const;
+
+    bool IsChanged() const { return m_addedCount > 0; }
+    int GetEntryCount() const { return (m_header ? m_header->entryCount : 0) + m_addedCount; }
+
+    static DWORD Read(LPCTSTR path, ImageMetadata& metadata, Array<TCHAR>& imports);
+
+private:
+
+    //
+    // The header is followed by a record per image, the hash table of
+    // records, holding record indexes plus one, and the text that holds
+    // the names of the DLLs that each image imports from, one after the
+    // other, each part aligned on eight bytes.
+    //
+
+    struct FileHeader
+    {
+        DWORD signature;
+        WORD version;
+        WORD characterSize;
+        DWORD entryCount;
+        DWORD slotCount;
+        DWORD entriesOffset;
+        DWORD slotsOffset;
+        DWORD textOffset;
+        DWORD textLength;
+        DWORD size;
+    };
+
+    struct FileEntry
+    {
+        ImageIdentity identity;
+        ImageMetadata metadata;
+        DWORD importsOffset;
+        DWORD importsLength;
+    };
+
+    //
+    // An image read since the cache was loaded, chained to the others
+    // that hash to the same bucket.
+    //
+
+    struct AddedEntry
+    {
+        ImageIdentity identity;
+        ImageMetadata metadata;
+        Array<TCHAR> imports;
+        int next;
+    };
+
+    enum { AddedBucketCount = 1024 };
+
+    enum
+    {
+        VersionResource = 16,
+        ManifestResource = 24
+    };
+
+    struct ResourceDirectory
+    {
+        DWORD characteristics;
+        DWORD timeDateStamp;
+        WORD majorVersion;
+        WORD minorVersion;
+        WORD namedEntryCount;
+        WORD idEntryCount;
+    };
+
+    struct ResourceEntry
+    {
+        DWORD name;
+        DWORD offset;
+    };
+
+    struct ResourceData
+    {
+        DWORD address;
+        DWORD size;
+        DWORD codePage;
+        DWORD reserved;
+    };
+
+    struct ImportDescriptor
+    {
+        DWORD originalFirstThunk;
+        DWORD timeDateStamp;
+        DWORD forwarderChain;
+        DWORD name;
+        DWORD firstThunk;
+    };
+
+    const FileEntry* Find(const ImageIdentity& identity) const;
+    int FindAdded(const ImageIdentity& identity) const;
+    bool IsValid(DWORD fileSize) const;
+    void Attach(const BYTE* view);
+    void Unload();
+
+    static DWORD Hash(const ImageIdentity& identity);
+    static DWORD HashFile(const ImageIdentity& identity);
+    static DWORD HashFields(DWORD hash, DWORD a, DWORD b, DWORD c);
+    static void ReadImports(const ImageFile& file, ImageMetadata& metadata, Array<TCHAR>& imports);
+    static void ReadExports(const ImageFile& file, ImageMetadata& metadata);
+    static void ReadResources(const ImageFile& file, ImageMetadata& metadata);
+    static bool FindResource(const ImageFile& file, DWORD type, ResourceData& data);
+
+    HANDLE m_mapping;
+    const BYTE* m_view;
+    Array<BYTE> m_image;
+    const FileHeader* m_header;
+    const FileEntry* m_entries;
+    const DWORD* m_slots;
+    const TCHAR* m_text;
+
+    mutable CRITICAL_SECTION m_lock;
+    mutable Array<AddedEntry*> m_added;
+    mutable int m_addedBuckets[AddedBucketCount];
+    mutable volatile LONG m_addedCount;
+
+    ImageMetadataCache(const ImageMetadataCache&);
+    ImageMetadataCache& operator=(const ImageMetadataCache&);
+};
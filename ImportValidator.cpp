@@ -0,0 +1,608 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "LookupIndex.h"
+#include "NameTable.h"
+#include "ImageFile.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "ImageMetadataCache.h"
+#include "Resolver.h"
+#include "ImportValidator.h"
+
+//
+// The layout of an entry in the import directory of an image. Its thunks
+// are 32 bits wide in a 32-bit image and 64 bits wide in a 64-bit one,
+// with the top bit set on those that import by ordinal.
+//
+
+struct ImportDescriptor
+{
+    DWORD originalFirstThunk;
+    DWORD timeDateStamp;
+    DWORD forwarderChain;
+    DWORD name;
+    DWORD firstThunk;
+};
+
+// --------------------------------------------------------------------------
+//  ImportValidator
+// --------------------------------------------------------------------------
+
+DWORD ImportValidator::Validate(LPCTSTR path, const Resolver& resolver, int threadCount)
+{
+    _ASSERT(path);
+
+    Clear();
+    m_resolver = &resolver;
+
+    try
+    {
+        TCHAR fullPath[MAX_PATH];
+
+        if (!GetFullPathName(path, DIM(fullPath), fullPath, NULL))
+            return GetLastError();
+
+        AddModule(fullPath);
+
+        //
+        // Walk the closure one level at a time: parse every module that
+        // turned up in the last level, all at once, and then resolve the
+        // DLLs they name, which is what makes up the next level. DLLs
+        // that exports are forwarded to are brought in along with those
+        // that are imported from so that everything a check could lead
+        // to has been parsed before any check is made.
+        //
+
+        int levelStart = 0;
+
+        while (levelStart < m_modules.GetCount())
+        {
+            const int levelEnd = m_modules.GetCount();
+
+            const DWORD error = ParallelFor(levelEnd - levelStart, threadCount,
+                ParseModule, m_modules.GetData() + levelStart);
+
+            if (NO_ERROR != error)
+                throw SystemException(error);
+
+            for (int i = levelStart; i < levelEnd; i++)
+            {
+                Module& module = *m_modules[i];
+
+                for (int j = 0; j < module.dlls.GetCount(); j++)
+                {
+                    ImportedDll& dll = module.dlls[j];
+                    dll.moduleIndex = ResolveDll(module.text.GetData() + dll.nameOffset);
+                }
+
+                for (int j = 0; j < module.forwardedDllOffsets.GetCount(); j++)
+                    ResolveDll(module.text.GetData() + module.forwardedDllOffsets[j]);
+            }
+
+            levelStart = levelEnd;
+        }
+
+        const DWORD error = m_modules[0]->error;
+
+        if (NO_ERROR != error)
+        {
+            Clear();
+            return error;
+        }
+
+        //
+        // With every module parsed, nothing changes any more while the
+        // imports are checked, so each module can be checked on its own.
+        //
+
+        const DWORD checkError = ParallelFor(m_modules.GetCount(), threadCount, CheckModule, this);
+
+        if (NO_ERROR != checkError)
+            throw SystemException(checkError);
+
+        for (int i = 0; i < m_modules.GetCount(); i++)
+        {
+            const Array<Problem>& problems = m_modules[i]->problems;
+            m_problems.Append(problems.GetData(), problems.GetCount());
+        }
+    }
+    catch (SystemException& e)
+    {
+        Clear();
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+void ImportValidator::GetProblem(int index, ImportProblem& problem) const
+{
+    const Problem& entry = m_problems[index];
+    const Module& module = *m_modules[entry.moduleIndex];
+
+    problem.moduleIndex = entry.moduleIndex;
+    problem.error = entry.error;
+    problem.dllName = module.text.GetData() + entry.dllOffset;
+    problem.symbol = NoSymbol != entry.symbolOffset ? module.text.GetData() + entry.symbolOffset : NULL;
+    problem.ordinal = entry.ordinal;
+}
+
+void ImportValidator::Clear()
+{
+    for (int i = 0; i < m_modules.GetCount(); i++)
+        delete m_modules[i];
+
+    m_modules.Clear();
+    m_problems.Clear();
+    m_dllModules.Clear();
+    m_modulePaths.Clear();
+    m_dllNames.Clear();
+}
+
+int ImportValidator::AddModule(LPCTSTR path)
+{
+    _ASSERT(path);
+
+    //
+    // The same module can be reached under different names, such as
+    // through an API set and directly, but it is only ever parsed once.
+    //
+
+    TCHAR foldedPath[MAX_PATH];
+    lstrcpyn(foldedPath, path, DIM(foldedPath));
+    CharUpperBuff(foldedPath, lstrlen(foldedPath));
+
+    const int index = m_modulePaths.Add(foldedPath, DirectoryIndex::Hash(foldedPath));
+
+    if (index < m_modules.GetCount())
+        return index;
+
+    Module* module = new Module;
+
+    if (!module)
+        throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+    lstrcpyn(module->path, path, DIM(module->path));
+    module->error = NO_ERROR;
+    module->ordinalBase = 0;
+
+    try
+    {
+        m_modules.Add(module);
+    }
+    catch (...)
+    {
+        delete module;
+        throw;
+    }
+
+    return index;
+}
+
+int ImportValidator::ResolveDll(LPCTSTR name)
+{
+    _ASSERT(name);
+    _ASSERT(m_resolver);
+
+    //
+    // Every module in the process that imports from a DLL of a given
+    // name gets the same one, so a name is only resolved the first time
+    // it comes up.
+    //
+
+    TCHAR foldedName[MAX_PATH];
+    lstrcpyn(foldedName, name, DIM(foldedName));
+    CharUpperBuff(foldedName, lstrlen(foldedName));
+
+    const int nameIndex = m_dllNames.Add(foldedName, DirectoryIndex::Hash(foldedName));
+
+    if (nameIndex < m_dllModules.GetCount())
+        return m_dllModules[nameIndex];
+
+    Resolution resolution;
+    const DWORD error = m_resolver->Resolve(name, resolution);
+
+    if (ERROR_NOT_ENOUGH_MEMORY == error)
+        throw SystemException(error);
+
+    const int moduleIndex = NO_ERROR == error ? AddModule(resolution.path) : -1;
+    m_dllModules.Add(moduleIndex);
+
+    return moduleIndex;
+}
+
+int ImportValidator::FindDll(LPCTSTR name) const
+{
+    _ASSERT(name);
+
+    TCHAR foldedName[MAX_PATH];
+    lstrcpyn(foldedName, name, DIM(foldedName));
+    CharUpperBuff(foldedName, lstrlen(foldedName));
+
+    const int nameIndex = m_dllNames.Find(foldedName, DirectoryIndex::Hash(foldedName));
+
+    return nameIndex >= 0 ? m_dllModules[nameIndex] : -1;
+}
+
+void CALLBACK ImportValidator::ParseModule(int index, LPVOID context)
+{
+    Module& module = *static_cast<Module* const*>(context)[index];
+    Parse(module);
+}
+
+void CALLBACK ImportValidator::CheckModule(int index, LPVOID context)
+{
+    static_cast<ImportValidator*>(context)->Check(index);
+}
+
+void ImportValidator::Parse(Module& module)
+{
+    ImageFile file;
+    module.error = file.Open(module.path);
+
+    if (NO_ERROR != module.error)
+        return;
+
+    try
+    {
+        ParseImports(file, module);
+        ParseExports(file, module);
+    }
+    catch (SystemException& e)
+    {
+        //
+        // A damaged image is one the loader would refuse, which is a
+        // problem to report like any other. Only running out of memory
+        // is worth giving up over.
+        //
+
+        if (ERROR_NOT_ENOUGH_MEMORY == e.GetCode())
+            throw;
+
+        module.error = ERROR_BAD_EXE_FORMAT;
+    }
+}
+
+void ImportValidator::ParseImports(const ImageFile& file, Module& module)
+{
+    IMAGE_DATA_DIRECTORY importData;
+
+    if (!file.GetDirectory(IMAGE_DIRECTORY_ENTRY_IMPORT, importData))
+        return;
+
+    const bool is64Bit = file.Is64Bit();
+    const DWORD thunkSize = is64Bit ? sizeof(ULONGLONG) : sizeof(DWORD);
+    const ULONGLONG ordinalFlag = is64Bit ? 0x8000000000000000ULL : 0x80000000UL;
+
+    DWORD descriptorOffset = file.MapAddress(importData.VirtualAddress);
+
+    for (;;)
+    {
+        ImportDescriptor descriptor;
+        file.Read(descriptorOffset, &descriptor, sizeof(descriptor));
+        descriptorOffset += sizeof(descriptor);
+
+        if (!descriptor.name || !descriptor.firstThunk)
+            break;
+
+        ImportedDll dll = { module.text.GetCount(), -1, module.imports.GetCount(), 0 };
+
+        if (!file.ReadString(file.MapAddress(descriptor.name), MAX_PATH, module.text))
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        //
+        // The original thunks are the ones left as they were when the
+        // image was bound. Images that have none only have the thunks
+        // that the loader overwrites, which are as good in the file.
+        //
+
+        DWORD thunkOffset = file.MapAddress(descriptor.originalFirstThunk ?
+            descriptor.originalFirstThunk : descriptor.firstThunk);
+
+        for (;;)
+        {
+            ULONGLONG thunk = 0;
+            file.Read(thunkOffset, &thunk, thunkSize);
+            thunkOffset += thunkSize;
+
+            if (!thunk)
+                break;
+
+            Import import = { NoSymbol, 0 };
+
+            if (thunk & ordinalFlag)
+            {
+                import.ordinal = static_cast<WORD>(thunk);
+            }
+            else
+            {
+                //
+                // The name comes after a two-byte hint of where in the
+                // export table it is likely to be found.
+                //
+
+                import.symbolOffset = module.text.GetCount();
+
+                if (!file.ReadString(file.MapAddress(static_cast<DWORD>(thunk)) + sizeof(WORD),
+                        MaxSymbolLength, module.text))
+                {
+                    throw SystemException(ERROR_BAD_FORMAT);
+                }
+            }
+
+            module.imports.Add(import);
+        }
+
+        dll.importCount = module.imports.GetCount() - dll.firstImport;
+        module.dlls.Add(dll);
+    }
+}
+
+void ImportValidator::ParseExports(const ImageFile& file, Module& module)
+{
+    IMAGE_DATA_DIRECTORY exportData;
+
+    if (!file.GetDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT, exportData))
+        return;
+
+    IMAGE_EXPORT_DIRECTORY directory;
+    file.Read(file.MapAddress(exportData.VirtualAddress), &directory, sizeof(directory));
+
+    if (directory.NumberOfNames > file.GetSize() / sizeof(DWORD) ||
+        directory.NumberOfFunctions > file.GetSize() / sizeof(DWORD))
+    {
+        throw SystemException(ERROR_BAD_FORMAT);
+    }
+
+    module.ordinalBase = directory.Base;
+
+    if (!directory.NumberOfFunctions)
+        return;
+
+    //
+    // Functions with no address are gaps in the range of ordinals. Those
+    // whose address lies within the export directory are forwarded, and
+    // the DLLs they are forwarded to are noted so that they can be
+    // brought into the closure.
+    //
+
+    const DWORD functionsOffset = file.MapAddress(directory.AddressOfFunctions);
+
+    module.functions.SetCount(directory.NumberOfFunctions);
+
+    for (DWORD i = 0; i < directory.NumberOfFunctions; i++)
+    {
+        DWORD functionAddress;
+        file.Read(functionsOffset + i * sizeof(DWORD), &functionAddress, sizeof(functionAddress));
+
+        module.functions[i] = functionAddress ? NoForwarder : NoFunction;
+
+        if (functionAddress < exportData.VirtualAddress ||
+            functionAddress - exportData.VirtualAddress >= exportData.Size)
+        {
+            continue;
+        }
+
+        const DWORD forwarderOffset = module.text.GetCount();
+
+        if (!file.ReadString(file.MapAddress(functionAddress), MaxSymbolLength, module.text))
+            continue;
+
+        module.functions[i] = forwarderOffset;
+
+        TCHAR dllName[MAX_PATH];
+        LPCTSTR symbol;
+
+        if (!GetForwardedDll(module.text.GetData() + forwarderOffset, dllName, symbol))
+            continue;
+
+        bool isKnown = false;
+
+        for (int j = 0; j < module.forwardedDllOffsets.GetCount() && !isKnown; j++)
+            isKnown = 0 == lstrcmpi(dllName, module.text.GetData() + module.forwardedDllOffsets[j]);
+
+        if (!isKnown)
+        {
+            module.forwardedDllOffsets.Add(module.text.GetCount());
+            module.text.Append(dllName, lstrlen(dllName) + 1);
+        }
+    }
+
+    if (!directory.NumberOfNames)
+        return;
+
+    const DWORD namesOffset = file.MapAddress(directory.AddressOfNames);
+    const DWORD ordinalsOffset = file.MapAddress(directory.AddressOfNameOrdinals);
+
+    Array<TCHAR> name;
+
+    module.exportFunctions.Reserve(directory.NumberOfNames);
+
+    for (DWORD i = 0; i < directory.NumberOfNames; i++)
+    {
+        DWORD nameAddress;
+        file.Read(namesOffset + i * sizeof(DWORD), &nameAddress, sizeof(nameAddress));
+
+        WORD functionIndex;
+        file.Read(ordinalsOffset + i * sizeof(WORD), &functionIndex, sizeof(functionIndex));
+
+        name.Clear();
+
+        if (functionIndex >= directory.NumberOfFunctions ||
+            !file.ReadString(file.MapAddress(nameAddress), MaxSymbolLength, name))
+        {
+            continue;
+        }
+
+        //
+        // Export names are matched exactly, as the loader does, so they
+        // go into the table as they are rather than folded.
+        //
+
+        if (module.exportNames.Add(name.GetData(), DirectoryIndex::Hash(name.GetData())) ==
+            module.exportFunctions.GetCount())
+        {
+            module.exportFunctions.Add(functionIndex);
+        }
+    }
+}
+
+bool ImportValidator::GetForwardedDll(LPCTSTR forwarder, LPTSTR dllName, LPCTSTR& symbol)
+{
+    _ASSERT(forwarder);
+    _ASSERT(dllName);
+
+    //
+    // A forwarder names the DLL and the export in it, as in
+    // NTDLL.RtlAllocateHeap or NTDLL.#12. The DLL is given without its
+    // extension, which is then taken to be .DLL.
+    //
+
+    LPCTSTR dot = StrRChr(forwarder, NULL, _T('.'));
+
+    if (!dot || dot == forwarder || !dot[1])
+        return false;
+
+    const int length = static_cast<int>(dot - forwarder);
+
+    if (length + 5 > MAX_PATH)
+        return false;
+
+    lstrcpyn(dllName, forwarder, length + 1);
+
+    if (!StrChr(dllName, _T('.')))
+        lstrcat(dllName, _T(".DLL"));
+
+    symbol = dot + 1;
+
+    return true;
+}
+
+void ImportValidator::Check(int moduleIndex)
+{
+    Module& module = *m_modules[moduleIndex];
+
+    for (int i = 0; i < module.dlls.GetCount(); i++)
+    {
+        const ImportedDll& dll = module.dlls[i];
+
+        //
+        // A DLL that cannot be found or loaded is one problem, however
+        // many entry points are imported from it.
+        //
+
+        DWORD error = dll.moduleIndex < 0 ? ERROR_MOD_NOT_FOUND : m_modules[dll.moduleIndex]->error;
+
+        if (NO_ERROR != error)
+        {
+            Problem problem = { moduleIndex, error, dll.nameOffset, NoSymbol, 0 };
+            module.problems.Add(problem);
+            continue;
+        }
+
+        for (int j = 0; j < dll.importCount; j++)
+        {
+            const Import& import = module.imports[dll.firstImport + j];
+
+            error = CheckImport(dll.moduleIndex, NoSymbol != import.symbolOffset ?
+                module.text.GetData() + import.symbolOffset : NULL, import.ordinal);
+
+            if (NO_ERROR != error)
+            {
+                Problem problem = { moduleIndex, error, dll.nameOffset, import.symbolOffset, import.ordinal };
+                module.problems.Add(problem);
+            }
+        }
+    }
+}
+
+DWORD ImportValidator::CheckImport(int moduleIndex, LPCTSTR symbol, DWORD ordinal) const
+{
+    //
+    // Follow the export through however many forwarders until it lands
+    // on code, or on a DLL or export that is not there. A chain that
+    // goes on for too long is taken to be going round in a circle.
+    //
+
+    for (int depth = 0; depth < MaxForwarderDepth; depth++)
+    {
+        const Module& module = *m_modules[moduleIndex];
+
+        if (NO_ERROR != module.error)
+            return module.error;
+
+        DWORD functionIndex = NoFunction;
+
+        if (symbol)
+        {
+            const int nameIndex = module.exportNames.Find(symbol, DirectoryIndex::Hash(symbol));
+
+            if (nameIndex >= 0)
+                functionIndex = module.exportFunctions[nameIndex];
+        }
+        else if (ordinal >= module.ordinalBase)
+        {
+            functionIndex = ordinal - module.ordinalBase;
+        }
+
+        if (functionIndex >= static_cast<DWORD>(module.functions.GetCount()) ||
+            NoFunction == module.functions[functionIndex])
+        {
+            return ERROR_PROC_NOT_FOUND;
+        }
+
+        const DWORD forwarderOffset = module.functions[functionIndex];
+
+        if (NoForwarder == forwarderOffset)
+            return NO_ERROR;
+
+        TCHAR dllName[MAX_PATH];
+        LPCTSTR forwardedSymbol;
+
+        if (!GetForwardedDll(module.text.GetData() + forwarderOffset, dllName, forwardedSymbol))
+            return ERROR_PROC_NOT_FOUND;
+
+        moduleIndex = FindDll(dllName);
+
+        if (moduleIndex < 0)
+            return ERROR_MOD_NOT_FOUND;
+
+        if (_T('#') == forwardedSymbol[0])
+        {
+            symbol = NULL;
+            ordinal = StrToInt(forwardedSymbol + 1);
+        }
+        else
+        {
+            symbol = forwardedSymbol;
+        }
+    }
+
+    return ERROR_PROC_NOT_FOUND;
+}
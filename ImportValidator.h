@@ -0,0 +1,159 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ImportProblem
+// --------------------------------------------------------------------------
+//
+//  Something that would stop the loader from getting an image going: a
+//  DLL that it imports from and that cannot be found or loaded, or an
+//  entry point that it imports and that the DLL does not export. The
+//  symbol is NULL for an import by ordinal, in which case the ordinal is
+//  set instead, and both are empty for a problem with the DLL as a whole.
+//
+
+struct ImportProblem
+{
+    int moduleIndex;
+    DWORD error;
+    LPCTSTR dllName;
+    LPCTSTR symbol;
+    DWORD ordinal;
+};
+
+// --------------------------------------------------------------------------
+//  ImportValidator
+// --------------------------------------------------------------------------
+//
+//  Checks that an executable would load by walking the closure of the
+//  DLLs it imports from, as found by a resolver set up for it, and
+//  checking every import, by name or by ordinal, against the exports of
+//  the DLL it is bound to. Forwarded exports are followed to the DLL that
+//  actually provides them.
+//
+//  Every module in the closure is parsed once, however many others import
+//  from it, and the modules at each level of the closure are parsed in
+//  parallel. Once they all are, the imports of every module are checked
+//  in parallel too, since by then everything they are checked against is
+//  only ever read.
+//
+//  Delay-loaded imports are not checked since a missing one only fails
+//  if and when it is first called.
+//
+//  None of the methods throw. Failures are reported as Win32 error codes.
+//  Validate only fails when the executable itself cannot be read; what
+//  is wrong with its imports is reported as problems.
+//
+
+class ImportValidator
+{
+public:
+
+    enum { MaxForwarderDepth = 16 };
+
+    ImportValidator() : m_resolver(NULL) {}
+    ~ImportValidator() { Clear(); }
+
+    DWORD Validate(LPCTSTR path, const Resolver& resolver, int threadCount);
+
+    int GetModuleCount() const { return m_modules.GetCount(); }
+    LPCTSTR GetModulePath(int index) const { return m_modules[index]->path; }
+
+    int GetProblemCount() const { return m_problems.GetCount(); }
+    void GetProblem(int index, ImportProblem& problem) const;
+
+private:
+
+    enum
+    {
+        NoSymbol = 0xFFFFFFFF,
+        NoFunction = 0xFFFFFFFF,
+        NoForwarder = 0xFFFFFFFE,
+        MaxSymbolLength = 1024
+    };
+
+    struct ImportedDll
+    {
+        DWORD nameOffset;
+        int moduleIndex;
+        int firstImport;
+        int importCount;
+    };
+
+    struct Import
+    {
+        DWORD symbolOffset;
+        DWORD ordinal;
+    };
+
+    struct Problem
+    {
+        int moduleIndex;
+        DWORD error;
+        DWORD dllOffset;
+        DWORD symbolOffset;
+        DWORD ordinal;
+    };
+
+    //
+    // Everything about one module that its imports and those of others
+    // are checked against. The functions hold, for each ordinal from the
+    // base onwards, whether it is exported and, if so, whether it is
+    // forwarded and the offset of the forwarder string in the text.
+    //
+
+    struct Module
+    {
+        TCHAR path[MAX_PATH];
+        DWORD error;
+        Array<TCHAR> text;
+        Array<ImportedDll> dlls;
+        Array<Import> imports;
+        Array<DWORD> forwardedDllOffsets;
+        NameTable exportNames;
+        Array<WORD> exportFunctions;
+        Array<DWORD> functions;
+        DWORD ordinalBase;
+        Array<Problem> problems;
+    };
+
+    void Clear();
+    int AddModule(LPCTSTR path);
+    int ResolveDll(LPCTSTR name);
+    int FindDll(LPCTSTR name) const;
+    void Check(int moduleIndex);
+    DWORD CheckImport(int moduleIndex, LPCTSTR symbol, DWORD ordinal) const;
+
+    static void CALLBACK ParseModule(int index, LPVOID context);
+    static void CALLBACK CheckModule(int index, LPVOID context);
+    static void Parse(Module& module);
+    static void ParseImports(const ImageFile& file, Module& module);
+    static void ParseExports(const ImageFile& file, Module& module);
+    static bool GetForwardedDll(LPCTSTR forwarder, LPTSTR dllName, LPCTSTR& symbol);
+
+    const Resolver* m_resolver;
+    Array<Module*> m_modules;
+    NameTable m_modulePaths;
+    NameTable m_dllNames;
+    Array<int> m_dllModules;
+    Array<Problem> m_problems;
+
+    ImportValidator(const ImportValidator&);
+    ImportValidator& operator=(const ImportValidator&);
+};
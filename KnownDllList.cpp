@@ -0,0 +1,185 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "KnownDllList.h"
+
+// --------------------------------------------------------------------------
+//  KnownDllList
+// --------------------------------------------------------------------------
+
+DWORD KnownDllList::Load(LPCTSTR filePath)
+{
+    _ASSERT(filePath);
+    _ASSERT(!GetCount());
+
+    if (!GetSystemDirectory(m_directory, DIM(m_directory)))
+        return GetLastError();
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD error = NO_ERROR;
+
+    try
+    {
+        DWORD fileSizeHigh = 0;
+        const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+        if (fileSizeHigh || fileSize > MaxFileSize)
+            throw SystemException(ERROR_BAD_FORMAT);
+
+        Array<TCHAR> text;
+        text.SetCount(fileSize / sizeof(TCHAR) + 1);
+
+        DWORD bytesRead = 0;
+
+        if (!ReadFile(file, text.GetData(), fileSize, &bytesRead, NULL))
+            throw SystemException(GetLastError());
+
+        text[bytesRead / sizeof(TCHAR)] = 0;
+
+        //
+        // Break the text up into lines in place. Line breaks may be
+        // either CR+LF or just LF.
+        //
+
+        LPTSTR line = text.GetData();
+
+        while (*line)
+        {
+            LPTSTR end = StrChr(line, _T('\n'));
+
+            if (end)
+                *end = 0;
+
+            ParseLine(line);
+
+            if (!end)
+                break;
+
+            line = end + 1;
+        }
+    }
+    catch (SystemException& e)
+    {
+        error = e.GetCode();
+    }
+
+    CloseHandle(file);
+
+    return error;
+}
+
+void KnownDllList::ParseLine(LPTSTR line)
+{
+    _ASSERT(line);
+
+    StrTrim(line, _T(" \t\r"));
+
+    if (!*line || _T(';') == *line || _T('#') == *line)
+        return;
+
+    LPTSTR value = StrChr(line, _T('='));
+
+    if (!value)
+    {
+        PathUnquoteSpaces(line);
+        Add(line);
+        return;
+    }
+
+    *value++ = 0;
+
+    StrTrim(line, _T(" \t"));
+    StrTrim(value, _T(" \t"));
+    PathUnquoteSpaces(line);
+    PathUnquoteSpaces(value);
+
+    if (0 != lstrcmpi(line, _T("DllDirectory")))
+    {
+        Add(value);
+        return;
+    }
+
+    DWORD length = ExpandEnvironmentStrings(value, m_directory, DIM(m_directory));
+
+    if (0 == length || length > DIM(m_directory))
+        throw SystemException(ERROR_BAD_FORMAT);
+}
+
+void KnownDllList::Add(LPCTSTR name)
+{
+    _ASSERT(name);
+
+    const int length = lstrlen(name);
+
+    if (!length)
+        return;
+
+    if (length >= MAX_PATH)
+        throw SystemException(ERROR_BAD_FORMAT);
+
+    TCHAR foldedName[MAX_PATH];
+    lstrcpy(foldedName, name);
+    CharUpperBuff(foldedName, length);
+
+    if (m_names.Add(foldedName, DirectoryIndex::Hash(foldedName)) == m_offsets.GetCount())
+    {
+        m_offsets.Add(m_text.GetCount());
+        m_text.Append(name, length + 1);
+    }
+}
+
+bool KnownDllList::Find(LPCTSTR fileName, LPTSTR path) const
+{
+    _ASSERT(fileName);
+    _ASSERT(path);
+
+    //
+    // Like the loader, take a name without an extension to be that of
+    // a DLL. A name with a path of its own is never a known DLL.
+    //
+
+    const int length = lstrlen(fileName);
+
+    if (!GetCount() || length + 4 >= MAX_PATH || StrPBrk(fileName, _T("\\/:")))
+        return false;
+
+    TCHAR foldedName[MAX_PATH];
+    lstrcpy(foldedName, fileName);
+    CharUpperBuff(foldedName, length);
+
+    int index = m_names.Find(foldedName, DirectoryIndex::Hash(foldedName));
+
+    if (index < 0 && !*PathFindExtension(foldedName))
+    {
+        lstrcat(foldedName, _T(".DLL"));
+        index = m_names.Find(foldedName, DirectoryIndex::Hash(foldedName));
+    }
+
+    return index >= 0 && NULL != PathCombine(path, m_directory, GetName(index));
+}
@@ -0,0 +1,65 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  KnownDllList
+// --------------------------------------------------------------------------
+//
+//  The DLLs that the loader serves from its own cache of sections, set
+//  up at boot from the KnownDLLs key of the session manager, instead of
+//  searching for them. A name on the list always resolves to the copy in
+//  the system directory, whatever the search order says.
+//
+//  The list is read from a text file with a name per line, so that it
+//  can be taken from any machine. A line can also be a value in the form
+//  name=kernel32.dll, as the registry lists them, and a DllDirectory line
+//  gives the directory where the DLLs are, which is otherwise the system
+//  directory of this machine. Blank lines and lines starting with ; or #
+//  are skipped.
+//
+
+class KnownDllList
+{
+public:
+
+    enum { MaxFileSize = 1024 * 1024 };
+
+    KnownDllList() { m_directory[0] = 0; }
+
+    DWORD Load(LPCTSTR filePath);
+
+    int GetCount() const { return m_offsets.GetCount(); }
+    LPCTSTR GetName(int index) const { return m_text.GetData() + m_offsets[index]; }
+    LPCTSTR GetDirectory() const { return m_directory; }
+
+    bool Find(LPCTSTR fileName, LPTSTR path) const;
+
+private:
+
+    void ParseLine(LPTSTR line);
+    void Add(LPCTSTR name);
+
+    NameTable m_names;
+    Array<TCHAR> m_text;
+    Array<int> m_offsets;
+    TCHAR m_directory[MAX_PATH];
+
+    KnownDllList(const KnownDllList&);
+    KnownDllList& operator=(const KnownDllList&);
+};
@@ -0,0 +1,125 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  LineReader
+// --------------------------------------------------------------------------
+//
+//  Reads a file or pipe one line at a time through a fixed-size buffer
+//  so that arbitrarily long lists of names can be streamed through
+//  without ever being held in memory as a whole. Line breaks may be
+//  either CR+LF or just LF.
+//
+
+class LineReader
+{
+public:
+
+    enum { BufferSize = 64 * 1024 };
+
+    LineReader(HANDLE handle) :
+        m_handle(handle),
+        m_buffer(new TCHAR[BufferSize]),
+        m_position(0),
+        m_length(0),
+        m_isAtEnd(false)
+    {
+        _ASSERT(handle);
+
+        if (!m_buffer)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+    }
+
+    ~LineReader() { delete [] m_buffer; }
+
+    //
+    // Reads the next line into the given buffer and returns false at the
+    // end of the input. A line that does not fit is cut short and
+    // flagged through isTruncated; the rest of it is skipped.
+    //
+
+    bool ReadLine(LPTSTR line, int capacity, bool& isTruncated)
+    {
+        _ASSERT(line);
+        _ASSERT(capacity > 0);
+
+        int length = 0;
+        bool hasData = false;
+        isTruncated = false;
+
+        for (;;)
+        {
+            if (m_position == m_length && !Fill())
+                break;
+
+            hasData = true;
+            TCHAR ch = m_buffer[m_position++];
+
+            if (_T('\n') == ch)
+                break;
+
+            if (length < capacity - 1)
+                line[length++] = ch;
+            else
+                isTruncated = true;
+        }
+
+        if (length > 0 && _T('\r') == line[length - 1])
+            length--;
+
+        line[length] = 0;
+
+        return hasData;
+    }
+
+private:
+
+    bool Fill()
+    {
+        if (m_isAtEnd)
+            return false;
+
+        DWORD bytesRead = 0;
+
+        if (!ReadFile(m_handle, m_buffer, BufferSize * sizeof(TCHAR), &bytesRead, NULL) ||
+            0 == bytesRead)
+        {
+            //
+            // A broken pipe is how the writing end of a pipe signals
+            // that it is done, so it is an end like any other.
+            //
+
+            m_isAtEnd = true;
+            return false;
+        }
+
+        m_position = 0;
+        m_length = bytesRead / sizeof(TCHAR);
+
+        return m_length > 0;
+    }
+
+    HANDLE m_handle;
+    LPTSTR m_buffer;
+    DWORD m_position;
+    DWORD m_length;
+    bool m_isAtEnd;
+
+    LineReader(const LineReader&);
+    LineReader& operator=(const LineReader&);
+};
@@ -0,0 +1,826 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "Suggestions.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "LookupIndex.h"
+
+//
+// Rounds a size up to a multiple of eight so that whatever follows it in
+// the image is suitably aligned.
+//
+
+static DWORD Align(DWORD size)
+{
+    return (size + 7) & ~7UL;
+}
+
+static ULONGLONG MakeQuad(DWORD high, DWORD low)
+{
+    return (static_cast<ULONGLONG>(high) << 32) | low;
+}
+
+//
+// The finalizer of MurmurHash3, which makes every bit of the result
+// depend on every bit of the input.
+//
+
+static ULONGLONG Mix(ULONGLONG value)
+{
+    value ^= value >> 33;
+    value *= MakeQuad(0xFF51AFD7, 0xED558CCD);
+    value ^= value >> 33;
+    value *= MakeQuad(0xC4CEB9FE, 0x1A85EC53);
+    value ^= value >> 33;
+
+    return value;
+}
+
+// --------------------------------------------------------------------------
+//  LookupIndex
+// --------------------------------------------------------------------------
+
+LookupIndex::LookupIndex() :
+    m_mapping(NULL),
+    m_view(NULL),
+    m_header(NULL),
+    m_directories(NULL),
+    m_buckets(NULL),
+    m_slots(NULL),
+    m_names(NULL),
+    m_lists(NULL)
+{
+}
+
+LookupIndex::~LookupIndex()
+{
+    Unload();
+}
+
+DWORD LookupIndex::Build(const SearchOrder& searchOrder, const DirectoryIndex* const* indexes)
+{
+    _ASSERT(indexes);
+
+    //
+    // Every directory has to have been listed, or the index could not
+    // tell a name that is not there from one it was never told about.
+    //
+
+    const int directoryCount = searchOrder.GetCount();
+    int occurrenceCount = 0;
+
+    for (int i = 0; i < directoryCount; i++)
+    {
+        if (!indexes[i]->IsScanned())
+            return ERROR_NOT_READY;
+
+        occurrenceCount += indexes[i]->GetNameCount();
+    }
+
+    Unload();
+
+    try
+    {
+        //
+        // Gather the distinct names along with every directory each one
+        // is in. Going through the directories in order means that the
+        // directories of a name are gathered in order of precedence.
+        //
+
+        NameTable names;
+        Array<DWORD> occurrenceNames;
+        Array<DWORD> occurrenceDirectories;
+
+        occurrenceNames.Reserve(occurrenceCount);
+        occurrenceDirectories.Reserve(occurrenceCount);
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            const DirectoryIndex& index = *indexes[i];
+
+            for (int j = 0; j < index.GetNameCount(); j++)
+            {
+                TCHAR name[MAX_PATH];
+                index.GetName(j, name);
+
+                occurrenceNames.Add(names.Add(name, index.GetNameHash(j)));
+                occurrenceDirectories.Add(i);
+            }
+        }
+
+        const DWORD nameCount = names.GetCount();
+
+        //
+        // Lay out the list of every name, a count followed by that many
+        // directory indexes, and then fill them in.
+        //
+
+        Array<DWORD> listOffsets;
+        listOffsets.SetCount(nameCount);
+        ZeroMemory(listOffsets.GetData(), nameCount * sizeof(DWORD));
+
+        for (int i = 0; i < occurrenceCount; i++)
+            listOffsets[occurrenceNames[i]]++;
+
+        DWORD listOffset = 0;
+
+        for (DWORD i = 0; i < nameCount; i++)
+        {
+            const DWORD count = listOffsets[i];
+            listOffsets[i] = listOffset;
+            listOffset += count + 1;
+        }
+
+        Array<DWORD> lists;
+        lists.SetCount(listOffset);
+        ZeroMemory(lists.GetData(), listOffset * sizeof(DWORD));
+
+        for (int i = 0; i < occurrenceCount; i++)
+        {
+            DWORD* list = lists.GetData() + listOffsets[occurrenceNames[i]];
+            list[++list[0]] = occurrenceDirectories[i];
+        }
+
+        //
+        // Build the suggestions over the same names, in the same order,
+        // so that the postings refer to them by their index here.
+        //
+
+        SuggestionIndex suggestions;
+
+        for (DWORD i = 0; i < nameCount; i++)
+            suggestions.AddName(names.GetName(i), lists[listOffsets[i] + 1]);
+
+        suggestions.Build();
+
+        const SuggestionImage& suggestionImage = suggestions.GetImage();
+        const DWORD postingCount = suggestionImage.postingCount;
+
+        //
+        // Look for a seed under which every name can be placed. With a
+        // good hash the first one nearly always does.
+        //
+
+        const DWORD bucketCount = nameCount / BucketSize + 1;
+
+        Array<KeySlot> keys;
+        keys.SetCount(nameCount);
+
+        Array<Bucket> buckets;
+        Array<DWORD> slotKeys;
+        DWORD seed = 0;
+
+        for (;;)
+        {
+            for (DWORD i = 0; i < nameCount; i++)
+                Split(Hash(names.GetName(i), seed), nameCount, bucketCount, keys[i]);
+
+            if (Place(keys, bucketCount, buckets, slotKeys))
+                break;
+
+            if (++seed == MaxSeedCount)
+                return ERROR_CAN_NOT_COMPLETE;
+        }
+
+        //
+        // Now that everything is known, write out the image.
+        //
+
+        const DWORD namesLength = names.GetTextLength();
+        const DWORD listsLength = lists.GetCount();
+
+        const DWORD directoriesOffset = Align(sizeof(FileHeader));
+        const DWORD bucketsOffset = Align(directoriesOffset + directoryCount * sizeof(FileDirectory));
+        const DWORD slotsOffset = Align(bucketsOffset + bucketCount * sizeof(Bucket));
+        const DWORD namesOffset = Align(slotsOffset + nameCount * sizeof(Slot));
+        const DWORD listsOffset = Align(namesOffset + namesLength * sizeof(TCHAR));
+        const DWORD suggestionNamesOffset = Align(listsOffset + listsLength * sizeof(DWORD));
+        const DWORD suggestionDirectoriesOffset = Align(suggestionNamesOffset + nameCount * sizeof(DWORD));
+        const DWORD bucketStartsOffset = Align(suggestionDirectoriesOffset + nameCount * sizeof(DWORD));
+        const DWORD postingsOffset = Align(bucketStartsOffset + (SuggestionIndex::BucketCount + 1) * sizeof(DWORD));
+        const DWORD pathsOffset = Align(postingsOffset + postingCount * sizeof(DWORD));
+
+        DWORD size = pathsOffset;
+
+        for (int i = 0; i < directoryCount; i++)
+            size += (lstrlen(searchOrder.GetDirectory(i)) + 1) * sizeof(TCHAR);
+
+        size = Align(size);
+
+        m_storage.SetCount(size);
+        ZeroMemory(m_storage.GetData(), size);
+
+        BYTE* image = m_storage.GetData();
+
+        FileHeader& header = *reinterpret_cast<FileHeader*>(image);
+        header.signature = FileSignature;
+        header.version = FileVersion;
+        header.characterSize = sizeof(TCHAR);
+        header.seed = seed;
+        header.nameCount = nameCount;
+        header.bucketCount = bucketCount;
+        header.directoryCount = directoryCount;
+        header.directoriesOffset = directoriesOffset;
+        header.bucketsOffset = bucketsOffset;
+        header.slotsOffset = slotsOffset;
+        header.namesOffset = namesOffset;
+        header.namesLength = namesLength;
+        header.listsOffset = listsOffset;
+        header.listsLength = listsLength;
+        header.suggestionNamesOffset = suggestionNamesOffset;
+        header.suggestionDirectoriesOffset = suggestionDirectoriesOffset;
+        header.bucketStartsOffset = bucketStartsOffset;
+        header.postingsOffset = postingsOffset;
+        header.postingCount = postingCount;
+        header.size = size;
+
+        FileDirectory* directories = reinterpret_cast<FileDirectory*>(image + directoriesOffset);
+        DWORD pathOffset = pathsOffset;
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            LPCTSTR path = searchOrder.GetDirectory(i);
+            const DWORD length = lstrlen(path);
+
+            directories[i].pathOffset = pathOffset;
+            directories[i].lastWriteTime = indexes[i]->GetLastWriteTime();
+
+            CopyMemory(image + pathOffset, path, length * sizeof(TCHAR));
+            pathOffset += (length + 1) * sizeof(TCHAR);
+        }
+
+        CopyMemory(image + bucketsOffset, buckets.GetData(), bucketCount * sizeof(Bucket));
+
+        Slot* slots = reinterpret_cast<Slot*>(image + slotsOffset);
+
+        for (DWORD i = 0; i < nameCount; i++)
+        {
+            const DWORD nameIndex = slotKeys[i] - 1;
+
+            slots[i].fingerprint = keys[nameIndex].fingerprint;
+            slots[i].nameOffset = names.GetOffset(nameIndex);
+            slots[i].listOffset = listOffsets[nameIndex];
+        }
+
+        if (namesLength)
+            CopyMemory(image + namesOffset, names.GetText(), namesLength * sizeof(TCHAR));
+
+        if (listsLength)
+            CopyMemory(image + listsOffset, lists.GetData(), listsLength * sizeof(DWORD));
+
+        DWORD* suggestionNames = reinterpret_cast<DWORD*>(image + suggestionNamesOffset);
+
+        for (DWORD i = 0; i < nameCount; i++)
+            suggestionNames[i] = names.GetOffset(i);
+
+        if (nameCount)
+        {
+            CopyMemory(image + suggestionDirectoriesOffset,
+                suggestionImage.directoryIndexes, nameCount * sizeof(DWORD));
+        }
+
+        CopyMemory(image + bucketStartsOffset, suggestionImage.bucketStarts,
+            (SuggestionIndex::BucketCount + 1) * sizeof(DWORD));
+
+        if (postingCount)
+        {
+            CopyMemory(image + postingsOffset,
+                suggestionImage.postings, postingCount * sizeof(DWORD));
+        }
+
+        SetImage(image);
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+void LookupIndex::Split(ULONGLONG hash, DWORD nameCount, DWORD bucketCount, KeySlot& key)
+{
+    _ASSERT(nameCount);
+    _ASSERT(bucketCount);
+
+    //
+    // The bucket and first slot come from the two halves of the hash.
+    // The second slot, which the displacement of the bucket multiplies,
+    // and the fingerprint come from mixing it once more.
+    //
+
+    const ULONGLONG mixed = Mix(hash ^ MakeQuad(0x9E3779B9, 0x7F4A7C15));
+
+    key.bucket = static_cast<DWORD>(hash) % bucketCount;
+    key.first = static_cast<DWORD>(hash >> 32) % nameCount;
+    key.second = static_cast<DWORD>(mixed) % nameCount;
+    key.fingerprint = static_cast<DWORD>(mixed >> 32);
+}
+
+bool LookupIndex::Place(const Array<KeySlot>& keys, DWORD bucketCount,
+    Array<Bucket>& buckets, Array<DWORD>& slotKeys)
+{
+    const DWORD nameCount = keys.GetCount();
+
+    buckets.SetCount(bucketCount);
+    ZeroMemory(buckets.GetData(), bucketCount * sizeof(Bucket));
+
+    slotKeys.SetCount(nameCount);
+
+    if (!nameCount)
+        return true;
+
+    ZeroMemory(slotKeys.GetData(), nameCount * sizeof(DWORD));
+
+    //
+    // Group the keys by bucket.
+    //
+
+    Array<DWORD> bucketStarts;
+    bucketStarts.SetCount(bucketCount + 1);
+    ZeroMemory(bucketStarts.GetData(), (bucketCount + 1) * sizeof(DWORD));
+
+    for (DWORD i = 0; i < nameCount; i++)
+        bucketStarts[keys[i].bucket + 1]++;
+
+    DWORD maxBucketSize = 0;
+
+    for (DWORD i = 0; i < bucketCount; i++)
+    {
+        if (bucketStarts[i + 1] > maxBucketSize)
+            maxBucketSize = bucketStarts[i + 1];
+
+        bucketStarts[i + 1] += bucketStarts[i];
+    }
+
+    Array<DWORD> cursors;
+    cursors.Append(bucketStarts.GetData(), bucketCount);
+
+    Array<DWORD> bucketKeys;
+    bucketKeys.SetCount(nameCount);
+
+    for (DWORD i = 0; i < nameCount; i++)
+        bucketKeys[cursors[keys[i].bucket]++] = i;
+
+    //
+    // Place the largest buckets first, while there is still plenty of
+    // room, leaving the ones with a single key for last.
+    //
+
+    Array<DWORD> sizeStarts;
+    sizeStarts.SetCount(maxBucketSize + 2);
+    ZeroMemory(sizeStarts.GetData(), (maxBucketSize + 2) * sizeof(DWORD));
+
+    for (DWORD i = 0; i < bucketCount; i++)
+        sizeStarts[maxBucketSize - (bucketStarts[i + 1] - bucketStarts[i]) + 1]++;
+
+    for (DWORD i = 0; i <= maxBucketSize; i++)
+        sizeStarts[i + 1] += sizeStarts[i];
+
+    Array<DWORD> order;
+    order.SetCount(bucketCount);
+
+    for (DWORD i = 0; i < bucketCount; i++)
+        order[sizeStarts[maxBucketSize - (bucketStarts[i + 1] - bucketStarts[i])]++] = i;
+
+    Array<DWORD> positions;
+    positions.SetCount(maxBucketSize);
+
+    DWORD freeSlot = 0;
+
+    for (DWORD i = 0; i < bucketCount; i++)
+    {
+        const DWORD bucketIndex = order[i];
+        const DWORD first = bucketStarts[bucketIndex];
+        const DWORD size = bucketStarts[bucketIndex + 1] - first;
+
+        if (0 == size)
+            break;
+
+        Bucket& bucket = buckets[bucketIndex];
+
+        //
+        // A key on its own can go in any free slot, so rather than
+        // searching for a displacement that leads to one, which gets
+        // slow as the last few slots are taken, point it straight at
+        // the next one.
+        //
+
+        if (1 == size)
+        {
+            while (slotKeys[freeSlot])
+                freeSlot++;
+
+            const DWORD keyIndex = bucketKeys[first];
+
+            bucket.offset = (freeSlot + nameCount - keys[keyIndex].first) % nameCount;
+            slotKeys[freeSlot] = keyIndex + 1;
+
+            continue;
+        }
+
+        //
+        // Otherwise try one displacement after another until all the
+        // keys of the bucket land in free slots of their own, taking
+        // the slots as they go and giving them back on failure. The
+        // offset that goes with each displacement is drawn from a mix
+        // of it so that the pairs tried are spread over every possible
+        // combination rather than repeating every so many tries.
+        //
+
+        bool isPlaced = false;
+
+        for (DWORD displacement = 0; displacement < MaxDisplacementCount && !isPlaced; displacement++)
+        {
+            const DWORD offset = static_cast<DWORD>(Mix(displacement) % nameCount);
+
+            DWORD placedCount = 0;
+
+            for (; placedCount < size; placedCount++)
+            {
+                const DWORD keyIndex = bucketKeys[first + placedCount];
+                const KeySlot& key = keys[keyIndex];
+
+                const DWORD slot = static_cast<DWORD>((key.first +
+                    static_cast<ULONGLONG>(displacement) * key.second + offset) % nameCount);
+
+                if (slotKeys[slot])
+                    break;
+
+                slotKeys[slot] = keyIndex + 1;
+                positions[placedCount] = slot;
+            }
+
+            if (placedCount == size)
+            {
+                bucket.displacement = displacement;
+                bucket.offset = offset;
+                isPlaced = true;
+            }
+            else
+            {
+                while (placedCount > 0)
+                    slotKeys[positions[--placedCount]] = 0;
+            }
+        }
+
+        //
+        // Keys whose hashes coincide entirely can never be told apart,
+        // in which case there is nothing for it but another seed.
+        //
+
+        if (!isPlaced)
+            return false;
+    }
+
+    return true;
+}
+
+ULONGLONG LookupIndex::Hash(LPCTSTR foldedName, DWORD seed)
+{
+    _ASSERT(foldedName);
+
+    //
+    // FNV-1a in 64 bits, starting from a basis that depends on the seed,
+    // with the result mixed so that its high and low halves can be used
+    // independently.
+    //
+
+    ULONGLONG hash = MakeQuad(0xCBF29CE4, 0x84222325) ^
+        (seed * MakeQuad(0x9E3779B9, 0x7F4A7C15));
+
+    for (LPCTSTR ch = foldedName; *ch; ch++)
+    {
+        hash ^= static_cast<ULONGLONG>(static_cast<_TUCHAR>(*ch));
+        hash *= MakeQuad(0x00000100, 0x000001B3);
+    }
+
+    return Mix(hash);
+}
+
+int LookupIndex::Find(LPCTSTR foldedName, const DWORD*& directoryIndexes) const
+{
+    _ASSERT(foldedName);
+    _ASSERT(IsReady());
+
+    const DWORD nameCount = m_header->nameCount;
+
+    if (!nameCount)
+        return 0;
+
+    KeySlot key;
+    Split(Hash(foldedName, m_header->seed), nameCount, m_header->bucketCount, key);
+
+    const Bucket& bucket = m_buckets[key.bucket];
+
+    const Slot& slot = m_slots[static_cast<DWORD>((key.first +
+        static_cast<ULONGLONG>(bucket.displacement) * key.second + bucket.offset) % nameCount)];
+
+    //
+    // Every name leads to some slot, so make sure it is this one. The
+    // offsets are checked too since the file may have been damaged.
+    //
+
+    if (key.fingerprint != slot.fingerprint ||
+        slot.nameOffset >= m_header->namesLength || slot.listOffset >= m_header->listsLength ||
+        0 != _tcscmp(foldedName, m_names + slot.nameOffset))
+    {
+        return 0;
+    }
+
+    const DWORD count = m_lists[slot.listOffset];
+
+    if (count > m_header->listsLength - slot.listOffset - 1)
+        return 0;
+
+    directoryIndexes = m_lists + slot.listOffset + 1;
+
+    return count;
+}
+
+bool LookupIndex::GetSuggestions(SuggestionImage& image) const
+{
+    _ASSERT(IsReady());
+
+    const BYTE* base = reinterpret_cast<const BYTE*>(m_header);
+    const DWORD nameCount = m_header->nameCount;
+    const DWORD postingCount = m_header->postingCount;
+
+    const DWORD* nameOffsets = reinterpret_cast<const DWORD*>(base + m_header->suggestionNamesOffset);
+    const DWORD* directoryIndexes = reinterpret_cast<const DWORD*>(base + m_header->suggestionDirectoriesOffset);
+    const DWORD* bucketStarts = reinterpret_cast<const DWORD*>(base + m_header->bucketStartsOffset);
+    const DWORD* postings = reinterpret_cast<const DWORD*>(base + m_header->postingsOffset);
+
+    //
+    // Unlike a lookup, a suggestion reads wherever the postings lead, so
+    // everything they refer to is checked once, up front, in case the
+    // file was damaged.
+    //
+
+    for (DWORD i = 0; i < nameCount; i++)
+    {
+        if (nameOffsets[i] >= m_header->namesLength ||
+            directoryIndexes[i] >= m_header->directoryCount)
+        {
+            return false;
+        }
+    }
+
+    if (0 != bucketStarts[0] || postingCount != bucketStarts[SuggestionIndex::BucketCount])
+        return false;
+
+    for (int i = 0; i < SuggestionIndex::BucketCount; i++)
+    {
+        if (bucketStarts[i] > bucketStarts[i + 1])
+            return false;
+    }
+
+    for (DWORD i = 0; i < postingCount; i++)
+    {
+        if (postings[i] >= nameCount)
+            return false;
+    }
+
+    image.names = m_names;
+    image.foldedNames = m_names;
+    image.nameOffsets = nameOffsets;
+    image.directoryIndexes = directoryIndexes;
+    image.nameCount = nameCount;
+    image.bucketStarts = bucketStarts;
+    image.postings = postings;
+    image.postingCount = postingCount;
+
+    return true;
+}
+
+DWORD LookupIndex::Load(LPCTSTR filePath, const SearchOrder& searchOrder,
+    const FileSystem* fileSystem)
+{
+    _ASSERT(filePath);
+
+    Unload();
+
+    HANDLE file = CreateFile(filePath, GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    DWORD fileSizeHigh = 0;
+    const DWORD fileSize = GetFileSize(file, &fileSizeHigh);
+
+    if (fileSizeHigh || fileSize < sizeof(FileHeader))
+    {
+        CloseHandle(file);
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD error = m_mapping ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    m_view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (!m_view)
+    {
+        error = GetLastError();
+        Unload();
+        return error;
+    }
+
+    //
+    // Check that every part lies within the file and that the names
+    // end in a terminator, which is all that lookups rely on beyond the
+    // checks they make themselves.
+    //
+
+    const FileHeader& header = *reinterpret_cast<const FileHeader*>(m_view);
+
+    const ULONGLONG directoriesEnd = header.directoriesOffset +
+        static_cast<ULONGLONG>(header.directoryCount) * sizeof(FileDirectory);
+    const ULONGLONG bucketsEnd = header.bucketsOffset +
+        static_cast<ULONGLONG>(header.bucketCount) * sizeof(Bucket);
+    const ULONGLONG slotsEnd = header.slotsOffset +
+        static_cast<ULONGLONG>(header.nameCount) * sizeof(Slot);
+    const ULONGLONG namesEnd = header.namesOffset +
+        static_cast<ULONGLONG>(header.namesLength) * sizeof(TCHAR);
+    const ULONGLONG listsEnd = header.listsOffset +
+        static_cast<ULONGLONG>(header.listsLength) * sizeof(DWORD);
+    const ULONGLONG suggestionNamesEnd = header.suggestionNamesOffset +
+        static_cast<ULONGLONG>(header.nameCount) * sizeof(DWORD);
+    const ULONGLONG suggestionDirectoriesEnd = header.suggestionDirectoriesOffset +
+        static_cast<ULONGLONG>(header.nameCount) * sizeof(DWORD);
+    const ULONGLONG bucketStartsEnd = header.bucketStartsOffset +
+        static_cast<ULONGLONG>(SuggestionIndex::BucketCount + 1) * sizeof(DWORD);
+    const ULONGLONG postingsEnd = header.postingsOffset +
+        static_cast<ULONGLONG>(header.postingCount) * sizeof(DWORD);
+
+    if (FileSignature != header.signature || FileVersion != header.version ||
+        sizeof(TCHAR) != header.characterSize || header.size > fileSize ||
+        0 != ((header.directoriesOffset | header.bucketsOffset | header.slotsOffset |
+            header.namesOffset | header.listsOffset | header.suggestionNamesOffset |
+            header.suggestionDirectoriesOffset | header.bucketStartsOffset |
+            header.postingsOffset) & 7) ||
+        directoriesEnd > header.size || bucketsEnd > header.size || slotsEnd > header.size ||
+        namesEnd > header.size || listsEnd > header.size ||
+        suggestionNamesEnd > header.size || suggestionDirectoriesEnd > header.size ||
+        bucketStartsEnd > header.size || postingsEnd > header.size ||
+        (header.nameCount && (0 == header.bucketCount || 0 == header.namesLength)) ||
+        (header.namesLength && reinterpret_cast<const TCHAR*>(
+            m_view + header.namesOffset)[header.namesLength - 1]))
+    {
+        Unload();
+        return ERROR_BAD_FORMAT;
+    }
+
+    SetImage(m_view);
+
+    //
+    // An index that was built for another search order, or before any
+    // of its directories last changed, no longer says where names are.
+    //
+
+    if (!IsCurrent(searchOrder, fileSystem))
+    {
+        Unload();
+        return ERROR_INVALID_DATA;
+    }
+
+    return NO_ERROR;
+}
+
+bool LookupIndex::IsCurrent(const SearchOrder& searchOrder, const FileSystem* fileSystem) const
+{
+    _ASSERT(IsReady());
+
+    if (static_cast<DWORD>(searchOrder.GetCount()) != m_header->directoryCount)
+        return false;
+
+    const BYTE* image = reinterpret_cast<const BYTE*>(m_header);
+    const DWORD size = m_header->size;
+
+    for (DWORD i = 0; i < m_header->directoryCount; i++)
+    {
+        const FileDirectory& directory = m_directories[i];
+
+        if (directory.pathOffset >= size || 0 != (directory.pathOffset % sizeof(TCHAR)))
+            return false;
+
+        LPCTSTR path = reinterpret_cast<LPCTSTR>(image + directory.pathOffset);
+        const DWORD maxLength = (size - directory.pathOffset) / sizeof(TCHAR);
+        DWORD length = 0;
+
+        while (length < maxLength && length < MAX_PATH && path[length])
+            length++;
+
+        if (length == maxLength || length == MAX_PATH ||
+            0 != lstrcmpi(path, searchOrder.GetDirectory(i)))
+        {
+            return false;
+        }
+
+        FILETIME lastWriteTime;
+
+        if (!DirectoryIndex::QueryLastWriteTime(path, lastWriteTime, fileSystem) ||
+            0 != CompareFileTime(&lastWriteTime, &directory.lastWriteTime))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void LookupIndex::SetImage(const BYTE* image)
+{
+    _ASSERT(image);
+
+    m_header = reinterpret_cast<const FileHeader*>(image);
+    m_directories = reinterpret_cast<const FileDirectory*>(image + m_header->directoriesOffset);
+    m_buckets = reinterpret_cast<const Bucket*>(image + m_header->bucketsOffset);
+    m_slots = reinterpret_cast<const Slot*>(image + m_header->slotsOffset);
+    m_names = reinterpret_cast<const TCHAR*>(image + m_header->namesOffset);
+    m_lists = reinterpret_cast<const DWORD*>(image + m_header->listsOffset);
+}
+
+void LookupIndex::Unload()
+{
+    if (m_view)
+        UnmapViewOfFile(m_view);
+
+    if (m_mapping)
+        CloseHandle(m_mapping);
+
+    m_mapping = NULL;
+    m_view = NULL;
+    m_header = NULL;
+    m_directories = NULL;
+    m_buckets = NULL;
+    m_slots = NULL;
+    m_names = NULL;
+    m_lists = NULL;
+}
+
+DWORD LookupIndex::Save(LPCTSTR filePath) const
+{
+    _ASSERT(filePath);
+    _ASSERT(IsReady());
+
+    //
+    // Write to a temporary file and then move it over the old one so
+    // that no reader ever maps a file that is only partly written.
+    //
+
+    TCHAR temporaryPath[MAX_PATH];
+
+    if (lstrlen(filePath) + 4 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(temporaryPath, filePath);
+    lstrcat(temporaryPath, _T(".tmp"));
+
+    HANDLE output = CreateFile(temporaryPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == output)
+        return GetLastError();
+
+    DWORD written = 0;
+    DWORD error = WriteFile(output, m_header, m_header->size, &written, NULL) ?
+        NO_ERROR : GetLastError();
+
+    CloseHandle(output);
+
+    if (NO_ERROR == error && !MoveFileEx(temporaryPath, filePath, MOVEFILE_REPLACE_EXISTING))
+        error = GetLastError();
+
+    if (NO_ERROR != error)
+        DeleteFile(temporaryPath);
+
+    return error;
+}
@@ -0,0 +1,161 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  LookupIndex
+// --------------------------------------------------------------------------
+//
+//  Every name that can be found through a search order, mapped to the
+//  directories that have it, in order of precedence. It is built from the
+//  scanned indexes of all the directories in the search order and saved
+//  to a file that later runs map and use as it is.
+//
+//  Names are placed with a minimal perfect hash, built with the hash and
+//  displace scheme: names are split into small buckets and each bucket,
+//  largest first, is given the displacement that moves all of its names
+//  into free slots. There are exactly as many slots as names, so a lookup
+//  is one hash of the name, one read of its bucket and one read of the
+//  slot it leads to, which holds a fingerprint, the name itself and its
+//  list of directories. The name is compared to tell a name that is not
+//  in the index from the one that happens to share its slot.
+//
+//  A saved index is only used while its search order is the same and
+//  none of the directories in it have changed since it was built, as
+//  seen through the file system given, or that of Windows.
+//
+//  The trigram postings of a suggestion index over the same names are
+//  built and saved along with it, each name being suggested from the
+//  first directory that has it, so that a resolver can attach to those
+//  too instead of listing every directory again.
+//
+
+class LookupIndex
+{
+public:
+
+    enum
+    {
+        FileSignature = 0x494C5046, // FPLI
+        FileVersion = 2,
+        BucketSize = 2,
+        MaxSeedCount = 16,
+        MaxDisplacementCount = 1 << 20
+    };
+
+    LookupIndex();
+    ~LookupIndex();
+
+    DWORD Build(const SearchOrder& searchOrder, const DirectoryIndex* const* indexes);
+    DWORD Load(LPCTSTR filePath, const SearchOrder& searchOrder,
+        const FileSystem* fileSystem = NULL);
+    DWORD Save(LPCTSTR filePath) const;
+
+    bool IsReady() const { return NULL != m_header; }
+    int GetNameCount() const { return m_header ? m_header->nameCount : 0; }
+
+    int Find(LPCTSTR foldedName, const DWORD*& directoryIndexes) const;
+    bool GetSuggestions(SuggestionImage& image) const;
+
+    static ULONGLONG Hash(LPCTSTR foldedName, DWORD seed);
+
+private:
+
+    //
+    // The file is the image itself. The header is followed, each part
+    // at the offset the header gives for it, by a record per directory
+    // in the search order, a displacement pair per bucket, a slot per
+    // name, the names and then the directory lists, each of which is a
+    // count followed by that many directory indexes. After those come
+    // the parts of the suggestion index: the offset of every name and
+    // its first directory, in the order the postings refer to them, the
+    // start of every trigram bucket and then the postings.
+    //
+
+    struct FileHeader
+    {
+        DWORD signature;
+        WORD version;
+        WORD characterSize;
+        DWORD seed;
+        DWORD nameCount;
+        DWORD bucketCount;
+        DWORD directoryCount;
+        DWORD directoriesOffset;
+        DWORD bucketsOffset;
+        DWORD slotsOffset;
+        DWORD namesOffset;
+        DWORD namesLength;
+        DWORD listsOffset;
+        DWORD listsLength;
+        DWORD suggestionNamesOffset;
+        DWORD suggestionDirectoriesOffset;
+        DWORD bucketStartsOffset;
+        DWORD postingsOffset;
+        DWORD postingCount;
+        DWORD size;
+    };
+
+    struct FileDirectory
+    {
+        DWORD pathOffset;
+        FILETIME lastWriteTime;
+    };
+
+    struct Bucket
+    {
+        DWORD displacement;
+        DWORD offset;
+    };
+
+    struct Slot
+    {
+        DWORD fingerprint;
+        DWORD nameOffset;
+        DWORD listOffset;
+    };
+
+    struct KeySlot
+    {
+        DWORD bucket;
+        DWORD first;
+        DWORD second;
+        DWORD fingerprint;
+    };
+
+    static void Split(ULONGLONG hash, DWORD nameCount, DWORD bucketCount, KeySlot& key);
+    static bool Place(const Array<KeySlot>& keys, DWORD bucketCount,
+        Array<Bucket>& buckets, Array<DWORD>& slotKeys);
+
+    bool IsCurrent(const SearchOrder& searchOrder, const FileSystem* fileSystem) const;
+    void SetImage(const BYTE* image);
+    void Unload();
+
+    Array<BYTE> m_storage;
+    HANDLE m_mapping;
+    const BYTE* m_view;
+    const FileHeader* m_header;
+    const FileDirectory* m_directories;
+    const Bucket* m_buckets;
+    const Slot* m_slots;
+    const TCHAR* m_names;
+    const DWORD* m_lists;
+
+    LookupIndex(const LookupIndex&);
+    LookupIndex& operator=(const LookupIndex&);
+};
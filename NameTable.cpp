@@ -0,0 +1,118 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "NameTable.h"
+
+// --------------------------------------------------------------------------
+//  NameTable
+// --------------------------------------------------------------------------
+
+int NameTable::Add(LPCTSTR foldedName, DWORD hash)
+{
+    _ASSERT(foldedName);
+
+    //
+    // Keep the table at most half full so that probe sequences stay
+    // short.
+    //
+
+    if ((GetCount() + 1) * 2 > m_slots.GetCount())
+        Grow();
+
+    const DWORD slot = FindSlot(foldedName, hash);
+
+    if (m_slots[slot])
+        return m_slots[slot] - 1;
+
+    const int index = GetCount();
+
+    const DWORD offset = m_text.GetCount();
+
+    m_offsets.Reserve(index + 1);
+    m_hashes.Reserve(index + 1);
+    m_text.Append(foldedName, lstrlen(foldedName) + 1);
+
+    m_offsets.Add(offset);
+    m_hashes.Add(hash);
+    m_slots[slot] = index + 1;
+
+    return index;
+}
+
+int NameTable::Find(LPCTSTR foldedName, DWORD hash) const
+{
+    _ASSERT(foldedName);
+
+    if (!m_slots.GetCount())
+        return -1;
+
+    return static_cast<int>(m_slots[FindSlot(foldedName, hash)]) - 1;
+}
+
+void NameTable::Clear()
+{
+    m_slots.Clear();
+    m_text.Clear();
+    m_offsets.Clear();
+    m_hashes.Clear();
+    m_mask = 0;
+}
+
+DWORD NameTable::FindSlot(LPCTSTR foldedName, DWORD hash) const
+{
+    //
+    // Open addressing with linear probing. The slot returned holds
+    // either the name or nothing, in which case it is where the name
+    // would go.
+    //
+
+    DWORD slot = hash & m_mask;
+
+    while (m_slots[slot])
+    {
+        const int index = m_slots[slot] - 1;
+
+        if (hash == m_hashes[index] && 0 == _tcscmp(foldedName, GetName(index)))
+            break;
+
+        slot = (slot + 1) & m_mask;
+    }
+
+    return slot;
+}
+
+void NameTable::Grow()
+{
+    const DWORD slotCount = m_slots.GetCount() ? m_slots.GetCount() * 2 : 64;
+
+    m_slots.SetCount(slotCount);
+    ZeroMemory(m_slots.GetData(), slotCount * sizeof(DWORD));
+    m_mask = slotCount - 1;
+
+    for (int i = 0; i < GetCount(); i++)
+    {
+        DWORD slot = m_hashes[i] & m_mask;
+
+        while (m_slots[slot])
+            slot = (slot + 1) & m_mask;
+
+        m_slots[slot] = i + 1;
+    }
+}
@@ -0,0 +1,63 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  NameTable
+// --------------------------------------------------------------------------
+//
+//  A set of distinct case-folded names, numbered in the order in which
+//  they were first added and kept end to end in one block of text. It is
+//  how the names of many directory indexes are brought together, keyed
+//  by the hashes that the indexes have already computed for them.
+//
+//  Adding a name may move the text, so pointers from GetName are only
+//  good until the next Add.
+//
+
+class NameTable
+{
+public:
+
+    NameTable() : m_mask(0) {}
+
+    int Add(LPCTSTR foldedName, DWORD hash);
+    int Find(LPCTSTR foldedName, DWORD hash) const;
+    void Clear();
+
+    int GetCount() const { return m_offsets.GetCount(); }
+    LPCTSTR GetName(int index) const { return m_text.GetData() + m_offsets[index]; }
+    DWORD GetOffset(int index) const { return m_offsets[index]; }
+
+    const TCHAR* GetText() const { return m_text.GetData(); }
+    int GetTextLength() const { return m_text.GetCount(); }
+
+private:
+
+    DWORD FindSlot(LPCTSTR foldedName, DWORD hash) const;
+    void Grow();
+
+    Array<DWORD> m_slots;
+    Array<TCHAR> m_text;
+    Array<DWORD> m_offsets;
+    Array<DWORD> m_hashes;
+    DWORD m_mask;
+
+    NameTable(const NameTable&);
+    NameTable& operator=(const NameTable&);
+};
@@ -0,0 +1,450 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "Parallel.h"
+
+// --------------------------------------------------------------------------
+//  ParallelFor
+// --------------------------------------------------------------------------
+
+struct ParallelForState
+{
+    int count;
+    ParallelForProc proc;
+    LPVOID context;
+    LONG volatile next;
+    LONG volatile error;
+};
+
+static unsigned __stdcall ParallelForWorker(LPVOID parameter)
+{
+    ParallelForState& state = *static_cast<ParallelForState*>(parameter);
+
+    for (;;)
+    {
+        if (NO_ERROR != state.error)
+            break;
+
+        const int index = InterlockedIncrement(&state.next) - 1;
+
+        if (index >= state.count)
+            break;
+
+        try
+        {
+            state.proc(index, state.context);
+        }
+        catch (SystemException& e)
+        {
+            InterlockedCompareExchange(&state.error, e.GetCode(), NO_ERROR);
+        }
+    }
+
+    return 0;
+}
+
+DWORD ParallelFor(int count, int threadCount, ParallelForProc proc, LPVOID context)
+{
+    _ASSERT(count >= 0);
+    _ASSERT(proc);
+
+    ParallelForState state = { count, proc, context, 0, NO_ERROR };
+
+    //
+    // The calling thread is one of the workers, so only the rest need to
+    // be started. Should starting one fail, the work is simply shared
+    // out among fewer threads.
+    //
+
+    HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+    int startedCount = 0;
+
+    if (threadCount > count)
+        threadCount = count;
+
+    while (startedCount < threadCount - 1 && startedCount < MAXIMUM_WAIT_OBJECTS)
+    {
+        HANDLE thread = reinterpret_cast<HANDLE>(
+            _beginthreadex(NULL, 0, ParallelForWorker, &state, 0, NULL));
+
+        if (!thread)
+            break;
+
+        threads[startedCount++] = thread;
+    }
+
+    ParallelForWorker(&state);
+
+    if (startedCount)
+    {
+        WaitForMultipleObjects(startedCount, threads, TRUE, INFINITE);
+
+        for (int i = 0; i < startedCount; i++)
+            CloseHandle(threads[i]);
+    }
+
+    return state.error;
+}
+
+// --------------------------------------------------------------------------
+//  ParallelPipeline
+// --------------------------------------------------------------------------
+
+//
+// The items a worker has been dealt, by sequence number. No more items
+// than there are slots are ever in flight, so a ring of that size is
+// enough for any one queue. The worker takes the oldest item so that the
+// writer is kept waiting as little as possible, whereas thieves take the
+// newest, which the worker itself would only have got to last.
+//
+
+struct PipelineQueue
+{
+    CRITICAL_SECTION lock;
+    int* sequences;
+    int head;
+    int count;
+};
+
+struct PipelineState
+{
+    int slotCount;
+    int queueCount;
+    PipelineReadProc read;
+    PipelineProcessProc process;
+    PipelineWriteProc write;
+    LPVOID context;
+    PipelineQueue* queues;
+    LONG volatile* doneSequences;
+    HANDLE freeSlots;
+    HANDLE work;
+    HANDLE progress;
+    LONG volatile nextQueue;
+    LONG volatile readCount;
+    LONG volatile isReadDone;
+    LONG volatile error;
+};
+
+static void PushPipelineItem(PipelineState& state, PipelineQueue& queue, int sequence)
+{
+    EnterCriticalSection(&queue.lock);
+
+    _ASSERT(queue.count < state.slotCount);
+
+    queue.sequences[(queue.head + queue.count) % state.slotCount] = sequence;
+    queue.count++;
+
+    LeaveCriticalSection(&queue.lock);
+}
+
+static bool TakePipelineItem(PipelineState& state, PipelineQueue& queue, bool isOldest, int& sequence)
+{
+    bool isTaken = false;
+
+    EnterCriticalSection(&queue.lock);
+
+    if (queue.count)
+    {
+        if (isOldest)
+        {
+            sequence = queue.sequences[queue.head];
+            queue.head = (queue.head + 1) % state.slotCount;
+        }
+        else
+        {
+            sequence = queue.sequences[(queue.head + queue.count - 1) % state.slotCount];
+        }
+
+        queue.count--;
+        isTaken = true;
+    }
+
+    LeaveCriticalSection(&queue.lock);
+
+    return isTaken;
+}
+
+static unsigned __stdcall PipelineReader(LPVOID parameter)
+{
+    PipelineState& state = *static_cast<PipelineState*>(parameter);
+
+    int sequence = 0;
+
+    for (;; sequence++)
+    {
+        WaitForSingleObject(state.freeSlots, INFINITE);
+
+        if (NO_ERROR != state.error)
+            break;
+
+        try
+        {
+            if (!state.read(sequence % state.slotCount, state.context))
+                break;
+        }
+        catch (SystemException& e)
+        {
+            InterlockedCompareExchange(&state.error, e.GetCode(), NO_ERROR);
+            break;
+        }
+
+        PushPipelineItem(state, state.queues[sequence % state.queueCount], sequence);
+        ReleaseSemaphore(state.work, 1, NULL);
+    }
+
+    //
+    // Tell the writer where the stream ended and wake every worker once
+    // more than there are items, so that each finds the queues empty in
+    // the end and stops.
+    //
+
+    InterlockedExchange(&state.readCount, sequence);
+    InterlockedExchange(&state.isReadDone, TRUE);
+    SetEvent(state.progress);
+    ReleaseSemaphore(state.work, state.queueCount, NULL);
+
+    return 0;
+}
+
+static unsigned __stdcall PipelineWorker(LPVOID parameter)
+{
+    PipelineState& state = *static_cast<PipelineState*>(parameter);
+
+    const int queueIndex = InterlockedIncrement(&state.nextQueue) - 1;
+
+    for (;;)
+    {
+        WaitForSingleObject(state.work, INFINITE);
+
+        //
+        // Every wake-up but the last is for an item that is in one of
+        // the queues, if not this worker's own then another's. The queues
+        // are not looked at all at once, though, so another worker can
+        // take the item from behind this one while the reader pushes the
+        // next onto a queue already passed. Since there are never fewer
+        // items untaken than wake-ups held, keep going round until one is
+        // taken, and stop only once the stream has ended and every queue
+        // has been found empty.
+        //
+
+        int sequence;
+        bool isTaken = false;
+
+        for (;;)
+        {
+            const bool isReadDone = 0 != state.isReadDone;
+
+            isTaken = TakePipelineItem(state, state.queues[queueIndex], true, sequence);
+
+            for (int i = 1; i < state.queueCount && !isTaken; i++)
+            {
+                isTaken = TakePipelineItem(state,
+                    state.queues[(queueIndex + i) % state.queueCount], false, sequence);
+            }
+
+            if (isTaken || isReadDone)
+                break;
+
+            SwitchToThread();
+        }
+
+        if (!isTaken)
+            break;
+
+        const int slot = sequence % state.slotCount;
+
+        if (NO_ERROR == state.error)
+        {
+            try
+            {
+                state.process(slot, state.context);
+            }
+            catch (SystemException& e)
+            {
+                InterlockedCompareExchange(&state.error, e.GetCode(), NO_ERROR);
+            }
+        }
+
+        InterlockedExchange(&state.doneSequences[slot], sequence + 1);
+        SetEvent(state.progress);
+    }
+
+    return 0;
+}
+
+static void WritePipeline(PipelineState& state)
+{
+    for (int sequence = 0;; sequence++)
+    {
+        const int slot = sequence % state.slotCount;
+
+        //
+        // Wait for the item to be processed, unless the stream turns out
+        // to have ended before it. The slot is stamped with the sequence
+        // number of the last item processed in it, plus one so that a
+        // slot never used is told apart.
+        //
+
+        while (sequence + 1 != state.doneSequences[slot])
+        {
+            if (state.isReadDone && sequence >= state.readCount)
+                return;
+
+            WaitForSingleObject(state.progress, INFINITE);
+        }
+
+        if (NO_ERROR == state.error)
+        {
+            try
+            {
+                state.write(slot, state.context);
+            }
+            catch (SystemException& e)
+            {
+                InterlockedCompareExchange(&state.error, e.GetCode(), NO_ERROR);
+            }
+        }
+
+        ReleaseSemaphore(state.freeSlots, 1, NULL);
+    }
+}
+
+DWORD ParallelPipeline(int threadCount, int slotCount, PipelineReadProc read,
+    PipelineProcessProc process, PipelineWriteProc write, LPVOID context)
+{
+    _ASSERT(slotCount > 0);
+    _ASSERT(read);
+    _ASSERT(process);
+    _ASSERT(write);
+
+    //
+    // The reader needs a thread of its own too, and all of them have to
+    // be waited for together in the end.
+    //
+
+    const int workerCount = max(1, min(threadCount, MAXIMUM_WAIT_OBJECTS - 1));
+
+    Array<LONG> doneSequences;
+    Array<int> sequences;
+    Array<PipelineQueue> queues;
+
+    try
+    {
+        doneSequences.SetCount(slotCount);
+        sequences.SetCount(slotCount * workerCount);
+        queues.SetCount(workerCount);
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    ZeroMemory(doneSequences.GetData(), slotCount * sizeof(LONG));
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        InitializeCriticalSection(&queues[i].lock);
+        queues[i].sequences = sequences.GetData() + i * slotCount;
+        queues[i].head = 0;
+        queues[i].count = 0;
+    }
+
+    PipelineState state = { slotCount, workerCount, read, process, write, context,
+        queues.GetData(), doneSequences.GetData() };
+
+    state.freeSlots = CreateSemaphore(NULL, slotCount, slotCount, NULL);
+    state.work = CreateSemaphore(NULL, 0, slotCount + workerCount, NULL);
+    state.progress = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    DWORD error = NO_ERROR;
+
+    if (!state.freeSlots || !state.work || !state.progress)
+        error = GetLastError();
+
+    //
+    // Should some of the workers fail to start, the rest steal the items
+    // dealt out to them, so it is enough for one to be running.
+    //
+
+    HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+    int startedCount = 0;
+
+    while (NO_ERROR == error && startedCount < workerCount)
+    {
+        HANDLE thread = reinterpret_cast<HANDLE>(
+            _beginthreadex(NULL, 0, PipelineWorker, &state, 0, NULL));
+
+        if (!thread)
+            break;
+
+        threads[startedCount++] = thread;
+    }
+
+    if (NO_ERROR == error && !startedCount)
+        error = ERROR_NOT_ENOUGH_MEMORY;
+
+    if (NO_ERROR == error)
+    {
+        HANDLE reader = reinterpret_cast<HANDLE>(
+            _beginthreadex(NULL, 0, PipelineReader, &state, 0, NULL));
+
+        if (reader)
+        {
+            threads[startedCount++] = reader;
+            WritePipeline(state);
+            error = state.error;
+        }
+        else
+        {
+            InterlockedExchange(&state.isReadDone, TRUE);
+            ReleaseSemaphore(state.work, workerCount, NULL);
+            error = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    if (startedCount)
+    {
+        WaitForMultipleObjects(startedCount, threads, TRUE, INFINITE);
+
+        for (int i = 0; i < startedCount; i++)
+            CloseHandle(threads[i]);
+    }
+
+    if (state.progress)
+        CloseHandle(state.progress);
+
+    if (state.work)
+        CloseHandle(state.work);
+
+    if (state.freeSlots)
+        CloseHandle(state.freeSlots);
+
+    for (int i = 0; i < workerCount; i++)
+        DeleteCriticalSection(&queues[i].lock);
+
+    return error;
+}
+
+int GetProcessorCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors > 0 ? static_cast<int>(info.dwNumberOfProcessors) : 1;
+}
@@ -0,0 +1,64 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ParallelFor
+// --------------------------------------------------------------------------
+//
+//  Calls a procedure once for each index from zero up to the count, from
+//  up to the given number of threads including the calling one. Indexes
+//  are handed out one at a time as threads become free, so uneven work
+//  balances out by itself. The procedure may throw a SystemException, in
+//  which case no new indexes are handed out and its code is returned once
+//  the calls already under way have finished.
+//
+
+typedef void (CALLBACK * ParallelForProc)(int index, LPVOID context);
+
+DWORD ParallelFor(int count, int threadCount, ParallelForProc proc, LPVOID context);
+
+// --------------------------------------------------------------------------
+//  ParallelPipeline
+// --------------------------------------------------------------------------
+//
+//  Runs a stream of items through three stages: reading, processing and
+//  writing. Items are read one at a time on a thread of their own and
+//  dealt out to up to the given number of worker threads, each of which
+//  keeps a queue of its own and steals from the others when it runs dry.
+//  The calling thread writes the items out in the order they were read,
+//  each as soon as it and all those before it have been processed.
+//
+//  Every item in flight occupies one of the given number of slots, which
+//  the procedures are passed in place of the item itself so that the
+//  caller can keep the items in an array. Reading stops short once every
+//  slot is taken, which bounds the memory used however long the stream.
+//  The read procedure returns false at the end of the stream.
+//
+//  Any procedure may throw a SystemException, after which no new items
+//  are read or written and its code is returned once the threads have
+//  all finished.
+//
+
+typedef bool (CALLBACK * PipelineReadProc)(int slot, LPVOID context);
+typedef void (CALLBACK * PipelineProcessProc)(int slot, LPVOID context);
+typedef void (CALLBACK * PipelineWriteProc)(int slot, LPVOID context);
+
+DWORD ParallelPipeline(int threadCount, int slotCount, PipelineReadProc read,
+    PipelineProcessProc process, PipelineWriteProc write, LPVOID context);
+
+int GetProcessorCount();
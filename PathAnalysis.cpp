@@ -0,0 +1,386 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "PathAnalysis.h"
+
+// --------------------------------------------------------------------------
+//  PathAnalysis
+// --------------------------------------------------------------------------
+
+DWORD PathAnalysis::Analyze(const EnvironmentProfile* profile, int threadCount)
+{
+    try
+    {
+        //
+        // The environment supplies PATHEXT for the queries. Its search
+        // order has had the duplicates taken out, though, so capture
+        // the raw one separately.
+        //
+
+        m_environment.Capture(profile);
+
+        if (profile)
+        {
+            m_searchOrder.Capture(profile->applicationDirectory,
+                profile->currentDirectory, profile->path,
+                profile->searchPolicy, profile->applicationPath);
+        }
+        else
+        {
+            m_searchOrder.Capture();
+        }
+
+        const int count = m_searchOrder.GetCount();
+
+        m_entries.SetCount(count);
+        m_directoryIndexes.SetCount(count);
+
+        for (int i = 0; i < count; i++)
+        {
+            Probe(i);
+
+            m_directoryIndexes[i] = PathEntryReachable == m_entries[i].status ?
+                m_indexes.Register(m_searchOrder.GetDirectory(i)) : NULL;
+        }
+
+        FindDuplicates();
+
+        DWORD error = m_indexes.Scan(threadCount);
+
+        if (NO_ERROR != error)
+            return error;
+
+        FindPrecedences();
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+void PathAnalysis::Probe(int index)
+{
+    LPCTSTR directory = m_searchOrder.GetDirectory(index);
+    PathEntry& entry = m_entries[index];
+
+    ZeroMemory(&entry, sizeof(entry));
+    entry.duplicateOf = -1;
+
+    DWORD attributes = GetFileAttributes(directory);
+
+    if (INVALID_FILE_ATTRIBUTES == attributes)
+    {
+        entry.error = GetLastError();
+
+        entry.status = ERROR_FILE_NOT_FOUND == entry.error ||
+                       ERROR_PATH_NOT_FOUND == entry.error ||
+                       ERROR_INVALID_NAME == entry.error ?
+                       PathEntryMissing : PathEntryUnreachable;
+    }
+    else if (0 == (attributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        entry.status = PathEntryNotDirectory;
+    }
+
+    //
+    // Time what a miss costs, which is what every name that is not in
+    // the directory pays for it. Dead entries are timed too since they
+    // are often the most expensive of all, like a share on a server
+    // that is no longer there.
+    //
+
+    TCHAR probe[MAX_PATH];
+    LARGE_INTEGER frequency;
+
+    if (!PathCombine(probe, directory, _T("findpath-probe.{9C6B3F0E}")) ||
+        !QueryPerformanceFrequency(&frequency) || 0 == frequency.QuadPart)
+    {
+        return;
+    }
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    for (int i = 0; i < ProbesPerTiming; i++)
+        GetFileAttributes(probe);
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+
+    entry.missMicroseconds = static_cast<DWORD>(
+        (end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart / ProbesPerTiming);
+}
+
+void PathAnalysis::FindDuplicates()
+{
+    const int count = m_searchOrder.GetCount();
+
+    Array<DirectoryIdentity> identities;
+    Array<bool> hasIdentity;
+
+    identities.SetCount(count);
+    hasIdentity.SetCount(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        hasIdentity[i] = PathEntryReachable == m_entries[i].status &&
+            DirectoryIdentity::Query(m_searchOrder.GetDirectory(i), identities[i]);
+
+        if (!hasIdentity[i])
+            continue;
+
+        for (int j = 0; j < i; j++)
+        {
+            if (hasIdentity[j] && identities[i].IsSameAs(identities[j]))
+            {
+                m_entries[i].status = PathEntryDuplicate;
+                m_entries[i].duplicateOf = j;
+                m_directoryIndexes[i] = NULL;
+                break;
+            }
+        }
+    }
+}
+
+void PathAnalysis::FindPrecedences()
+{
+    const int count = m_searchOrder.GetCount();
+
+    m_precedences.SetCount(count * count);
+    ZeroMemory(m_precedences.GetData(), count * count * sizeof(bool));
+
+    //
+    // Go through the names of every directory that may be moved and look
+    // for the first such directory ahead of it that has the name too.
+    // That one is where the name resolves today, so it has to stay ahead.
+    // Names also in one of the fixed directories resolve there whatever
+    // the order of PATH, so they do not constrain it.
+    //
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!IsReorderable(i))
+            continue;
+
+        const DirectoryIndex& index = *m_directoryIndexes[i];
+
+        for (int n = 0; n < index.GetNameCount(); n++)
+        {
+            TCHAR name[MAX_PATH];
+            index.GetName(n, name);
+
+            const DWORD hash = index.GetNameHash(n);
+
+            for (int j = m_searchOrder.GetFirstPathIndex(); j < i; j++)
+            {
+                if (IsReorderable(j) && m_directoryIndexes[j]->Contains(name, hash))
+                {
+                    m_precedences[j * count + i] = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+bool PathAnalysis::IsReorderable(int index) const
+{
+    return index >= m_searchOrder.GetFirstPathIndex() &&
+        m_directoryIndexes[index] && m_directoryIndexes[index]->IsScanned();
+}
+
+bool PathAnalysis::IsBarrier(int index) const
+{
+    const PathEntryStatus status = m_entries[index].status;
+
+    return !IsReorderable(index) &&
+        (PathEntryReachable == status || PathEntryUnreachable == status);
+}
+
+DWORD PathAnalysis::AddQuery(LPCTSTR fileName)
+{
+    _ASSERT(fileName);
+
+    //
+    // A name with a path of its own does not go through the search order
+    // so it costs the same however that is arranged.
+    //
+
+    m_queryCount++;
+
+    if (!DirectoryIndex::IsIndexable(fileName))
+        return NO_ERROR;
+
+    const bool hasExtension = 0 != *PathFindExtension(fileName);
+    const int extensionCount = hasExtension ? 0 : m_environment.GetExtensionCount();
+    const int count = m_searchOrder.GetCount();
+
+    for (int extensionIndex = -1; extensionIndex < extensionCount; extensionIndex++)
+    {
+        LPCTSTR extension = extensionIndex < 0 ? NULL :
+            m_environment.GetExtension(extensionIndex);
+
+        TCHAR foldedName[MAX_PATH];
+
+        if (lstrlen(fileName) + (extension ? lstrlen(extension) : 0) >= MAX_PATH)
+            return ERROR_FILENAME_EXCED_RANGE;
+
+        lstrcpy(foldedName, fileName);
+
+        if (extension)
+            lstrcat(foldedName, extension);
+
+        CharUpperBuff(foldedName, lstrlen(foldedName));
+
+        const DWORD hash = DirectoryIndex::Hash(foldedName);
+
+        for (int i = 0; i < count; i++)
+        {
+            m_entries[i].probeCount++;
+
+            const DirectoryIndex* index = m_directoryIndexes[i];
+
+            if (index && index->IsScanned() && index->Contains(foldedName, hash))
+            {
+                m_entries[i].hitCount++;
+                return NO_ERROR;
+            }
+        }
+
+        m_missRoundCount++;
+    }
+
+    return NO_ERROR;
+}
+
+DWORD PathAnalysis::ProposeOrder(Array<int>& order) const
+{
+    const int count = m_searchOrder.GetCount();
+    const int firstPathIndex = m_searchOrder.GetFirstPathIndex();
+
+    try
+    {
+        order.Clear();
+
+        for (int i = 0; i < firstPathIndex; i++)
+            order.Add(i);
+
+        Array<bool> isPlaced;
+        isPlaced.SetCount(count);
+        ZeroMemory(isPlaced.GetData(), count * sizeof(bool));
+
+        //
+        // What is in a directory that could not be listed is not known,
+        // so neither is whether a name in it wins today. Such directories
+        // stay put and split PATH into runs that are reordered each on
+        // their own, so that nothing crosses them either way.
+        //
+
+        int runStart = firstPathIndex;
+
+        while (runStart < count)
+        {
+            int runEnd = runStart;
+
+            while (runEnd < count && !IsBarrier(runEnd))
+                runEnd++;
+
+            //
+            // Place one directory of the run at a time, choosing among
+            // those whose every required predecessor is already placed
+            // the one with the most hits. Ties go to the cheaper miss and
+            // then to the current order. Since the constraints only ever
+            // point forward in the current order, there is always at
+            // least one directory to choose from.
+            //
+
+            for (;;)
+            {
+                int best = -1;
+
+                for (int i = runStart; i < runEnd; i++)
+                {
+                    if (isPlaced[i] || !IsReorderable(i))
+                        continue;
+
+                    bool isReady = true;
+
+                    for (int j = firstPathIndex; j < i && isReady; j++)
+                        isReady = isPlaced[j] || !MustPrecede(j, i);
+
+                    if (!isReady)
+                        continue;
+
+                    if (best < 0 ||
+                        m_entries[i].hitCount > m_entries[best].hitCount ||
+                        (m_entries[i].hitCount == m_entries[best].hitCount &&
+                         m_entries[i].missMicroseconds < m_entries[best].missMicroseconds))
+                    {
+                        best = i;
+                    }
+                }
+
+                if (best < 0)
+                    break;
+
+                isPlaced[best] = true;
+                order.Add(best);
+            }
+
+            if (runEnd < count)
+            {
+                isPlaced[runEnd] = true;
+                order.Add(runEnd);
+            }
+
+            runStart = runEnd + 1;
+        }
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+DWORD PathAnalysis::CountProbes(const Array<int>& order) const
+{
+    //
+    // A query that is answered by a directory probes every directory up
+    // to and including it, and a round that finds nothing probes them
+    // all. The hits stay with their directories however they are ordered.
+    //
+
+    DWORD probeCount = m_missRoundCount * order.GetCount();
+
+    for (int i = 0; i < order.GetCount(); i++)
+        probeCount += m_entries[order[i]].hitCount * (i + 1);
+
+    return probeCount;
+}
@@ -0,0 +1,110 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  PathEntry
+// --------------------------------------------------------------------------
+//
+//  What was found out about one entry of the search order: whether it
+//  could be reached, what a miss in it costs and, over the queries
+//  analyzed, how often it was probed and how often it had the file.
+//
+
+enum PathEntryStatus
+{
+    PathEntryReachable,
+    PathEntryDuplicate,
+    PathEntryMissing,
+    PathEntryNotDirectory,
+    PathEntryUnreachable
+};
+
+struct PathEntry
+{
+    PathEntryStatus status;
+    DWORD error;
+    int duplicateOf;
+    DWORD missMicroseconds;
+    DWORD probeCount;
+    DWORD hitCount;
+};
+
+// --------------------------------------------------------------------------
+//  PathAnalysis
+// --------------------------------------------------------------------------
+//
+//  Measures the search order as SearchPath walks it, duplicates and
+//  dead entries included, and proposes a better one.
+//
+//  A reordering has to leave every name resolving to the same file it
+//  does today. Whenever a name is in more than one PATH directory, the
+//  one that has it first must therefore stay ahead of the others. Within
+//  those constraints, the directories that answer the most queries are
+//  moved forward so that fewer probes are spent on the way to them.
+//  Duplicate and missing entries are dropped since they never answer
+//  anything. Entries that are there but could not be listed may have
+//  any name in them, so they stay where they are and no directory is
+//  moved past one of them in either direction.
+//
+
+class PathAnalysis
+{
+public:
+
+    enum
+    {
+        SlowMissMicroseconds = 10000,
+        ProbesPerTiming = 3
+    };
+
+    PathAnalysis() : m_queryCount(0), m_missRoundCount(0) {}
+
+    DWORD Analyze(const EnvironmentProfile* profile, int threadCount);
+    DWORD AddQuery(LPCTSTR fileName);
+    DWORD ProposeOrder(Array<int>& order) const;
+    DWORD CountProbes(const Array<int>& order) const;
+
+    const SearchOrder& GetSearchOrder() const { return m_searchOrder; }
+    const PathEntry& GetEntry(int index) const { return m_entries[index]; }
+    DWORD GetQueryCount() const { return m_queryCount; }
+
+private:
+
+    void Probe(int index);
+    void FindDuplicates();
+    void FindPrecedences();
+    bool IsReorderable(int index) const;
+    bool IsBarrier(int index) const;
+
+    bool MustPrecede(int a, int b) const
+    {
+        return m_precedences[a * m_searchOrder.GetCount() + b];
+    }
+
+    SearchEnvironment m_environment;
+    SearchOrder m_searchOrder;
+    Array<PathEntry> m_entries;
+    DirectoryIndexTable m_indexes;
+    Array<const DirectoryIndex*> m_directoryIndexes;
+    Array<bool> m_precedences;
+    DWORD m_queryCount;
+    DWORD m_missRoundCount;
+
+    PathAnalysis(const PathAnalysis&);
+    PathAnalysis& operator=(const PathAnalysis&);
+};
@@ -0,0 +1,155 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Profiler.h"
+
+#ifdef FINDPATH_PROFILER
+
+//
+// QueryThreadCycleTime is only available as of Windows Vista, so it is
+// bound late to keep the library loading on earlier versions.
+//
+
+typedef BOOL (WINAPI * QueryThreadCycleTimeProc)(HANDLE, PULONG64);
+
+static bool isEnabled = false;
+static QueryThreadCycleTimeProc queryThreadCycleTime = NULL;
+static LARGE_INTEGER frequency;
+static CRITICAL_SECTION lock;
+static ProfileCounters phaseCounters[ProfilePhaseCount];
+
+// --------------------------------------------------------------------------
+//  Profiler
+// --------------------------------------------------------------------------
+
+void Profiler::Enable()
+{
+    if (isEnabled)
+        return;
+
+    HMODULE kernelLibrary = GetModuleHandle(_T("kernel32.dll"));
+
+    if (kernelLibrary)
+    {
+        queryThreadCycleTime = reinterpret_cast<QueryThreadCycleTimeProc>(
+            GetProcAddress(kernelLibrary, "QueryThreadCycleTime"));
+    }
+
+    if (!QueryPerformanceFrequency(&frequency) || !frequency.QuadPart)
+        frequency.QuadPart = 1;
+
+    InitializeCriticalSection(&lock);
+    ZeroMemory(phaseCounters, sizeof(phaseCounters));
+
+    isEnabled = true;
+}
+
+bool Profiler::IsEnabled()
+{
+    return isEnabled;
+}
+
+void Profiler::TakeSample(ProfileSample& sample)
+{
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+
+    sample.cpuTime = 0;
+    sample.cycleCount = 0;
+
+    if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        ULARGE_INTEGER kernel;
+        kernel.LowPart = kernelTime.dwLowDateTime;
+        kernel.HighPart = kernelTime.dwHighDateTime;
+
+        ULARGE_INTEGER user;
+        user.LowPart = userTime.dwLowDateTime;
+        user.HighPart = userTime.dwHighDateTime;
+
+        sample.cpuTime = kernel.QuadPart + user.QuadPart;
+    }
+
+    if (queryThreadCycleTime)
+        queryThreadCycleTime(GetCurrentThread(), &sample.cycleCount);
+
+    //
+    // Read the clock last on the way in so that taking the sample is
+    // not counted as part of the phase.
+    //
+
+    QueryPerformanceCounter(&sample.time);
+}
+
+void Profiler::Add(ProfilePhase phase, const ProfileSample& start)
+{
+    _ASSERT(phase >= 0 && phase < ProfilePhaseCount);
+
+    ProfileSample end;
+    TakeSample(end);
+
+    EnterCriticalSection(&lock);
+
+    ProfileCounters& counters = phaseCounters[phase];
+    counters.callCount++;
+    counters.elapsedMicroseconds += end.time.QuadPart - start.time.QuadPart;
+    counters.cpuMicroseconds += end.cpuTime - start.cpuTime;
+    counters.cycleCount += end.cycleCount - start.cycleCount;
+
+    LeaveCriticalSection(&lock);
+}
+
+void Profiler::GetCounters(ProfilePhase phase, ProfileCounters& counters)
+{
+    _ASSERT(phase >= 0 && phase < ProfilePhaseCount);
+
+    ZeroMemory(&counters, sizeof(counters));
+
+    if (!isEnabled)
+        return;
+
+    EnterCriticalSection(&lock);
+    counters = phaseCounters[phase];
+    LeaveCriticalSection(&lock);
+
+    //
+    // Elapsed time is added up in ticks of the performance counter and
+    // processor time in the 100 nanosecond units of a FILETIME.
+    //
+
+    counters.elapsedMicroseconds = counters.elapsedMicroseconds * 1000000 /
+        static_cast<ULONGLONG>(frequency.QuadPart);
+    counters.cpuMicroseconds /= 10;
+}
+
+LPCTSTR Profiler::GetPhaseName(ProfilePhase phase)
+{
+    _ASSERT(phase >= 0 && phase < ProfilePhaseCount);
+
+    static const LPCTSTR phaseNames[] =
+    {
+        _T("environment"),
+        _T("scan"),
+        _T("match"),
+        _T("metadata"),
+        _T("output")
+    };
+
+    return phaseNames[phase];
+}
+
+#endif
@@ -0,0 +1,132 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ProfilePhase
+// --------------------------------------------------------------------------
+//
+//  The phases of a lookup that the profiler breaks its counts down by.
+//  Phases can nest, as when a directory is scanned on demand while a
+//  name is being matched, in which case what the inner phase counts is
+//  counted towards the outer one too.
+//
+
+enum ProfilePhase
+{
+    EnvironmentPhase,
+    ScanPhase,
+    MatchPhase,
+    MetadataPhase,
+    OutputPhase,
+    ProfilePhaseCount
+};
+
+struct ProfileCounters
+{
+    ULONGLONG callCount;
+    ULONGLONG elapsedMicroseconds;
+    ULONGLONG cpuMicroseconds;
+    ULONGLONG cycleCount;
+};
+
+#ifdef FINDPATH_PROFILER
+
+// --------------------------------------------------------------------------
+//  Profiler
+// --------------------------------------------------------------------------
+//
+//  Counts, for each phase, how often it ran, the time it took, the time
+//  the thread running it spent on a processor and the processor cycles
+//  charged to that thread. Cycles are only counted as of Windows Vista,
+//  where the system keeps them per thread.
+//
+//  The profiler is only built in when FINDPATH_PROFILER is defined, as it
+//  is for the Profile configuration. Otherwise PROFILE_PHASE expands to
+//  nothing and no trace of it is left in the code. Even when built in, it
+//  does nothing until enabled, which has to be done before any phase it
+//  is to count starts.
+//
+
+struct ProfileSample
+{
+    LARGE_INTEGER time;
+    ULONGLONG cpuTime;
+    ULONGLONG cycleCount;
+};
+
+class Profiler
+{
+public:
+
+    static void Enable();
+    static bool IsEnabled();
+
+    static void TakeSample(ProfileSample& sample);
+    static void Add(ProfilePhase phase, const ProfileSample& start);
+
+    static void GetCounters(ProfilePhase phase, ProfileCounters& counters);
+    static LPCTSTR GetPhaseName(ProfilePhase phase);
+
+private:
+
+    Profiler();
+};
+
+// --------------------------------------------------------------------------
+//  ProfileScope
+// --------------------------------------------------------------------------
+//
+//  Counts the rest of the enclosing block towards a phase.
+//
+
+class ProfileScope
+{
+public:
+
+    ProfileScope(ProfilePhase phase) :
+        m_phase(phase),
+        m_isEnabled(Profiler::IsEnabled())
+    {
+        if (m_isEnabled)
+            Profiler::TakeSample(m_start);
+    }
+
+    ~ProfileScope()
+    {
+        if (m_isEnabled)
+            Profiler::Add(m_phase, m_start);
+    }
+
+private:
+
+    ProfilePhase m_phase;
+    bool m_isEnabled;
+    ProfileSample m_start;
+
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+};
+
+#define PROFILE_PHASE(phase) ProfileScope profileScope(phase)
+
+#else
+
+#define PROFILE_PHASE(phase)
+
+#endif
@@ -0,0 +1,134 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  QueryLog
+// --------------------------------------------------------------------------
+//
+//  Records every name resolved, one line per name, with the time it took
+//  in microseconds and the Win32 error code it came out with, separated
+//  by tabs:
+//
+//  notepad<TAB>38<TAB>0
+//
+//  Records are appended so that a log can build up over many runs. Since
+//  a name cannot contain a tab, the name alone is everything up to the
+//  first one, which lets a log be read back as a list of names.
+//
+
+class QueryLog
+{
+public:
+
+    QueryLog() :
+        m_file(INVALID_HANDLE_VALUE),
+        m_output(NULL) {}
+
+    ~QueryLog()
+    {
+        delete m_output;
+
+        if (INVALID_HANDLE_VALUE != m_file)
+            CloseHandle(m_file);
+    }
+
+    void Open(LPCTSTR filePath)
+    {
+        _ASSERT(filePath);
+        _ASSERT(!IsOpen());
+
+        m_file = CreateFile(filePath, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (INVALID_HANDLE_VALUE == m_file)
+            SystemException::ThrowLast();
+
+        m_output = new BufferedOutputStream(m_file);
+
+        if (!m_output)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+    }
+
+    bool IsOpen() const { return NULL != m_output; }
+
+    void Write(LPCTSTR fileName, DWORD microseconds, DWORD error)
+    {
+        _ASSERT(fileName);
+
+        if (m_output)
+        {
+            *m_output << fileName << _T('\t') << microseconds
+                << _T('\t') << error << _T('\n');
+        }
+    }
+
+    //
+    // Cuts a line read back from a log down to the name alone.
+    //
+
+    static LPTSTR ParseName(LPTSTR line)
+    {
+        _ASSERT(line);
+
+        LPTSTR tab = StrChr(line, _T('\t'));
+
+        if (tab)
+            *tab = 0;
+
+        return line;
+    }
+
+    //
+    // A timer good for the microseconds the log records. The time is in
+    // ticks of the performance counter.
+    //
+
+    static LONGLONG GetTime()
+    {
+        LARGE_INTEGER time;
+        QueryPerformanceCounter(&time);
+
+        return time.QuadPart;
+    }
+
+    static DWORD GetMicroseconds(LONGLONG start, LONGLONG end)
+    {
+        static LONGLONG frequency = 0;
+
+        if (!frequency)
+        {
+            LARGE_INTEGER counterFrequency;
+
+            if (!QueryPerformanceFrequency(&counterFrequency) || !counterFrequency.QuadPart)
+                return 0;
+
+            frequency = counterFrequency.QuadPart;
+        }
+
+        return static_cast<DWORD>((end - start) * 1000000 / frequency);
+    }
+
+private:
+
+    HANDLE m_file;
+    BufferedOutputStream* m_output;
+
+    QueryLog(const QueryLog&);
+    QueryLog& operator=(const QueryLog&);
+};
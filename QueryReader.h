@@ -0,0 +1,110 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  QueryReader
+// --------------------------------------------------------------------------
+//
+//  Hands out the names to resolve one at a time: first those given on
+//  the command line and then those listed in the batch file, if any. The
+//  batch file is "-" for standard input. Blank lines in it are skipped.
+//
+
+class QueryReader
+{
+public:
+
+    QueryReader(const Array<LPCTSTR>& fileNames, LPCTSTR batchFilePath) :
+        m_fileNames(fileNames),
+        m_nextFileName(0),
+        m_batchFilePath(batchFilePath),
+        m_batchFile(INVALID_HANDLE_VALUE),
+        m_isStandardInput(false),
+        m_reader(NULL) {}
+
+    ~QueryReader()
+    {
+        delete m_reader;
+
+        if (INVALID_HANDLE_VALUE != m_batchFile && !m_isStandardInput)
+            CloseHandle(m_batchFile);
+    }
+
+    //
+    // Copies the next name into the given buffer and returns false when
+    // there are none left. A name that does not fit is cut short and
+    // flagged through isTruncated.
+    //
+
+    bool Next(LPTSTR fileName, int capacity, bool& isTruncated)
+    {
+        _ASSERT(fileName);
+        _ASSERT(capacity > 0);
+
+        if (m_nextFileName < m_fileNames.GetCount())
+        {
+            LPCTSTR next = m_fileNames[m_nextFileName++];
+            isTruncated = lstrlen(next) >= capacity;
+            lstrcpyn(fileName, next, capacity);
+            return true;
+        }
+
+        if (!m_batchFilePath)
+            return false;
+
+        if (!m_reader)
+            Open();
+
+        while (m_reader->ReadLine(fileName, capacity, isTruncated))
+        {
+            if (fileName[0])
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+
+    void Open()
+    {
+        m_isStandardInput = 0 == lstrcmp(m_batchFilePath, _T("-"));
+
+        m_batchFile = m_isStandardInput ? GetStdHandle(STD_INPUT_HANDLE) :
+            CreateFile(m_batchFilePath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (INVALID_HANDLE_VALUE == m_batchFile)
+            SystemException::ThrowLast();
+
+        m_reader = new LineReader(m_batchFile);
+
+        if (!m_reader)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+    }
+
+    const Array<LPCTSTR>& m_fileNames;
+    int m_nextFileName;
+    LPCTSTR m_batchFilePath;
+    HANDLE m_batchFile;
+    bool m_isStandardInput;
+    LineReader* m_reader;
+
+    QueryReader(const QueryReader&);
+    QueryReader& operator=(const QueryReader&);
+};
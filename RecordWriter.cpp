@@ -0,0 +1,307 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "OutputStream.h"
+#include "BufferedOutputStream.h"
+#include "libfindpath.h"
+#include "RecordWriter.h"
+
+// --------------------------------------------------------------------------
+//  RecordWriter
+// --------------------------------------------------------------------------
+
+void RecordWriter::WriteUtf8(LPCTSTR text, bool escapeJson)
+{
+    _ASSERT(text);
+
+    //
+    // Go through UTF-16 to get from the ANSI code page to UTF-8. All the
+    // text written here is a name or a path so it is never longer than
+    // what the buffers below can hold.
+    //
+
+#ifdef UNICODE
+    LPCWSTR wide = text;
+    int wideLength = lstrlen(text);
+#else
+    WCHAR wide[MAX_PATH * 2];
+    int wideLength = MultiByteToWideChar(CP_ACP, 0, text, -1, wide, DIM(wide)) - 1;
+
+    if (wideLength < 0)
+        wideLength = 0;
+#endif
+
+    char utf8[MAX_PATH * 2 * 3];
+    int utf8Length = WideCharToMultiByte(CP_UTF8, 0, wide, wideLength,
+        utf8, sizeof(utf8), NULL, NULL);
+
+    if (!escapeJson)
+    {
+        m_output.WriteBytes(utf8, utf8Length);
+        return;
+    }
+
+    //
+    // Copy runs of characters that need no escaping in one go and only
+    // break them up where an escape sequence has to go in.
+    //
+
+    int runStart = 0;
+
+    for (int i = 0; i < utf8Length; i++)
+    {
+        const BYTE ch = static_cast<BYTE>(utf8[i]);
+        char escape[8];
+
+        if ('"' == ch || '\\' == ch)
+            wsprintfA(escape, "\\%c", ch);
+        else if (ch < 0x20)
+            wsprintfA(escape, "\\u%04x", ch);
+        else
+            continue;
+
+        m_output.WriteBytes(utf8 + runStart, i - runStart);
+        WriteAscii(escape);
+        runStart = i + 1;
+    }
+
+    m_output.WriteBytes(utf8 + runStart, utf8Length - runStart);
+}
+
+void RecordWriter::WriteNumber(ULONGLONG n)
+{
+    char digits[24];
+    int i = DIM(digits);
+
+    do
+    {
+        digits[--i] = static_cast<char>('0' + n % 10);
+        n /= 10;
+    }
+    while (n);
+
+    m_output.WriteBytes(digits + i, DIM(digits) - i);
+}
+
+void RecordWriter::WriteTime(const FILETIME& time)
+{
+    SYSTEMTIME systemTime;
+
+    if (!FileTimeToSystemTime(&time, &systemTime))
+        return;
+
+    char text[32];
+
+    wsprintfA(text, "%04u-%02u-%02uT%02u:%02u:%02uZ",
+        systemTime.wYear, systemTime.wMonth, systemTime.wDay,
+        systemTime.wHour, systemTime.wMinute, systemTime.wSecond);
+
+    WriteAscii(text);
+}
+
+// --------------------------------------------------------------------------
+//  TextRecordWriter
+// --------------------------------------------------------------------------
+
+void TextRecordWriter::Write(const QueryRecord& record)
+{
+    if (NO_ERROR != record.error)
+        return;
+
+    _ASSERT(record.resolution);
+
+    if (record.profile)
+        m_output << record.profile << _T(": ");
+
+    //
+    // Quote the path if there is space in it, for long file paths.
+    //
+
+    LPCTSTR path = record.resolution->path;
+    const bool isQuoted = NULL != StrChr(path, _T(' '));
+
+    if (isQuoted)
+        m_output << _T('"');
+
+    m_output << path;
+
+    if (isQuoted)
+        m_output << _T('"');
+
+    m_output << _T('\n');
+}
+
+// --------------------------------------------------------------------------
+//  JsonLinesRecordWriter
+// --------------------------------------------------------------------------
+
+void JsonLinesRecordWriter::Write(const QueryRecord& record)
+{
+    _ASSERT(record.name);
+
+    WriteAscii("{");
+
+    if (record.profile)
+    {
+        WriteAscii("\"profile\":\"");
+        WriteUtf8(record.profile, true);
+        WriteAscii("\",");
+    }
+
+    WriteAscii("\"name\":\"");
+    WriteUtf8(record.name, true);
+    WriteAscii("\",\"path\":");
+
+    if (NO_ERROR != record.error)
+    {
+        WriteAscii("null,\"error\":");
+        WriteNumber(record.error);
+        WriteAscii("}\n");
+        return;
+    }
+
+    _ASSERT(record.resolution);
+
+    WriteAscii("\"");
+    WriteUtf8(record.resolution->path, true);
+    WriteAscii("\",\"directory\":");
+
+    if (record.resolution->directoryIndex >= 0)
+        WriteNumber(record.resolution->directoryIndex);
+    else
+        WriteAscii("null");
+
+    WriteAscii(",\"extension\":");
+
+    if (record.extension)
+    {
+        WriteAscii("\"");
+        WriteUtf8(record.extension, true);
+        WriteAscii("\"");
+    }
+    else
+    {
+        WriteAscii("null");
+    }
+
+    if (record.metadata)
+    {
+        ULARGE_INTEGER size;
+        size.LowPart = record.metadata->nFileSizeLow;
+        size.HighPart = record.metadata->nFileSizeHigh;
+
+        WriteAscii(",\"size\":");
+        WriteNumber(size.QuadPart);
+        WriteAscii(",\"modified\":\"");
+        WriteTime(record.metadata->ftLastWriteTime);
+        WriteAscii("\"");
+    }
+
+    if (record.image)
+    {
+        const ImageMetadata& image = *record.image;
+        LPCTSTR machine = ImageMachine::GetName(image.machine);
+
+        WriteAscii(",\"machine\":");
+
+        if (machine)
+        {
+            WriteAscii("\"");
+            WriteUtf8(machine, false);
+            WriteAscii("\"");
+        }
+        else
+        {
+            WriteNumber(image.machine);
+        }
+
+        if (image.fileVersionMS || image.fileVersionLS)
+        {
+            char version[48];
+
+            wsprintfA(version, ",\"version\":\"%u.%u.%u.%u\"",
+                HIWORD(image.fileVersionMS), LOWORD(image.fileVersionMS),
+                HIWORD(image.fileVersionLS), LOWORD(image.fileVersionLS));
+
+            WriteAscii(version);
+        }
+    }
+
+    WriteAscii("}\n");
+}
+
+// --------------------------------------------------------------------------
+//  NulRecordWriter
+// --------------------------------------------------------------------------
+
+void NulRecordWriter::Write(const QueryRecord& record)
+{
+    _ASSERT(record.name);
+
+    const Resolution* resolution = NO_ERROR == record.error ? record.resolution : NULL;
+
+    if (m_hasProfile)
+    {
+        if (record.profile)
+            WriteUtf8(record.profile, false);
+
+        EndField();
+    }
+
+    WriteUtf8(record.name, false);
+    EndField();
+
+    if (resolution)
+        WriteUtf8(resolution->path, false);
+
+    EndField();
+
+    if (resolution && resolution->directoryIndex >= 0)
+        WriteNumber(resolution->directoryIndex);
+
+    EndField();
+
+    if (resolution && record.extension)
+        WriteUtf8(record.extension, false);
+
+    EndField();
+
+    WriteNumber(record.error);
+    EndField();
+
+    if (m_hasMetadata)
+    {
+        if (resolution && record.metadata)
+        {
+            ULARGE_INTEGER size;
+            size.LowPart = record.metadata->nFileSizeLow;
+            size.HighPart = record.metadata->nFileSizeHigh;
+
+            WriteNumber(size.QuadPart);
+            EndField();
+
+            WriteTime(record.metadata->ftLastWriteTime);
+            EndField();
+        }
+        else
+        {
+            EndField();
+            EndField();
+        }
+    }
+}
@@ -0,0 +1,151 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  QueryRecord
+// --------------------------------------------------------------------------
+//
+//  Everything known about the outcome of one query. The resolution is
+//  only set when the error is NO_ERROR and the metadata only when it was
+//  asked for and could be read, as is the image metadata, which also
+//  takes an image metadata cache and a file that is an image. The
+//  profile is the name of the environment profile the query was
+//  resolved against, if any.
+//
+
+struct QueryRecord
+{
+    LPCTSTR name;
+    DWORD error;
+    const Resolution* resolution;
+    LPCTSTR extension;
+    const WIN32_FILE_ATTRIBUTE_DATA* metadata;
+    LPCTSTR profile;
+    const ImageMetadata* image;
+};
+
+// --------------------------------------------------------------------------
+//  RecordWriter
+// --------------------------------------------------------------------------
+//
+//  Encodes query records onto a stream, one record at a time, so that
+//  nothing beyond the current record is ever held in memory.
+//
+
+class RecordWriter
+{
+public:
+
+    RecordWriter(BufferedOutputStream& output) : m_output(output) {}
+    virtual ~RecordWriter() {}
+
+    virtual void Write(const QueryRecord& record) = 0;
+
+protected:
+
+    BufferedOutputStream& m_output;
+
+    void WriteAscii(const char* text) { m_output.WriteBytes(text, lstrlenA(text)); }
+    void WriteUtf8(LPCTSTR text, bool escapeJson);
+    void WriteNumber(ULONGLONG n);
+    void WriteTime(const FILETIME& time);
+
+private:
+
+    RecordWriter(const RecordWriter&);
+    RecordWriter& operator=(const RecordWriter&);
+};
+
+// --------------------------------------------------------------------------
+//  TextRecordWriter
+// --------------------------------------------------------------------------
+//
+//  The human-readable form: just the path, quoted when it has a space in
+//  it and preceded by the profile name when there is one. Failures are
+//  left for the caller to report on the error stream.
+//
+
+class TextRecordWriter : public RecordWriter
+{
+public:
+
+    TextRecordWriter(BufferedOutputStream& output) : RecordWriter(output) {}
+
+    virtual void Write(const QueryRecord& record);
+};
+
+// --------------------------------------------------------------------------
+//  JsonLinesRecordWriter
+// --------------------------------------------------------------------------
+//
+//  One JSON object per line, encoded in UTF-8:
+//
+//  {"name":"notepad","path":"C:\\WINDOWS\\system32\\notepad.exe",
+//   "directory":2,"extension":".EXE","size":69120,
+//   "modified":"2004-08-04T12:00:00Z"}
+//
+//  A name that could not be resolved has a null path and an "error"
+//  member holding the Win32 error code instead. A record resolved against
+//  an environment profile starts with a "profile" member naming it. One
+//  with image metadata ends with the "machine" the image was built for
+//  and, if it has one, its file "version", such as "5.1.2600.0".
+//
+
+class JsonLinesRecordWriter : public RecordWriter
+{
+public:
+
+    JsonLinesRecordWriter(BufferedOutputStream& output) : RecordWriter(output) {}
+
+    virtual void Write(const QueryRecord& record);
+};
+
+// --------------------------------------------------------------------------
+//  NulRecordWriter
+// --------------------------------------------------------------------------
+//
+//  Fields encoded in UTF-8 and each terminated by a NUL character, which
+//  cannot appear in a file name. Every record has the same fields in the
+//  same order, so a consumer can read them a fixed number at a time:
+//
+//  name, path, directory index, extension, error code
+//
+//  followed by the size and modification time if metadata was asked
+//  for. When resolving against environment profiles, every record starts
+//  with the profile name as an extra field. Fields that do not apply are
+//  empty.
+//
+
+class NulRecordWriter : public RecordWriter
+{
+public:
+
+    NulRecordWriter(BufferedOutputStream& output, bool hasMetadata, bool hasProfile) :
+        RecordWriter(output),
+        m_hasMetadata(hasMetadata),
+        m_hasProfile(hasProfile) {}
+
+    virtual void Write(const QueryRecord& record);
+
+private:
+
+    void EndField() { m_output.WriteBytes("", 1); }
+
+    bool m_hasMetadata;
+    bool m_hasProfile;
+};
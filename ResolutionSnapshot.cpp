@@ -0,0 +1,286 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "ResolutionSnapshot.h"
+
+//
+// Rounds a size up to a multiple of eight so that whatever follows it in
+// the image is suitably aligned.
+//
+
+static DWORD Align(DWORD size)
+{
+    return (size + 7) & ~7UL;
+}
+
+// --------------------------------------------------------------------------
+//  ResolutionSnapshot
+// --------------------------------------------------------------------------
+
+DWORD ResolutionSnapshot::Build(const SearchEnvironment& environment,
+    const DirectoryIndex* const* indexes)
+{
+    _ASSERT(indexes);
+
+    const SearchOrder& searchOrder = environment.GetSearchOrder();
+    const int directoryCount = searchOrder.GetCount();
+
+    if (directoryCount > 0xFFFF)
+        return ERROR_NOT_SUPPORTED;
+
+    for (int i = 0; i < directoryCount; i++)
+    {
+        if (!indexes[i]->IsScanned())
+            return ERROR_NOT_READY;
+    }
+
+    m_header = NULL;
+
+    try
+    {
+        //
+        // Find the directory in which each name is first found, going
+        // through the directories in order so that the first time a name
+        // turns up is the one that counts.
+        //
+
+        NameTable names;
+        Array<int> nameDirectories;
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            const DirectoryIndex& index = *indexes[i];
+
+            for (int j = 0; j < index.GetNameCount(); j++)
+            {
+                TCHAR name[MAX_PATH];
+                index.GetName(j, name);
+
+                if (names.Add(name, index.GetNameHash(j)) == nameDirectories.GetCount())
+                    nameDirectories.Add(i);
+            }
+        }
+
+        const int nameCount = names.GetCount();
+
+        //
+        // Every name is a command as it is. A name without its extension
+        // is one too when the extension is in PATHEXT, unless a file by
+        // that name exists, which the resolver would try first. Where
+        // several extensions would do, the one that comes first in
+        // PATHEXT wins, just as it does when resolving.
+        //
+
+        Array<Command> commands;
+        commands.SetCount(nameCount);
+
+        for (int i = 0; i < nameCount; i++)
+        {
+            commands[i].name = names.GetName(i);
+            commands[i].keyLength = lstrlen(commands[i].name);
+            commands[i].directoryIndex = nameDirectories[i];
+        }
+
+        NameTable stems;
+        Array<int> stemCommands;
+        Array<int> stemExtensions;
+
+        for (int i = 0; i < nameCount; i++)
+        {
+            LPCTSTR name = names.GetName(i);
+            LPCTSTR extension = PathFindExtension(name);
+
+            if (!*extension || extension == name)
+                continue;
+
+            int extensionIndex = 0;
+
+            while (extensionIndex < environment.GetExtensionCount() &&
+                0 != lstrcmpi(extension, environment.GetExtension(extensionIndex)))
+            {
+                extensionIndex++;
+            }
+
+            if (extensionIndex == environment.GetExtensionCount())
+                continue;
+
+            TCHAR stem[MAX_PATH];
+            lstrcpyn(stem, name, static_cast<int>(extension - name) + 1);
+
+            //
+            // A stem with an extension of its own would be taken as it is
+            // and never have anything appended to it.
+            //
+
+            if (*PathFindExtension(stem))
+                continue;
+
+            const DWORD hash = DirectoryIndex::Hash(stem);
+
+            if (names.Find(stem, hash) >= 0)
+                continue;
+
+            const int stemIndex = stems.Add(stem, hash);
+
+            if (stemIndex == stemCommands.GetCount())
+            {
+                stemCommands.Add(commands.GetCount());
+                stemExtensions.Add(extensionIndex);
+            }
+            else if (extensionIndex < stemExtensions[stemIndex])
+            {
+                stemExtensions[stemIndex] = extensionIndex;
+            }
+            else
+            {
+                continue;
+            }
+
+            Command command;
+            command.name = name;
+            command.keyLength = lstrlen(stem);
+            command.directoryIndex = nameDirectories[i];
+
+            if (stemCommands[stemIndex] == commands.GetCount())
+                commands.Add(command);
+            else
+                commands[stemCommands[stemIndex]] = command;
+        }
+
+        qsort(commands.GetData(), commands.GetCount(), sizeof(Command), CompareCommands);
+
+        //
+        // Write out the image, the directory paths first and then the
+        // file names in command order.
+        //
+
+        const int commandCount = commands.GetCount();
+        DWORD namesLength = 0;
+
+        for (int i = 0; i < directoryCount; i++)
+            namesLength += lstrlen(searchOrder.GetDirectory(i)) + 1;
+
+        for (int i = 0; i < commandCount; i++)
+            namesLength += lstrlen(commands[i].name) + 1;
+
+        const DWORD entriesOffset = Align(sizeof(ResolutionSnapshotHeader));
+        const DWORD directoriesOffset = Align(entriesOffset + commandCount * sizeof(ResolutionSnapshotEntry));
+        const DWORD namesOffset = Align(directoriesOffset + directoryCount * sizeof(DWORD));
+        const DWORD size = Align(namesOffset + namesLength * sizeof(TCHAR));
+
+        m_storage.SetCount(size);
+        ZeroMemory(m_storage.GetData(), size);
+
+        BYTE* image = m_storage.GetData();
+
+        ResolutionSnapshotHeader& header = *reinterpret_cast<ResolutionSnapshotHeader*>(image);
+        header.signature = Signature;
+        header.version = Version;
+        header.characterSize = sizeof(TCHAR);
+        header.entryCount = commandCount;
+        header.directoryCount = directoryCount;
+        header.entriesOffset = entriesOffset;
+        header.directoriesOffset = directoriesOffset;
+        header.namesOffset = namesOffset;
+        header.namesLength = namesLength;
+        header.size = size;
+
+        ResolutionSnapshotEntry* entries = reinterpret_cast<ResolutionSnapshotEntry*>(image + entriesOffset);
+        DWORD* directories = reinterpret_cast<DWORD*>(image + directoriesOffset);
+        LPTSTR text = reinterpret_cast<LPTSTR>(image + namesOffset);
+        DWORD offset = 0;
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            directories[i] = offset;
+            lstrcpy(text + offset, searchOrder.GetDirectory(i));
+            offset += lstrlen(text + offset) + 1;
+        }
+
+        for (int i = 0; i < commandCount; i++)
+        {
+            entries[i].nameOffset = offset;
+            entries[i].keyLength = static_cast<WORD>(commands[i].keyLength);
+            entries[i].directoryIndex = static_cast<WORD>(commands[i].directoryIndex);
+
+            lstrcpy(text + offset, commands[i].name);
+            offset += lstrlen(text + offset) + 1;
+        }
+
+        m_header = &header;
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+LPCTSTR ResolutionSnapshot::GetCommand(int index, LPTSTR buffer) const
+{
+    _ASSERT(buffer);
+    _ASSERT(index >= 0 && index < GetCount());
+
+    const BYTE* image = reinterpret_cast<const BYTE*>(m_header);
+    const ResolutionSnapshotEntry& entry = reinterpret_cast<const ResolutionSnapshotEntry*>(
+        image + m_header->entriesOffset)[index];
+
+    LPCTSTR text = reinterpret_cast<LPCTSTR>(image + m_header->namesOffset);
+    lstrcpyn(buffer, text + entry.nameOffset, entry.keyLength + 1);
+
+    return buffer;
+}
+
+LPCTSTR ResolutionSnapshot::GetPath(int index, LPTSTR buffer) const
+{
+    _ASSERT(buffer);
+    _ASSERT(index >= 0 && index < GetCount());
+
+    const BYTE* image = reinterpret_cast<const BYTE*>(m_header);
+    const ResolutionSnapshotEntry& entry = reinterpret_cast<const ResolutionSnapshotEntry*>(
+        image + m_header->entriesOffset)[index];
+
+    const DWORD* directories = reinterpret_cast<const DWORD*>(image + m_header->directoriesOffset);
+    LPCTSTR text = reinterpret_cast<LPCTSTR>(image + m_header->namesOffset);
+
+    if (!PathCombine(buffer, text + directories[entry.directoryIndex], text + entry.nameOffset))
+        *buffer = 0;
+
+    return buffer;
+}
+
+int __cdecl ResolutionSnapshot::CompareCommands(const void* a, const void* b)
+{
+    const Command& commandA = *static_cast<const Command*>(a);
+    const Command& commandB = *static_cast<const Command*>(b);
+
+    const int length = min(commandA.keyLength, commandB.keyLength);
+    const int order = _tcsncmp(commandA.name, commandB.name, length);
+
+    return order ? order : commandA.keyLength - commandB.keyLength;
+}
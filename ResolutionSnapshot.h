@@ -0,0 +1,110 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ResolutionSnapshotHeader
+// --------------------------------------------------------------------------
+//
+//  A snapshot is a single flat image meant to be read whole by shells and
+//  launchers. The header is followed by, at the offsets it gives:
+//
+//  - an entry per command, sorted ordinally by command;
+//  - the offset into the names of every directory in the search order;
+//  - the names: every directory path and file name, each terminated.
+//
+//  An entry names the file that wins and the directory it is in. The
+//  command is the first keyLength characters of the file name, which is
+//  the whole name or the name without the PATHEXT extension that gets
+//  appended to find it. Names are case-folded since commands are typed
+//  in any case.
+//
+
+struct ResolutionSnapshotHeader
+{
+    DWORD signature;
+    WORD version;
+    WORD characterSize;
+    DWORD entryCount;
+    DWORD directoryCount;
+    DWORD entriesOffset;
+    DWORD directoriesOffset;
+    DWORD namesOffset;
+    DWORD namesLength;
+    DWORD size;
+};
+
+struct ResolutionSnapshotEntry
+{
+    DWORD nameOffset;
+    WORD keyLength;
+    WORD directoryIndex;
+};
+
+// --------------------------------------------------------------------------
+//  ResolutionSnapshot
+// --------------------------------------------------------------------------
+//
+//  Every command that can be run through a search environment, mapped to
+//  the path it resolves to, much like the command hash table of a shell
+//  but complete. A command is either a file name as it is or a file name
+//  without one of the PATHEXT extensions, and where several files answer
+//  to the same command the one the resolver would find wins.
+//
+//  It is built from the indexes of the directories in the search order,
+//  all of which must have been scanned.
+//
+
+class ResolutionSnapshot
+{
+public:
+
+    enum
+    {
+        Signature = 0x53535046, // FPSS
+        Version = 1
+    };
+
+    ResolutionSnapshot() : m_header(NULL) {}
+
+    DWORD Build(const SearchEnvironment& environment, const DirectoryIndex* const* indexes);
+
+    const void* GetImage() const { return m_header; }
+    DWORD GetImageSize() const { return m_header ? m_header->size : 0; }
+
+    int GetCount() const { return m_header ? m_header->entryCount : 0; }
+    LPCTSTR GetCommand(int index, LPTSTR buffer) const;
+    LPCTSTR GetPath(int index, LPTSTR buffer) const;
+
+private:
+
+    struct Command
+    {
+        LPCTSTR name;
+        int keyLength;
+        int directoryIndex;
+    };
+
+    static int __cdecl CompareCommands(const void* a, const void* b);
+
+    Array<BYTE> m_storage;
+    const ResolutionSnapshotHeader* m_header;
+
+    ResolutionSnapshot(const ResolutionSnapshot&);
+    ResolutionSnapshot& operator=(const ResolutionSnapshot&);
+};
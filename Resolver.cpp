@@ -0,0 +1,738 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Profiler.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "LookupIndex.h"
+#include "NameTable.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "ImageMachine.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+#include "Resolver.h"
+
+//
+// Libraries
+//
+
+#pragma comment(lib, "shlwapi")
+
+template<class P>
+static void GetProcAddress(HMODULE module, LPCSTR procedureName, P& procedure)
+{
+    procedure = (P) GetProcAddress(module, procedureName);
+}
+
+// --------------------------------------------------------------------------
+//  Resolver
+// --------------------------------------------------------------------------
+
+Resolver::Resolver() :
+    m_isInitialized(false),
+    m_activationContext(NULL),
+    m_machine(ImageMachine::Any),
+    m_isIndexOnly(false),
+    m_apiSetSchema(NULL),
+    m_knownDlls(NULL),
+    m_imageMetadata(NULL),
+    m_fileSystem(&FileSystem::GetWin32()),
+    m_suggestionIndex(NULL),
+    m_probeCount(0),
+    m_imageReadCount(0),
+    m_listingCount(0)
+{
+    ZeroMemory(&m_activationContextApi, sizeof(m_activationContextApi));
+}
+
+Resolver::~Resolver()
+{
+    if (m_activationContext)
+        m_activationContextApi.Release(m_activationContext);
+
+    delete static_cast<SuggestionIndex*>(m_suggestionIndex);
+}
+
+DWORD Resolver::Initialize(const ResolverOptions& options)
+{
+    _ASSERT(!m_isInitialized);
+
+    if (options.fileSystem && options.fileSystem != &FileSystem::GetWin32() &&
+        (options.manifestFilePath || options.imageMetadata))
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    if (options.fileSystem)
+        m_fileSystem = options.fileSystem;
+
+    try
+    {
+        if (options.environment)
+            m_environment.Assign(*options.environment);
+        else
+            m_environment.Capture(options.profile, options.directoryIdentities);
+
+        m_machine = options.machine;
+        m_isIndexOnly = options.isIndexOnly;
+        m_apiSetSchema = options.apiSetSchema;
+        m_knownDlls = options.knownDlls;
+        m_imageMetadata = options.imageMetadata;
+
+        //
+        // Keep the search order around as a path list too, in the form
+        // that SearchPath takes it, for when an activation context has
+        // to be taken into account.
+        //
+
+        const SearchOrder& searchOrder = m_environment.GetSearchOrder();
+
+        for (int i = 0; i < searchOrder.GetCount(); i++)
+        {
+            LPCTSTR directory = searchOrder.GetDirectory(i);
+
+            if (i > 0)
+                m_searchPath.Add(_T(';'));
+
+            m_searchPath.Append(directory, lstrlen(directory));
+        }
+
+        m_searchPath.Add(0);
+
+        if (options.directoryIndexes)
+        {
+            for (int i = 0; i < searchOrder.GetCount(); i++)
+                m_directoryIndexes.Add(options.directoryIndexes->Register(searchOrder.GetDirectory(i)));
+        }
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    if (options.manifestFilePath)
+    {
+        DWORD error = CreateActivationContext(options.manifestFilePath);
+
+        if (NO_ERROR != error)
+            return error;
+    }
+
+    m_isInitialized = true;
+
+    return NO_ERROR;
+}
+
+DWORD Resolver::AttachLookupIndex(LPCTSTR filePath, int threadCount)
+{
+    _ASSERT(filePath);
+
+    if (!m_isInitialized)
+        return ERROR_INVALID_HANDLE;
+
+    if (!m_directoryIndexes.GetCount())
+        return ERROR_INVALID_FUNCTION;
+
+    //
+    // A saved index that is still current is used as it is, without so
+    // much as listing a directory. Otherwise one is built from the
+    // directory indexes, scanning those that need it, and saved for
+    // next time.
+    //
+
+    const SearchOrder& searchOrder = m_environment.GetSearchOrder();
+
+    if (NO_ERROR == m_lookupIndex.Load(filePath, searchOrder, m_fileSystem))
+        return NO_ERROR;
+
+    DWORD error = ScanDirectories(threadCount);
+
+    if (NO_ERROR != error)
+        return error;
+
+    error = m_lookupIndex.Build(searchOrder, m_directoryIndexes.GetData());
+
+    //
+    // Should a directory be impossible to list, the names in it are not
+    // known and so neither is where any name is first found. Resolving
+    // then carries on the usual way.
+    //
+
+    if (ERROR_NOT_READY == error)
+        return NO_ERROR;
+
+    if (NO_ERROR != error)
+        return error;
+
+    return m_lookupIndex.Save(filePath);
+}
+
+DWORD Resolver::ScanDirectories(int threadCount)
+{
+    if (!m_isInitialized)
+        return ERROR_INVALID_HANDLE;
+
+    //
+    // Directories already scanned, whether by this resolver or another
+    // one sharing the same table, are left as they are.
+    //
+
+    return ParallelFor(m_directoryIndexes.GetCount(), threadCount, ScanDirectory, this);
+}
+
+void CALLBACK Resolver::ScanDirectory(int index, LPVOID context)
+{
+    Resolver* resolver = static_cast<Resolver*>(context);
+    resolver->m_directoryIndexes[index]->Scan();
+}
+
+struct SpellingMatch
+{
+    LPCTSTR name;
+    LPTSTR spelling;
+};
+
+void Resolver::GetSpelling(LPCTSTR directory, LPCTSTR name, LPTSTR spelling) const
+{
+    _ASSERT(directory);
+    _ASSERT(name);
+    _ASSERT(spelling);
+
+    //
+    // Names from an index come back case-folded. Only a handful are ever
+    // suggested, so list their directories again and take the name as it
+    // is spelled there, keeping the folded one should that fail.
+    //
+
+    lstrcpyn(spelling, name, MAX_PATH);
+
+    SpellingMatch match = { name, spelling };
+    m_fileSystem->List(directory, MatchSpelling, &match);
+}
+
+void CALLBACK Resolver::MatchSpelling(const WIN32_FIND_DATA& findData, LPVOID context)
+{
+    SpellingMatch& match = *static_cast<SpellingMatch*>(context);
+
+    if (0 == lstrcmpi(findData.cFileName, match.name))
+        lstrcpyn(match.spelling, findData.cFileName, MAX_PATH);
+    else if (0 == lstrcmpi(findData.cAlternateFileName, match.name))
+        lstrcpyn(match.spelling, findData.cAlternateFileName, MAX_PATH);
+}
+
+DWORD Resolver::Resolve(LPCTSTR fileName, Resolution& resolution,
+    ResolveTraceProc trace, LPVOID traceContext) const
+{
+    _ASSERT(fileName);
+
+    if (!m_isInitialized)
+        return ERROR_INVALID_HANDLE;
+
+    PROFILE_PHASE(MatchPhase);
+
+    //
+    // Before searching at all, the loader replaces an API set contract
+    // with its host and then serves a known DLL from the system
+    // directory. A contract with no host cannot be loaded.
+    //
+
+    TCHAR hostName[MAX_PATH];
+
+    if (m_apiSetSchema)
+    {
+        LPCTSTR host = m_apiSetSchema->Find(fileName);
+
+        if (host)
+        {
+            if (!*host)
+                return ERROR_FILE_NOT_FOUND;
+
+            lstrcpyn(hostName, host, DIM(hostName));
+            fileName = hostName;
+        }
+    }
+
+    if (m_knownDlls && m_knownDlls->Find(fileName, resolution.path))
+    {
+        resolution.directoryIndex = FindDirectoryIndex(resolution.path);
+        resolution.extensionIndex = -1;
+        return NO_ERROR;
+    }
+
+    //
+    // Try the name as given and then with each extension from PATHEXT
+    // appended in turn. Like SearchPath, an extension is only appended
+    // when the name does not already have one, in which case there is
+    // nothing left to try after the first round.
+    //
+
+    const bool hasExtension = 0 != *PathFindExtension(fileName);
+    const int extensionCount = hasExtension ? 0 : m_environment.GetExtensionCount();
+
+    for (int extensionIndex = -1; extensionIndex < extensionCount; extensionIndex++)
+    {
+        LPCTSTR extension = extensionIndex < 0 ? NULL :
+            m_environment.GetExtension(extensionIndex);
+
+        if (trace)
+            trace(fileName, extension, traceContext);
+
+        DWORD error = m_activationContext ?
+            SearchActivationContext(fileName, extension, resolution) :
+            SearchDirectories(fileName, extension, resolution);
+
+        if (ERROR_FILE_NOT_FOUND != error)
+        {
+            resolution.extensionIndex = extensionIndex;
+            return error;
+        }
+    }
+
+    return ERROR_FILE_NOT_FOUND;
+}
+
+DWORD Resolver::Suggest(LPCTSTR fileName, Resolution* suggestions,
+    int maxSuggestionCount, int& suggestionCount) const
+{
+    _ASSERT(fileName);
+    _ASSERT(suggestions || !maxSuggestionCount);
+
+    suggestionCount = 0;
+
+    if (!m_isInitialized)
+        return ERROR_INVALID_HANDLE;
+
+    if (maxSuggestionCount <= 0)
+        return NO_ERROR;
+
+    try
+    {
+        const SuggestionIndex* index = GetSuggestionIndex();
+        const SearchOrder& searchOrder = m_environment.GetSearchOrder();
+
+        Array<Suggestion> ranked;
+        ranked.SetCount(maxSuggestionCount);
+
+        int rankedCount = index->Suggest(fileName, m_environment.GetPathExtensions(),
+            ranked.GetData(), maxSuggestionCount);
+
+        for (int i = 0; i < rankedCount; i++)
+        {
+            Resolution& suggestion = suggestions[suggestionCount];
+            LPCTSTR directory = searchOrder.GetDirectory(ranked[i].directoryIndex);
+
+            TCHAR spelling[MAX_PATH];
+            GetSpelling(directory, index->GetName(ranked[i].nameIndex), spelling);
+
+            if (PathCombine(suggestion.path, directory, spelling))
+            {
+                suggestion.directoryIndex = ranked[i].directoryIndex;
+                suggestion.extensionIndex = -1;
+                suggestionCount++;
+            }
+        }
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+DWORD Resolver::CreateActivationContext(LPCTSTR manifestFilePath)
+{
+    _ASSERT(manifestFilePath);
+
+    //
+    // The activation context API is only available as of Windows XP.
+    // On older systems the manifest is ignored, which is no worse than
+    // what those systems would do with it for any other application.
+    //
+
+    HMODULE kernelLibrary = GetModuleHandle(_T("kernel32.dll"));
+
+    if (NULL == kernelLibrary)
+        return NO_ERROR;
+
+    #ifdef UNICODE
+        GetProcAddress(kernelLibrary, "CreateActCtxW", m_activationContextApi.Create);
+    #else
+        GetProcAddress(kernelLibrary, "CreateActCtxA", m_activationContextApi.Create);
+    #endif
+
+    GetProcAddress(kernelLibrary, "ActivateActCtx", m_activationContextApi.Activate);
+    GetProcAddress(kernelLibrary, "DeactivateActCtx", m_activationContextApi.Deactivate);
+    GetProcAddress(kernelLibrary, "ReleaseActCtx", m_activationContextApi.Release);
+
+    if (!m_activationContextApi.Create || !m_activationContextApi.Activate ||
+        !m_activationContextApi.Deactivate || !m_activationContextApi.Release)
+    {
+        return NO_ERROR;
+    }
+
+    ACTCTX activationContextSetup = { sizeof(activationContextSetup) };
+    activationContextSetup.lpSource = manifestFilePath;
+
+    HANDLE activationContext = m_activationContextApi.Create(&activationContextSetup);
+
+    if (INVALID_HANDLE_VALUE == activationContext)
+        return GetLastError();
+
+    m_activationContext = activationContext;
+
+    return NO_ERROR;
+}
+
+DWORD Resolver::SearchDirectories(LPCTSTR fileName, LPCTSTR extension,
+    Resolution& resolution) const
+{
+    _ASSERT(fileName);
+
+    TCHAR name[MAX_PATH];
+
+    if (lstrlen(fileName) + (extension ? lstrlen(extension) : 0) >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(name, fileName);
+
+    if (extension)
+        lstrcat(name, extension);
+
+    //
+    // A name with a path of its own is not subject to the search order
+    // at all. It either exists or it does not.
+    //
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!PathIsRelative(name))
+    {
+        InterlockedIncrement(&m_probeCount);
+
+        if (NO_ERROR != m_fileSystem->GetAttributes(name, data))
+            return ERROR_FILE_NOT_FOUND;
+
+        DWORD length = GetFullPathName(name, DIM(resolution.path), resolution.path, NULL);
+
+        if (0 == length)
+            return GetLastError();
+
+        if (length >= DIM(resolution.path))
+            return ERROR_FILENAME_EXCED_RANGE;
+
+        resolution.directoryIndex = -1;
+
+        return IsLoadable(resolution.path) ? NO_ERROR : ERROR_BAD_EXE_FORMAT;
+    }
+
+    //
+    // Directories that have been indexed can answer for the name without
+    // touching the file system, so fold and hash it once up front for
+    // all of them.
+    //
+
+    const bool isIndexable = m_directoryIndexes.GetCount() > 0 &&
+        DirectoryIndex::IsIndexable(name);
+
+    const SearchOrder& searchOrder = m_environment.GetSearchOrder();
+
+    TCHAR foldedName[MAX_PATH];
+    DWORD hash = 0;
+
+    if (isIndexable)
+    {
+        lstrcpy(foldedName, name);
+        CharUpperBuff(foldedName, lstrlen(foldedName));
+
+        //
+        // The lookup index knows outright which directories have the
+        // name, in order, so the first of them is the one unless it is
+        // an image for the wrong machine.
+        //
+
+        if (m_lookupIndex.IsReady())
+        {
+            const DWORD* directoryIndexes;
+            const int count = m_lookupIndex.Find(foldedName, directoryIndexes);
+
+            for (int i = 0; i < count; i++)
+            {
+                const DWORD directoryIndex = directoryIndexes[i];
+
+                if (directoryIndex >= static_cast<DWORD>(searchOrder.GetCount()) ||
+                    !PathCombine(resolution.path, searchOrder.GetDirectory(directoryIndex), name))
+                {
+                    break;
+                }
+
+                if (IsLoadable(resolution.path))
+                {
+                    resolution.directoryIndex = directoryIndex;
+                    return NO_ERROR;
+                }
+            }
+
+            return ERROR_FILE_NOT_FOUND;
+        }
+
+        hash = DirectoryIndex::Hash(foldedName);
+    }
+
+    for (int i = 0; i < searchOrder.GetCount(); i++)
+    {
+        DirectoryIndex* index = isIndexable ? m_directoryIndexes[i] : NULL;
+
+        if (index && index->IsScanOnDemand())
+            UseOnDemand(index);
+
+        const bool isIndexed = index && index->IsScanned();
+
+        if (index && !isIndexed && m_isIndexOnly)
+            return ERROR_NOT_READY;
+
+        if (isIndexed && !index->Contains(foldedName, hash))
+            continue;
+
+        if (!PathCombine(resolution.path, searchOrder.GetDirectory(i), name))
+            continue;
+
+        if (!isIndexed)
+            InterlockedIncrement(&m_probeCount);
+
+        if ((isIndexed || NO_ERROR == m_fileSystem->GetAttributes(resolution.path, data)) &&
+            IsLoadable(resolution.path))
+        {
+            resolution.directoryIndex = i;
+            return NO_ERROR;
+        }
+    }
+
+    return ERROR_FILE_NOT_FOUND;
+}
+
+DWORD Resolver::SearchActivationContext(LPCTSTR fileName, LPCTSTR extension,
+    Resolution& resolution) const
+{
+    _ASSERT(fileName);
+    _ASSERT(m_activationContext);
+
+    //
+    // Redirection through an activation context is something that only
+    // SearchPath knows how to apply. Activation is per thread so this
+    // does not get in the way of any other thread using the resolver.
+    //
+
+    ULONG_PTR cookie = 0;
+
+    if (!m_activationContextApi.Activate(m_activationContext, &cookie))
+        return GetLastError();
+
+    LPTSTR filePart;
+
+    InterlockedIncrement(&m_probeCount);
+
+    DWORD length = SearchPath(m_searchPath.GetData(), fileName, extension,
+        DIM(resolution.path), resolution.path, &filePart);
+
+    DWORD error = NO_ERROR;
+
+    if (0 == length)
+        error = GetLastError();
+    else if (length >= DIM(resolution.path))
+        error = ERROR_FILENAME_EXCED_RANGE;
+
+    m_activationContextApi.Deactivate(0, cookie);
+
+    if (NO_ERROR != error)
+        return error;
+
+    if (!IsLoadable(resolution.path))
+        return ERROR_BAD_EXE_FORMAT;
+
+    resolution.directoryIndex = FindDirectoryIndex(resolution.path);
+
+    return NO_ERROR;
+}
+
+void Resolver::UseOnDemand(DirectoryIndex* index) const
+{
+    _ASSERT(index);
+
+    if (index->IsScanned())
+    {
+        index->RecordHit();
+        return;
+    }
+
+    //
+    // Whoever needs the index first scans it, while any other thread
+    // that needs it in the meantime goes to the file system. Should the
+    // scan fail, so does everyone from then on.
+    //
+
+    index->RecordMiss();
+
+    if (!index->IsPending())
+        return;
+
+    InterlockedIncrement(&m_listingCount);
+
+    try
+    {
+        index->Scan();
+    }
+    catch (SystemException&)
+    {
+    }
+}
+
+bool Resolver::IsLoadable(LPCTSTR path) const
+{
+    _ASSERT(path);
+
+    if (ImageMachine::Any == m_machine)
+        return true;
+
+    if (m_imageMetadata)
+    {
+        ImageMetadata metadata;
+
+        if (NO_ERROR == m_imageMetadata->Query(path, metadata))
+            return NO_ERROR != metadata.error || metadata.machine == m_machine;
+    }
+
+    InterlockedIncrement(&m_imageReadCount);
+
+    WORD machine;
+
+    return !ImageMachine::Query(path, machine, m_fileSystem) || machine == m_machine;
+}
+
+void Resolver::GetStatistics(ResolverStatistics& statistics) const
+{
+    statistics.probeCount = m_probeCount;
+    statistics.imageReadCount = m_imageReadCount;
+    statistics.listingCount = m_listingCount;
+}
+
+int Resolver::FindDirectoryIndex(LPCTSTR path) const
+{
+    _ASSERT(path);
+
+    TCHAR directory[MAX_PATH];
+    lstrcpyn(directory, path, DIM(directory));
+    PathRemoveFileSpec(directory);
+
+    const SearchOrder& searchOrder = m_environment.GetSearchOrder();
+
+    for (int i = 0; i < searchOrder.GetCount(); i++)
+    {
+        if (0 == lstrcmpi(directory, searchOrder.GetDirectory(i)))
+            return i;
+    }
+
+    return -1;
+}
+
+const SuggestionIndex* Resolver::GetSuggestionIndex() const
+{
+    SuggestionIndex* index = static_cast<SuggestionIndex*>(m_suggestionIndex);
+
+    if (index)
+        return index;
+
+    //
+    // Build the index without holding any lock. Should several threads
+    // race to build it, the first one to publish its copy wins and the
+    // others throw theirs away.
+    //
+
+    index = new SuggestionIndex;
+
+    if (!index)
+        throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+    try
+    {
+        //
+        // A lookup index carries the postings of its names ready to be
+        // used. Failing that, the names of every directory that has been
+        // indexed are already at hand, and only those that have not are
+        // listed.
+        //
+
+        SuggestionImage image;
+
+        if (m_lookupIndex.IsReady() && m_lookupIndex.GetSuggestions(image))
+        {
+            index->Attach(image);
+        }
+        else
+        {
+            const SearchOrder& searchOrder = m_environment.GetSearchOrder();
+
+            for (int i = 0; i < searchOrder.GetCount(); i++)
+            {
+                DirectoryIndex* directoryIndex = m_directoryIndexes.GetCount() ?
+                    m_directoryIndexes[i] : NULL;
+
+                if (directoryIndex && directoryIndex->IsScanOnDemand())
+                    UseOnDemand(directoryIndex);
+
+                if (directoryIndex && directoryIndex->IsScanned())
+                {
+                    for (int j = 0; j < directoryIndex->GetNameCount(); j++)
+                    {
+                        TCHAR name[MAX_PATH];
+                        index->AddName(directoryIndex->GetName(j, name), i);
+                    }
+                }
+                else
+                {
+                    index->AddDirectory(searchOrder.GetDirectory(i), i, m_fileSystem);
+                }
+            }
+
+            index->Build();
+        }
+    }
+    catch (...)
+    {
+        delete index;
+        throw;
+    }
+
+    PVOID published = InterlockedCompareExchangePointer(&m_suggestionIndex, index, NULL);
+
+    if (published)
+    {
+        delete index;
+        index = static_cast<SuggestionIndex*>(published);
+    }
+
+    return index;
+}
@@ -0,0 +1,222 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ResolverOptions
+// --------------------------------------------------------------------------
+//
+//  The profile, when given, is the environment to resolve against in
+//  place of this process's own. The directory index table, when given,
+//  is where the resolver registers its search order directories so that
+//  it can answer from their indexes once the table has been scanned. The
+//  directory identity cache, when given, saves opening directories that
+//  other resolvers sharing it have already seen. The machine, when given,
+//  is that of the process to resolve for, so that images built for any
+//  other machine are passed over just as the loader would. The API set
+//  schema and known DLL list, when given, are applied ahead of the search
+//  order as the loader does and have to outlive the resolver. So does the
+//  image metadata cache, when given, which is where the machine of an
+//  image is then taken from.
+//
+//  The file system, when given, is what files are looked for in and read
+//  from in place of that of Windows, and has to outlive the resolver too.
+//  It should be the same as that of the directory index table. Only
+//  SearchPath can apply an activation context and the image metadata
+//  cache knows files by their identity on Windows, so neither can be
+//  used with any other file system. The environment itself is taken from
+//  the system all the same, unless one is given ready made, such as one
+//  restored from a capture of another host, which is then used as it is
+//  in place of the profile.
+//
+//  A resolver told to answer from its indexes alone never looks for a
+//  name in a directory whose index has not been scanned, and fails the
+//  search with ERROR_NOT_READY instead of passing the directory over.
+//  Names that no index can answer for still go to the file system.
+//
+
+struct ResolverOptions
+{
+    LPCTSTR manifestFilePath;
+    const EnvironmentProfile* profile;
+    DirectoryIndexTable* directoryIndexes;
+    DirectoryIdentityCache* directoryIdentities;
+    WORD machine;
+    const ApiSetSchema* apiSetSchema;
+    const KnownDllList* knownDlls;
+    const ImageMetadataCache* imageMetadata;
+    const FileSystem* fileSystem;
+    const SearchEnvironment* environment;
+    bool isIndexOnly;
+};
+
+// --------------------------------------------------------------------------
+//  Resolution
+// --------------------------------------------------------------------------
+//
+//  The outcome of a successful resolution. The directory and extension
+//  indexes refer to the resolver's environment and are -1 when the path
+//  was not found through the search order or no extension was appended.
+//
+
+struct Resolution
+{
+    TCHAR path[MAX_PATH];
+    int directoryIndex;
+    int extensionIndex;
+};
+
+// --------------------------------------------------------------------------
+//  ResolverStatistics
+// --------------------------------------------------------------------------
+//
+//  What resolving has cost in calls to the file system so far: probes
+//  for a file, or a search through an activation context, reads of an
+//  image header to tell its machine and directories listed on demand.
+//  A lookup answered entirely from indexes costs none of them, and nor
+//  does an image whose machine the metadata cache could tell. Calls made
+//  on behalf of anything else are counted by the file system itself.
+//
+
+struct ResolverStatistics
+{
+    LONG probeCount;
+    LONG imageReadCount;
+    LONG listingCount;
+};
+
+typedef void (CALLBACK * ResolveTraceProc)(LPCTSTR fileName, LPCTSTR extension, LPVOID context);
+
+// --------------------------------------------------------------------------
+//  Resolver
+// --------------------------------------------------------------------------
+//
+//  Locates files the way SearchPath does, but against its own snapshot of
+//  the environment rather than the live process state. Once initialized,
+//  a resolver can be used from any number of threads at the same time:
+//  Resolve keeps all of its working state on the caller's stack and any
+//  cache is built at most once and then only read. The exception is a
+//  directory index that is scanned on demand, which whichever thread
+//  first needs it scans.
+//
+//  A resolver that registered its directories in a table can also attach
+//  a lookup index of its whole search order, saved in a file, after which
+//  a name is found with a single lookup and no file system access at all.
+//  AttachLookupIndex has to be called before any thread starts resolving.
+//
+//  Suggestions are drawn from the same indexes, which only keep names
+//  case-folded, so the directory of each suggestion is listed once more
+//  to give the name back as it is spelled on disk.
+//
+//  When resolving for a given machine, a file that is an image built for
+//  another one does not count as found and the search goes on. Only the
+//  first file SearchPath finds through an activation context is known,
+//  so a mismatch there fails with ERROR_BAD_EXE_FORMAT, as does a name
+//  with a path of its own that leads to one.
+//
+//  None of the methods throw. Failures are reported as Win32 error codes,
+//  with ERROR_FILE_NOT_FOUND meaning that every variant was searched for
+//  and none was found.
+//
+
+class Resolver
+{
+public:
+
+    Resolver();
+    ~Resolver();
+
+    DWORD Initialize(const ResolverOptions& options);
+    DWORD ScanDirectories(int threadCount);
+    DWORD AttachLookupIndex(LPCTSTR filePath, int threadCount);
+
+    DWORD Resolve(LPCTSTR fileName, Resolution& resolution,
+        ResolveTraceProc trace = NULL, LPVOID traceContext = NULL) const;
+
+    DWORD Suggest(LPCTSTR fileName, Resolution* suggestions,
+        int maxSuggestionCount, int& suggestionCount) const;
+
+    const SearchEnvironment& GetEnvironment() const { return m_environment; }
+
+    void GetStatistics(ResolverStatistics& statistics) const;
+
+    const ImageMetadataCache* GetImageMetadata() const { return m_imageMetadata; }
+    const FileSystem& GetFileSystem() const { return *m_fileSystem; }
+
+    //
+    // The index of every directory in the search order, in the same
+    // order, or NULL if the resolver was not given a table to register
+    // them in.
+    //
+
+    const DirectoryIndex* const* GetDirectoryIndexes() const
+    {
+        return m_directoryIndexes.GetCount() ? m_directoryIndexes.GetData() : NULL;
+    }
+
+private:
+
+    //
+    // These function pointers are for late-binding support of the
+    // activation context API to prevent the library from implicitly
+    // importing them and therefore becoming bound to only those versions
+    // of the operating system that implement them.
+    //
+
+    struct ActivationContextApi
+    {
+        HANDLE (WINAPI * Create)(PACTCTX);
+        BOOL   (WINAPI * Activate)(HANDLE, ULONG_PTR*);
+        BOOL   (WINAPI * Deactivate)(DWORD, ULONG_PTR);
+        void   (WINAPI * Release)(HANDLE);
+    };
+
+    DWORD CreateActivationContext(LPCTSTR manifestFilePath);
+    DWORD SearchDirectories(LPCTSTR fileName, LPCTSTR extension, Resolution& resolution) const;
+    DWORD SearchActivationContext(LPCTSTR fileName, LPCTSTR extension, Resolution& resolution) const;
+    int FindDirectoryIndex(LPCTSTR path) const;
+    bool IsLoadable(LPCTSTR path) const;
+
+    void UseOnDemand(DirectoryIndex* index) const;
+    const SuggestionIndex* GetSuggestionIndex() const;
+
+    void GetSpelling(LPCTSTR directory, LPCTSTR name, LPTSTR spelling) const;
+
+    static void CALLBACK ScanDirectory(int index, LPVOID context);
+    static void CALLBACK MatchSpelling(const WIN32_FIND_DATA& findData, LPVOID context);
+
+    bool m_isInitialized;
+    SearchEnvironment m_environment;
+    Array<TCHAR> m_searchPath;
+    Array<DirectoryIndex*> m_directoryIndexes;
+    LookupIndex m_lookupIndex;
+    ActivationContextApi m_activationContextApi;
+    HANDLE m_activationContext;
+    WORD m_machine;
+    bool m_isIndexOnly;
+    const ApiSetSchema* m_apiSetSchema;
+    const KnownDllList* m_knownDlls;
+    const ImageMetadataCache* m_imageMetadata;
+    const FileSystem* m_fileSystem;
+    mutable PVOID volatile m_suggestionIndex;
+    mutable LONG m_probeCount;
+    mutable LONG m_imageReadCount;
+    mutable LONG m_listingCount;
+
+    Resolver(const Resolver&);
+    Resolver& operator=(const Resolver&);
+};
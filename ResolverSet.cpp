@@ -0,0 +1,117 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "LookupIndex.h"
+#include "NameTable.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+#include "Resolver.h"
+#include "ResolverSet.h"
+
+// --------------------------------------------------------------------------
+//  ResolverSet
+// --------------------------------------------------------------------------
+
+ResolverSet::~ResolverSet()
+{
+    for (int i = 0; i < m_resolvers.GetCount(); i++)
+        delete m_resolvers[i];
+}
+
+DWORD ResolverSet::Initialize(const EnvironmentProfile* profiles, int profileCount,
+    const ResolverOptions& options, int threadCount, LPCTSTR indexFilePath)
+{
+    _ASSERT(profiles || !profileCount);
+    _ASSERT(!m_resolvers.GetCount());
+
+    m_threadCount = threadCount > 0 ? threadCount : 1;
+
+    try
+    {
+        m_resolvers.Reserve(profileCount);
+
+        for (int i = 0; i < profileCount; i++)
+        {
+            Resolver* resolver = new Resolver;
+
+            if (!resolver)
+                throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+            m_resolvers.Add(resolver);
+
+            ResolverOptions profileOptions = options;
+            profileOptions.profile = &profiles[i];
+            profileOptions.directoryIndexes = &m_directoryIndexes;
+            profileOptions.directoryIdentities = &m_directoryIdentities;
+
+            DWORD error = resolver->Initialize(profileOptions);
+
+            if (NO_ERROR != error)
+                return error;
+        }
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    //
+    // Only now that every profile has registered its directories is it
+    // known which ones are shared, so that each gets listed just once.
+    //
+
+    return indexFilePath ?
+        m_directoryIndexes.Refresh(indexFilePath, m_threadCount) :
+        m_directoryIndexes.Scan(m_threadCount);
+}
+
+DWORD ResolverSet::ResolveAll(const LPCTSTR* fileNames, int fileNameCount,
+    Resolution* resolutions, DWORD* errors) const
+{
+    _ASSERT(fileNames || !fileNameCount);
+    _ASSERT(resolutions || !fileNameCount);
+    _ASSERT(errors || !fileNameCount);
+
+    ResolveAllContext context = { this, fileNames, fileNameCount, resolutions, errors };
+
+    return ParallelFor(m_resolvers.GetCount(), m_threadCount, ResolveProfile, &context);
+}
+
+void CALLBACK ResolverSet::ResolveProfile(int index, LPVOID context)
+{
+    const ResolveAllContext& all = *static_cast<ResolveAllContext*>(context);
+    const Resolver& resolver = *all.set->m_resolvers[index];
+    const int profileCount = all.set->m_resolvers.GetCount();
+
+    for (int i = 0; i < all.fileNameCount; i++)
+    {
+        const int result = i * profileCount + index;
+        all.errors[result] = resolver.Resolve(all.fileNames[i], all.resolutions[result]);
+    }
+}
@@ -0,0 +1,78 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  ResolverSet
+// --------------------------------------------------------------------------
+//
+//  One resolver for each of a number of environment profiles, all of them
+//  sharing a single directory index table. Each distinct directory is
+//  therefore listed once no matter how many profiles have it in their
+//  search order, and a set of names is resolved against every profile at
+//  once with the profiles spread over the available processors.
+//
+//  The identity of every directory is likewise looked up only once when
+//  the search orders are stripped of duplicates.
+//
+//  Given an index file, the directory indexes are loaded from it and only
+//  the directories that are missing or out of date there are scanned,
+//  after which the file is brought up to date.
+//
+//  Results are laid out name by name, with the results for each name
+//  against every profile, in profile order, next to each other.
+//
+
+class ResolverSet
+{
+public:
+
+    ResolverSet() : m_threadCount(1) {}
+    ~ResolverSet();
+
+    DWORD Initialize(const EnvironmentProfile* profiles, int profileCount,
+        const ResolverOptions& options, int threadCount, LPCTSTR indexFilePath = NULL);
+
+    DWORD ResolveAll(const LPCTSTR* fileNames, int fileNameCount,
+        Resolution* resolutions, DWORD* errors) const;
+
+    int GetCount() const { return m_resolvers.GetCount(); }
+    const Resolver& GetResolver(int index) const { return *m_resolvers[index]; }
+
+    const DirectoryIndexTable& GetDirectoryIndexes() const { return m_directoryIndexes; }
+
+private:
+
+    struct ResolveAllContext
+    {
+        const ResolverSet* set;
+        const LPCTSTR* fileNames;
+        int fileNameCount;
+        Resolution* resolutions;
+        DWORD* errors;
+    };
+
+    static void CALLBACK ResolveProfile(int index, LPVOID context);
+
+    DirectoryIndexTable m_directoryIndexes;
+    DirectoryIdentityCache m_directoryIdentities;
+    Array<Resolver*> m_resolvers;
+    int m_threadCount;
+
+    ResolverSet(const ResolverSet&);
+    ResolverSet& operator=(const ResolverSet&);
+};
@@ -0,0 +1,111 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Profiler.h"
+#include "Array.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+
+// --------------------------------------------------------------------------
+//  SearchEnvironment
+// --------------------------------------------------------------------------
+
+void SearchEnvironment::Capture(const EnvironmentProfile* profile,
+    DirectoryIdentityCache* identities)
+{
+    PROFILE_PHASE(EnvironmentPhase);
+
+    if (profile)
+    {
+        m_searchOrder.Capture(profile->applicationDirectory,
+            profile->currentDirectory, profile->path,
+            profile->searchPolicy, profile->applicationPath);
+    }
+    else
+    {
+        m_searchOrder.Capture();
+    }
+
+    m_searchOrder.RemoveDuplicates(identities);
+
+    if (profile && profile->pathExtensions)
+    {
+        SetPathExtensions(profile->pathExtensions);
+        return;
+    }
+
+    DWORD pathExtLength = GetEnvironmentVariable(_T("PATHEXT"), NULL, 0);
+    LPTSTR pathExt = static_cast<LPTSTR>(_alloca((pathExtLength + 1) * sizeof(pathExt[0])));
+    pathExt[0] = 0;
+    GetEnvironmentVariable(_T("PATHEXT"), pathExt, pathExtLength);
+
+    SetPathExtensions(pathExt);
+}
+
+void SearchEnvironment::Restore(const LPCTSTR* directories, int directoryCount,
+    int firstPathIndex, LPCTSTR pathExtensions)
+{
+    _ASSERT(pathExtensions);
+
+    m_searchOrder.Restore(directories, directoryCount, firstPathIndex);
+    SetPathExtensions(pathExtensions);
+}
+
+void SearchEnvironment::Assign(const SearchEnvironment& environment)
+{
+    m_searchOrder.Assign(environment.m_searchOrder);
+    SetPathExtensions(environment.GetPathExtensions());
+}
+
+void SearchEnvironment::SetPathExtensions(LPCTSTR pathExtensions)
+{
+    _ASSERT(pathExtensions);
+
+    m_pathExtensions.Clear();
+    m_pathExtensions.Append(pathExtensions, lstrlen(pathExtensions) + 1);
+
+    //
+    // Break up PATHEXT into individual extensions. The left-to-right
+    // order is significant since it decides which extension wins when
+    // more than one variant of a name exists.
+    //
+
+    m_extensions.Clear();
+    m_extensionOffsets.Clear();
+
+    LPCTSTR entry = pathExtensions;
+
+    while (*entry)
+    {
+        LPCTSTR end = StrChr(entry, _T(';'));
+        int length = end ? static_cast<int>(end - entry) : lstrlen(entry);
+
+        if (length > 0)
+        {
+            m_extensionOffsets.Add(m_extensions.GetCount());
+            m_extensions.Append(entry, length);
+            m_extensions.Add(0);
+        }
+
+        if (!end)
+            break;
+
+        entry = end + 1;
+    }
+}
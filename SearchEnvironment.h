@@ -0,0 +1,97 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  EnvironmentProfile
+// --------------------------------------------------------------------------
+//
+//  Describes the environment of some process other than this one, such
+//  as a service with its own PATH and application directory. Any member
+//  left NULL is taken from this process instead.
+//
+//  The application path, when given, is that of the executable whose
+//  DLLs are being looked for, and stands in for the application
+//  directory if that is not given. The search policy says which of the
+//  search orders of Windows to follow, and is zero for SearchPath's.
+//
+
+struct EnvironmentProfile
+{
+    LPCTSTR name;
+    LPCTSTR applicationDirectory;
+    LPCTSTR currentDirectory;
+    LPCTSTR path;
+    LPCTSTR pathExtensions;
+    LPCTSTR applicationPath;
+    DWORD searchPolicy;
+};
+
+// --------------------------------------------------------------------------
+//  SearchEnvironment
+// --------------------------------------------------------------------------
+//
+//  A snapshot of everything from the process environment that decides
+//  where a file is found: the search order directories and the PATHEXT
+//  extensions. Once captured, it does not change when the process
+//  changes its current directory or environment variables, so it can be
+//  read from any number of threads.
+//
+//  When captured from a profile, the snapshot is of that profile's
+//  environment instead, filled in from the process where it is silent.
+//  Either way, the search order has any duplicate directories removed.
+//
+//  A snapshot can also be restored from one taken elsewhere, such as on
+//  another host, or copied from another one, in which case it is taken
+//  as it is.
+//
+
+class SearchEnvironment
+{
+public:
+
+    SearchEnvironment() {}
+
+    void Capture(const EnvironmentProfile* profile = NULL,
+        DirectoryIdentityCache* identities = NULL);
+    void Restore(const LPCTSTR* directories, int directoryCount, int firstPathIndex,
+        LPCTSTR pathExtensions);
+    void Assign(const SearchEnvironment& environment);
+
+    const SearchOrder& GetSearchOrder() const { return m_searchOrder; }
+
+    int GetExtensionCount() const { return m_extensionOffsets.GetCount(); }
+
+    LPCTSTR GetExtension(int index) const
+    {
+        return m_extensions.GetData() + m_extensionOffsets[index];
+    }
+
+    LPCTSTR GetPathExtensions() const { return m_pathExtensions.GetData(); }
+
+private:
+
+    void SetPathExtensions(LPCTSTR pathExtensions);
+
+    SearchOrder m_searchOrder;
+    Array<TCHAR> m_pathExtensions;
+    Array<TCHAR> m_extensions;
+    Array<int> m_extensionOffsets;
+
+    SearchEnvironment(const SearchEnvironment&);
+    SearchEnvironment& operator=(const SearchEnvironment&);
+};
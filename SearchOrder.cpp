@@ -0,0 +1,407 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+
+// --------------------------------------------------------------------------
+//  SearchOrder
+// --------------------------------------------------------------------------
+
+void SearchOrder::Capture(LPCTSTR applicationDirectory,
+    LPCTSTR currentDirectory, LPCTSTR path, DWORD policy, LPCTSTR applicationPath)
+{
+    m_text.Clear();
+    m_offsets.Clear();
+
+    TCHAR directory[MAX_PATH];
+
+    TCHAR applicationPathDirectory[MAX_PATH];
+
+    if (!applicationDirectory && applicationPath)
+    {
+        lstrcpyn(applicationPathDirectory, applicationPath, DIM(applicationPathDirectory));
+        PathRemoveFileSpec(applicationPathDirectory);
+        applicationDirectory = applicationPathDirectory;
+    }
+
+    TCHAR processCurrentDirectory[MAX_PATH];
+
+    if (!currentDirectory)
+    {
+        if (!GetCurrentDirectory(DIM(processCurrentDirectory), processCurrentDirectory))
+            processCurrentDirectory[0] = 0;
+
+        currentDirectory = processCurrentDirectory;
+    }
+
+    //
+    // 0. With a .local directory next to the application, the loader
+    //    looks for its DLLs in there before anywhere else.
+    //
+
+    if ((policy & DotLocalSearchPolicy) && applicationPath &&
+        lstrlen(applicationPath) + 6 < MAX_PATH)
+    {
+        TCHAR localDirectory[MAX_PATH];
+        lstrcpy(localDirectory, applicationPath);
+        lstrcat(localDirectory, _T(".local"));
+
+        if (PathIsDirectory(localDirectory))
+            Add(localDirectory, lstrlen(localDirectory));
+    }
+
+    //
+    // 1. The directory from which the application loaded.
+    //
+
+    if (!(policy & LoadLibrarySearchPolicies) || (policy & ApplicationDirSearchPolicy))
+    {
+        if (applicationDirectory)
+        {
+            Add(applicationDirectory, lstrlen(applicationDirectory));
+        }
+        else
+        {
+            GetModuleFileName(NULL, directory, DIM(directory));
+            PathRemoveFileSpec(directory);
+            Add(directory, lstrlen(directory));
+        }
+    }
+
+    //
+    // The LOAD_LIBRARY_SEARCH_* flags name every location there is to
+    // search: the application directory, which is already in, the user
+    // directories and the system directory.
+    //
+
+    if (policy & LoadLibrarySearchPolicies)
+    {
+        m_firstPathIndex = GetCount();
+
+        if ((policy & UserDirsSearchPolicy) && path)
+            AddList(path, currentDirectory);
+
+        if ((policy & System32SearchPolicy) && GetSystemDirectory(directory, DIM(directory)))
+            Add(directory, lstrlen(directory));
+
+        return;
+    }
+
+    //
+    // 2. The current directory, unless the loader is in safe search mode.
+    //
+
+    const bool isSafe = 0 != (policy & SafeDllSearchPolicy);
+
+    if (!isSafe && *currentDirectory)
+        Add(currentDirectory, lstrlen(currentDirectory));
+
+    //
+    // 3. The Windows system directory.
+    //
+
+    if (GetSystemDirectory(directory, DIM(directory)))
+        Add(directory, lstrlen(directory));
+
+    //
+    // 4. The 16-bit Windows system directory followed by 5. the Windows
+    //    directory itself.
+    //
+
+    if (GetWindowsDirectory(directory, DIM(directory)))
+    {
+        TCHAR systemDirectory[MAX_PATH];
+        lstrcpy(systemDirectory, directory);
+        PathAppend(systemDirectory, _T("SYSTEM"));
+
+        Add(systemDirectory, lstrlen(systemDirectory));
+        Add(directory, lstrlen(directory));
+    }
+
+    //
+    //    In safe search mode, the current directory only comes now.
+    //
+
+    if (isSafe && *currentDirectory)
+        Add(currentDirectory, lstrlen(currentDirectory));
+
+    //
+    // 6. The directories listed in the PATH environment variable.
+    //
+
+    m_firstPathIndex = GetCount();
+    AddPath(path, currentDirectory);
+}
+
+void SearchOrder::AddPath(LPCTSTR path, LPCTSTR currentDirectory)
+{
+    if (path)
+    {
+        AddList(path, currentDirectory);
+        return;
+    }
+
+    DWORD pathLength = GetEnvironmentVariable(_T("PATH"), NULL, 0);
+
+    if (pathLength)
+    {
+        LPTSTR processPath = new TCHAR[pathLength];
+
+        if (!processPath)
+            throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+        GetEnvironmentVariable(_T("PATH"), processPath, pathLength);
+
+        try
+        {
+            AddList(processPath, currentDirectory);
+        }
+        catch (...)
+        {
+            delete [] processPath;
+            throw;
+        }
+
+        delete [] processPath;
+    }
+}
+
+bool SearchOrder::ParsePolicy(LPCTSTR text, DWORD& policy)
+{
+    _ASSERT(text);
+
+    static const struct
+    {
+        LPCTSTR name;
+        DWORD policy;
+    }
+    policies[] =
+    {
+        { _T("searchpath"),  SearchPathPolicy },
+        { _T("safe"),        SafeDllSearchPolicy },
+        { _T("unsafe"),      UnsafeDllSearchPolicy },
+        { _T("local"),       DotLocalSearchPolicy },
+        { _T("appdir"),      ApplicationDirSearchPolicy },
+        { _T("userdirs"),    UserDirsSearchPolicy },
+        { _T("system32"),    System32SearchPolicy },
+        { _T("defaultdirs"), LoadLibrarySearchPolicies }
+    };
+
+    //
+    // A policy is a list of names separated by commas, all of which
+    // apply together. Safe and unsafe search modes rule each other out.
+    //
+
+    DWORD result = SearchPathPolicy;
+
+    while (*text)
+    {
+        LPCTSTR end = StrChr(text, _T(','));
+        const int length = end ? static_cast<int>(end - text) : lstrlen(text);
+
+        int i = 0;
+
+        while (i < DIM(policies) &&
+            (lstrlen(policies[i].name) != length || StrCmpNI(text, policies[i].name, length)))
+        {
+            i++;
+        }
+
+        if (i == DIM(policies))
+            return false;
+
+        result |= policies[i].policy;
+
+        if (!end)
+            break;
+
+        text = end + 1;
+    }
+
+    if ((result & SafeDllSearchPolicy) && (result & UnsafeDllSearchPolicy))
+        return false;
+
+    policy = result;
+
+    return true;
+}
+
+void SearchOrder::Restore(const LPCTSTR* directories, int count, int firstPathIndex)
+{
+    _ASSERT(directories || !count);
+    _ASSERT(firstPathIndex >= 0 && firstPathIndex <= count);
+
+    m_text.Clear();
+    m_offsets.Clear();
+
+    for (int i = 0; i < count; i++)
+        Add(directories[i], lstrlen(directories[i]));
+
+    m_firstPathIndex = firstPathIndex;
+}
+
+void SearchOrder::Assign(const SearchOrder& searchOrder)
+{
+    m_text.Clear();
+    m_offsets.Clear();
+
+    m_text.Append(searchOrder.m_text.GetData(), searchOrder.m_text.GetCount());
+    m_offsets.Append(searchOrder.m_offsets.GetData(), searchOrder.m_offsets.GetCount());
+    m_firstPathIndex = searchOrder.m_firstPathIndex;
+}
+
+void SearchOrder::RemoveDuplicates(DirectoryIdentityCache* identities)
+{
+    //
+    // The same directory often turns up more than once: the application
+    // directory is also the current one, or PATH lists a directory twice,
+    // spells it differently or reaches it through a junction. Only the
+    // first occurrence could ever have a file that wins, so the rest are
+    // dropped and no longer probed on every miss. Directories that cannot
+    // be opened have no identity and are told apart by path alone.
+    //
+
+    const int count = GetCount();
+
+    Array<DirectoryIdentity> directoryIdentities;
+    Array<bool> hasIdentity;
+    Array<TCHAR> text;
+    Array<int> offsets;
+    int firstPathIndex = 0;
+
+    directoryIdentities.SetCount(count);
+    hasIdentity.SetCount(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        LPCTSTR directory = GetDirectory(i);
+
+        hasIdentity[i] = identities ?
+            identities->GetIdentity(directory, directoryIdentities[i]) :
+            DirectoryIdentity::Query(directory, directoryIdentities[i]);
+
+        bool isDuplicate = false;
+
+        for (int j = 0; j < i && !isDuplicate; j++)
+        {
+            isDuplicate = hasIdentity[i] && hasIdentity[j] ?
+                directoryIdentities[i].IsSameAs(directoryIdentities[j]) :
+                IsSamePath(directory, GetDirectory(j));
+        }
+
+        if (!isDuplicate)
+        {
+            if (i < m_firstPathIndex)
+                firstPathIndex++;
+
+            offsets.Add(text.GetCount());
+            text.Append(directory, lstrlen(directory) + 1);
+        }
+    }
+
+    m_text.Clear();
+    m_text.Append(text.GetData(), text.GetCount());
+
+    m_offsets.Clear();
+    m_offsets.Append(offsets.GetData(), offsets.GetCount());
+
+    m_firstPathIndex = firstPathIndex;
+}
+
+bool SearchOrder::IsSamePath(LPCTSTR a, LPCTSTR b)
+{
+    _ASSERT(a);
+    _ASSERT(b);
+
+    TCHAR normalA[MAX_PATH];
+    lstrcpyn(normalA, a, DIM(normalA));
+    PathRemoveBackslash(normalA);
+
+    TCHAR normalB[MAX_PATH];
+    lstrcpyn(normalB, b, DIM(normalB));
+    PathRemoveBackslash(normalB);
+
+    return 0 == lstrcmpi(normalA, normalB);
+}
+
+void SearchOrder::AddList(LPCTSTR list, LPCTSTR currentDirectory)
+{
+    _ASSERT(list);
+    _ASSERT(currentDirectory);
+
+    LPCTSTR entry = list;
+
+    while (*entry)
+    {
+        LPCTSTR end = StrChr(entry, _T(';'));
+        int length = end ? static_cast<int>(end - entry) : lstrlen(entry);
+
+        //
+        // Entries are sometimes quoted when they contain spaces. The
+        // quotes are not part of the directory name so drop them.
+        //
+
+        LPCTSTR directory = entry;
+
+        if (length >= 2 && directory[0] == _T('"') && directory[length - 1] == _T('"'))
+        {
+            directory++;
+            length -= 2;
+        }
+
+        //
+        // Relative entries are taken relative to the current directory
+        // of the snapshot, which is how SearchPath would have seen them
+        // at that moment.
+        //
+
+        if (length > 0 && length < MAX_PATH)
+        {
+            TCHAR entryDirectory[MAX_PATH];
+            lstrcpyn(entryDirectory, directory, length + 1);
+
+            TCHAR fullDirectory[MAX_PATH];
+
+            if (PathIsRelative(entryDirectory) && *currentDirectory &&
+                PathCombine(fullDirectory, currentDirectory, entryDirectory))
+            {
+                Add(fullDirectory, lstrlen(fullDirectory));
+            }
+            else
+            {
+                Add(entryDirectory, length);
+            }
+        }
+
+        if (!end)
+            break;
+
+        entry = end + 1;
+    }
+}
+
+void SearchOrder::Add(LPCTSTR directory, int length)
+{
+    _ASSERT(directory);
+
+    m_offsets.Add(m_text.GetCount());
+    m_text.Append(directory, length);
+    m_text.Add(0);
+}
@@ -0,0 +1,118 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  SearchPolicy
+// --------------------------------------------------------------------------
+//
+//  Which of the search orders that Windows applies to use. By default it
+//  is that of SearchPath, which puts the current directory right after
+//  the application directory. The loader does the same only when
+//  SafeDllSearchMode is off and otherwise puts the current directory
+//  after the Windows directory. A .local directory or file next to the
+//  application redirects its DLLs to be looked for next to it first.
+//
+//  The last three flags have the values of the LOAD_LIBRARY_SEARCH_*
+//  flags they stand for and replace the usual order altogether with the
+//  locations they name. The user directories, those added through
+//  AddDllDirectory, are taken from the path in their case since PATH
+//  itself is not searched.
+//
+
+enum SearchPolicy
+{
+    SearchPathPolicy            = 0x0000,
+    SafeDllSearchPolicy         = 0x0001,
+    UnsafeDllSearchPolicy       = 0x0002,
+    DotLocalSearchPolicy        = 0x0004,
+    ApplicationDirSearchPolicy  = 0x0200,
+    UserDirsSearchPolicy        = 0x0400,
+    System32SearchPolicy        = 0x0800,
+    LoadLibrarySearchPolicies   = 0x0E00
+};
+
+// --------------------------------------------------------------------------
+//  SearchOrder
+// --------------------------------------------------------------------------
+//
+//  The list of directories, in order of precedence, that SearchPath walks
+//  when it is not given an explicit search path. This is the same sequence
+//  that ShowHelp describes to the user.
+//
+//  The application directory, current directory and PATH are taken from
+//  the process unless they are given, which allows the search order of
+//  some other process or service to be reproduced.
+//
+//  When captured under a policy other than that of SearchPath, it is the
+//  order in which the loader would look for the DLLs of the application,
+//  whose path is needed to find a .local redirection.
+//
+//  Once captured, entries that lead to a directory already in the list
+//  can be removed since they can never be the first to have any file.
+//
+//  Instead of being captured, the list can be restored as it was captured
+//  elsewhere, such as on another host, or copied from another one. The
+//  directories are then taken as they are, without looking at any.
+//
+
+class SearchOrder
+{
+public:
+
+    SearchOrder() : m_firstPathIndex(0) {}
+
+    void Capture(LPCTSTR applicationDirectory = NULL,
+        LPCTSTR currentDirectory = NULL, LPCTSTR path = NULL,
+        DWORD policy = SearchPathPolicy, LPCTSTR applicationPath = NULL);
+
+    void Restore(const LPCTSTR* directories, int count, int firstPathIndex);
+    void Assign(const SearchOrder& searchOrder);
+
+    void RemoveDuplicates(DirectoryIdentityCache* identities = NULL);
+
+    int GetCount() const { return m_offsets.GetCount(); }
+
+    LPCTSTR GetDirectory(int index) const
+    {
+        return m_text.GetData() + m_offsets[index];
+    }
+
+    //
+    // The entries from this index onwards come from PATH and the ones
+    // before it are the fixed directories that always come first.
+    //
+
+    int GetFirstPathIndex() const { return m_firstPathIndex; }
+
+    static bool ParsePolicy(LPCTSTR text, DWORD& policy);
+
+private:
+
+    void Add(LPCTSTR directory, int length);
+    void AddList(LPCTSTR list, LPCTSTR currentDirectory);
+    void AddPath(LPCTSTR path, LPCTSTR currentDirectory);
+
+    static bool IsSamePath(LPCTSTR a, LPCTSTR b);
+
+    Array<TCHAR> m_text;
+    Array<int> m_offsets;
+    int m_firstPathIndex;
+
+    SearchOrder(const SearchOrder&);
+    SearchOrder& operator=(const SearchOrder&);
+};
@@ -0,0 +1,467 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "ShadowReport.h"
+
+#pragma comment(lib, "version")
+
+// --------------------------------------------------------------------------
+//  ShadowReport
+// --------------------------------------------------------------------------
+
+DWORD ShadowReport::Build(const SearchEnvironment& environment,
+    const DirectoryIndex* const* indexes)
+{
+    _ASSERT(indexes);
+
+    const SearchOrder& searchOrder = environment.GetSearchOrder();
+    const int directoryCount = searchOrder.GetCount();
+
+    for (int i = 0; i < directoryCount; i++)
+    {
+        if (!indexes[i]->IsScanned())
+            return ERROR_NOT_READY;
+    }
+
+    m_searchOrder = NULL;
+    m_names.Clear();
+    m_commands.Clear();
+    m_copies.Clear();
+    m_shadows.Clear();
+
+    try
+    {
+        //
+        // Join the names of all the directories on their hashes, which
+        // the indexes already have, noting every directory a name is in.
+        // Going through the directories in order leaves the directories
+        // of each name in order too.
+        //
+
+        Array<int> occurrenceNames;
+        Array<int> occurrenceDirectories;
+
+        for (int i = 0; i < directoryCount; i++)
+        {
+            const DirectoryIndex& index = *indexes[i];
+
+            for (int j = 0; j < index.GetNameCount(); j++)
+            {
+                TCHAR name[MAX_PATH];
+                index.GetName(j, name);
+
+                if (IsShortAlias(name))
+                    continue;
+
+                occurrenceNames.Add(m_names.Add(name, index.GetNameHash(j)));
+                occurrenceDirectories.Add(i);
+            }
+        }
+
+        const int nameCount = m_names.GetCount();
+        const int occurrenceCount = occurrenceNames.GetCount();
+
+        //
+        // Then gather the directories of each name together, keeping
+        // their order, by counting them first.
+        //
+
+        Array<int> nameStarts;
+        nameStarts.SetCount(nameCount + 1);
+        ZeroMemory(nameStarts.GetData(), nameStarts.GetCount() * sizeof(int));
+
+        for (int i = 0; i < occurrenceCount; i++)
+            nameStarts[occurrenceNames[i] + 1]++;
+
+        for (int i = 0; i < nameCount; i++)
+            nameStarts[i + 1] += nameStarts[i];
+
+        Array<int> nameDirectories;
+        nameDirectories.SetCount(occurrenceCount);
+
+        Array<int> nameEnds;
+        nameEnds.Append(nameStarts.GetData(), nameCount);
+
+        for (int i = 0; i < occurrenceCount; i++)
+            nameDirectories[nameEnds[occurrenceNames[i]]++] = occurrenceDirectories[i];
+
+        //
+        // Every name answers to the command that is the name itself,
+        // unless it has a PATHEXT extension, in which case it answers to
+        // the name without it. The resolver tries the name as given in
+        // every directory before it tries any extension, and then the
+        // extensions in the order PATHEXT gives them, so that is the
+        // order in which the variants of a command rank.
+        //
+
+        Array<Variant> variants;
+        Array<int> commandCopyCounts;
+
+        variants.Reserve(nameCount);
+
+        for (int i = 0; i < nameCount; i++)
+        {
+            LPCTSTR name = m_names.GetName(i);
+            LPCTSTR extension = PathFindExtension(name);
+
+            TCHAR stem[MAX_PATH];
+            LPCTSTR command = name;
+            int rank = 0;
+
+            if (*extension && extension != name)
+            {
+                int extensionIndex = 0;
+
+                while (extensionIndex < environment.GetExtensionCount() &&
+                    0 != lstrcmpi(extension, environment.GetExtension(extensionIndex)))
+                {
+                    extensionIndex++;
+                }
+
+                //
+                // A stem with an extension of its own would be taken as
+                // it is and never have anything appended to it.
+                //
+
+                if (extensionIndex < environment.GetExtensionCount())
+                {
+                    lstrcpyn(stem, name, static_cast<int>(extension - name) + 1);
+
+                    if (!*PathFindExtension(stem))
+                    {
+                        command = stem;
+                        rank = extensionIndex + 1;
+                    }
+                }
+            }
+
+            const int commandIndex = m_commands.Add(command, DirectoryIndex::Hash(command));
+
+            if (commandIndex == commandCopyCounts.GetCount())
+                commandCopyCounts.Add(0);
+
+            commandCopyCounts[commandIndex] += nameStarts[i + 1] - nameStarts[i];
+
+            Variant variant = { commandIndex, rank, i };
+            variants.Add(variant);
+        }
+
+        qsort(variants.GetData(), variants.GetCount(), sizeof(Variant), CompareVariants);
+
+        //
+        // Only commands that more than one file answers to are of any
+        // interest. Their copies go down variant by variant and, within
+        // each, directory by directory.
+        //
+
+        for (int i = 0; i < variants.GetCount(); )
+        {
+            const int commandIndex = variants[i].commandIndex;
+            const int copyCount = commandCopyCounts[commandIndex];
+
+            int end = i;
+
+            while (end < variants.GetCount() && commandIndex == variants[end].commandIndex)
+                end++;
+
+            if (copyCount > 1)
+            {
+                Shadow shadow = { m_commands.GetName(commandIndex), m_copies.GetCount(), copyCount };
+
+                for (int j = i; j < end; j++)
+                {
+                    const int nameIndex = variants[j].nameIndex;
+
+                    for (int k = nameStarts[nameIndex]; k < nameStarts[nameIndex + 1]; k++)
+                    {
+                        Copy copy = { nameIndex, nameDirectories[k] };
+                        m_copies.Add(copy);
+                    }
+                }
+
+                m_shadows.Add(shadow);
+            }
+
+            i = end;
+        }
+
+        qsort(m_shadows.GetData(), m_shadows.GetCount(), sizeof(Shadow), CompareShadows);
+
+        m_searchOrder = &searchOrder;
+    }
+    catch (SystemException& e)
+    {
+        m_shadows.Clear();
+        return e.GetCode();
+    }
+
+    return NO_ERROR;
+}
+
+LPCTSTR ShadowReport::GetPath(int index, int copyIndex, LPTSTR buffer) const
+{
+    _ASSERT(buffer);
+    _ASSERT(m_searchOrder);
+    _ASSERT(copyIndex >= 0 && copyIndex < GetCopyCount(index));
+
+    const Copy& copy = m_copies[m_shadows[index].firstCopy + copyIndex];
+
+    if (!PathCombine(buffer, m_searchOrder->GetDirectory(copy.directoryIndex),
+            m_names.GetName(copy.nameIndex)))
+    {
+        *buffer = 0;
+    }
+
+    return buffer;
+}
+
+DWORD ShadowReport::Fingerprint(LPCTSTR path, bool hashContent, FileFingerprint& fingerprint)
+{
+    _ASSERT(path);
+
+    ZeroMemory(&fingerprint, sizeof(fingerprint));
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data))
+        return GetLastError();
+
+    ULARGE_INTEGER size;
+    size.LowPart = data.nFileSizeLow;
+    size.HighPart = data.nFileSizeHigh;
+    fingerprint.size = size.QuadPart;
+
+    //
+    // Most files have no version resource, which is not a failure but
+    // simply leaves the version out of the comparison.
+    //
+
+    TCHAR versionPath[MAX_PATH];
+    lstrcpyn(versionPath, path, DIM(versionPath));
+
+    DWORD reservedHandle;
+    const DWORD versionInfoSize = GetFileVersionInfoSize(versionPath, &reservedHandle);
+
+    if (versionInfoSize)
+    {
+        Array<BYTE> versionInfo;
+        versionInfo.SetCount(versionInfoSize);
+
+        VS_FIXEDFILEINFO* fixedFileInfo = NULL;
+        UINT fixedFileInfoSize = 0;
+
+        if (GetFileVersionInfo(versionPath, reservedHandle, versionInfoSize, versionInfo.GetData()) &&
+            VerQueryValue(versionInfo.GetData(), _T("\\"),
+                reinterpret_cast<LPVOID*>(&fixedFileInfo), &fixedFileInfoSize) &&
+            fixedFileInfoSize >= sizeof(VS_FIXEDFILEINFO))
+        {
+            fingerprint.versionMS = fixedFileInfo->dwFileVersionMS;
+            fingerprint.versionLS = fixedFileInfo->dwFileVersionLS;
+            fingerprint.hasVersion = true;
+        }
+    }
+
+    if (!hashContent)
+        return NO_ERROR;
+
+    //
+    // The content is hashed with 64-bit FNV-1a, which is quick and good
+    // enough to tell whether two copies are the same.
+    //
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+        return GetLastError();
+
+    Array<BYTE> buffer;
+    buffer.SetCount(64 * 1024);
+
+    ULONGLONG hash = 14695981039346656037ULL;
+    DWORD bytesRead;
+    BOOL isRead;
+
+    while ((isRead = ReadFile(file, buffer.GetData(), buffer.GetCount(), &bytesRead, NULL)) && bytesRead)
+    {
+        for (DWORD i = 0; i < bytesRead; i++)
+        {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    const DWORD error = isRead ? NO_ERROR : GetLastError();
+    CloseHandle(file);
+
+    if (NO_ERROR != error)
+        return error;
+
+    fingerprint.hash = hash;
+    fingerprint.hasHash = true;
+
+    return NO_ERROR;
+}
+
+DWORD ShadowReport::Compare(const FileFingerprint& a, const FileFingerprint& b)
+{
+    DWORD differences = 0;
+
+    if (a.size != b.size)
+        differences |= FileSizeDiffers;
+
+    if (a.hasVersion != b.hasVersion ||
+        (a.hasVersion && (a.versionMS != b.versionMS || a.versionLS != b.versionLS)))
+    {
+        differences |= FileVersionDiffers;
+    }
+
+    if (a.hasHash && b.hasHash && (a.size != b.size || a.hash != b.hash))
+        differences |= FileContentDiffers;
+
+    return differences;
+}
+
+DWORD ShadowReport::CompareCopies(int threadCount, ShadowComparisonProc proc, LPVOID context) const
+{
+    _ASSERT(proc);
+
+    //
+    // Comparing means reading every copy, which is best spread over the
+    // threads while the commands already compared are passed on in order.
+    //
+
+    enum { SlotCount = 256 };
+
+    Array<ShadowComparison> slots;
+
+    try
+    {
+        slots.SetCount(SlotCount);
+    }
+    catch (SystemException& e)
+    {
+        return e.GetCode();
+    }
+
+    ComparisonContext comparisons = { this, slots.GetData(), 0, proc, context };
+
+    return ParallelPipeline(threadCount, SlotCount, ReadComparison,
+        CompareCopy, WriteComparison, &comparisons);
+}
+
+bool CALLBACK ShadowReport::ReadComparison(int slot, LPVOID context)
+{
+    ComparisonContext& comparisons = *static_cast<ComparisonContext*>(context);
+
+    if (comparisons.nextIndex == comparisons.report->GetCount())
+        return false;
+
+    comparisons.slots[slot].index = comparisons.nextIndex++;
+
+    return true;
+}
+
+void CALLBACK ShadowReport::CompareCopy(int slot, LPVOID context)
+{
+    ComparisonContext& comparisons = *static_cast<ComparisonContext*>(context);
+    ShadowComparison& comparison = comparisons.slots[slot];
+    const ShadowReport& report = *comparisons.report;
+
+    const int copyCount = min(report.GetCopyCount(comparison.index),
+        static_cast<int>(ShadowComparison::MaxCopyCount));
+
+    FileFingerprint winner;
+    TCHAR path[MAX_PATH];
+
+    const DWORD winnerError = Fingerprint(report.GetPath(comparison.index, 0, path), true, winner);
+
+    for (int i = 1; i < copyCount; i++)
+    {
+        FileFingerprint copy;
+
+        comparison.errors[i] = NO_ERROR != winnerError ? winnerError :
+            Fingerprint(report.GetPath(comparison.index, i, path), true, copy);
+
+        comparison.differences[i] = NO_ERROR == comparison.errors[i] ?
+            Compare(winner, copy) : 0;
+    }
+}
+
+void CALLBACK ShadowReport::WriteComparison(int slot, LPVOID context)
+{
+    ComparisonContext& comparisons = *static_cast<ComparisonContext*>(context);
+
+    comparisons.proc(comparisons.slots[slot], comparisons.context);
+}
+
+bool ShadowReport::IsShortAlias(LPCTSTR name)
+{
+    _ASSERT(name);
+
+    //
+    // Indexes hold the generated 8.3 alias of every long name alongside
+    // it, and two directories holding files with long names that are
+    // alike would otherwise seem to shadow each other through them. An
+    // alias has a base of at most eight characters ending in a tilde
+    // and digits.
+    //
+
+    LPCTSTR extension = PathFindExtension(name);
+    LPCTSTR tilde = StrChr(name, _T('~'));
+
+    if (!tilde || tilde > extension || extension - name > 8 || lstrlen(extension) > 4)
+        return false;
+
+    if (tilde + 1 == extension)
+        return false;
+
+    for (LPCTSTR ch = tilde + 1; ch < extension; ch++)
+    {
+        if (!_istdigit(*ch))
+            return false;
+    }
+
+    return true;
+}
+
+int __cdecl ShadowReport::CompareVariants(const void* a, const void* b)
+{
+    const Variant& variantA = *static_cast<const Variant*>(a);
+    const Variant& variantB = *static_cast<const Variant*>(b);
+
+    if (variantA.commandIndex != variantB.commandIndex)
+        return variantA.commandIndex - variantB.commandIndex;
+
+    return variantA.rank - variantB.rank;
+}
+
+int __cdecl ShadowReport::CompareShadows(const void* a, const void* b)
+{
+    return _tcscmp(static_cast<const Shadow*>(a)->command, static_cast<const Shadow*>(b)->command);
+}
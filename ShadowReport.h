@@ -0,0 +1,153 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  FileFingerprint
+// --------------------------------------------------------------------------
+//
+//  What tells two copies of a file apart without comparing them byte by
+//  byte: the size, the file version from the version resource, if there
+//  is one, and optionally a hash of the whole content.
+//
+
+enum FileDifference
+{
+    FileSizeDiffers = 1,
+    FileVersionDiffers = 2,
+    FileContentDiffers = 4
+};
+
+struct FileFingerprint
+{
+    ULONGLONG size;
+    DWORD versionMS;
+    DWORD versionLS;
+    bool hasVersion;
+    ULONGLONG hash;
+    bool hasHash;
+};
+
+// --------------------------------------------------------------------------
+//  ShadowComparison
+// --------------------------------------------------------------------------
+//
+//  How each copy of a command compares with the first, the one that wins:
+//  the differences found, or the error that kept it from being compared.
+//  Only the first MaxCopyCount copies of a command are compared, and the
+//  first copy has no entry of its own.
+//
+
+struct ShadowComparison
+{
+    enum { MaxCopyCount = 32 };
+
+    int index;
+    DWORD differences[MaxCopyCount];
+    DWORD errors[MaxCopyCount];
+};
+
+typedef void (CALLBACK * ShadowComparisonProc)(const ShadowComparison& comparison, LPVOID context);
+
+// --------------------------------------------------------------------------
+//  ShadowReport
+// --------------------------------------------------------------------------
+//
+//  Every command in a search environment that more than one file answers
+//  to, with all the files in the order the resolver would try them, so
+//  that the first is the one that wins and the rest are shadowed by it.
+//  A command is a file name as it is or, for a name with a PATHEXT
+//  extension, the name without it, in which case the variants with other
+//  PATHEXT extensions compete for it too.
+//
+//  It is built from the indexes of the directories in the search order,
+//  all of which must have been scanned, by joining all their names on
+//  their case-folded hashes in one pass. The report refers to the search
+//  order it was built from, which has to outlive it.
+//
+//  CompareCopies reads every copy of every command, spread over the given
+//  number of threads, and passes the comparisons to the procedure one at
+//  a time in the order of the report. The procedure may throw a
+//  SystemException, whose code is then returned.
+//
+
+class ShadowReport
+{
+public:
+
+    ShadowReport() : m_searchOrder(NULL) {}
+
+    DWORD Build(const SearchEnvironment& environment, const DirectoryIndex* const* indexes);
+
+    int GetCount() const { return m_shadows.GetCount(); }
+    LPCTSTR GetCommand(int index) const { return m_shadows[index].command; }
+    int GetCopyCount(int index) const { return m_shadows[index].copyCount; }
+    LPCTSTR GetPath(int index, int copyIndex, LPTSTR buffer) const;
+
+    DWORD CompareCopies(int threadCount, ShadowComparisonProc proc, LPVOID context) const;
+
+    static DWORD Fingerprint(LPCTSTR path, bool hashContent, FileFingerprint& fingerprint);
+    static DWORD Compare(const FileFingerprint& a, const FileFingerprint& b);
+
+private:
+
+    struct Copy
+    {
+        int nameIndex;
+        int directoryIndex;
+    };
+
+    struct Variant
+    {
+        int commandIndex;
+        int rank;
+        int nameIndex;
+    };
+
+    struct Shadow
+    {
+        LPCTSTR command;
+        int firstCopy;
+        int copyCount;
+    };
+
+    struct ComparisonContext
+    {
+        const ShadowReport* report;
+        ShadowComparison* slots;
+        int nextIndex;
+        ShadowComparisonProc proc;
+        LPVOID context;
+    };
+
+    static bool CALLBACK ReadComparison(int slot, LPVOID context);
+    static void CALLBACK CompareCopy(int slot, LPVOID context);
+    static void CALLBACK WriteComparison(int slot, LPVOID context);
+    static bool IsShortAlias(LPCTSTR name);
+    static int __cdecl CompareVariants(const void* a, const void* b);
+    static int __cdecl CompareShadows(const void* a, const void* b);
+
+    const SearchOrder* m_searchOrder;
+    NameTable m_names;
+    NameTable m_commands;
+    Array<Copy> m_copies;
+    Array<Shadow> m_shadows;
+
+    ShadowReport(const ShadowReport&);
+    ShadowReport& operator=(const ShadowReport&);
+};
@@ -0,0 +1,285 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "SharedIndexSegment.h"
+
+//
+// Rounds a size up to a multiple of eight so that every image in the
+// segment is suitably aligned.
+//
+
+static DWORD Align(DWORD size)
+{
+    return (size + 7) & ~7UL;
+}
+
+// --------------------------------------------------------------------------
+//  SharedIndexSegment
+// --------------------------------------------------------------------------
+
+SharedIndexSegment::SharedIndexSegment() :
+    m_lock(NULL),
+    m_header(NULL),
+    m_generation(0)
+{
+    m_name[0] = 0;
+}
+
+SharedIndexSegment::~SharedIndexSegment()
+{
+    for (int i = 0; i < m_views.GetCount(); i++)
+        UnmapViewOfFile(m_views[i]);
+
+    for (int i = 0; i < m_mappings.GetCount(); i++)
+        CloseHandle(m_mappings[i]);
+
+    if (m_lock)
+        CloseHandle(m_lock);
+}
+
+DWORD SharedIndexSegment::Open(LPCTSTR name)
+{
+    _ASSERT(name);
+    _ASSERT(!IsOpen());
+
+    //
+    // Leave room for the suffixes that tell the lock and the
+    // generations apart.
+    //
+
+    if (lstrlen(name) + 16 >= MAX_PATH)
+        return ERROR_FILENAME_EXCED_RANGE;
+
+    lstrcpy(m_name, name);
+
+    TCHAR lockName[MAX_PATH];
+    wsprintf(lockName, _T("%s.Lock"), m_name);
+
+    m_lock = CreateMutex(NULL, FALSE, lockName);
+
+    if (!m_lock)
+        return GetLastError();
+
+    DWORD error = Lock();
+
+    if (NO_ERROR != error)
+        return error;
+
+    error = OpenGeneration(0);
+    Unlock();
+
+    return error;
+}
+
+DWORD SharedIndexSegment::OpenGeneration(LONG generation)
+{
+    //
+    // Segments are created and set up with the lock held, so that nobody
+    // ever sees one half set up.
+    //
+
+    TCHAR mappingName[MAX_PATH];
+    wsprintf(mappingName, _T("%s.%ld"), m_name, generation);
+
+    m_mappings.Reserve(m_mappings.GetCount() + 1);
+    m_views.Reserve(m_views.GetCount() + 1);
+
+    HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+        PAGE_READWRITE, 0, Capacity, mappingName);
+
+    if (!mapping)
+        return GetLastError();
+
+    const bool isNew = ERROR_ALREADY_EXISTS != GetLastError();
+
+    BYTE* view = static_cast<BYTE*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+
+    if (!view)
+    {
+        DWORD error = GetLastError();
+        CloseHandle(mapping);
+        return error;
+    }
+
+    m_mappings.Add(mapping);
+    m_views.Add(view);
+
+    Header* header = reinterpret_cast<Header*>(view);
+
+    if (isNew)
+    {
+        header->signature = Signature;
+        header->version = Version;
+        header->characterSize = sizeof(TCHAR);
+        header->capacity = Capacity;
+        header->used = Align(sizeof(Header));
+    }
+    else if (Signature != header->signature || Version != header->version ||
+        sizeof(TCHAR) != header->characterSize || Capacity != header->capacity)
+    {
+        return ERROR_BAD_FORMAT;
+    }
+
+    m_header = header;
+    m_generation = generation;
+
+    return NO_ERROR;
+}
+
+bool SharedIndexSegment::Read(const BYTE*& image, DWORD& imageSize)
+{
+    _ASSERT(IsOpen());
+
+    //
+    // Move on to the latest generation first. This takes the lock, but
+    // only ever happens once for every time a segment fills up.
+    //
+
+    for (;;)
+    {
+        const LONG successor = InterlockedCompareExchange(&m_header->successor, 0, 0);
+
+        if (!successor)
+            break;
+
+        if (NO_ERROR != Lock())
+            return false;
+
+        DWORD error = OpenGeneration(successor);
+        Unlock();
+
+        if (NO_ERROR != error)
+            return false;
+    }
+
+    //
+    // Read where the latest image is until the sequence count says that
+    // nothing changed while doing so. The interlocked reads act as the
+    // barriers that keep the reads of the location between them.
+    //
+
+    DWORD offset;
+    DWORD size;
+
+    for (;;)
+    {
+        const LONG sequence = InterlockedCompareExchange(&m_header->sequence, 0, 0);
+
+        if (sequence & 1)
+        {
+            Sleep(0);
+            continue;
+        }
+
+        offset = m_header->imageOffset;
+        size = m_header->imageSize;
+
+        if (sequence == InterlockedCompareExchange(&m_header->sequence, 0, 0))
+            break;
+    }
+
+    if (0 == size || offset < Align(sizeof(Header)) || offset > Capacity ||
+        size > Capacity - offset || 0 != (offset & 7))
+    {
+        return false;
+    }
+
+    image = reinterpret_cast<const BYTE*>(m_header) + offset;
+    imageSize = size;
+
+    return true;
+}
+
+DWORD SharedIndexSegment::Lock()
+{
+    _ASSERT(m_lock);
+
+    switch (WaitForSingleObject(m_lock, INFINITE))
+    {
+        case WAIT_OBJECT_0:
+            return NO_ERROR;
+
+        case WAIT_ABANDONED:
+
+            //
+            // The last writer died while holding the lock, possibly half
+            // way through publishing. Whatever location it left behind
+            // is checked before use, so all that needs putting right is
+            // a sequence count that would otherwise stay odd for good.
+            //
+
+            if (m_header && (m_header->sequence & 1))
+                InterlockedIncrement(&m_header->sequence);
+
+            return NO_ERROR;
+
+        default:
+            return GetLastError();
+    }
+}
+
+void SharedIndexSegment::Unlock()
+{
+    _ASSERT(m_lock);
+
+    ReleaseMutex(m_lock);
+}
+
+DWORD SharedIndexSegment::Publish(const void* image, DWORD imageSize)
+{
+    _ASSERT(image);
+    _ASSERT(IsOpen());
+
+    //
+    // The caller holds the lock and has just read, so this is the latest
+    // generation. If the image does not fit in what is left of it, start
+    // another.
+    //
+
+    if (imageSize > Capacity - Align(sizeof(Header)))
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    Array<Header*> retired;
+
+    while (m_header->used > Capacity || imageSize > Capacity - m_header->used)
+    {
+        retired.Add(m_header);
+
+        DWORD error = OpenGeneration(m_generation + 1);
+
+        if (NO_ERROR != error)
+            return error;
+    }
+
+    const DWORD offset = m_header->used;
+
+    CopyMemory(reinterpret_cast<BYTE*>(m_header) + offset, image, imageSize);
+    m_header->used = offset + Align(imageSize);
+
+    InterlockedIncrement(&m_header->sequence);
+    m_header->imageOffset = offset;
+    m_header->imageSize = imageSize;
+    InterlockedIncrement(&m_header->sequence);
+
+    for (int i = 0; i < retired.GetCount(); i++)
+        InterlockedExchange(&retired[i]->successor, m_generation);
+
+    return NO_ERROR;
+}
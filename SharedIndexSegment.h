@@ -0,0 +1,91 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  SharedIndexSegment
+// --------------------------------------------------------------------------
+//
+//  A block of memory shared by every process in the session that opens
+//  it by the same name, into which directory index tables are published
+//  for the others to attach to.
+//
+//  Published images are appended and never changed, so once a reader
+//  has found the latest one it can use it for as long as it likes. The
+//  only thing that changes is where the latest image is, and readers get
+//  at that without locking through a sequence count that the writer makes
+//  odd while it is updating it: a reader that sees the count odd, or
+//  changed by the time it is done, simply reads again.
+//
+//  Only one process at a time may publish, which it ensures by holding
+//  the lock. When a segment fills up, the writer starts a new generation
+//  of it and marks the old one as superseded. Processes still using
+//  images in the old generation keep it alive until they are done, while
+//  every reader that comes along later is led on to the new one.
+//
+
+class SharedIndexSegment
+{
+public:
+
+    enum
+    {
+        Signature = 0x53495046, // FPIS
+        Version = 1,
+        Capacity = 16 * 1024 * 1024
+    };
+
+    SharedIndexSegment();
+    ~SharedIndexSegment();
+
+    DWORD Open(LPCTSTR name);
+    bool IsOpen() const { return NULL != m_header; }
+
+    bool Read(const BYTE*& image, DWORD& imageSize);
+
+    DWORD Lock();
+    void Unlock();
+    DWORD Publish(const void* image, DWORD imageSize);
+
+private:
+
+    struct Header
+    {
+        DWORD signature;
+        WORD version;
+        WORD characterSize;
+        DWORD capacity;
+        LONG volatile sequence;
+        DWORD imageOffset;
+        DWORD imageSize;
+        DWORD used;
+        LONG volatile successor;
+    };
+
+    DWORD OpenGeneration(LONG generation);
+
+    TCHAR m_name[MAX_PATH];
+    HANDLE m_lock;
+    Array<HANDLE> m_mappings;
+    Array<BYTE*> m_views;
+    Header* m_header;
+    LONG m_generation;
+
+    SharedIndexSegment(const SharedIndexSegment&);
+    SharedIndexSegment& operator=(const SharedIndexSegment&);
+};
@@ -0,0 +1,426 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "Suggestions.h"
+
+static int __cdecl CompareSuggestions(const void* a, const void* b);
+
+// --------------------------------------------------------------------------
+//  SuggestionIndex
+// --------------------------------------------------------------------------
+
+struct SuggestionListing
+{
+    SuggestionIndex* index;
+    int directoryIndex;
+};
+
+SuggestionIndex::SuggestionIndex()
+{
+    ZeroMemory(&m_image, sizeof(m_image));
+}
+
+void SuggestionIndex::AddDirectory(LPCTSTR directory, int directoryIndex,
+    const FileSystem* fileSystem)
+{
+    _ASSERT(directory);
+
+    if (!fileSystem)
+        fileSystem = &FileSystem::GetWin32();
+
+    //
+    // Directories that cannot be listed (dead network shares, entries
+    // in PATH that no longer exist) are simply skipped. They cannot
+    // contribute any suggestions anyhow.
+    //
+
+    SuggestionListing listing = { this, directoryIndex };
+
+    fileSystem->List(directory, AddListedName, &listing);
+}
+
+void CALLBACK SuggestionIndex::AddListedName(const WIN32_FIND_DATA& findData, LPVOID context)
+{
+    SuggestionListing& listing = *static_cast<SuggestionListing*>(context);
+
+    if (0 == (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        listing.index->AddName(findData.cFileName, listing.directoryIndex);
+}
+
+void SuggestionIndex::AddName(LPCTSTR name, int directoryIndex)
+{
+    _ASSERT(name);
+    _ASSERT(!IsBuilt());
+
+    int length = lstrlen(name);
+
+    if (length >= MAX_PATH)
+        return;
+
+    int offset = m_names.GetCount();
+
+    m_nameOffsets.Add(offset);
+    m_directoryIndexes.Add(directoryIndex);
+
+    m_names.Append(name, length + 1);
+    m_foldedNames.Append(name, length + 1);
+    CharUpperBuff(m_foldedNames.GetData() + offset, length);
+}
+
+void SuggestionIndex::Build()
+{
+    _ASSERT(!IsBuilt());
+
+    //
+    // Lay out the inverted lists contiguously, one after another in
+    // bucket order. The first pass counts the postings per bucket so
+    // that the second can drop each name directly into place.
+    //
+
+    m_bucketStarts.SetCount(BucketCount + 1);
+    ZeroMemory(m_bucketStarts.GetData(), m_bucketStarts.GetCount() * sizeof(DWORD));
+
+    const int nameCount = m_nameOffsets.GetCount();
+    DWORD buckets[MAX_PATH + 1];
+
+    for (int i = 0; i < nameCount; i++)
+    {
+        LPCTSTR foldedName = m_foldedNames.GetData() + m_nameOffsets[i];
+        int bucketCount = GetTrigramBuckets(foldedName, lstrlen(foldedName), buckets);
+
+        for (int j = 0; j < bucketCount; j++)
+            m_bucketStarts[buckets[j] + 1]++;
+    }
+
+    for (int bucket = 0; bucket < BucketCount; bucket++)
+        m_bucketStarts[bucket + 1] += m_bucketStarts[bucket];
+
+    m_postings.SetCount(m_bucketStarts[BucketCount]);
+
+    Array<DWORD> cursors;
+    cursors.Append(m_bucketStarts.GetData(), BucketCount);
+
+    for (int i = 0; i < nameCount; i++)
+    {
+        LPCTSTR foldedName = m_foldedNames.GetData() + m_nameOffsets[i];
+        int bucketCount = GetTrigramBuckets(foldedName, lstrlen(foldedName), buckets);
+
+        for (int j = 0; j < bucketCount; j++)
+            m_postings[cursors[buckets[j]]++] = i;
+    }
+
+    m_image.names = m_names.GetData();
+    m_image.foldedNames = m_foldedNames.GetData();
+    m_image.nameOffsets = m_nameOffsets.GetData();
+    m_image.directoryIndexes = m_directoryIndexes.GetData();
+    m_image.nameCount = nameCount;
+    m_image.postings = m_postings.GetData();
+    m_image.postingCount = m_postings.GetCount();
+    m_image.bucketStarts = m_bucketStarts.GetData();
+}
+
+void SuggestionIndex::Attach(const SuggestionImage& image)
+{
+    _ASSERT(!IsBuilt());
+    _ASSERT(image.bucketStarts);
+
+    m_image = image;
+}
+
+int SuggestionIndex::Suggest(LPCTSTR query, LPCTSTR pathExtensions,
+    Suggestion* suggestions, int maxSuggestionCount) const
+{
+    _ASSERT(query);
+    _ASSERT(suggestions || !maxSuggestionCount);
+
+    if (maxSuggestionCount <= 0 || !IsBuilt())
+        return 0;
+
+    TCHAR foldedQuery[MAX_PATH];
+    lstrcpyn(foldedQuery, query, DIM(foldedQuery));
+    const int queryLength = lstrlen(foldedQuery);
+    CharUpperBuff(foldedQuery, queryLength);
+
+    //
+    // Allow roughly one typo for every five characters, but never more
+    // than three. Beyond that the suggestions stop looking related.
+    //
+
+    int maxDistance = 1 + queryLength / 5;
+
+    if (maxDistance > 3)
+        maxDistance = 3;
+
+    //
+    // Each edit can destroy at most three of the query's trigrams, so a
+    // name within reach must share at least this many with the query.
+    //
+
+    DWORD queryBuckets[MAX_PATH + 1];
+    const int queryBucketCount = GetTrigramBuckets(foldedQuery, queryLength, queryBuckets);
+
+    int minSharedCount = queryBucketCount - 3 * maxDistance;
+
+    if (minSharedCount < 1)
+        minSharedCount = 1;
+
+    //
+    // Count the trigrams that each name shares with the query, keeping
+    // track of which counters were touched so that only those need to
+    // be visited afterwards.
+    //
+
+    const int nameCount = GetNameCount();
+
+    Array<WORD> sharedCounts;
+    sharedCounts.SetCount(nameCount);
+    ZeroMemory(sharedCounts.GetData(), nameCount * sizeof(WORD));
+
+    Array<int> touched;
+
+    for (int i = 0; i < queryBucketCount; i++)
+    {
+        const DWORD bucket = queryBuckets[i];
+
+        for (DWORD j = m_image.bucketStarts[bucket]; j < m_image.bucketStarts[bucket + 1]; j++)
+        {
+            const int nameIndex = m_image.postings[j];
+
+            if (0 == sharedCounts[nameIndex]++)
+                touched.Add(nameIndex);
+        }
+    }
+
+    //
+    // Score the surviving candidates. When the query has no extension,
+    // a name is also compared without its extension if that is one of
+    // the PATHEXT extensions, since SearchPath would have appended it.
+    //
+
+    const bool queryHasExtension = 0 != *PathFindExtension(query);
+
+    Array<Suggestion> candidates;
+
+    for (int i = 0; i < touched.GetCount(); i++)
+    {
+        const int nameIndex = touched[i];
+
+        if (sharedCounts[nameIndex] < minSharedCount)
+            continue;
+
+        LPCTSTR foldedName = GetFoldedName(nameIndex);
+        const int nameLength = lstrlen(foldedName);
+
+        if (nameLength >= MAX_PATH)
+            continue;
+
+        int distance = GetEditDistance(foldedQuery, queryLength,
+            foldedName, nameLength, maxDistance);
+
+        if (!queryHasExtension)
+        {
+            LPCTSTR name = GetName(nameIndex);
+            LPCTSTR extension = PathFindExtension(name);
+
+            if (*extension && IsListedExtension(extension, pathExtensions))
+            {
+                int stemDistance = GetEditDistance(foldedQuery, queryLength,
+                    foldedName, static_cast<int>(extension - name), maxDistance);
+
+                if (stemDistance < distance)
+                    distance = stemDistance;
+            }
+        }
+
+        if (distance <= maxDistance)
+        {
+            Suggestion candidate = { nameIndex, GetDirectoryIndex(nameIndex), distance };
+            candidates.Add(candidate);
+        }
+    }
+
+    //
+    // Rank by distance first and then by precedence in the search order.
+    // The same name may live in several directories, but only the one
+    // that SearchPath would find first is worth suggesting.
+    //
+
+    qsort(candidates.GetData(), candidates.GetCount(),
+        sizeof(Suggestion), CompareSuggestions);
+
+    int suggestionCount = 0;
+
+    for (int i = 0; i < candidates.GetCount() && suggestionCount < maxSuggestionCount; i++)
+    {
+        LPCTSTR foldedName = GetFoldedName(candidates[i].nameIndex);
+        bool isDuplicate = false;
+
+        for (int j = 0; j < suggestionCount && !isDuplicate; j++)
+            isDuplicate = 0 == lstrcmp(foldedName, GetFoldedName(suggestions[j].nameIndex));
+
+        if (!isDuplicate)
+            suggestions[suggestionCount++] = candidates[i];
+    }
+
+    return suggestionCount;
+}
+
+int SuggestionIndex::GetTrigramBuckets(LPCTSTR foldedText, int length, DWORD* buckets)
+{
+    _ASSERT(foldedText);
+    _ASSERT(buckets);
+    _ASSERT(length < MAX_PATH);
+
+    //
+    // The text is padded with two markers in front and one behind so
+    // that the leading and trailing characters weigh in as much as the
+    // ones in the middle. Each trigram is hashed into one of the buckets
+    // and duplicates are dropped so that a name appears at most once in
+    // any inverted list.
+    //
+
+    const TCHAR padding = 1;
+    int bucketCount = 0;
+
+    for (int i = -2; i < length - 1; i++)
+    {
+        const DWORD a = i < 0 ? padding : foldedText[i];
+        const DWORD b = i + 1 < 0 ? padding : foldedText[i + 1];
+        const DWORD c = i + 2 < length ? foldedText[i + 2] : padding;
+
+        DWORD hash = (a * 0x9E3779B1) ^ (b * 0x85EBCA77) ^ (c * 0xC2B2AE3D);
+        const DWORD bucket = (hash ^ (hash >> 16)) & (BucketCount - 1);
+
+        bool isDuplicate = false;
+
+        for (int j = 0; j < bucketCount && !isDuplicate; j++)
+            isDuplicate = buckets[j] == bucket;
+
+        if (!isDuplicate)
+            buckets[bucketCount++] = bucket;
+    }
+
+    return bucketCount;
+}
+
+int SuggestionIndex::GetEditDistance(LPCTSTR a, int aLength,
+    LPCTSTR b, int bLength, int limit)
+{
+    _ASSERT(a);
+    _ASSERT(b);
+    _ASSERT(aLength < MAX_PATH && bLength < MAX_PATH);
+
+    const int difference = aLength > bLength ? aLength - bLength : bLength - aLength;
+
+    if (difference > limit)
+        return limit + 1;
+
+    //
+    // Classic two-row Levenshtein, abandoned as soon as every cell in a
+    // row is beyond the limit since the distance can only grow from there.
+    //
+
+    int rows[2][MAX_PATH + 1];
+    int* previous = rows[0];
+    int* current = rows[1];
+
+    for (int j = 0; j <= bLength; j++)
+        previous[j] = j;
+
+    for (int i = 1; i <= aLength; i++)
+    {
+        current[0] = i;
+        int rowMinimum = i;
+
+        for (int j = 1; j <= bLength; j++)
+        {
+            int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+            int distance = previous[j - 1] + cost;
+
+            if (previous[j] + 1 < distance)
+                distance = previous[j] + 1;
+
+            if (current[j - 1] + 1 < distance)
+                distance = current[j - 1] + 1;
+
+            current[j] = distance;
+
+            if (distance < rowMinimum)
+                rowMinimum = distance;
+        }
+
+        if (rowMinimum > limit)
+            return limit + 1;
+
+        int* swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    return previous[bLength] > limit ? limit + 1 : previous[bLength];
+}
+
+bool SuggestionIndex::IsListedExtension(LPCTSTR extension, LPCTSTR pathExtensions)
+{
+    _ASSERT(extension);
+
+    if (!pathExtensions)
+        return false;
+
+    const int extensionLength = lstrlen(extension);
+    LPCTSTR entry = pathExtensions;
+
+    while (*entry)
+    {
+        LPCTSTR end = StrChr(entry, _T(';'));
+        int length = end ? static_cast<int>(end - entry) : lstrlen(entry);
+
+        if (CSTR_EQUAL == CompareString(LOCALE_INVARIANT, NORM_IGNORECASE,
+                extension, extensionLength, entry, length))
+        {
+            return true;
+        }
+
+        if (!end)
+            break;
+
+        entry = end + 1;
+    }
+
+    return false;
+}
+
+// --------------------------------------------------------------------------
+//  CompareSuggestions
+// --------------------------------------------------------------------------
+
+int __cdecl CompareSuggestions(const void* a, const void* b)
+{
+    const Suggestion* x = static_cast<const Suggestion*>(a);
+    const Suggestion* y = static_cast<const Suggestion*>(b);
+
+    if (x->distance != y->distance)
+        return x->distance - y->distance;
+
+    if (x->directoryIndex != y->directoryIndex)
+        return x->directoryIndex - y->directoryIndex;
+
+    return x->nameIndex - y->nameIndex;
+}
@@ -0,0 +1,123 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --------------------------------------------------------------------------
+//  Suggestion
+// --------------------------------------------------------------------------
+
+struct Suggestion
+{
+    int nameIndex;
+    int directoryIndex;
+    int distance;
+};
+
+// --------------------------------------------------------------------------
+//  SuggestionImage
+// --------------------------------------------------------------------------
+//
+//  The parts a built index is made of, laid out flat so that they can be
+//  saved along with some other image and used from it as they are. For
+//  every name there is the offset of its text, both as it is and folded,
+//  and the directory it is in. The postings of every bucket follow those
+//  of the one before it, starting where bucketStarts says, so that there
+//  are BucketCount + 1 of those.
+//
+
+struct SuggestionImage
+{
+    const TCHAR* names;
+    const TCHAR* foldedNames;
+    const DWORD* nameOffsets;
+    const DWORD* directoryIndexes;
+    DWORD nameCount;
+    const DWORD* bucketStarts;
+    const DWORD* postings;
+    DWORD postingCount;
+};
+
+// --------------------------------------------------------------------------
+//  SuggestionIndex
+// --------------------------------------------------------------------------
+//
+//  Answers "did you mean" queries over the names found in the search
+//  order directories. Every name is broken into case-folded trigrams and
+//  an inverted list from trigram to names is built once. A query then
+//  only computes the edit distance against names that share enough
+//  trigrams with it to possibly be within reach, instead of against
+//  every name on the search path. Directories are listed through the
+//  file system given, or that of Windows.
+//
+//  Rather than being built, an index can be attached to the image of one
+//  built before, which has to stay put for as long as the index lives.
+//
+
+class SuggestionIndex
+{
+public:
+
+    enum { BucketCount = 0x10000 };
+
+    SuggestionIndex();
+
+    void AddDirectory(LPCTSTR directory, int directoryIndex, const FileSystem* fileSystem = NULL);
+    void AddName(LPCTSTR name, int directoryIndex);
+    void Build();
+    void Attach(const SuggestionImage& image);
+
+    bool IsBuilt() const { return NULL != m_image.bucketStarts; }
+    const SuggestionImage& GetImage() const { return m_image; }
+
+    int Suggest(LPCTSTR query, LPCTSTR pathExtensions,
+        Suggestion* suggestions, int maxSuggestionCount) const;
+
+    int GetNameCount() const { return m_image.nameCount; }
+
+    LPCTSTR GetName(int nameIndex) const
+    {
+        return m_image.names + m_image.nameOffsets[nameIndex];
+    }
+
+    int GetDirectoryIndex(int nameIndex) const
+    {
+        return m_image.directoryIndexes[nameIndex];
+    }
+
+private:
+
+    LPCTSTR GetFoldedName(int nameIndex) const
+    {
+        return m_image.foldedNames + m_image.nameOffsets[nameIndex];
+    }
+
+    static void CALLBACK AddListedName(const WIN32_FIND_DATA& findData, LPVOID context);
+    static int GetTrigramBuckets(LPCTSTR foldedText, int length, DWORD* buckets);
+    static int GetEditDistance(LPCTSTR a, int aLength, LPCTSTR b, int bLength, int limit);
+    static bool IsListedExtension(LPCTSTR extension, LPCTSTR pathExtensions);
+
+    Array<TCHAR> m_names;
+    Array<TCHAR> m_foldedNames;
+    Array<DWORD> m_nameOffsets;
+    Array<DWORD> m_directoryIndexes;
+    Array<DWORD> m_bucketStarts;
+    Array<DWORD> m_postings;
+    SuggestionImage m_image;
+
+    SuggestionIndex(const SuggestionIndex&);
+    SuggestionIndex& operator=(const SuggestionIndex&);
+};
@@ -0,0 +1,533 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stdafx.h"
+#include "Exceptions.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "TreeSearch.h"
+
+//
+// Additions to FindFirstFileEx as of Windows 7, which the headers for the
+// versions of Windows this builds for do not define.
+//
+
+static const int FindExInfoBasicLevel = 1;
+static const DWORD FindFirstExLargeFetch = 2;
+
+// --------------------------------------------------------------------------
+//  TreeSearch
+// --------------------------------------------------------------------------
+
+TreeSearch::TreeSearch(const SearchEnvironment& environment) :
+    m_environment(environment),
+    m_nameCount(0),
+    m_foundCount(0),
+    m_pendingCount(0),
+    m_idleCount(0),
+    m_workEvent(NULL),
+    m_doneEvent(NULL),
+    m_isStopped(FALSE),
+    m_isLargeFetchSupported(TRUE),
+    m_isFirstMatchOnly(false),
+    m_found(NULL),
+    m_context(NULL)
+{
+    InitializeCriticalSection(&m_reportLock);
+}
+
+TreeSearch::~TreeSearch()
+{
+    Clear();
+    DeleteCriticalSection(&m_reportLock);
+}
+
+void TreeSearch::AddName(LPCTSTR fileName)
+{
+    _ASSERT(fileName);
+
+    m_isFound.Add(false);
+
+    TCHAR name[MAX_PATH];
+    lstrcpyn(name, fileName, DIM(name));
+    CharUpperBuff(name, lstrlen(name));
+
+    //
+    // As with resolving, extensions are only appended to a name that
+    // does not already have one.
+    //
+
+    const int nameLength = lstrlen(name);
+    const int extensionCount = *PathFindExtension(name) ? 0 : m_environment.GetExtensionCount();
+
+    for (int extensionIndex = -1; extensionIndex < extensionCount; extensionIndex++)
+    {
+        if (extensionIndex >= 0)
+        {
+            LPCTSTR extension = m_environment.GetExtension(extensionIndex);
+
+            if (nameLength + lstrlen(extension) >= MAX_PATH)
+                continue;
+
+            lstrcpy(name + nameLength, extension);
+            CharUpperBuff(name + nameLength, lstrlen(extension));
+        }
+
+        const int fileNameIndex = m_fileNames.Add(name, DirectoryIndex::Hash(name));
+
+        if (fileNameIndex == m_firstTargets.GetCount())
+            m_firstTargets.Add(-1);
+
+        Target target = { m_nameCount, extensionIndex, m_firstTargets[fileNameIndex] };
+        m_firstTargets[fileNameIndex] = m_targets.GetCount();
+        m_targets.Add(target);
+    }
+
+    m_nameCount++;
+}
+
+DWORD TreeSearch::Search(const LPCTSTR* roots, int rootCount, bool isFirstMatchOnly,
+    int threadCount, TreeSearchProc found, LPVOID context)
+{
+    _ASSERT(roots || !rootCount);
+    _ASSERT(found);
+
+    for (int i = 0; i < m_nameCount; i++)
+        m_isFound[i] = false;
+
+    m_foundCount = 0;
+    m_pendingCount = 0;
+    m_idleCount = 0;
+    m_isStopped = FALSE;
+    m_isFirstMatchOnly = isFirstMatchOnly;
+    m_found = found;
+    m_context = context;
+
+    if (!m_nameCount || !rootCount)
+        return NO_ERROR;
+
+    const int walkerCount = max(1, min(threadCount, MAXIMUM_WAIT_OBJECTS));
+    DWORD error = NO_ERROR;
+
+    try
+    {
+        //
+        // Idle walkers are woken when a directory is added for them to
+        // take and, for good, once there is nothing left or the search
+        // is stopped.
+        //
+
+        m_workEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        if (!m_workEvent)
+            throw SystemException(GetLastError());
+
+        m_doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        if (!m_doneEvent)
+            throw SystemException(GetLastError());
+
+        m_walkers.Reserve(walkerCount);
+
+        for (int i = 0; i < walkerCount; i++)
+        {
+            Walker* walker = new Walker;
+
+            if (!walker)
+                throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+            InitializeCriticalSection(&walker->lock);
+            walker->head = 0;
+            m_walkers.Add(walker);
+        }
+
+        //
+        // Deal the roots out between the walkers to start them off.
+        //
+
+        for (int i = 0; i < rootCount; i++)
+            Push(i % walkerCount, roots[i], NULL);
+
+        error = ParallelFor(walkerCount, walkerCount, WalkProc, this);
+    }
+    catch (SystemException& e)
+    {
+        error = e.GetCode();
+    }
+
+    Clear();
+
+    return error;
+}
+
+void CALLBACK TreeSearch::WalkProc(int index, LPVOID context)
+{
+    TreeSearch* search = static_cast<TreeSearch*>(context);
+    search->Walk(index);
+}
+
+void TreeSearch::Walk(int walkerIndex)
+{
+    //
+    // Keep going until the search is stopped or there is no directory
+    // left anywhere, either waiting in a queue or being read by another
+    // walker, which might yet add more.
+    //
+
+    while (!m_isStopped)
+    {
+        LPTSTR directory = Pop(walkerIndex);
+
+        if (!directory)
+            directory = Steal(walkerIndex);
+
+        if (!directory)
+        {
+            if (0 == m_pendingCount)
+                break;
+
+            directory = Park(walkerIndex);
+
+            if (!directory)
+                continue;
+        }
+
+        try
+        {
+            ReadDirectory(walkerIndex, directory);
+        }
+        catch (...)
+        {
+            //
+            // The other walkers would wait forever for this directory to
+            // be finished, so take them down too.
+            //
+
+            delete [] directory;
+            Stop();
+            throw;
+        }
+
+        delete [] directory;
+
+        if (0 == InterlockedDecrement(&m_pendingCount))
+            SetEvent(m_doneEvent);
+    }
+}
+
+LPTSTR TreeSearch::Park(int walkerIndex)
+{
+    //
+    // Only a walker adds to its own queue, so with that one empty the
+    // work can only come from the others. The event is reset before
+    // looking through their queues once more so that a directory added
+    // in between is either seen here or sets the event again.
+    //
+
+    InterlockedIncrement(&m_idleCount);
+    ResetEvent(m_workEvent);
+
+    LPTSTR directory = Steal(walkerIndex);
+
+    if (!directory && 0 != m_pendingCount && !m_isStopped)
+    {
+        HANDLE events[] = { m_workEvent, m_doneEvent };
+        WaitForMultipleObjects(DIM(events), events, FALSE, INFINITE);
+    }
+
+    InterlockedDecrement(&m_idleCount);
+
+    return directory;
+}
+
+void TreeSearch::ReadDirectory(int walkerIndex, LPCTSTR directory)
+{
+    _ASSERT(directory);
+
+    TCHAR pattern[MAX_PATH];
+
+    if (!PathCombine(pattern, directory, _T("*")))
+        return;
+
+    //
+    // Directories that cannot be read, usually for want of access, are
+    // passed over just as they would be when looking by hand.
+    //
+
+    WIN32_FIND_DATA findData;
+    HANDLE find = FindFirst(pattern, findData);
+
+    if (INVALID_HANDLE_VALUE == find)
+        return;
+
+    try
+    {
+        do
+        {
+            LPCTSTR name = findData.cFileName;
+
+            if (0 == (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                Match(directory, name);
+            }
+            else if (0 == (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+                0 != lstrcmp(name, _T(".")) && 0 != lstrcmp(name, _T("..")))
+            {
+                Push(walkerIndex, directory, name);
+            }
+        }
+        while (!m_isStopped && FindNextFile(find, &findData));
+    }
+    catch (...)
+    {
+        FindClose(find);
+        throw;
+    }
+
+    FindClose(find);
+}
+
+HANDLE TreeSearch::FindFirst(LPCTSTR pattern, WIN32_FIND_DATA& findData)
+{
+    _ASSERT(pattern);
+
+    //
+    // Fetch entries in large batches, and without their short names that
+    // are not needed here, where Windows supports it. Where it does not,
+    // the flags are rejected outright and not tried again.
+    //
+
+    if (m_isLargeFetchSupported)
+    {
+        HANDLE find = FindFirstFileEx(pattern, static_cast<FINDEX_INFO_LEVELS>(FindExInfoBasicLevel),
+            &findData, FindExSearchNameMatch, NULL, FindFirstExLargeFetch);
+
+        if (INVALID_HANDLE_VALUE != find || ERROR_INVALID_PARAMETER != GetLastError())
+            return find;
+
+        InterlockedExchange(&m_isLargeFetchSupported, FALSE);
+    }
+
+    return FindFirstFile(pattern, &findData);
+}
+
+void TreeSearch::Match(LPCTSTR directory, LPCTSTR name)
+{
+    _ASSERT(directory);
+    _ASSERT(name);
+
+    TCHAR foldedName[MAX_PATH];
+    lstrcpyn(foldedName, name, DIM(foldedName));
+    CharUpperBuff(foldedName, lstrlen(foldedName));
+
+    const int fileNameIndex = m_fileNames.Find(foldedName, DirectoryIndex::Hash(foldedName));
+
+    if (fileNameIndex < 0)
+        return;
+
+    for (int i = m_firstTargets[fileNameIndex]; i >= 0; i = m_targets[i].next)
+        Report(m_targets[i], directory, name);
+}
+
+void TreeSearch::Report(const Target& target, LPCTSTR directory, LPCTSTR name)
+{
+    TCHAR path[MAX_PATH];
+
+    if (!PathCombine(path, directory, name))
+        return;
+
+    //
+    // Matches are reported one at a time so that the procedure does
+    // not have to be safe to call from several threads at once.
+    //
+
+    EnterCriticalSection(&m_reportLock);
+
+    try
+    {
+        const int nameIndex = target.nameIndex;
+
+        if (!m_isStopped && !(m_isFirstMatchOnly && m_isFound[nameIndex]))
+        {
+            if (!m_isFound[nameIndex])
+            {
+                m_isFound[nameIndex] = true;
+                m_foundCount++;
+            }
+
+            if (!m_found(nameIndex, target.extensionIndex, path, m_context) ||
+                (m_isFirstMatchOnly && m_foundCount == m_nameCount))
+            {
+                Stop();
+            }
+        }
+    }
+    catch (...)
+    {
+        LeaveCriticalSection(&m_reportLock);
+        throw;
+    }
+
+    LeaveCriticalSection(&m_reportLock);
+}
+
+void TreeSearch::Push(int walkerIndex, LPCTSTR directory, LPCTSTR name)
+{
+    _ASSERT(directory);
+
+    TCHAR path[MAX_PATH];
+
+    if (name)
+    {
+        if (!PathCombine(path, directory, name))
+            return;
+    }
+    else
+    {
+        lstrcpyn(path, directory, DIM(path));
+    }
+
+    LPTSTR entry = new TCHAR[lstrlen(path) + 1];
+
+    if (!entry)
+        throw SystemException(ERROR_NOT_ENOUGH_MEMORY);
+
+    lstrcpy(entry, path);
+
+    Walker& walker = *m_walkers[walkerIndex];
+
+    EnterCriticalSection(&walker.lock);
+
+    try
+    {
+        walker.directories.Add(entry);
+    }
+    catch (...)
+    {
+        LeaveCriticalSection(&walker.lock);
+        delete [] entry;
+        throw;
+    }
+
+    InterlockedIncrement(&m_pendingCount);
+    LeaveCriticalSection(&walker.lock);
+
+    if (m_idleCount)
+        SetEvent(m_workEvent);
+}
+
+LPTSTR TreeSearch::Pop(int walkerIndex)
+{
+    Walker& walker = *m_walkers[walkerIndex];
+    LPTSTR directory = NULL;
+
+    EnterCriticalSection(&walker.lock);
+
+    const int count = walker.directories.GetCount();
+
+    if (count > walker.head)
+    {
+        directory = walker.directories[count - 1];
+        walker.directories.SetCount(count - 1);
+
+        if (count - 1 == walker.head)
+        {
+            walker.directories.Clear();
+            walker.head = 0;
+        }
+    }
+
+    LeaveCriticalSection(&walker.lock);
+
+    return directory;
+}
+
+LPTSTR TreeSearch::Steal(int walkerIndex)
+{
+    const int walkerCount = m_walkers.GetCount();
+
+    for (int i = 1; i < walkerCount; i++)
+    {
+        Walker& victim = *m_walkers[(walkerIndex + i) % walkerCount];
+        LPTSTR directory = NULL;
+
+        EnterCriticalSection(&victim.lock);
+
+        if (victim.directories.GetCount() > victim.head)
+        {
+            directory = victim.directories[victim.head++];
+
+            if (victim.directories.GetCount() == victim.head)
+            {
+                victim.directories.Clear();
+                victim.head = 0;
+            }
+        }
+
+        LeaveCriticalSection(&victim.lock);
+
+        if (directory)
+            return directory;
+    }
+
+    return NULL;
+}
+
+void TreeSearch::Stop()
+{
+    InterlockedExchange(&m_isStopped, TRUE);
+
+    if (m_doneEvent)
+        SetEvent(m_doneEvent);
+}
+
+void TreeSearch::Clear()
+{
+    //
+    // A search that was stopped early leaves directories behind that
+    // were never read.
+    //
+
+    for (int i = 0; i < m_walkers.GetCount(); i++)
+    {
+        Walker* walker = m_walkers[i];
+
+        for (int j = walker->head; j < walker->directories.GetCount(); j++)
+            delete [] walker->directories[j];
+
+        DeleteCriticalSection(&walker->lock);
+        delete walker;
+    }
+
+    m_walkers.Clear();
+
+    if (m_workEvent)
+        CloseHandle(m_workEvent);
+
+    if (m_doneEvent)
+        CloseHandle(m_doneEvent);
+
+    m_workEvent = NULL;
+    m_doneEvent = NULL;
+}
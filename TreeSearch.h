@@ -0,0 +1,122 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+typedef bool (CALLBACK * TreeSearchProc)(int nameIndex, int extensionIndex,
+    LPCTSTR path, LPVOID context);
+
+// --------------------------------------------------------------------------
+//  TreeSearch
+// --------------------------------------------------------------------------
+//
+//  Looks for files by name throughout whole directory trees rather than
+//  along the search order, for when a file is not on the search path at
+//  all. Every name is looked for as it is and, when it has no extension,
+//  with each of the PATHEXT extensions of the environment appended, all
+//  in the one pass over the trees.
+//
+//  The trees are walked by a pool of walkers, one per thread, each with
+//  its own queue of directories still to be read. A walker adds the
+//  subdirectories it comes across to the back of its own queue and takes
+//  its next directory from there too, so it mostly stays in the same
+//  part of the tree. One that runs out of work takes a directory from the
+//  front of somebody else's queue, which is where the biggest pieces of
+//  work tend to be. One that finds nothing to take either waits for more
+//  to turn up or, once no directory is left anywhere, is done. Directory
+//  junctions and other reparse points are not followed, since they can
+//  lead round in circles.
+//
+//  Matches are reported as they are found, one at a time, and so in no
+//  particular order. The procedure can stop the search by returning
+//  false. When only the first match of every name is wanted, the search
+//  stops by itself once every name has one.
+//
+
+class TreeSearch
+{
+public:
+
+    TreeSearch(const SearchEnvironment& environment);
+    ~TreeSearch();
+
+    void AddName(LPCTSTR fileName);
+    int GetNameCount() const { return m_nameCount; }
+
+    DWORD Search(const LPCTSTR* roots, int rootCount, bool isFirstMatchOnly,
+        int threadCount, TreeSearchProc found, LPVOID context);
+
+    bool IsFound(int nameIndex) const { return m_isFound[nameIndex]; }
+
+private:
+
+    //
+    // Every name and extension to look for, keyed by the folded file
+    // name they make together. Different names can make the same file
+    // name, so the targets of each are chained together.
+    //
+
+    struct Target
+    {
+        int nameIndex;
+        int extensionIndex;
+        int next;
+    };
+
+    struct Walker
+    {
+        CRITICAL_SECTION lock;
+        Array<LPTSTR> directories;
+        int head;
+    };
+
+    void Walk(int walkerIndex);
+    void ReadDirectory(int walkerIndex, LPCTSTR directory);
+    void Match(LPCTSTR directory, LPCTSTR name);
+    void Report(const Target& target, LPCTSTR directory, LPCTSTR name);
+    void Push(int walkerIndex, LPCTSTR directory, LPCTSTR name);
+    LPTSTR Pop(int walkerIndex);
+    LPTSTR Steal(int walkerIndex);
+    LPTSTR Park(int walkerIndex);
+    HANDLE FindFirst(LPCTSTR pattern, WIN32_FIND_DATA& findData);
+    void Stop();
+    void Clear();
+
+    static void CALLBACK WalkProc(int index, LPVOID context);
+
+    const SearchEnvironment& m_environment;
+    NameTable m_fileNames;
+    Array<int> m_firstTargets;
+    Array<Target> m_targets;
+    int m_nameCount;
+    Array<bool> m_isFound;
+    int m_foundCount;
+    Array<Walker*> m_walkers;
+    CRITICAL_SECTION m_reportLock;
+    LONG volatile m_pendingCount;
+    LONG volatile m_idleCount;
+    HANDLE m_workEvent;
+    HANDLE m_doneEvent;
+    LONG volatile m_isStopped;
+    LONG volatile m_isLargeFetchSupported;
+    bool m_isFirstMatchOnly;
+    TreeSearchProc m_found;
+    LPVOID m_context;
+
+    TreeSearch(const TreeSearch&);
+    TreeSearch& operator=(const TreeSearch&);
+};
@@ -0,0 +1,53 @@
+// FINDPATH - Locates a file using the Windows search path
+// Copyright (C) 2002, Atif Aziz (http://www.raboof.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+//
+// Public interface of the libfindpath library. The headers of the
+// library do not include one another so this pulls them in the order
+// in which they depend on each other.
+//
+
+#include "Exceptions.h"
+#include "Profiler.h"
+#include "Array.h"
+#include "FileSystem.h"
+#include "DirectoryIdentity.h"
+#include "SearchOrder.h"
+#include "SearchEnvironment.h"
+#include "Suggestions.h"
+#include "Parallel.h"
+#include "SharedIndexSegment.h"
+#include "DirectoryIndex.h"
+#include "NameTable.h"
+#include "TreeSearch.h"
+#include "LookupIndex.h"
+#include "ImageFile.h"
+#include "ImageMetadataCache.h"
+#include "ExportIndex.h"
+#include "ResolutionSnapshot.h"
+#include "ShadowReport.h"
+#include "ImageMachine.h"
+#include "ApiSetSchema.h"
+#include "KnownDllList.h"
+#include "Resolver.h"
+#include "AsyncResolver.h"
+#include "HostCapture.h"
+#include "Benchmark.h"
+#include "ImportValidator.h"
+#include "ResolverSet.h"
+#include "PathAnalysis.h"
@@ -14,4 +14,14 @@
 #include <shlobj.h>
 #include <tchar.h>
 #include <malloc.h>
+#include <process.h>
+#include <stdlib.h>
 #include <crtdbg.h>
+
+//
+// Macros
+//
+
+#ifndef DIM
+#define DIM(a) (sizeof(a) / sizeof((a)[0]))
+#endif